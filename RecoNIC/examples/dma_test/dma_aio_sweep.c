@@ -0,0 +1,195 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Queue depth sweep of asynchronous device memory transfers: "count"
+// transfers of "size" bytes each are run through an io_uring context at
+// queue depth 1, 2, 4, ... up to "depth". Transfer i of a depth uses
+// region i % depth of the host buffer and of the device memory. The
+// synchronous read_to_buffer()/write_from_buffer() path is measured first
+// as the baseline.
+
+#include <getopt.h>
+#include "memory_api.h"
+
+#define DEVICE_NAME_DEFAULT "/dev/reconic-mm"
+#define SIZE_DEFAULT (65536)
+#define COUNT_DEFAULT (1000)
+#define DEPTH_DEFAULT (64)
+
+static struct option const long_opts[] = {
+	{"device", required_argument, NULL, 'd'},
+	{"address", required_argument, NULL, 'a'},
+	{"size", required_argument, NULL, 's'},
+	{"count", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'q'},
+	{"read", no_argument, NULL, 'r'},
+	{"help", no_argument, NULL, 'h'},
+	{0, 0, 0, 0}
+};
+
+static void usage(const char *name)
+{
+	int i = 0;
+
+	fprintf(stdout, "usage: %s [OPTIONS]\n\n", name);
+
+	fprintf(stdout, "  -%c (--%s) device name, default %s\n",
+		long_opts[i].val, long_opts[i].name, DEVICE_NAME_DEFAULT);
+	i++;
+	fprintf(stdout, "  -%c (--%s) the start address of the device memory\n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) size of a single transfer in bytes, default %d\n",
+		long_opts[i].val, long_opts[i].name, SIZE_DEFAULT);
+	i++;
+	fprintf(stdout, "  -%c (--%s) number of transfers per queue depth, default %d\n",
+		long_opts[i].val, long_opts[i].name, COUNT_DEFAULT);
+	i++;
+	fprintf(stdout, "  -%c (--%s) largest queue depth, default %d\n",
+		long_opts[i].val, long_opts[i].name, DEPTH_DEFAULT);
+	i++;
+	fprintf(stdout, "  -%c (--%s) use read scenario (write scenario without this flag)\n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) print usage help and exit\n",
+		long_opts[i].val, long_opts[i].name);
+}
+
+static double elapsed_sec(struct timespec *ts_end, struct timespec *ts_start)
+{
+	timespec_sub(ts_end, ts_start);
+	return ts_end->tv_sec + ((double)ts_end->tv_nsec/NSEC_DIV);
+}
+
+static void print_result(const char *name, uint64_t size, uint64_t count, double total_time)
+{
+	printf("%-6s: %lu x %lu bytes, BW = %f GB/sec, %f Mops/sec, average time = %f us\n",
+	       name, count, size, ((double)size * count / total_time) / 1e9,
+	       ((double)count / total_time) / 1e6, total_time / count * 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	int cmd_opt;
+	char *device = DEVICE_NAME_DEFAULT;
+	uint64_t address = 0;
+	uint64_t size = SIZE_DEFAULT;
+	uint64_t count = COUNT_DEFAULT;
+	uint32_t max_depth = DEPTH_DEFAULT;
+	int scenario = 0; // 0 write 1 read
+	struct timespec ts_start, ts_end;
+	struct rn_aio_ctx_t *ctx;
+	struct rn_aio_op_t *ops;
+	char *buffer = NULL;
+	char name[16];
+	uint32_t depth;
+	uint64_t i;
+	ssize_t rc = 0;
+	int fpga_fd;
+
+	while ((cmd_opt = getopt_long(argc, argv, "d:a:s:c:q:rh", long_opts,
+				      NULL)) != -1) {
+		switch (cmd_opt) {
+		case 'd':
+			device = strdup(optarg);
+			break;
+		case 'a':
+			address = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			count = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			max_depth = (uint32_t) strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			scenario = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			exit(0);
+			break;
+		}
+	}
+
+	if (size == 0 || size > RW_MAX_SIZE || count == 0 || count > UINT32_MAX ||
+	    max_depth == 0 || max_depth > RN_AIO_MAX_DEPTH) {
+		fprintf(stderr, "Error: invalid size, count or depth\n");
+		return -EINVAL;
+	}
+
+	fpga_fd = open(device, O_RDWR);
+	if (fpga_fd < 0) {
+		fprintf(stderr, "unable to open device %s, %d.\n",
+			device, fpga_fd);
+		perror("open device");
+		return -EINVAL;
+	}
+
+	ops = (struct rn_aio_op_t *) calloc(count, sizeof(struct rn_aio_op_t));
+	if (ops == NULL ||
+	    posix_memalign((void **)&buffer, 4096, size * max_depth) != 0) {
+		fprintf(stderr, "OOM %lu.\n", size * max_depth);
+		rc = -ENOMEM;
+		goto out;
+	}
+	memset(buffer, 0x5a, size * max_depth);
+
+	printf("%s scenario, %lu transfers of %lu bytes per queue depth\n",
+	       (scenario == 1) ? "Read" : "Write", count, size);
+
+	// Baseline: one blocking transfer at a time
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	for (i = 0; i < count; i++) {
+		if (scenario == 1)
+			rc = read_to_buffer(device, fpga_fd, buffer, size, address);
+		else
+			rc = write_from_buffer(device, fpga_fd, buffer, size, address);
+		if (rc < 0)
+			goto out;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	print_result("sync", size, count, elapsed_sec(&ts_end, &ts_start));
+
+	// Powers of two, then max_depth itself if it is not one
+	for (depth = 1; ; depth <<= 1) {
+		if (depth > max_depth)
+			depth = max_depth;
+		ctx = rn_aio_create(device, fpga_fd, depth);
+		if (ctx == NULL) {
+			rc = -EINVAL;
+			goto out;
+		}
+		for (i = 0; i < count; i++) {
+			ops[i].host_buf = buffer + (i % depth) * size;
+			ops[i].dev_addr = address + (i % depth) * size;
+			ops[i].len = size;
+			ops[i].dir = (scenario == 1) ? RN_AIO_READ : RN_AIO_WRITE;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		rc = rn_aio_run(ctx, ops, (uint32_t) count);
+		clock_gettime(CLOCK_MONOTONIC, &ts_end);
+		rn_aio_destroy(ctx);
+		if (rc < 0)
+			goto out;
+		snprintf(name, sizeof(name), "QD %u", depth);
+		print_result(name, size, count, elapsed_sec(&ts_end, &ts_start));
+		if (depth == max_depth)
+			break;
+	}
+	rc = 0;
+
+out:
+	close(fpga_fd);
+	free(ops);
+	free(buffer);
+	return rc;
+}
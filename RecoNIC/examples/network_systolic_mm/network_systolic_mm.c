@@ -141,7 +141,6 @@ int main(int argc, char *argv[])
   uint32_t dst_qpid;
   uint32_t qdepth;
   uint16_t wrid;
-  uint32_t wqe_idx;
   uint32_t transfer_size;
 
   uint64_t read_A_offset;
@@ -319,11 +318,10 @@ int main(int argc, char *argv[])
    * 6. Allocate a queue pair
    */
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size)
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --   1MB RQ (64 RQEs of RQE_SIZE = 16KB)
     //struct rdma_qp_t* qp =
   allocate_rdma_qp(rdma_dev, qpid, dst_qpid, rdma_pd, cq_cidb_addr, rq_cidb_addr, qdepth, qp_location, &dst_mac, dst_ip, P_KEY, R_KEY);
 
@@ -383,7 +381,6 @@ int main(int argc, char *argv[])
 
     read_B_offset = ntohll(read_B_offset);
 
-    wqe_idx   = 0;
     wrid      = 0;
     transfer_size = matrix_size * 4;
 
@@ -395,24 +392,19 @@ int main(int argc, char *argv[])
 
     clock_gettime(CLOCK_MONOTONIC, &ts_start);
 
-    create_a_wqe(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_bufferA->dma_addr, transfer_size, RNIC_OP_READ, read_A_offset, R_KEY, 0, 0, 0, 0, 0);
-
-    // Post RDMA operation
-    ret_val = rdma_post_send(rn_dev->rdma_dev, qpid);
+    // Post RDMA operations, large matrices are split into pipelined chunks
+    ret_val = rdma_read_large(rn_dev->rdma_dev, qpid, wrid, device_bufferA->dma_addr, read_A_offset, transfer_size, 0, R_KEY);
     if(ret_val>=0) {
       fprintf(stderr, "Successfully sent an RDMA read operation for Array A!\n");
     } else {
       fprintf(stderr, "Failed to send an RDMA read operation for Array A!\n");
     }
 
-    wqe_idx++;
+    wrid++;
 
     dump_registers(rn_dev->rdma_dev, 1, qpid);
 
-    create_a_wqe(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_bufferB->dma_addr, transfer_size, RNIC_OP_READ, read_B_offset, R_KEY, 0, 0, 0, 0, 0);
-
-    // Post RDMA operation
-    ret_val = rdma_post_send(rn_dev->rdma_dev, qpid);
+    ret_val = rdma_read_large(rn_dev->rdma_dev, qpid, wrid, device_bufferB->dma_addr, read_B_offset, transfer_size, 0, R_KEY);
     if(ret_val>=0) {
       fprintf(stderr, "Successfully sent an RDMA read operation for Array B!\n");
     } else {
@@ -0,0 +1,278 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Multi-peer connection setup: every node of a run is started with the same
+// --tcp_sport and the comma-separated IP addresses of all the other nodes in
+// --dst_ip. The connection manager brings up one QP per peer in parallel and
+// the time it takes is printed. Each node then reads --payload_size bytes
+// from the buffer exported by every peer, over the QP of that peer.
+
+#include "reconic.h"
+#include "rdma_api.h"
+#include "cm_api.h"
+#include "rdma_test.h"
+
+#define DEVICE_NAME_DEFAULT "/dev/reconic-mm"
+
+// Time limit of the whole bring-up in milliseconds
+#define CM_TIMEOUT_MS 30000
+
+struct mac_addr_t src_mac;
+
+uint32_t src_ip         = 0;
+char src_ip_str[16];
+uint16_t tcp_sport      = 0;
+uint16_t udp_sport      = 0;
+uint8_t  num_qp         = 8;
+
+// Same defaults as read_batch, see read_batch.c for the buffer layout
+uint16_t num_data_buf          = 4096;
+uint16_t per_data_buf_size     = 4096;
+uint16_t ipkt_err_stat_q_size  = 8192;
+uint16_t num_err_buf           = 256;
+uint16_t per_err_buf_size      = 256;
+uint64_t resp_err_pkt_buf_size = 65536;
+
+struct rn_dev_t* rn_dev;
+
+int main(int argc, char *argv[])
+{
+  int sockfd;
+  int cmd_opt;
+  device = DEVICE_NAME_DEFAULT;
+  char *pcie_resource = NULL;
+  char *qp_location = QP_LOCATION_DEFAULT;
+  char *peer_list = NULL;
+  char *peer_ip_str;
+  char *saveptr = NULL;
+  char *peer_ips[RDMA_CM_MAX_PEERS];
+  uint32_t num_peers = 0;
+  uint32_t payload_size = 4 * 1024 * 1024;
+  uint32_t chunk_size = 0;
+  int   pcie_resource_fd;
+  char  val = 0;
+  struct timespec ts_start;
+  struct timespec ts_end;
+  double total_time;
+
+  struct rdma_buff_t* cidb_buffer;
+  struct rdma_buff_t* local_buffer;
+  struct rdma_buff_t* export_buffer;
+
+  uint64_t cq_cidb_addr;
+  uint64_t rq_cidb_addr;
+
+  struct rdma_dev_t* rdma_dev;
+  struct rdma_cm_t* cm;
+  struct rdma_cm_peer_t* peer;
+
+  struct rdma_buff_t* data_buf;
+  struct rdma_buff_t* ipkterr_buf;
+  struct rdma_buff_t* err_buf;
+  struct rdma_buff_t* resp_err_pkt_buf;
+
+  uint32_t sq_psn = 0xabc + 1;
+  uint32_t qdepth;
+  uint32_t length;
+  int ret_val = 0;
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:z:k:l:gh", \
+          long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'd':
+      /* device node name */
+      fprintf(stderr, "Info: Device - %s\n", optarg);
+      device = optarg;
+      break;
+    case 'p':
+      /* PCIe resource file name */
+      fprintf(stderr, "Info: PCIe resource file: %s\n", optarg);
+      pcie_resource = optarg;
+      break;
+    case 'r':
+      src_ip = convert_ip_addr_to_uint(optarg);
+      strcpy(src_ip_str, optarg);
+      fprintf(stderr, "src_ip_str = %s\n", (char*) src_ip_str);
+      break;
+    case 'i':
+      // Comma-separated IP addresses of the peers, MAC addresses come from the ARP cache
+      peer_list = optarg;
+      break;
+    case 'u':
+      udp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 't':
+      tcp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 'z':
+      payload_size = (uint32_t) atoi(optarg);
+      break;
+    case 'k':
+      chunk_size = (uint32_t) atoi(optarg);
+      break;
+    case 'l':
+      /* QP allocated at host memory or device memory */
+      fprintf(stderr, "Info: QP allocated at: %s\n", optarg);
+      qp_location = optarg;
+      if (!(strcmp(qp_location, HOST_MEM) || strcmp(qp_location, DEVICE_MEM))) {
+        usage(argv[0]);
+        exit(0);
+      }
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    /* print usage help and exit */
+    case 'h':
+    default:
+      fprintf(stderr, "Info: cmd_opt = %c\n", cmd_opt);
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  if(peer_list == NULL || src_ip == 0 || tcp_sport == 0) {
+    fprintf(stderr, "Error: --src_ip, --dst_ip and --tcp_sport are required\n");
+    exit(EXIT_FAILURE);
+  }
+  for(peer_ip_str = strtok_r(peer_list, ",", &saveptr); peer_ip_str != NULL;
+      peer_ip_str = strtok_r(NULL, ",", &saveptr)) {
+    if(num_peers == RDMA_CM_MAX_PEERS) {
+      fprintf(stderr, "Error: at most %d peers are supported\n", RDMA_CM_MAX_PEERS);
+      exit(EXIT_FAILURE);
+    }
+    peer_ips[num_peers++] = peer_ip_str;
+  }
+  if(num_peers == 0 || payload_size == 0) {
+    fprintf(stderr, "Error: at least one peer and a positive payload size are required\n");
+    exit(EXIT_FAILURE);
+  }
+  // QP of the i-th peer is 2 + i, QP1 is reserved
+  num_qp = num_peers + 2;
+
+  src_mac = get_mac_addr_from_str_ip(sockfd, src_ip_str);
+
+  /*
+   * 1. Create an RecoNIC device instance
+   */
+  fprintf(stderr, "Info: Creating rn_dev\n");
+  rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, num_qp);
+
+  /*
+   * 2. Create an RDMA device instance
+   */
+  fprintf(stderr, "Info: CREATE RDMA DEVICE\n");
+  rdma_dev = create_rdma_dev(rn_dev);
+
+  /*
+   * 3. Allocate memory for CQ and RQ's cidb buffers, data buffer,
+   *    incoming_pkt_error_stat_q buffer, err_buffer and response error pkt buffer.
+   */
+  uint32_t cidb_buffer_size = (1 << HUGE_PAGE_SHIFT);
+  cidb_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) cidb_buffer_size, "host_mem");
+  cq_cidb_addr = cidb_buffer->dma_addr;
+  rq_cidb_addr = cidb_buffer->dma_addr + (num_qp<<2);
+
+  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_data_buf*per_data_buf_size), "host_mem");
+  ipkterr_buf = allocate_rdma_buffer(rn_dev, (uint64_t) ipkt_err_stat_q_size, "host_mem");
+  err_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_err_buf*per_err_buf_size), "host_mem");
+  resp_err_pkt_buf = allocate_rdma_buffer(rn_dev, (uint64_t) resp_err_pkt_buf_size, "host_mem");
+
+  /*
+   * 4. Open RDMA engine
+   */
+  fprintf(stderr, "Info: OPEN RDMA DEVICE\n");
+  open_rdma_dev(rdma_dev, src_mac, src_ip, udp_sport, num_data_buf, per_data_buf_size,
+                data_buf->dma_addr, ipkt_err_stat_q_size, ipkterr_buf->dma_addr, num_err_buf,
+                per_err_buf_size, err_buf->dma_addr, resp_err_pkt_buf_size, resp_err_pkt_buf->dma_addr);
+
+  /*
+   * 5. Allocate protection domain for queues and memory regions
+   */
+  fprintf(stderr, "Info: ALLOCATE PD\n");
+  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+
+  qdepth = 64;
+
+  fprintf(stderr, "Info: OPEN DEVICE FILE\n");
+  // Open the character device, reconic-mm, for data communication between host and device memory.
+  fpga_fd = open(device, O_RDWR);
+  if (fpga_fd < 0) {
+    fprintf(stderr, "unable to open device %s, %d.\n",
+      device, fpga_fd);
+    perror("open device");
+    close(fpga_fd);
+    return -EINVAL;
+  }
+  set_rn_dev_mm_handle(rn_dev, device, fpga_fd);
+
+  // Every peer reads the same registered buffer of this node
+  export_buffer = allocate_rdma_buffer(rn_dev, payload_size, "dev_mem");
+  rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, export_buffer);
+  local_buffer = allocate_rdma_buffer(rn_dev, payload_size, "dev_mem");
+
+  /*
+   * 6. Bring up one QP per peer through the connection manager
+   */
+  cm = rdma_cm_create(rdma_dev, rdma_pd, src_ip_str, tcp_sport, cq_cidb_addr, rq_cidb_addr,
+                      qdepth, qp_location, P_KEY);
+  if(cm == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  rdma_cm_export_buffer(cm, (uint64_t) export_buffer->buffer, payload_size, R_KEY);
+  for(uint32_t i = 0; i < num_peers; i++) {
+    if(rdma_cm_add_peer(cm, peer_ips[i], 2 + i, sq_psn) < 0) {
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  fprintf(stderr, "Info: CONNECTING %d PEERS\n", num_peers);
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  ret_val = rdma_cm_connect_all(cm, CM_TIMEOUT_MS);
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  timespec_sub(&ts_end, &ts_start);
+  total_time = (ts_end.tv_sec + ((double)ts_end.tv_nsec/NSEC_DIV));
+  if(ret_val < 0) {
+    fprintf(stderr, "Error: failed to connect all the peers\n");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "Info: %d peers connected in %f sec\n", ret_val, total_time);
+
+  /*
+   * 7. Read the buffer exported by every peer
+   */
+  for(uint32_t i = 0; i < cm->num_peers; i++) {
+    peer = &cm->peers[i];
+    length = (peer->remote.buf_size < payload_size) ? (uint32_t) peer->remote.buf_size : payload_size;
+    ret_val = rdma_read_large(rdma_dev, peer->local_qpid, (uint16_t) i, local_buffer->dma_addr,
+                              peer->remote.buf_addr, length, chunk_size, peer->remote.r_key);
+    if(ret_val < 0) {
+      fprintf(stderr, "Error: RDMA read from %s failed\n", peer->ip_str);
+      break;
+    }
+    fprintf(stderr, "Info: read %d bytes from %s over QP %d (remote QP %d)\n",
+            length, peer->ip_str, peer->local_qpid, peer->remote.qpid);
+  }
+
+  // Peers may still be reading the exported buffer
+  fprintf(stderr, "Have all the peers finished reading? If yes, please press any key\n");
+  while(val != '\r' && val != '\n') {
+    val = getchar();
+  }
+  fprintf(stderr, "\n");
+
+  // The sockfd was only used to look up the local MAC address
+  close(sockfd);
+  close(fpga_fd);
+  close(pcie_resource_fd);
+  // The QPs point at the peer MAC addresses of the connection manager
+  destroy_rn_dev(rn_dev);
+  rdma_cm_destroy(cm);
+  return (ret_val < 0) ? -1 : 0;
+}
@@ -0,0 +1,596 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Multi-QP completion wait example: a single client thread keeps --batch_size
+// RDMA reads outstanding on each of --num_qp QPs. Instead of polling every CQ
+// in turn, it sweeps a CQ group to find the QPs with new completions, reaps
+// them with rdma_poll_cq() and refills those QPs only. The bandwidth and the
+// CPU time spent per completion are reported. With --events, the thread sleeps
+// in poll() on the eventfds of an event channel whenever a sweep finds no QP
+// ready, instead of sweeping again.
+
+#include <poll.h>
+#include "reconic.h"
+#include "rdma_api.h"
+#include "rdma_test.h"
+
+#define DEVICE_NAME_DEFAULT "/dev/reconic-mm"
+
+// Completions reaped from one QP per rdma_poll_cq() call
+#define REAP_MAX 64
+
+uint8_t server;
+uint8_t client;
+
+struct mac_addr_t src_mac;
+struct mac_addr_t dst_mac;
+
+uint32_t src_ip         = 0;
+char src_ip_str[16];
+uint32_t dst_ip         = 0;
+char dst_ip_str[16];
+uint16_t tcp_sport      = 0;
+uint16_t udp_sport      = 0;
+uint8_t  num_qp         = 8;
+uint8_t  use_events     = 0;
+
+// Same defaults as read_batch, see read_batch.c for the buffer layout
+uint16_t num_data_buf          = 4096;
+uint16_t per_data_buf_size     = 4096;
+uint16_t ipkt_err_stat_q_size  = 8192;
+uint16_t num_err_buf           = 256;
+uint16_t per_err_buf_size      = 256;
+uint64_t resp_err_pkt_buf_size = 65536;
+
+struct rn_dev_t* rn_dev;
+
+// Per-QP progress of the client
+struct qp_load_t {
+  uint32_t qpid;
+  struct rdma_buff_t* buf;
+  uint64_t laddr;
+  uint32_t num_posted;
+  uint32_t num_completed;
+  uint16_t wrid;
+};
+
+// Post as many reads as the SQ of the QP has room for, up to WQE_count in total
+static int refill_qp(struct rdma_dev_t* rdma_dev, struct qp_load_t* load, struct rdma_wqe_desc_t* descs,
+                     uint64_t remote_offset, uint32_t payload_size, uint32_t WQE_count)
+{
+  uint32_t batch_size;
+
+  batch_size = rdma_sq_credits(rdma_dev->qps_ptr[load->qpid]);
+  if(batch_size > (WQE_count - load->num_posted)) {
+    batch_size = WQE_count - load->num_posted;
+  }
+  if(batch_size == 0) {
+    return 0;
+  }
+  for(uint32_t i = 0; i < batch_size; i++) {
+    descs[i].laddr         = load->laddr;
+    descs[i].remote_offset = remote_offset;
+    descs[i].length        = payload_size;
+    descs[i].wrid          = load->wrid;
+    descs[i].opcode        = RNIC_OP_READ;
+    load->wrid = load->wrid + 1;
+  }
+  if(rdma_wqe_batch(rdma_dev, load->qpid, descs, batch_size, R_KEY) < 0) {
+    return -1;
+  }
+  load->num_posted += batch_size;
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int sockfd;
+  int accepted_sockfd;
+  struct sockaddr_in server_addr;
+  struct sockaddr_in client_addr;
+  socklen_t addr_size;
+  char command[64];
+  FILE *dst_mac_fp;
+  char *line = NULL;
+  size_t len = 0;
+  char *tmp_mac_addr_ptr = NULL;
+  char tmp_mac_addr_str[18] = "";
+  ssize_t command_read;
+
+  int cmd_opt;
+  device = DEVICE_NAME_DEFAULT;
+  char *pcie_resource = NULL;
+  char *qp_location = QP_LOCATION_DEFAULT;
+  double total_time = 0.0;
+  double cpu_time = 0.0;
+  double bandwidth  = 0.0;
+  struct timespec ts_start;
+  struct timespec ts_end;
+  struct timespec cpu_start;
+  struct timespec cpu_end;
+  //payload size in bytes
+  uint32_t payload_size = 128;
+  uint32_t WQE_count = 1;
+  uint32_t num_load_qps = 4;
+  int   pcie_resource_fd;
+  char  val = 0;
+
+  struct rdma_buff_t* cidb_buffer;
+  struct rdma_buff_t* tmp_buffer;
+
+  uint64_t cq_cidb_addr;
+  uint64_t rq_cidb_addr;
+
+  struct rdma_dev_t* rdma_dev;
+
+  struct rdma_buff_t* data_buf;
+  struct rdma_buff_t* ipkterr_buf;
+  struct rdma_buff_t* err_buf;
+  struct rdma_buff_t* resp_err_pkt_buf;
+
+  uint32_t rq_psn = 0xabc;
+  uint32_t sq_psn = 0xabc + 1;
+  uint32_t qpid;
+  uint32_t dst_qpid;
+  uint32_t qdepth;
+  struct qp_load_t* loads = NULL;
+  struct rdma_wqe_desc_t* descs = NULL;
+  struct rdma_cq_group_t* group = NULL;
+  struct rdma_cq_ready_t* ready = NULL;
+  struct rdma_completion_t completions[REAP_MAX];
+  struct qp_load_t* load;
+  uint64_t num_total;
+  uint64_t num_done;
+  uint64_t num_sweeps;
+  uint32_t num_ready;
+  struct rdma_event_channel_t* event_ch = NULL;
+  struct pollfd* pfds = NULL;
+  uint64_t num_wakeups;
+  uint64_t count;
+
+  uint64_t read_A_offset;
+  uint64_t read_offset;
+  uint32_t* sw_golden;
+  uint32_t* read_check;
+  ssize_t rc;
+  int ret_val = 0;
+
+  server = 0;
+  client = 0;
+  dst_qpid = 2;
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:b:l:N:Escgh", \
+          long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'd':
+      /* device node name */
+      fprintf(stderr, "Info: Device - %s\n", optarg);
+      device = optarg;
+      break;
+    case 'p':
+      /* PCIe resource file name */
+      fprintf(stderr, "Info: PCIe resource file: %s\n", optarg);
+      pcie_resource = optarg;
+      break;
+    case 'r':
+      src_ip = convert_ip_addr_to_uint(optarg);
+      strcpy(src_ip_str, optarg);
+      fprintf(stderr, "src_ip_str = %s\n", (char*) src_ip_str);
+      break;
+    case 'i':
+      dst_ip = convert_ip_addr_to_uint(optarg);
+      strcpy(dst_ip_str, optarg);
+      fprintf(stderr, "dst_ip_str = %s\n", (char*) dst_ip_str);
+      sprintf(command, "arp -a %s", dst_ip_str);
+      dst_mac_fp = popen(command, "r");
+      if(dst_mac_fp == NULL) {
+        perror("Error: popen\n");
+        exit(EXIT_FAILURE);
+      }
+
+      while((command_read = getline(&line, &len, dst_mac_fp)) != -1) {
+        // Check if we find an entry
+        if (strstr(line, "no match found") != NULL) {
+          fprintf(stderr, "Error: No arp cache entry for the IP (%s). Please use \"arping | ping -c 1 %s\" to create the cache entry", dst_ip_str, dst_ip_str);
+          exit(0);
+        }
+
+        if (strstr(line, "at") != NULL) {
+          // Get the MAC address from the line
+          tmp_mac_addr_ptr = strstr(line, "at")+3;
+          strncpy(tmp_mac_addr_str, tmp_mac_addr_ptr, 17);
+          dst_mac = convert_mac_addr_str_to_uint(tmp_mac_addr_str);
+          break;
+        }
+      }
+
+      pclose(dst_mac_fp);
+      free(line);
+
+      break;
+    case 'u':
+      udp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 't':
+      tcp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 'q':
+      dst_qpid  = (uint32_t) atoi(optarg);
+      break;
+    case 'z':
+      payload_size = (uint32_t) atoi(optarg);
+      break;
+    case 'b':
+      WQE_count = (uint32_t) atoi(optarg);
+      break;
+    case 'N':
+      num_load_qps = (uint32_t) atoi(optarg);
+      break;
+    case 'E':
+      use_events = 1;
+      break;
+    case 'l':
+      /* QP allocated at host memory or device memory */
+      fprintf(stderr, "Info: QP allocated at: %s\n", optarg);
+      qp_location = optarg;
+      if (!(strcmp(qp_location, HOST_MEM) || strcmp(qp_location, DEVICE_MEM))) {
+        usage(argv[0]);
+        exit(0);
+      }
+      break;
+    case 's':
+      server = 1;
+      client = 0;
+      break;
+    case 'c':
+      server = 0;
+      client = 1;
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    /* print usage help and exit */
+    case 'h':
+    default:
+      fprintf(stderr, "Info: cmd_opt = %c\n", cmd_opt);
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  // QP IDs 2 .. num_load_qps+1 are used, QP1 is reserved
+  if(num_load_qps == 0 || num_load_qps > 253) {
+    fprintf(stderr, "Error: number of QPs must be between 1 and 253\n");
+    exit(EXIT_FAILURE);
+  }
+  num_qp = num_load_qps + 2;
+
+  src_mac = get_mac_addr_from_str_ip(sockfd, src_ip_str);
+
+  /*
+   * 1. Create an RecoNIC device instance
+   */
+  fprintf(stderr, "Info: Creating rn_dev\n");
+  rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, num_qp);
+
+  /*
+   * 2. Create an RDMA device instance
+   */
+  fprintf(stderr, "Info: CREATE RDMA DEVICE\n");
+  rdma_dev = create_rdma_dev(rn_dev);
+
+  /*
+   * 3. Allocate memory for CQ and RQ's cidb buffers, data buffer,
+   *    incoming_pkt_error_stat_q buffer, err_buffer and response error pkt buffer.
+   */
+  uint32_t cidb_buffer_size = (1 << HUGE_PAGE_SHIFT);
+  cidb_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) cidb_buffer_size, "host_mem");
+  cq_cidb_addr = cidb_buffer->dma_addr;
+  rq_cidb_addr = cidb_buffer->dma_addr + (num_qp<<2);
+
+  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_data_buf*per_data_buf_size), "host_mem");
+  ipkterr_buf = allocate_rdma_buffer(rn_dev, (uint64_t) ipkt_err_stat_q_size, "host_mem");
+  err_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_err_buf*per_err_buf_size), "host_mem");
+  resp_err_pkt_buf = allocate_rdma_buffer(rn_dev, (uint64_t) resp_err_pkt_buf_size, "host_mem");
+
+  /*
+   * 4. Open RDMA engine
+   */
+  fprintf(stderr, "Info: OPEN RDMA DEVICE\n");
+  open_rdma_dev(rdma_dev, src_mac, src_ip, udp_sport, num_data_buf, per_data_buf_size,
+                data_buf->dma_addr, ipkt_err_stat_q_size, ipkterr_buf->dma_addr, num_err_buf,
+                per_err_buf_size, err_buf->dma_addr, resp_err_pkt_buf_size, resp_err_pkt_buf->dma_addr);
+
+  /*
+   * 5. Allocate protection domain for queues and memory regions
+   */
+  fprintf(stderr, "Info: ALLOCATE PD\n");
+  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+
+  qdepth = 64;
+
+  fprintf(stderr, "Info: OPEN DEVICE FILE\n");
+  // Open the character device, reconic-mm, for data communication between host and device memory.
+  fpga_fd = open(device, O_RDWR);
+  if (fpga_fd < 0) {
+    fprintf(stderr, "unable to open device %s, %d.\n",
+      device, fpga_fd);
+    perror("open device");
+    close(fpga_fd);
+    return -EINVAL;
+  }
+  set_rn_dev_mm_handle(rn_dev, device, fpga_fd);
+
+  /*
+   * 6. Allocate the queue pairs, each with its own CQ and RQ doorbell word
+   */
+  fprintf(stderr, "Info: ALLOCATE %d RDMA QPs\n", num_load_qps);
+  for(uint32_t i = 0; i < num_load_qps; i++) {
+    qpid = 2 + i;
+    allocate_rdma_qp(rdma_dev, qpid, dst_qpid + i, rdma_pd, cq_cidb_addr + (i<<2), rq_cidb_addr + (i<<2), qdepth, qp_location, &dst_mac, dst_ip, P_KEY, R_KEY);
+    config_last_rq_psn(rdma_dev, qpid, rq_psn);
+    config_sq_psn(rdma_dev, qpid, sq_psn);
+  }
+
+  sw_golden = (uint32_t* ) malloc(payload_size);
+  for (uint32_t i = 0; i < payload_size>>2; i++) {
+    sw_golden[i] = i % 10;
+  }
+
+  if(client) {
+    memset(&server_addr, '\0', sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port   = htons(tcp_sport);
+    server_addr.sin_addr.s_addr = inet_addr(dst_ip_str);
+
+    fprintf(stderr, "Info: Client is connecting to a remote server\n");
+    connect(sockfd, (struct sockaddr* )&server_addr, sizeof(server_addr));
+
+    fprintf(stderr, "Info: Client is connected to a remote server\n");
+
+    rc = read(sockfd, &read_A_offset, sizeof(read_A_offset));
+
+    if(rc > 0) {
+      fprintf(stderr, "Info: client received remote offset of A = 0x%lx\n", ntohll(read_A_offset));
+    } else {
+      fprintf(stderr, "Error: Can't receive remote offset of A from the remote peer\n");
+      close(sockfd);
+      return -1;
+    }
+
+    read_A_offset = ntohll(read_A_offset);
+
+    loads = (struct qp_load_t* ) calloc(num_load_qps, sizeof(struct qp_load_t));
+    ready = (struct rdma_cq_ready_t* ) malloc(num_load_qps * sizeof(struct rdma_cq_ready_t));
+    descs = (struct rdma_wqe_desc_t* ) malloc(qdepth * sizeof(struct rdma_wqe_desc_t));
+    if(loads == NULL || ready == NULL || descs == NULL) {
+      fprintf(stderr, "Error: failed to allocate the client state\n");
+      close(sockfd);
+      return -1;
+    }
+
+    // Every QP of the load is watched by one CQ group
+    group = rdma_create_cq_group(rdma_dev);
+    for(uint32_t i = 0; i < num_load_qps; i++) {
+      loads[i].qpid  = 2 + i;
+      loads[i].buf   = allocate_rdma_buffer(rn_dev, (uint64_t) payload_size, "dev_mem");
+      loads[i].laddr = loads[i].buf->dma_addr;
+      if(rdma_cq_group_add(group, loads[i].qpid) < 0) {
+        close(sockfd);
+        return -1;
+      }
+    }
+
+    // One eventfd per QP, all watched by a single poll() call
+    if(use_events) {
+      pfds = (struct pollfd* ) malloc(num_load_qps * sizeof(struct pollfd));
+      event_ch = rdma_create_event_channel(rdma_dev->axil_ctl, num_load_qps + 1);
+      if(pfds == NULL || event_ch == NULL) {
+        close(sockfd);
+        return -1;
+      }
+      for(uint32_t i = 0; i < num_load_qps; i++) {
+        pfds[i].fd = rdma_get_event_fd(event_ch, loads[i].qpid);
+        pfds[i].events = POLLIN;
+        if(pfds[i].fd < 0) {
+          close(sockfd);
+          return -1;
+        }
+      }
+      // The channel clears CQINTSTS, the group gets its bits from it
+      if(rdma_cq_group_set_event_channel(group, event_ch) < 0 || rdma_start_event_channel(event_ch) < 0) {
+        close(sockfd);
+        return -1;
+      }
+    }
+
+    num_total = (uint64_t) WQE_count * num_load_qps;
+    num_done = 0;
+    num_sweeps = 0;
+    num_wakeups = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    for(uint32_t i = 0; (i < num_load_qps) && (ret_val >= 0); i++) {
+      ret_val = refill_qp(rdma_dev, &loads[i], descs, read_A_offset, payload_size, WQE_count);
+    }
+    while((num_done < num_total) && (ret_val >= 0)) {
+      num_ready = rdma_cq_group_poll(group, ready, num_load_qps);
+      num_sweeps++;
+      if((num_ready == 0) && use_events) {
+        // A completion that lands after the sweep still signals its eventfd,
+        // so nothing is missed by sleeping now. WQEs held back by the
+        // doorbell coalescer would never complete though, ring them first.
+        for(uint32_t i = 0; (i < num_load_qps) && (ret_val >= 0); i++) {
+          ret_val = rdma_flush_doorbell(rdma_dev->qps_ptr[loads[i].qpid]);
+        }
+        if(ret_val < 0) {
+          break;
+        }
+        if(poll(pfds, num_load_qps, -1) < 0 && errno != EINTR) {
+          perror("Error: poll");
+          ret_val = -1;
+          break;
+        }
+        for(uint32_t i = 0; i < num_load_qps; i++) {
+          if(pfds[i].revents & POLLIN) {
+            rc = read(pfds[i].fd, &count, sizeof(count));
+          }
+        }
+        num_wakeups++;
+        continue;
+      }
+      for(uint32_t i = 0; (i < num_ready) && (ret_val >= 0); i++) {
+        load = &loads[ready[i].qpid - 2];
+        rc = rdma_poll_cq(rdma_dev->qps_ptr[load->qpid], REAP_MAX, completions);
+        if(rc < 0) {
+          ret_val = -1;
+          break;
+        }
+        for(uint32_t j = 0; j < (uint32_t) rc; j++) {
+          if(completions[j].status != 0) {
+            fprintf(stderr, "Error: read %d on QP%d completed with status 0x%x\n",
+                    completions[j].wrid, load->qpid, completions[j].status);
+            ret_val = -1;
+          }
+        }
+        load->num_completed += (uint32_t) rc;
+        num_done += (uint64_t) rc;
+        if(ret_val >= 0) {
+          ret_val = refill_qp(rdma_dev, load, descs, read_A_offset, payload_size, WQE_count);
+        }
+      }
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+    // Every QP read the same remote buffer, check what landed in each local one
+    if(ret_val >= 0) {
+      read_check = (uint32_t* ) malloc(payload_size);
+      for(uint32_t i = 0; (i < num_load_qps) && (ret_val >= 0); i++) {
+        if(is_device_address(loads[i].buf->dma_addr)) {
+          rc = read_to_buffer(device, fpga_fd, (char* ) read_check, (uint64_t) payload_size, loads[i].buf->dma_addr);
+          if(rc < 0) {
+            ret_val = -1;
+            break;
+          }
+        } else {
+          memcpy(read_check, loads[i].buf->buffer, payload_size);
+        }
+        for(uint32_t j = 0; j < payload_size>>2; j++) {
+          if(read_check[j] != sw_golden[j]) {
+            fprintf(stderr, "Error: data read on QP%d mismatched: read[%d]=%d, sw_golden[%d]=%d\n",
+                    loads[i].qpid, j, read_check[j], j, sw_golden[j]);
+            ret_val = -1;
+            break;
+          }
+        }
+      }
+      free(read_check);
+    }
+
+    if(ret_val >= 0) {
+      timespec_sub(&ts_end, &ts_start);
+      total_time = (ts_end.tv_sec + ((double)ts_end.tv_nsec/NSEC_DIV));
+      timespec_sub(&cpu_end, &cpu_start);
+      cpu_time = (cpu_end.tv_sec + ((double)cpu_end.tv_nsec/NSEC_DIV));
+      bandwidth = ((double) payload_size) * num_total / total_time;
+      fprintf(stderr, "Info: QPs = %d, Total Time spent %f usec, Size per WQE = %d bytes, WQEs per QP = %d, Bandwidth = %f gigabits/sec\n",
+              num_load_qps, (total_time*1000000), payload_size, WQE_count, ((bandwidth*8)/1000000000));
+      fprintf(stderr, "Info: CQ group sweeps = %lu, CPU time per completion = %f usec\n",
+              num_sweeps, (cpu_time*1000000) / num_total);
+      if(use_events) {
+        fprintf(stderr, "Info: eventfd wakeups = %lu, notifier scans = %lu, notifier events = %lu\n",
+                num_wakeups, event_ch->num_scans, event_ch->num_events);
+      }
+      fprintf(stderr, "Info: Data read successfully\n");
+    } else {
+      fprintf(stderr, "Error: the RDMA reads failed or returned wrong data\n");
+    }
+
+    rdma_destroy_cq_group(group);
+    rdma_destroy_event_channel(event_ch);
+    free(pfds);
+    free(loads);
+    free(ready);
+    free(descs);
+  }
+
+  if(server) {
+    // Connect to the remote peer via TCP/IP
+    memset(&server_addr, '\0', sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(tcp_sport);
+    server_addr.sin_addr.s_addr = inet_addr((char *) src_ip_str);
+
+    bind(sockfd, (struct sockaddr*) &server_addr, sizeof(struct sockaddr_in));
+
+    fprintf(stderr, "Info: Server is listening to a remote peer\n");
+    listen(sockfd, LISTENQ);
+
+    addr_size = sizeof(client_addr);
+    accepted_sockfd = accept(sockfd, (struct sockaddr*)&client_addr, &addr_size);
+
+    fprintf(stderr, "Info: Server is connected to a remote peer\n");
+
+    // All client QPs read the same registered buffer
+    tmp_buffer = allocate_rdma_buffer(rn_dev, payload_size, "dev_mem");
+    rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, tmp_buffer);
+
+    if(is_device_address(tmp_buffer->dma_addr)) {
+      // Device memory address
+      fprintf(stderr, "Info: copy payload data to the device memory\n");
+      rc = write_from_buffer(device, fpga_fd, (char* ) sw_golden, (uint32_t)(payload_size), tmp_buffer->dma_addr);
+      if (rc < 0){
+        ret_val = -1;
+        goto out;
+      }
+    } else {
+      // Host memory address
+      fprintf(stderr, "Info: Initialize payload data on the host memory\n");
+      for (uint32_t i = 0; i < payload_size>>2; i++) {
+        *((uint32_t* )(tmp_buffer->buffer) + i) = i % 10;
+      }
+    }
+
+    read_offset = htonll((uint64_t) tmp_buffer->buffer);
+    write(accepted_sockfd, &read_offset, sizeof(uint64_t));
+    fprintf(stderr, "Sending read_offset (%lx) to the remote client\n", ntohll(read_offset));
+
+    fprintf(stderr, "Does the client finish its RDMA read operation? If yes, please press any key\n");
+
+    while(val != '\r' && val != '\n') {
+      val = getchar();
+    }
+    fprintf(stderr, "\n");
+
+    if(shutdown(accepted_sockfd, SHUT_RDWR) < 0){
+      fprintf(stderr, "accepted_sockfd shutdown failed\n");
+      fprintf(stderr, "Error: %s\n", strerror(errno));
+    }
+    close(accepted_sockfd);
+  }
+
+  if(shutdown(sockfd, SHUT_RDWR) < 0){
+    fprintf(stderr, "sockfd shutdown failed\n");
+    fprintf(stderr, "Error: %s\n", strerror(errno));
+  }
+  close(sockfd);
+
+out:
+  free(cidb_buffer);
+  free(data_buf);
+  free(ipkterr_buf);
+  free(err_buf);
+  free(resp_err_pkt_buf);
+  free(sw_golden);
+  close(fpga_fd);
+  close(pcie_resource_fd);
+  destroy_rn_dev(rn_dev);
+  return (ret_val < 0) ? -1 : 0;
+}
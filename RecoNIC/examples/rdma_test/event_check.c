@@ -0,0 +1,125 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Self-check of the event channel without a card: known INTSTS, CQINTSTS1..8
+// and RQINTSTS1..8 words are written to an emulated register file, and the
+// QPs reported by rdma_read_int_status()/rdma_decode_int_status(), the
+// eventfd signaled by the notifier thread and the bits handed to a CQ sink
+// are compared with the expected ones. The emulated registers are plain
+// memory, so the write-1-to-clear of the notifier leaves them set.
+
+#include "event_api.h"
+
+static int num_failed = 0;
+
+// Compare the events decoded from the emulated registers with the expected ones
+static void check_events(const char* name, uint32_t* axil_ctl, uint32_t max_events, int expected_pending,
+                         const struct rdma_qp_event_t* expected, uint32_t num_expected)
+{
+  struct rdma_int_status_t sts;
+  struct rdma_qp_event_t events[RDMA_EVENT_MAX_QP];
+  uint32_t num_events;
+  int pending;
+  uint32_t i;
+
+  pending = rdma_read_int_status(axil_ctl, &sts);
+  num_events = rdma_decode_int_status(&sts, events, max_events);
+  if(pending != expected_pending || num_events != num_expected) {
+    fprintf(stderr, "Error: %s: pending = %d, %d events, expected pending = %d, %d events\n",
+            name, pending, num_events, expected_pending, num_expected);
+    num_failed++;
+    return;
+  }
+  for(i = 0; i < num_events; i++) {
+    if(events[i].qpid != expected[i].qpid || events[i].flags != expected[i].flags) {
+      fprintf(stderr, "Error: %s: event %d is QP%d flags 0x%x, expected QP%d flags 0x%x\n",
+              name, i, events[i].qpid, events[i].flags, expected[i].qpid, expected[i].flags);
+      num_failed++;
+      return;
+    }
+  }
+  fprintf(stderr, "Info: %s: passed\n", name);
+}
+
+static void set_int_status(uint32_t* axil_ctl, uint32_t intsts, const uint32_t* cq_intsts, const uint32_t* rq_intsts)
+{
+  for(int w = 0; w < 8; w++) {
+    write32_data(axil_ctl, RN_RDMA_GCSR_CQINTSTS1 + (w << 2), cq_intsts[w]);
+    write32_data(axil_ctl, RN_RDMA_GCSR_RQINTSTS1 + (w << 2), rq_intsts[w]);
+  }
+  write32_data(axil_ctl, RN_RDMA_GCSR_INTSTS, intsts);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t* axil_ctl;
+  uint32_t cq_intsts[8] = {0};
+  uint32_t rq_intsts[8] = {0};
+  uint32_t cq_sink[8] = {0};
+  struct rdma_event_channel_t* ch;
+  int rc;
+
+  // QP1: CQ, QP5: RQ, QP33: CQ and RQ, QP256: CQ
+  const struct rdma_qp_event_t expected[] = {
+    {1,   RDMA_EVENT_CQ},
+    {5,   RDMA_EVENT_RQ},
+    {33,  RDMA_EVENT_CQ | RDMA_EVENT_RQ},
+    {256, RDMA_EVENT_CQ},
+  };
+
+  axil_ctl = (uint32_t* ) calloc(1, RN_SCR_MAP_SIZE);
+  if(axil_ctl == NULL) {
+    fprintf(stderr, "Error: failed to allocate the emulated register file\n");
+    return EXIT_FAILURE;
+  }
+
+  check_events("no interrupt", axil_ctl, RDMA_EVENT_MAX_QP, 0, NULL, 0);
+
+  cq_intsts[0] = 0x00000001;
+  rq_intsts[0] = 0x00000010;
+  cq_intsts[1] = 0x00000001;
+  rq_intsts[1] = 0x00000001;
+  cq_intsts[7] = 0x80000000;
+
+  // Per-QP words are only read when INTSTS says something is pending
+  set_int_status(axil_ctl, 0, cq_intsts, rq_intsts);
+  check_events("INTSTS clear", axil_ctl, RDMA_EVENT_MAX_QP, 0, NULL, 0);
+
+  set_int_status(axil_ctl, 0x1, cq_intsts, rq_intsts);
+  check_events("CQ and RQ bits", axil_ctl, RDMA_EVENT_MAX_QP, 1, expected, 4);
+  check_events("truncated to 2 events", axil_ctl, 2, 1, expected, 2);
+
+  // The notifier signals the eventfd of QP33 and hands the CQ bits to the sink
+  ch = rdma_create_event_channel(axil_ctl, RDMA_EVENT_MAX_QP);
+  if(ch == NULL || rdma_event_add_cq_sink(ch, cq_sink) < 0 ||
+     rdma_get_event_fd(ch, 33) < 0 || rdma_start_event_channel(ch) < 0) {
+    fprintf(stderr, "Error: failed to set up the event channel\n");
+    return EXIT_FAILURE;
+  }
+  rc = rdma_wait_event(ch, 33, 2000);
+  if(rc <= 0) {
+    fprintf(stderr, "Error: notifier: QP33 was not signaled within 2 s, rc = %d\n", rc);
+    num_failed++;
+  } else {
+    for(int w = 0; w < 8; w++) {
+      if(__atomic_load_n(&cq_sink[w], __ATOMIC_ACQUIRE) != cq_intsts[w]) {
+        fprintf(stderr, "Error: notifier: CQ sink word %d is 0x%x, expected 0x%x\n", w, cq_sink[w], cq_intsts[w]);
+        num_failed++;
+      }
+    }
+    fprintf(stderr, "Info: notifier: QP33 signaled, %lu scans\n", ch->num_scans);
+  }
+  rdma_event_remove_cq_sink(ch, cq_sink);
+  rdma_destroy_event_channel(ch);
+  free(axil_ctl);
+
+  if(num_failed != 0) {
+    fprintf(stderr, "Error: %d checks failed\n", num_failed);
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "Info: all event channel checks passed\n");
+  return 0;
+}
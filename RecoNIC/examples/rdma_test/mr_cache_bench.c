@@ -0,0 +1,127 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Memory region registration benchmark: a working set of buffers of
+// --payload_size bytes is used --iterations times, first registering and
+// deregistering every buffer on each use, then through a registration cache.
+// Reports the uses per second and the register writes per use of both.
+// Only the PCIe resource is needed, no remote peer.
+
+#include "reconic.h"
+#include "rdma_api.h"
+#include "rdma_test.h"
+
+// Number of buffers used in turn, and number of regions the cache may keep
+#define NUM_BUFFERS 64
+#define CACHE_CAPACITY 128
+
+static double elapsed_sec(struct timespec* ts_end, struct timespec* ts_start)
+{
+  timespec_sub(ts_end, ts_start);
+  return ts_end->tv_sec + ((double)ts_end->tv_nsec/NSEC_DIV);
+}
+
+int main(int argc, char *argv[])
+{
+  int cmd_opt;
+  char *pcie_resource = NULL;
+  int   pcie_resource_fd;
+  struct timespec ts_start;
+  struct timespec ts_end;
+  double total_time;
+  uint64_t writes;
+  uint32_t payload_size = 4096;
+  uint32_t iterations = 100;
+  uint64_t num_use;
+
+  struct rn_dev_t* rn_dev;
+  struct rdma_dev_t* rdma_dev;
+  struct rdma_buff_t* data_buf;
+  struct rdma_mr_cache_t* cache;
+  struct rdma_mr_t* mr;
+
+  while ((cmd_opt = getopt_long(argc, argv, "p:z:n:gh", \
+          long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'p':
+      /* PCIe resource file name */
+      fprintf(stderr, "Info: PCIe resource file: %s\n", optarg);
+      pcie_resource = optarg;
+      break;
+    case 'z':
+      payload_size = (uint32_t) atoi(optarg);
+      break;
+    case 'n':
+      iterations = (uint32_t) atoi(optarg);
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    /* print usage help and exit */
+    case 'h':
+    default:
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  if(payload_size == 0 || iterations == 0) {
+    fprintf(stderr, "Error: payload size and iterations must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+
+  rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, 2);
+  rdma_dev = create_rdma_dev(rn_dev);
+  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) payload_size * NUM_BUFFERS, "host_mem");
+  num_use = (uint64_t) iterations * NUM_BUFFERS;
+
+  /*
+   * Pass A: register every buffer for each use
+   */
+  writes = rdma_dev->csr_shadow.writes;
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  for(uint32_t n = 0; n < iterations; n++) {
+    for(uint32_t i = 0; i < NUM_BUFFERS; i++) {
+      mr = rdma_reg_mr(rdma_dev, rdma_pd, data_buf, (uint64_t) i * payload_size, payload_size, R_KEY, RDMA_ACCESS_READ_WRITE);
+      if(mr == NULL) {
+        exit(EXIT_FAILURE);
+      }
+      rdma_dereg_mr(mr);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  total_time = elapsed_sec(&ts_end, &ts_start);
+  fprintf(stderr, "Info: register per use: %lu uses, %f uses/sec, %.1f register writes per use\n",
+          num_use, num_use / total_time, ((double) (rdma_dev->csr_shadow.writes - writes)) / num_use);
+
+  /*
+   * Pass B: registration cache
+   */
+  cache = rdma_mr_cache_create(rdma_dev, rdma_pd, CACHE_CAPACITY);
+  writes = rdma_dev->csr_shadow.writes;
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  for(uint32_t n = 0; n < iterations; n++) {
+    for(uint32_t i = 0; i < NUM_BUFFERS; i++) {
+      mr = rdma_mr_cache_get(cache, data_buf, (uint64_t) i * payload_size, payload_size, RDMA_ACCESS_READ_WRITE);
+      if(mr == NULL) {
+        exit(EXIT_FAILURE);
+      }
+      rdma_mr_cache_put(cache, mr);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  total_time = elapsed_sec(&ts_end, &ts_start);
+  fprintf(stderr, "Info: registration cache: %lu uses, %f uses/sec, %.1f register writes per use, hits = %lu, misses = %lu, evictions = %lu\n",
+          num_use, num_use / total_time, ((double) (rdma_dev->csr_shadow.writes - writes)) / num_use,
+          cache->hits, cache->misses, cache->evictions);
+  rdma_mr_cache_destroy(cache);
+
+  close(pcie_resource_fd);
+  destroy_rn_dev(rn_dev);
+  return 0;
+}
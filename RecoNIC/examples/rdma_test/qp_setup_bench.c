@@ -0,0 +1,275 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// QP bring-up benchmark: creates and destroys --num_qp queue pairs, first one
+// by one with allocate_rdma_qp(), config_sq_psn() and config_last_rq_psn(),
+// then with a single rdma_qp_create_bulk() call, and reports the setup and
+// teardown rates of both, together with the ring memory taken per QP. The
+// bulk pass leaves the RQs unallocated (lazy_rq) as READ/WRITE-only QPs would.
+// A last pass acquires and releases the same number of QPs from a QP pool
+// --iterations times, as short-lived connections would.
+// Only the PCIe resource is needed, no remote peer.
+
+#include "reconic.h"
+#include "rdma_api.h"
+#include "rdma_test.h"
+
+uint16_t num_data_buf          = 4096;
+uint16_t per_data_buf_size     = 4096;
+uint16_t ipkt_err_stat_q_size  = 8192;
+uint16_t num_err_buf           = 256;
+uint16_t per_err_buf_size      = 256;
+uint64_t resp_err_pkt_buf_size = 65536;
+
+static double elapsed_sec(struct timespec* ts_end, struct timespec* ts_start)
+{
+  timespec_sub(ts_end, ts_start);
+  return ts_end->tv_sec + ((double)ts_end->tv_nsec/NSEC_DIV);
+}
+
+// Host and device memory held by live allocate_rdma_buffer() buffers
+static uint64_t buffer_bytes(struct rn_dev_t* rn_dev)
+{
+  struct rn_mem_stats_t host_stats;
+  struct rn_mem_stats_t dev_stats;
+
+  get_rn_mem_stats(rn_dev, HOST_MEM, &host_stats);
+  get_rn_mem_stats(rn_dev, DEVICE_MEM, &dev_stats);
+  return host_stats.used_bytes + dev_stats.used_bytes;
+}
+
+static void destroy_qps(struct rdma_dev_t* rdma_dev, uint32_t first_qpid, uint32_t count)
+{
+  for(uint32_t i = 0; i < count; i++) {
+    destroy_rdma_qp(rdma_dev->qps_ptr[first_qpid + i]);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int cmd_opt;
+  char *pcie_resource = NULL;
+  char *qp_location = QP_LOCATION_DEFAULT;
+  int   pcie_resource_fd;
+  struct timespec ts_start;
+  struct timespec ts_end;
+  double setup_time;
+  double teardown_time;
+  uint64_t skipped;
+  uint64_t saved;
+  uint64_t writes;
+  uint64_t acquire_writes;
+  uint64_t ring_bytes;
+  uint32_t iterations = 10;
+  struct rdma_qp_pool_t* pool;
+  struct rdma_qp_t** conns;
+
+  uint32_t bench_qps = 64;
+  uint32_t qdepth = 8;
+  uint32_t rq_psn = 0xabc;
+  uint32_t sq_psn = 0xabc + 1;
+  uint32_t dst_ip = 0;
+  uint8_t  num_qp;
+  struct mac_addr_t src_mac;
+  struct mac_addr_t dst_mac;
+
+  struct rn_dev_t* rn_dev;
+  struct rdma_dev_t* rdma_dev;
+  struct rdma_buff_t* cidb_buffer;
+  struct rdma_buff_t* data_buf;
+  struct rdma_buff_t* ipkterr_buf;
+  struct rdma_buff_t* err_buf;
+  struct rdma_buff_t* resp_err_pkt_buf;
+  struct rdma_qp_attr_t* attrs;
+  uint64_t cq_cidb_addr;
+  uint64_t rq_cidb_addr;
+
+  while ((cmd_opt = getopt_long(argc, argv, "p:i:l:N:D:n:gh", \
+          long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'p':
+      /* PCIe resource file name */
+      fprintf(stderr, "Info: PCIe resource file: %s\n", optarg);
+      pcie_resource = optarg;
+      break;
+    case 'i':
+      dst_ip = convert_ip_addr_to_uint(optarg);
+      break;
+    case 'l':
+      /* QP allocated at host memory or device memory */
+      fprintf(stderr, "Info: QP allocated at: %s\n", optarg);
+      qp_location = optarg;
+      break;
+    case 'N':
+      bench_qps = (uint32_t) atoi(optarg);
+      break;
+    case 'D':
+      qdepth = (uint32_t) atoi(optarg);
+      break;
+    case 'n':
+      iterations = (uint32_t) atoi(optarg);
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    /* print usage help and exit */
+    case 'h':
+    default:
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  // QP IDs 2 .. bench_qps+1 are used, QP1 is reserved
+  if(bench_qps == 0 || bench_qps > 253) {
+    fprintf(stderr, "Error: number of QPs must be between 1 and 253\n");
+    exit(EXIT_FAILURE);
+  }
+  if(qdepth < 2) {
+    fprintf(stderr, "Error: queue depth must be at least 2\n");
+    exit(EXIT_FAILURE);
+  }
+  num_qp = (uint8_t) (bench_qps + 2);
+  memset(&src_mac, 0, sizeof(struct mac_addr_t));
+  memset(&dst_mac, 0, sizeof(struct mac_addr_t));
+
+  rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, num_qp);
+  rdma_dev = create_rdma_dev(rn_dev);
+
+  uint32_t cidb_buffer_size = (1 << HUGE_PAGE_SHIFT);
+  cidb_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) cidb_buffer_size, "host_mem");
+  cq_cidb_addr = cidb_buffer->dma_addr;
+  rq_cidb_addr = cidb_buffer->dma_addr + (num_qp<<2);
+
+  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_data_buf*per_data_buf_size), "host_mem");
+  ipkterr_buf = allocate_rdma_buffer(rn_dev, (uint64_t) ipkt_err_stat_q_size, "host_mem");
+  err_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_err_buf*per_err_buf_size), "host_mem");
+  resp_err_pkt_buf = allocate_rdma_buffer(rn_dev, (uint64_t) resp_err_pkt_buf_size, "host_mem");
+
+  open_rdma_dev(rdma_dev, src_mac, 0, 0x4791, num_data_buf, per_data_buf_size,
+                data_buf->dma_addr, ipkt_err_stat_q_size, ipkterr_buf->dma_addr, num_err_buf,
+                per_err_buf_size, err_buf->dma_addr, resp_err_pkt_buf_size, resp_err_pkt_buf->dma_addr);
+
+  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+
+  /*
+   * Pass A: one QP at a time, as the examples do
+   */
+  ring_bytes = buffer_bytes(rn_dev);
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  for(uint32_t i = 0; i < bench_qps; i++) {
+    allocate_rdma_qp(rdma_dev, 2 + i, 2 + i, rdma_pd, cq_cidb_addr + (i<<2), rq_cidb_addr + (i<<2), qdepth, qp_location, &dst_mac, dst_ip, P_KEY, R_KEY);
+    config_last_rq_psn(rdma_dev, 2 + i, rq_psn);
+    config_sq_psn(rdma_dev, 2 + i, sq_psn);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  setup_time = elapsed_sec(&ts_end, &ts_start);
+  ring_bytes = buffer_bytes(rn_dev) - ring_bytes;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  destroy_qps(rdma_dev, 2, bench_qps);
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  teardown_time = elapsed_sec(&ts_end, &ts_start);
+
+  fprintf(stderr, "Info: per-QP setup:  %d QPs, setup %f QPs/sec, teardown %f QPs/sec, %lu bytes of rings per QP\n",
+          bench_qps, bench_qps / setup_time, bench_qps / teardown_time, ring_bytes / bench_qps);
+
+  /*
+   * Pass B: all QPs in one rdma_qp_create_bulk() call
+   */
+  attrs = (struct rdma_qp_attr_t* ) calloc(bench_qps, sizeof(struct rdma_qp_attr_t));
+  if(attrs == NULL) {
+    fprintf(stderr, "Error: failed to allocate QP attributes\n");
+    exit(EXIT_FAILURE);
+  }
+  for(uint32_t i = 0; i < bench_qps; i++) {
+    attrs[i].qpid         = 2 + i;
+    attrs[i].dst_qpid     = 2 + i;
+    attrs[i].pd_entry     = rdma_pd;
+    attrs[i].cq_cidb_addr = cq_cidb_addr + (i<<2);
+    attrs[i].rq_cidb_addr = rq_cidb_addr + (i<<2);
+    attrs[i].qdepth       = qdepth;
+    attrs[i].buf_location = qp_location;
+    attrs[i].dst_mac      = &dst_mac;
+    attrs[i].dst_ip       = dst_ip;
+    attrs[i].partion_key  = P_KEY;
+    attrs[i].r_key        = R_KEY;
+    attrs[i].sq_psn       = sq_psn;
+    attrs[i].last_rq_psn  = rq_psn;
+    attrs[i].lazy_rq      = 1;
+  }
+
+  skipped = rdma_dev->csr_shadow.writes_skipped;
+  saved   = rdma_dev->csr_shadow.reads_saved;
+  ring_bytes = buffer_bytes(rn_dev);
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  if(rdma_qp_create_bulk(rdma_dev, attrs, bench_qps, NULL) < 0) {
+    fprintf(stderr, "Error: rdma_qp_create_bulk failed\n");
+    exit(EXIT_FAILURE);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  setup_time = elapsed_sec(&ts_end, &ts_start);
+  ring_bytes = buffer_bytes(rn_dev) - ring_bytes;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  destroy_qps(rdma_dev, 2, bench_qps);
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  teardown_time = elapsed_sec(&ts_end, &ts_start);
+
+  fprintf(stderr, "Info: bulk setup:    %d QPs, setup %f QPs/sec, teardown %f QPs/sec, %lu bytes of rings per QP (lazy RQ)\n",
+          bench_qps, bench_qps / setup_time, bench_qps / teardown_time, ring_bytes / bench_qps);
+  fprintf(stderr, "Info: CSR shadow: %lu register writes skipped, %lu register reads saved (bulk pass: %lu, %lu)\n",
+          rdma_dev->csr_shadow.writes_skipped, rdma_dev->csr_shadow.reads_saved,
+          rdma_dev->csr_shadow.writes_skipped - skipped, rdma_dev->csr_shadow.reads_saved - saved);
+
+  /*
+   * Pass C: connection churn on a QP pool
+   */
+  // The pool gives its i-th QP the doorbell words at cq_cidb_addr/rq_cidb_addr + 4 * i
+  pool = rdma_qp_pool_create(rdma_dev, rdma_pd, 2, bench_qps, cq_cidb_addr, rq_cidb_addr, qdepth, qp_location, P_KEY);
+  conns = (struct rdma_qp_t** ) calloc(bench_qps, sizeof(struct rdma_qp_t*));
+  if(pool == NULL || conns == NULL) {
+    fprintf(stderr, "Error: failed to create the QP pool\n");
+    exit(EXIT_FAILURE);
+  }
+  setup_time = 0.0;
+  teardown_time = 0.0;
+  acquire_writes = 0;
+  writes = rdma_dev->csr_shadow.writes;
+  for(uint32_t n = 0; n < iterations; n++) {
+    // A different peer MAC every round, as for a new set of connections
+    dst_mac.mac_lsb = n;
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    for(uint32_t i = 0; i < bench_qps; i++) {
+      conns[i] = rdma_qp_pool_acquire(pool, 2 + i, &dst_mac, dst_ip, sq_psn, rq_psn);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+    setup_time += elapsed_sec(&ts_end, &ts_start);
+    acquire_writes += rdma_dev->csr_shadow.writes - writes;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    for(uint32_t i = 0; i < bench_qps; i++) {
+      rdma_qp_pool_release(pool, conns[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+    teardown_time += elapsed_sec(&ts_end, &ts_start);
+    writes = rdma_dev->csr_shadow.writes;
+  }
+  if(iterations > 0) {
+    fprintf(stderr, "Info: pool:          %d QPs x %d rounds, acquire %f QPs/sec, release %f QPs/sec, %.1f register writes per acquire\n",
+            bench_qps, iterations, ((double) bench_qps * iterations) / setup_time,
+            ((double) bench_qps * iterations) / teardown_time,
+            ((double) acquire_writes) / ((double) bench_qps * iterations));
+  }
+  rdma_qp_pool_destroy(pool);
+
+  free(conns);
+  free(attrs);
+  close(pcie_resource_fd);
+  destroy_rn_dev(rn_dev);
+  return 0;
+}
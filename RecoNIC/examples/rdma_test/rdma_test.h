@@ -37,11 +37,18 @@ static struct option const long_opts[] = {
 	{"tcp_sport"     , required_argument, NULL, 't'},
 	{"dst_qp"        , required_argument, NULL, 'q'},
 	{"payload_size"  , required_argument, NULL, 'z'},
+	{"chunk_size"    , required_argument, NULL, 'k'},
 	{"batch_size"    , required_argument, NULL, 'b'},
 	{"qp_location"   , required_argument, NULL, 'l'},
 	{"server"        , no_argument      , NULL, 's'},
 	{"client"        , no_argument      , NULL, 'c'},
   {"debug"         , no_argument      , NULL, 'g'},
+	{"iterations"    , required_argument, NULL, 'n'},
+	{"threads"       , required_argument, NULL, 'T'},
+	{"num_qp"        , required_argument, NULL, 'N'},
+	{"qdepth"        , required_argument, NULL, 'D'},
+	{"rate"          , required_argument, NULL, 'R'},
+	{"events"        , no_argument      , NULL, 'E'},
 	{"help"          , no_argument      , NULL, 'h'},
 	{0               , 0                , 0   ,  0 }
 };
@@ -60,7 +67,7 @@ static void usage(const char *name)
 	fprintf(stdout, "  -%c (--%s) Source IP address \n",
 		long_opts[i].val, long_opts[i].name);
 	i++;
-	fprintf(stdout, "  -%c (--%s) Destination IP address \n",
+	fprintf(stdout, "  -%c (--%s) Destination IP address, or comma-separated peer IP addresses (cm_mesh) \n",
 		long_opts[i].val, long_opts[i].name);
 	i++;
 	fprintf(stdout, "  -%c (--%s) UDP source port \n",
@@ -75,6 +82,9 @@ static void usage(const char *name)
 	fprintf(stdout, "  -%c (--%s) Payload size in bytes \n",
 		long_opts[i].val, long_opts[i].name);
 	i++;
+	fprintf(stdout, "  -%c (--%s) Chunk size in bytes of large RDMA reads, defaults to 64KB (read, stripe_sweep, cm_mesh) \n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
 	fprintf(stdout, "  -%c (--%s) Batch size, number of WQEs per QP \n",
 		long_opts[i].val, long_opts[i].name);
 	i++;
@@ -90,6 +100,24 @@ static void usage(const char *name)
 	fprintf(stdout, "  -%c (--%s) Debug mode \n",
 		long_opts[i].val, long_opts[i].name);
 	i++;
+	fprintf(stdout, "  -%c (--%s) Number of SENDs for the inline vs. buffer-based latency comparison, or of rounds (qp_setup_bench, mr_cache_bench, stripe_sweep) \n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) Largest number of threads, one QP per thread (read_batch_mt) \n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) Number of QPs to create and destroy (qp_setup_bench), largest stripe width (stripe_sweep) or number of QPs to read on (cq_group_read), at most 253 \n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) Queue depth of every QP (qp_setup_bench) \n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) Pacing rate limit in Mb/s with congestion backoff, 0 disables pacing (write_batch) \n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) Sleep on the event channel eventfds when no QP is ready instead of spinning (cq_group_read) \n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
 	fprintf(stdout, "  -%c (--%s) print usage help and exit\n",
 		long_opts[i].val, long_opts[i].name);
 }
\ No newline at end of file
@@ -98,7 +98,7 @@ int main(int argc, char *argv[])
   uint32_t dst_qpid;
   uint32_t qdepth;
   uint16_t wrid;
-  uint32_t wqe_idx;
+  uint32_t chunk_size = 0;
   //uint32_t transfer_size;
 
   uint64_t read_A_offset;
@@ -114,7 +114,7 @@ int main(int argc, char *argv[])
 
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
 
-  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:l:scgh", \
+  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:k:l:scgh", \
           long_opts, NULL)) != -1) {
     switch (cmd_opt) {
     case 'd':
@@ -175,6 +175,9 @@ int main(int argc, char *argv[])
     case 'z':
       payload_size = (uint32_t) atoi(optarg);
       break;
+    case 'k':
+      chunk_size = (uint32_t) atoi(optarg);
+      break;
     case 'l':
       /* QP allocated at host memory or device memory */
       fprintf(stderr, "Info: QP allocated at: %s\n", optarg);
@@ -269,11 +272,10 @@ int main(int argc, char *argv[])
    * 6. Allocate a queue pair
    */
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size)
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --   1MB RQ (64 RQEs of RQE_SIZE = 16KB)
     //struct rdma_qp_t* qp = 
   allocate_rdma_qp(rdma_dev, qpid, dst_qpid, rdma_pd, cq_cidb_addr, rq_cidb_addr, qdepth, qp_location, &dst_mac, dst_ip, P_KEY, R_KEY);
 
@@ -323,17 +325,16 @@ int main(int argc, char *argv[])
 
     read_A_offset = ntohll(read_A_offset);
 
-    wqe_idx   = 0;
     wrid      = 0;
 
     device_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) payload_size, "dev_mem");
 
     buf_phy_addr = device_buffer->dma_addr;
 
-    fprintf(stderr, "Info: creating an RDMA read WQE for getting data\n");
-    create_a_wqe(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_buffer->dma_addr, payload_size, RNIC_OP_READ, read_A_offset, R_KEY, 0, 0, 0, 0, 0);
+    // Transfers larger than the chunk size are split and pipelined on the SQ
+    fprintf(stderr, "Info: posting RDMA read WQEs for getting data\n");
     clock_gettime(CLOCK_MONOTONIC, &ts_start);
-    ret_val = rdma_post_send(rn_dev->rdma_dev, qpid);
+    ret_val = rdma_read_large(rn_dev->rdma_dev, qpid, wrid, device_buffer->dma_addr, read_A_offset, payload_size, chunk_size, R_KEY);
     clock_gettime(CLOCK_MONOTONIC, &ts_end);
     if(ret_val>=0) {
       fprintf(stderr, "Successfully sent an RDMA read operation\n");
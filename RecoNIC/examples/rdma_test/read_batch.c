@@ -101,7 +101,10 @@ int main(int argc, char *argv[])
   uint32_t dst_qpid;
   uint32_t qdepth;
   uint16_t wrid;
-  uint32_t wqe_idx;
+  uint32_t num_posted;
+  uint32_t batch_size;
+  struct rdma_qp_t* qp;
+  struct rdma_wqe_desc_t* wqe_descs;
   //uint32_t transfer_size;
 
   uint64_t read_A_offset;
@@ -276,11 +279,10 @@ int main(int argc, char *argv[])
    * 6. Allocate a queue pair
    */
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size)
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --   1MB RQ (64 RQEs of RQE_SIZE = 16KB)
     //struct rdma_qp_t* qp = 
   allocate_rdma_qp(rdma_dev, qpid, dst_qpid, rdma_pd, cq_cidb_addr, rq_cidb_addr, qdepth, qp_location, &dst_mac, dst_ip, P_KEY, R_KEY);
 
@@ -328,24 +330,51 @@ int main(int argc, char *argv[])
 
     read_A_offset = ntohll(read_A_offset);
 
-    wqe_idx   = 0;
     wrid      = 0;
     device_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) total_payload_size, "dev_mem");
 
-    for(int i=0; i < WQE_count; i++)
-    {
-      fprintf(stderr, "Info: creating an RDMA read WQE for getting data\n");
-      create_a_wqe(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_buffer->dma_addr, payload_size, RNIC_OP_READ, read_A_offset, R_KEY, 0, 0, 0, 0, 0);
-      wqe_idx = wqe_idx + 1;
-      fprintf(stderr, "Info: Adding delay of 1s\n");
-      sleep(1);
-    }
-    fprintf(stderr, "Info: All data has been received!\n");
     fprintf(stderr, "Info: buffer physical address is 0x%lx\n",device_buffer->dma_addr);
 
+    // Stream WQE_count RDMA read WQEs through the SQ ring: wait for at least one
+    // free slot, fill every free slot with new WQEs and ring the doorbell once
+    qp = rdma_dev->qps_ptr[qpid];
+    wqe_descs = (struct rdma_wqe_desc_t* ) malloc(qdepth * sizeof(struct rdma_wqe_desc_t));
+    if(wqe_descs == NULL) {
+      fprintf(stderr, "Error: failed to allocate wqe_descs\n");
+      close(sockfd);
+      return -1;
+    }
+    num_posted = 0;
+    ret_val = 0;
     clock_gettime(CLOCK_MONOTONIC, &ts_start);
-    ret_val = rdma_post_batch_send(rn_dev->rdma_dev, qpid, WQE_count);
+    while(num_posted < WQE_count) {
+      ret_val = rdma_sq_reserve(qp, 1);
+      if(ret_val < 0) {
+        break;
+      }
+      batch_size = rdma_sq_credits(qp);
+      if(batch_size > (WQE_count - num_posted)) {
+        batch_size = WQE_count - num_posted;
+      }
+      for(uint32_t i = 0; i < batch_size; i++) {
+        wqe_descs[i].laddr         = device_buffer->dma_addr;
+        wqe_descs[i].remote_offset = read_A_offset;
+        wqe_descs[i].length        = payload_size;
+        wqe_descs[i].wrid          = wrid;
+        wqe_descs[i].opcode        = RNIC_OP_READ;
+        wrid = wrid + 1;
+      }
+      ret_val = rdma_wqe_batch(rn_dev->rdma_dev, qpid, wqe_descs, batch_size, R_KEY);
+      if(ret_val < 0) {
+        break;
+      }
+      num_posted += batch_size;
+    }
+    if(ret_val >= 0) {
+      ret_val = rdma_sq_drain(qp);
+    }
     clock_gettime(CLOCK_MONOTONIC, &ts_end);
+    free(wqe_descs);
     if(ret_val>=0) {
       fprintf(stderr, "Successfully sent an RDMA read operation\n");
       } else {
@@ -0,0 +1,523 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Multi-threaded RDMA read benchmark: each thread owns one QP and streams
+// RDMA read WQEs through it without taking any lock. The client runs the test
+// with 1, 2, 4, ... up to --threads threads and reports the aggregate bandwidth
+// of every run.
+
+#include <pthread.h>
+
+#include "reconic.h"
+#include "rdma_api.h"
+#include "rdma_test.h"
+
+#define DEVICE_NAME_DEFAULT "/dev/reconic-mm"
+
+uint8_t server;
+uint8_t client;
+
+struct mac_addr_t src_mac;
+struct mac_addr_t dst_mac;
+
+uint32_t src_ip         = 0;
+char src_ip_str[16];
+uint32_t dst_ip         = 0;
+char dst_ip_str[16];
+uint16_t tcp_sport      = 0;
+uint16_t udp_sport      = 0;
+uint8_t  num_qp         = 8;
+
+// Same defaults as read_batch, see read_batch.c for the buffer layout
+uint16_t num_data_buf          = 4096;
+uint16_t per_data_buf_size     = 4096;
+uint16_t ipkt_err_stat_q_size  = 8192;
+uint16_t num_err_buf           = 256;
+uint16_t per_err_buf_size      = 256;
+uint64_t resp_err_pkt_buf_size = 65536;
+
+struct rn_dev_t* rn_dev;
+
+// Per-thread context, padded so that two threads never share a cache line
+struct read_worker_t {
+  struct rdma_dev_t* rdma_dev;
+  struct rdma_qp_t* qp;
+  uint32_t qpid;
+  uint64_t laddr;
+  uint64_t remote_offset;
+  uint32_t payload_size;
+  uint32_t WQE_count;
+  uint16_t wrid;
+  pthread_barrier_t* barrier;
+  struct rdma_wqe_desc_t* wqe_descs;
+  int ret_val;
+} __attribute__((aligned(RDMA_CACHE_LINE_SIZE)));
+
+static void* read_worker(void* arg)
+{
+  struct read_worker_t* worker = (struct read_worker_t* ) arg;
+  struct rdma_qp_t* qp = worker->qp;
+  uint32_t num_posted = 0;
+  uint32_t batch_size;
+  int ret_val = 0;
+
+  pthread_barrier_wait(worker->barrier);
+  while(num_posted < worker->WQE_count) {
+    ret_val = rdma_sq_reserve(qp, 1);
+    if(ret_val < 0) {
+      break;
+    }
+    batch_size = rdma_sq_credits(qp);
+    if(batch_size > (worker->WQE_count - num_posted)) {
+      batch_size = worker->WQE_count - num_posted;
+    }
+    for(uint32_t i = 0; i < batch_size; i++) {
+      worker->wqe_descs[i].laddr         = worker->laddr;
+      worker->wqe_descs[i].remote_offset = worker->remote_offset;
+      worker->wqe_descs[i].length        = worker->payload_size;
+      worker->wqe_descs[i].wrid          = worker->wrid;
+      worker->wqe_descs[i].opcode        = RNIC_OP_READ;
+      worker->wrid = worker->wrid + 1;
+    }
+    ret_val = rdma_wqe_batch(worker->rdma_dev, worker->qpid, worker->wqe_descs, batch_size, R_KEY);
+    if(ret_val < 0) {
+      break;
+    }
+    num_posted += batch_size;
+  }
+  if(ret_val >= 0) {
+    ret_val = rdma_sq_drain(qp);
+  }
+  worker->ret_val = ret_val;
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  int sockfd;
+  int accepted_sockfd;
+  struct sockaddr_in server_addr;
+  struct sockaddr_in client_addr;
+  socklen_t addr_size;
+  char command[64];
+  FILE *dst_mac_fp;
+  char *line = NULL;
+  size_t len = 0;
+  char *tmp_mac_addr_ptr = NULL;
+  char tmp_mac_addr_str[18] = "";
+  ssize_t command_read;
+
+  int cmd_opt;
+  device = DEVICE_NAME_DEFAULT;
+  char *pcie_resource = NULL;
+  char *qp_location = QP_LOCATION_DEFAULT;
+  double total_time = 0.0;
+  double base_bandwidth = 0.0;
+  double bandwidth  = 0.0;
+  struct timespec ts_start;
+  struct timespec ts_end;
+  //payload size in bytes
+  uint32_t payload_size = 128;
+  uint32_t WQE_count = 1;
+  uint32_t num_threads = 4;
+  uint32_t max_threads;
+  int   pcie_resource_fd;
+  char  val = 0;
+
+  struct rdma_buff_t* cidb_buffer;
+  struct rdma_buff_t* tmp_buffer;
+
+  uint64_t cq_cidb_addr;
+  uint64_t rq_cidb_addr;
+
+  struct rdma_dev_t* rdma_dev;
+
+  struct rdma_buff_t* data_buf;
+  struct rdma_buff_t* ipkterr_buf;
+  struct rdma_buff_t* err_buf;
+  struct rdma_buff_t* resp_err_pkt_buf;
+
+  uint32_t rq_psn = 0xabc;
+  uint32_t sq_psn = 0xabc + 1;
+  uint32_t qpid;
+  uint32_t dst_qpid;
+  uint32_t qdepth;
+  struct read_worker_t* workers = NULL;
+  pthread_t* threads = NULL;
+  pthread_barrier_t barrier;
+
+  uint64_t read_A_offset;
+  uint64_t read_offset;
+  uint32_t* sw_golden;
+  ssize_t rc;
+  int ret_val = 0;
+
+  server = 0;
+  client = 0;
+  dst_qpid = 2;
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:b:l:T:scgh", \
+          long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'd':
+      /* device node name */
+      fprintf(stderr, "Info: Device - %s\n", optarg);
+      device = optarg;
+      break;
+    case 'p':
+      /* PCIe resource file name */
+      fprintf(stderr, "Info: PCIe resource file: %s\n", optarg);
+      pcie_resource = optarg;
+      break;
+    case 'r':
+      src_ip = convert_ip_addr_to_uint(optarg);
+      strcpy(src_ip_str, optarg);
+      fprintf(stderr, "src_ip_str = %s\n", (char*) src_ip_str);
+      break;
+    case 'i':
+      dst_ip = convert_ip_addr_to_uint(optarg);
+      strcpy(dst_ip_str, optarg);
+      fprintf(stderr, "dst_ip_str = %s\n", (char*) dst_ip_str);
+      sprintf(command, "arp -a %s", dst_ip_str);
+      dst_mac_fp = popen(command, "r");
+      if(dst_mac_fp == NULL) {
+        perror("Error: popen\n");
+        exit(EXIT_FAILURE);
+      }
+
+      while((command_read = getline(&line, &len, dst_mac_fp)) != -1) {
+        // Check if we find an entry
+        if (strstr(line, "no match found") != NULL) {
+          fprintf(stderr, "Error: No arp cache entry for the IP (%s). Please use \"arping | ping -c 1 %s\" to create the cache entry", dst_ip_str, dst_ip_str);
+          exit(0);
+        }
+
+        if (strstr(line, "at") != NULL) {
+          // Get the MAC address from the line
+          tmp_mac_addr_ptr = strstr(line, "at")+3;
+          strncpy(tmp_mac_addr_str, tmp_mac_addr_ptr, 17);
+          dst_mac = convert_mac_addr_str_to_uint(tmp_mac_addr_str);
+          break;
+        }
+      }
+
+      pclose(dst_mac_fp);
+      free(line);
+
+      break;
+    case 'u':
+      udp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 't':
+      tcp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 'q':
+      dst_qpid  = (uint32_t) atoi(optarg);
+      break;
+    case 'z':
+      payload_size = (uint32_t) atoi(optarg);
+      break;
+    case 'b':
+      WQE_count = (uint32_t) atoi(optarg);
+      break;
+    case 'T':
+      num_threads = (uint32_t) atoi(optarg);
+      break;
+    case 'l':
+      /* QP allocated at host memory or device memory */
+      fprintf(stderr, "Info: QP allocated at: %s\n", optarg);
+      qp_location = optarg;
+      if (!(strcmp(qp_location, HOST_MEM) || strcmp(qp_location, DEVICE_MEM))) {
+        usage(argv[0]);
+        exit(0);
+      }
+      break;
+    case 's':
+      server = 1;
+      client = 0;
+      break;
+    case 'c':
+      server = 0;
+      client = 1;
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    /* print usage help and exit */
+    case 'h':
+    default:
+      fprintf(stderr, "Info: cmd_opt = %c\n", cmd_opt);
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  // QP IDs 2 .. num_threads+1 are used, QP1 is reserved
+  if(num_threads == 0 || num_threads > 253) {
+    fprintf(stderr, "Error: number of threads must be between 1 and 253\n");
+    exit(EXIT_FAILURE);
+  }
+  num_qp = num_threads + 2;
+
+  src_mac = get_mac_addr_from_str_ip(sockfd, src_ip_str);
+
+  /*
+   * 1. Create an RecoNIC device instance
+   */
+  fprintf(stderr, "Info: Creating rn_dev\n");
+  rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, num_qp);
+
+  /*
+   * 2. Create an RDMA device instance
+   */
+  fprintf(stderr, "Info: CREATE RDMA DEVICE\n");
+  rdma_dev = create_rdma_dev(rn_dev);
+
+  /*
+   * 3. Allocate memory for CQ and RQ's cidb buffers, data buffer,
+   *    incoming_pkt_error_stat_q buffer, err_buffer and response error pkt buffer.
+   */
+  uint32_t cidb_buffer_size = (1 << HUGE_PAGE_SHIFT);
+  cidb_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) cidb_buffer_size, "host_mem");
+  cq_cidb_addr = cidb_buffer->dma_addr;
+  rq_cidb_addr = cidb_buffer->dma_addr + (num_qp<<2);
+
+  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_data_buf*per_data_buf_size), "host_mem");
+  ipkterr_buf = allocate_rdma_buffer(rn_dev, (uint64_t) ipkt_err_stat_q_size, "host_mem");
+  err_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_err_buf*per_err_buf_size), "host_mem");
+  resp_err_pkt_buf = allocate_rdma_buffer(rn_dev, (uint64_t) resp_err_pkt_buf_size, "host_mem");
+
+  /*
+   * 4. Open RDMA engine
+   */
+  fprintf(stderr, "Info: OPEN RDMA DEVICE\n");
+  open_rdma_dev(rdma_dev, src_mac, src_ip, udp_sport, num_data_buf, per_data_buf_size,
+                data_buf->dma_addr, ipkt_err_stat_q_size, ipkterr_buf->dma_addr, num_err_buf,
+                per_err_buf_size, err_buf->dma_addr, resp_err_pkt_buf_size, resp_err_pkt_buf->dma_addr);
+
+  /*
+   * 5. Allocate protection domain for queues and memory regions
+   */
+  fprintf(stderr, "Info: ALLOCATE PD\n");
+  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+
+  qdepth = 64;
+
+  fprintf(stderr, "Info: OPEN DEVICE FILE\n");
+  // Open the character device, reconic-mm, for data communication between host and device memory.
+  // All threads share the descriptor: the library only uses positional I/O on it.
+  fpga_fd = open(device, O_RDWR);
+  if (fpga_fd < 0) {
+    fprintf(stderr, "unable to open device %s, %d.\n",
+      device, fpga_fd);
+    perror("open device");
+    close(fpga_fd);
+    return -EINVAL;
+  }
+  set_rn_dev_mm_handle(rn_dev, device, fpga_fd);
+
+  /*
+   * 6. Allocate one queue pair per thread and configure its PSNs
+   */
+  fprintf(stderr, "Info: ALLOCATE %d RDMA QPs\n", num_threads);
+  for(uint32_t i = 0; i < num_threads; i++) {
+    qpid = 2 + i;
+    allocate_rdma_qp(rdma_dev, qpid, dst_qpid + i, rdma_pd, cq_cidb_addr + (i<<2), rq_cidb_addr + (i<<2), qdepth, qp_location, &dst_mac, dst_ip, P_KEY, R_KEY);
+    config_last_rq_psn(rdma_dev, qpid, rq_psn);
+    config_sq_psn(rdma_dev, qpid, sq_psn);
+  }
+
+  sw_golden = (uint32_t* ) malloc(payload_size);
+  for (uint32_t i = 0; i < payload_size>>2; i++) {
+    sw_golden[i] = i % 10;
+  }
+
+  if(client) {
+    memset(&server_addr, '\0', sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port   = htons(tcp_sport);
+    server_addr.sin_addr.s_addr = inet_addr(dst_ip_str);
+
+    fprintf(stderr, "Info: Client is connecting to a remote server\n");
+    connect(sockfd, (struct sockaddr* )&server_addr, sizeof(server_addr));
+
+    fprintf(stderr, "Info: Client is connected to a remote server\n");
+
+    rc = read(sockfd, &read_A_offset, sizeof(read_A_offset));
+
+    if(rc > 0) {
+      fprintf(stderr, "Info: client received remote offset of A = 0x%lx\n", ntohll(read_A_offset));
+    } else {
+      fprintf(stderr, "Error: Can't receive remote offset of A from the remote peer\n");
+      close(sockfd);
+      return -1;
+    }
+
+    read_A_offset = ntohll(read_A_offset);
+
+    // Every resource a worker touches is allocated here: buffer allocation is
+    // not thread-safe, the data path is
+    workers = (struct read_worker_t* ) aligned_alloc(RDMA_CACHE_LINE_SIZE, num_threads * sizeof(struct read_worker_t));
+    threads = (pthread_t* ) malloc(num_threads * sizeof(pthread_t));
+    if(workers == NULL || threads == NULL) {
+      fprintf(stderr, "Error: failed to allocate worker contexts\n");
+      close(sockfd);
+      return -1;
+    }
+    for(uint32_t i = 0; i < num_threads; i++) {
+      workers[i].rdma_dev      = rdma_dev;
+      workers[i].qpid          = 2 + i;
+      workers[i].qp            = rdma_dev->qps_ptr[2 + i];
+      workers[i].laddr         = allocate_rdma_buffer(rn_dev, (uint64_t) payload_size, "dev_mem")->dma_addr;
+      workers[i].remote_offset = read_A_offset;
+      workers[i].payload_size  = payload_size;
+      workers[i].WQE_count     = WQE_count;
+      workers[i].wrid          = 0;
+      workers[i].barrier       = &barrier;
+      workers[i].wqe_descs     = (struct rdma_wqe_desc_t* ) malloc(qdepth * sizeof(struct rdma_wqe_desc_t));
+      if(workers[i].wqe_descs == NULL) {
+        fprintf(stderr, "Error: failed to allocate wqe_descs\n");
+        close(sockfd);
+        return -1;
+      }
+    }
+
+    // Run the same per-thread load with 1, 2, 4, ... threads
+    max_threads = num_threads;
+    num_threads = 1;
+    while(1) {
+      pthread_barrier_init(&barrier, NULL, num_threads + 1);
+      for(uint32_t i = 0; i < num_threads; i++) {
+        if(pthread_create(&threads[i], NULL, read_worker, &workers[i]) != 0) {
+          fprintf(stderr, "Error: failed to create thread %d\n", i);
+          exit(EXIT_FAILURE);
+        }
+      }
+      clock_gettime(CLOCK_MONOTONIC, &ts_start);
+      pthread_barrier_wait(&barrier);
+      for(uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        if(workers[i].ret_val < 0) {
+          fprintf(stderr, "Error: RDMA read failed on QP%d\n", workers[i].qpid);
+          ret_val = -1;
+        }
+      }
+      clock_gettime(CLOCK_MONOTONIC, &ts_end);
+      pthread_barrier_destroy(&barrier);
+      if(ret_val < 0) {
+        break;
+      }
+
+      timespec_sub(&ts_end, &ts_start);
+      total_time = (ts_end.tv_sec + ((double)ts_end.tv_nsec/NSEC_DIV));
+      bandwidth = ((double) payload_size) * WQE_count * num_threads / total_time;
+      if(num_threads == 1) {
+        base_bandwidth = bandwidth;
+      }
+      fprintf(stderr, "Info: threads = %d, Total Time spent %f usec, Size per WQE = %d bytes, WQEs per thread = %d, Aggregate bandwidth = %f gigabits/sec, Scaling = %.2fx\n",
+              num_threads, (total_time*1000000), payload_size, WQE_count, ((bandwidth*8)/1000000000),
+              (base_bandwidth > 0.0) ? (bandwidth / base_bandwidth) : 0.0);
+
+      if(num_threads == max_threads) {
+        break;
+      }
+      num_threads = (num_threads * 2 < max_threads) ? (num_threads * 2) : max_threads;
+    }
+
+    if(ret_val>=0) {
+      fprintf(stderr, "Info: Data read successfully\n");
+    } else {
+      fprintf(stderr, "Failed to send an RDMA read operation\n");
+    }
+
+    fprintf(stderr, "Info: Printing RDMA registers from the client side\n");
+    for(uint32_t i = 0; i < max_threads; i++) {
+      dump_registers(rdma_dev, 1, workers[i].qpid);
+      free(workers[i].wqe_descs);
+    }
+    free(workers);
+    free(threads);
+  }
+
+  if(server) {
+    // Connect to the remote peer via TCP/IP
+    memset(&server_addr, '\0', sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(tcp_sport);
+    server_addr.sin_addr.s_addr = inet_addr((char *) src_ip_str);
+
+    bind(sockfd, (struct sockaddr*) &server_addr, sizeof(struct sockaddr_in));
+
+    fprintf(stderr, "Info: Server is listening to a remote peer\n");
+    listen(sockfd, LISTENQ);
+
+    addr_size = sizeof(client_addr);
+    accepted_sockfd = accept(sockfd, (struct sockaddr*)&client_addr, &addr_size);
+
+    fprintf(stderr, "Info: Server is connected to a remote peer\n");
+
+    // All client threads read the same registered buffer
+    tmp_buffer = allocate_rdma_buffer(rn_dev, payload_size, "dev_mem");
+    rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, tmp_buffer);
+
+    if(is_device_address(tmp_buffer->dma_addr)) {
+      // Device memory address
+      fprintf(stderr, "Info: copy payload data to the device memory\n");
+      rc = write_from_buffer(device, fpga_fd, (char* ) sw_golden, (uint32_t)(payload_size), tmp_buffer->dma_addr);
+      if (rc < 0){
+        goto out;
+      }
+    } else {
+      // Host memory address
+      fprintf(stderr, "Info: Initialize payload data on the host memory\n");
+      for (uint32_t i = 0; i < payload_size>>2; i++) {
+        *((uint32_t* )(tmp_buffer->buffer) + i) = i % 10;
+      }
+    }
+
+    read_offset = htonll((uint64_t) tmp_buffer->buffer);
+    write(accepted_sockfd, &read_offset, sizeof(uint64_t));
+    fprintf(stderr, "Sending read_offset (%lx) to the remote client\n", ntohll(read_offset));
+
+    fprintf(stderr, "Does the client finish its RDMA read operation? If yes, please press any key\n");
+
+    while(val != '\r' && val != '\n') {
+      val = getchar();
+    }
+    fprintf(stderr, "\n");
+
+    for(uint32_t i = 0; i < num_threads; i++) {
+      dump_registers(rdma_dev, 0, 2 + i);
+    }
+
+    if(shutdown(accepted_sockfd, SHUT_RDWR) < 0){
+      fprintf(stderr, "accepted_sockfd shutdown failed\n");
+      fprintf(stderr, "Error: %s\n", strerror(errno));
+    }
+    close(accepted_sockfd);
+  }
+
+  if(shutdown(sockfd, SHUT_RDWR) < 0){
+    fprintf(stderr, "sockfd shutdown failed\n");
+    fprintf(stderr, "Error: %s\n", strerror(errno));
+  }
+  close(sockfd);
+
+out:
+  free(cidb_buffer);
+  free(data_buf);
+  free(ipkterr_buf);
+  free(err_buf);
+  free(resp_err_pkt_buf);
+  free(sw_golden);
+  close(fpga_fd);
+  close(pcie_resource_fd);
+  destroy_rn_dev(rn_dev);
+  return 0;
+}
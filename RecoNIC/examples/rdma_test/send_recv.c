@@ -46,6 +46,116 @@ uint64_t resp_err_pkt_buf_size = 65536;
 
 struct rn_dev_t* rn_dev;
 
+/* Server side of the SEND latency comparison: post num_iter buffer-based SENDs,
+ * then num_iter inline SENDs carrying the same payload, one at a time, and
+ * report the average latency of each path.
+ */
+static int send_latency_test(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_buff_t* payload_buf,
+                             uint32_t* sw_golden, uint32_t payload_size, uint32_t num_iter) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+  struct timespec ts_start, ts_end;
+  double buf_time    = 0.0;
+  double inline_time = 0.0;
+  uint16_t wrid = 0;
+  uint32_t k;
+
+  if(payload_size > RDMA_INLINE_MAX) {
+    fprintf(stderr, "Error: payload_size must not exceed %d bytes for the inline SEND comparison\n", RDMA_INLINE_MAX);
+    return -1;
+  }
+
+  // Buffer-based SEND: the RDMA engine fetches the payload from payload_buf
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  for(k = 0; k < num_iter; k++) {
+    create_a_wqe(rdma_dev, qpid, wrid++, qp->sq_pidb, payload_buf->dma_addr, payload_size, RNIC_OP_SEND, 0, R_KEY, 0, 0, 0, 0, 0);
+    if(rdma_post_send(rdma_dev, qpid) < 0) {
+      fprintf(stderr, "Error: buffer-based SEND %d failed\n", k);
+      return -1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  timespec_sub(&ts_end, &ts_start);
+  buf_time = ts_end.tv_sec + ((double)ts_end.tv_nsec/NSEC_DIV);
+
+  // Inline SEND: the payload travels inside the WQE
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  for(k = 0; k < num_iter; k++) {
+    if((rdma_send_inline(rdma_dev, qpid, wrid++, sw_golden, payload_size) < 0) || (rdma_sq_drain(qp) < 0)) {
+      fprintf(stderr, "Error: inline SEND %d failed\n", k);
+      return -1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  timespec_sub(&ts_end, &ts_start);
+  inline_time = ts_end.tv_sec + ((double)ts_end.tv_nsec/NSEC_DIV);
+
+  fprintf(stderr, "Info: %d SENDs of %d bytes\n", num_iter, payload_size);
+  fprintf(stderr, "Info: buffer-based SEND average latency = %f usec\n", (buf_time*1000000)/num_iter);
+  fprintf(stderr, "Info: inline SEND average latency       = %f usec\n", (inline_time*1000000)/num_iter);
+  return 0;
+}
+
+/* Client side of the SEND latency comparison: consume the 2 * num_iter SENDs
+ * posted by send_latency_test() and check the payload of the RQEs. Every RQE
+ * that landed since the last poll is checked, in place or after a copy out of
+ * the device memory, and the whole batch is released with a single RQCIi write.
+ */
+static int recv_latency_test(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t* sw_golden,
+                             uint32_t payload_size, uint32_t num_iter) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+  struct rdma_rqe_view_t views[64];
+  uint32_t num_recv = 0;
+  uint32_t num_db = 0;
+  uint32_t* recv_buf;
+  void* payload;
+  int num_rqe;
+  int rc = 0;
+
+  recv_buf = (uint32_t* ) malloc(payload_size);
+  if(recv_buf == NULL) {
+    fprintf(stderr, "Error: failed to allocate the receive check buffer\n");
+    return -1;
+  }
+
+  while((num_recv < (2 * num_iter)) && (rc == 0)) {
+    num_rqe = rdma_poll_rq(qp, 64, views);
+    if(num_rqe < 0) {
+      rc = -1;
+      break;
+    }
+    if(num_rqe == 0) {
+      continue;
+    }
+    for(int i = 0; i < num_rqe; i++) {
+      payload = views[i].data;
+      if(payload == NULL) {
+        // RQ in the device memory
+        if(read_to_buffer(device, fpga_fd, (char* ) recv_buf, (uint64_t) payload_size, views[i].dma_addr) < 0) {
+          rc = -1;
+          break;
+        }
+        payload = recv_buf;
+      }
+      if(memcmp(payload, sw_golden, payload_size) != 0) {
+        fprintf(stderr, "Error: received data mismatched in RQE %d after %d SENDs\n", views[i].index, num_recv + i);
+        rc = -1;
+        break;
+      }
+    }
+    num_recv += (uint32_t) num_rqe;
+    if(rdma_rq_release(qp, (uint32_t) num_rqe) < 0) {
+      rc = -1;
+    }
+    num_db += 1;
+  }
+  free(recv_buf);
+
+  if(rc == 0) {
+    fprintf(stderr, "Info: %d SENDs are successfully received with %d RQ doorbell writes!\n", num_recv, num_db);
+  }
+  return rc;
+}
+
 int main(int argc, char **argv) {
   int sockfd;
   device = DEVICE_NAME_DEFAULT;
@@ -85,9 +195,12 @@ int main(int argc, char **argv) {
 
   // payload size in bytes
   uint32_t payload_size = 4;
+  // number of SENDs per path for the inline vs. buffer-based SEND comparison
+  uint32_t num_iter = 0;
+  int test_rc = 0;
 
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:l:scgh", \
+  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:l:n:scgh", \
           long_opts, NULL)) != -1) {
     switch (cmd_opt) {
     case 'd':
@@ -168,6 +281,9 @@ int main(int argc, char **argv) {
     case 'g':
       debug = 1;
       break;
+    case 'n':
+      num_iter = (uint32_t) atoi(optarg);
+      break;
     /* print usage help and exit */
     case 'h':
     default:
@@ -243,11 +359,10 @@ int main(int argc, char **argv) {
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
   uint32_t qpid    = 2;
   uint32_t qdepth  = 64;
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size)
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --   1MB RQ (64 RQEs of RQE_SIZE = 16KB)
   allocate_rdma_qp(rdma_dev, 
                    qpid,
                    dst_qpid,
@@ -291,6 +406,14 @@ int main(int argc, char **argv) {
     buf_phy_addr = rdma_dev->qps_ptr[qpid]->rq->dma_addr;
     uint32_t* recv_tmp = malloc(buf_size);
 
+    if(num_iter > 0) {
+      fprintf(stderr, "Info: RECEIVE SENDS OF THE LATENCY COMPARISON\n");
+      test_rc = recv_latency_test(rdma_dev, qpid, sw_golden, payload_size, num_iter);
+      free(recv_tmp);
+      close(sockfd);
+      goto out;
+    }
+
     /* 
     * 8. The client posts receive request.
     */
@@ -313,6 +436,7 @@ int main(int argc, char **argv) {
       rc = read_to_buffer(device, fpga_fd, (char* ) recv_tmp, (uint64_t) payload_size, (uint64_t) buf_phy_addr);
       if(rc < 0) {
         fprintf(stderr, "Error: read_to_buffer failed with rc = %ld\n", rc);
+        test_rc = -1;
         goto out;
       }
     } else {
@@ -327,6 +451,7 @@ int main(int argc, char **argv) {
     for (i = 0; i < payload_size>>2; i++) {
       if(recv_tmp[i] != sw_golden[i]) {
         fprintf(stderr, "Error: received data mismatched: recv[%d]=%d, sw_golden[%d]=%d\n", i, recv_tmp[i], i, sw_golden[i]);
+        test_rc = -1;
         goto out;
       }
     }
@@ -359,6 +484,7 @@ int main(int argc, char **argv) {
       fprintf(stderr, "Info: copy software payload to the device memory\n");
       rc = write_from_buffer(device, fpga_fd, (char* ) sw_golden, payload_size, payload_tmp->dma_addr);
       if (rc < 0){
+        test_rc = -1;
         goto out;
       }
     } else {
@@ -369,6 +495,13 @@ int main(int argc, char **argv) {
       }
     }
 
+    if(num_iter > 0) {
+      fprintf(stderr, "Info: COMPARE BUFFER-BASED AND INLINE SEND LATENCY\n");
+      test_rc = send_latency_test(rdma_dev, qpid, payload_tmp, sw_golden, payload_size, num_iter);
+      close(sockfd);
+      goto out;
+    }
+
     /* 
     * 8. The server create a WQE request.
     */
@@ -397,6 +530,7 @@ int main(int argc, char **argv) {
       fprintf(stderr, "Info: Successfully completed an RDMA send operation!\n");
     } else {
       fprintf(stderr, "Error: Failed to perform an RDMA send operation!\n");
+      test_rc = -1;
       goto out;
     }
 
@@ -430,5 +564,5 @@ out:
   close(pcie_resource_fd);
   destroy_rn_dev(rn_dev);
 
-  return 0;
+  return (test_rc < 0) ? EXIT_FAILURE : 0;
 }
\ No newline at end of file
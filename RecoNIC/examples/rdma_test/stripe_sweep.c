@@ -0,0 +1,433 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Striped RDMA read benchmark: the client binds 1, 2, 4, ... up to --num_qp
+// QPs into a stripe and reads messages of 64KB up to --payload_size bytes
+// through it, --iterations times per message size. The aggregate bandwidth of
+// every (QPs, message size) point is printed for both stripe policies,
+// together with its share of the 100Gb/s line rate.
+
+#include "reconic.h"
+#include "rdma_api.h"
+#include "rdma_test.h"
+
+#define DEVICE_NAME_DEFAULT "/dev/reconic-mm"
+
+// Smallest message size of the sweep and line rate of the link in Gb/s
+#define MIN_MSG_SIZE (64 * 1024)
+#define LINE_RATE_GBPS 100.0
+
+uint8_t server;
+uint8_t client;
+
+struct mac_addr_t src_mac;
+struct mac_addr_t dst_mac;
+
+uint32_t src_ip         = 0;
+char src_ip_str[16];
+uint32_t dst_ip         = 0;
+char dst_ip_str[16];
+uint16_t tcp_sport      = 0;
+uint16_t udp_sport      = 0;
+uint8_t  num_qp         = 8;
+
+// Same defaults as read_batch, see read_batch.c for the buffer layout
+uint16_t num_data_buf          = 4096;
+uint16_t per_data_buf_size     = 4096;
+uint16_t ipkt_err_stat_q_size  = 8192;
+uint16_t num_err_buf           = 256;
+uint16_t per_err_buf_size      = 256;
+uint64_t resp_err_pkt_buf_size = 65536;
+
+struct rn_dev_t* rn_dev;
+
+// Aggregate bandwidth in Gb/s of iterations striped reads of msg_size bytes
+static double run_stripe(struct rdma_stripe_t* stripe, uint64_t laddr, uint64_t remote_offset,
+                         uint64_t msg_size, uint32_t iterations)
+{
+  struct timespec ts_start;
+  struct timespec ts_end;
+  double total_time;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+  for(uint32_t n = 0; n < iterations; n++) {
+    if(rdma_stripe_read(stripe, (uint16_t) n, laddr, remote_offset, msg_size, R_KEY) < 0) {
+      return -1.0;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  timespec_sub(&ts_end, &ts_start);
+  total_time = (ts_end.tv_sec + ((double)ts_end.tv_nsec/NSEC_DIV));
+  return ((double) msg_size) * iterations * 8 / total_time / 1000000000;
+}
+
+int main(int argc, char *argv[])
+{
+  int sockfd;
+  int accepted_sockfd;
+  struct sockaddr_in server_addr;
+  struct sockaddr_in client_addr;
+  socklen_t addr_size;
+  char command[64];
+  FILE *dst_mac_fp;
+  char *line = NULL;
+  size_t len = 0;
+  char *tmp_mac_addr_ptr = NULL;
+  char tmp_mac_addr_str[18] = "";
+  ssize_t command_read;
+
+  int cmd_opt;
+  device = DEVICE_NAME_DEFAULT;
+  char *pcie_resource = NULL;
+  char *qp_location = QP_LOCATION_DEFAULT;
+  //largest message size in bytes
+  uint32_t payload_size = 4 * 1024 * 1024;
+  uint32_t chunk_size = 0;
+  uint32_t iterations = 100;
+  uint32_t max_stripe_qps = 8;
+  uint32_t stripe_qps;
+  uint64_t msg_size;
+  double rr_gbps;
+  double ll_gbps;
+  int   pcie_resource_fd;
+  char  val = 0;
+
+  struct rdma_buff_t* cidb_buffer;
+  struct rdma_buff_t* local_buffer;
+  struct rdma_buff_t* tmp_buffer;
+
+  uint64_t cq_cidb_addr;
+  uint64_t rq_cidb_addr;
+
+  struct rdma_dev_t* rdma_dev;
+
+  struct rdma_buff_t* data_buf;
+  struct rdma_buff_t* ipkterr_buf;
+  struct rdma_buff_t* err_buf;
+  struct rdma_buff_t* resp_err_pkt_buf;
+
+  uint32_t rq_psn = 0xabc;
+  uint32_t sq_psn = 0xabc + 1;
+  uint32_t qpid;
+  uint32_t dst_qpid;
+  uint32_t qdepth;
+  uint32_t* qpids = NULL;
+  struct rdma_stripe_t* rr_stripe;
+  struct rdma_stripe_t* ll_stripe;
+
+  uint64_t read_A_offset;
+  uint64_t read_offset;
+  ssize_t rc;
+  int ret_val = 0;
+
+  server = 0;
+  client = 0;
+  dst_qpid = 2;
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:k:n:N:l:scgh", \
+          long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'd':
+      /* device node name */
+      fprintf(stderr, "Info: Device - %s\n", optarg);
+      device = optarg;
+      break;
+    case 'p':
+      /* PCIe resource file name */
+      fprintf(stderr, "Info: PCIe resource file: %s\n", optarg);
+      pcie_resource = optarg;
+      break;
+    case 'r':
+      src_ip = convert_ip_addr_to_uint(optarg);
+      strcpy(src_ip_str, optarg);
+      fprintf(stderr, "src_ip_str = %s\n", (char*) src_ip_str);
+      break;
+    case 'i':
+      dst_ip = convert_ip_addr_to_uint(optarg);
+      strcpy(dst_ip_str, optarg);
+      fprintf(stderr, "dst_ip_str = %s\n", (char*) dst_ip_str);
+      sprintf(command, "arp -a %s", dst_ip_str);
+      dst_mac_fp = popen(command, "r");
+      if(dst_mac_fp == NULL) {
+        perror("Error: popen\n");
+        exit(EXIT_FAILURE);
+      }
+
+      while((command_read = getline(&line, &len, dst_mac_fp)) != -1) {
+        // Check if we find an entry
+        if (strstr(line, "no match found") != NULL) {
+          fprintf(stderr, "Error: No arp cache entry for the IP (%s). Please use \"arping | ping -c 1 %s\" to create the cache entry", dst_ip_str, dst_ip_str);
+          exit(0);
+        }
+
+        if (strstr(line, "at") != NULL) {
+          // Get the MAC address from the line
+          tmp_mac_addr_ptr = strstr(line, "at")+3;
+          strncpy(tmp_mac_addr_str, tmp_mac_addr_ptr, 17);
+          dst_mac = convert_mac_addr_str_to_uint(tmp_mac_addr_str);
+          break;
+        }
+      }
+
+      pclose(dst_mac_fp);
+      free(line);
+
+      break;
+    case 'u':
+      udp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 't':
+      tcp_sport = (uint16_t) atoi(optarg);
+      break;
+    case 'q':
+      dst_qpid  = (uint32_t) atoi(optarg);
+      break;
+    case 'z':
+      payload_size = (uint32_t) atoi(optarg);
+      break;
+    case 'k':
+      chunk_size = (uint32_t) atoi(optarg);
+      break;
+    case 'n':
+      iterations = (uint32_t) atoi(optarg);
+      break;
+    case 'N':
+      max_stripe_qps = (uint32_t) atoi(optarg);
+      break;
+    case 'l':
+      /* QP allocated at host memory or device memory */
+      fprintf(stderr, "Info: QP allocated at: %s\n", optarg);
+      qp_location = optarg;
+      if (!(strcmp(qp_location, HOST_MEM) || strcmp(qp_location, DEVICE_MEM))) {
+        usage(argv[0]);
+        exit(0);
+      }
+      break;
+    case 's':
+      server = 1;
+      client = 0;
+      break;
+    case 'c':
+      server = 0;
+      client = 1;
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    /* print usage help and exit */
+    case 'h':
+    default:
+      fprintf(stderr, "Info: cmd_opt = %c\n", cmd_opt);
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  // QP IDs 2 .. max_stripe_qps+1 are used, QP1 is reserved
+  if(max_stripe_qps == 0 || max_stripe_qps > 253) {
+    fprintf(stderr, "Error: number of QPs must be between 1 and 253\n");
+    exit(EXIT_FAILURE);
+  }
+  if(payload_size < MIN_MSG_SIZE || iterations == 0) {
+    fprintf(stderr, "Error: payload size must be at least %d bytes and iterations positive\n", MIN_MSG_SIZE);
+    exit(EXIT_FAILURE);
+  }
+  num_qp = max_stripe_qps + 2;
+
+  src_mac = get_mac_addr_from_str_ip(sockfd, src_ip_str);
+
+  /*
+   * 1. Create an RecoNIC device instance
+   */
+  fprintf(stderr, "Info: Creating rn_dev\n");
+  rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, num_qp);
+
+  /*
+   * 2. Create an RDMA device instance
+   */
+  fprintf(stderr, "Info: CREATE RDMA DEVICE\n");
+  rdma_dev = create_rdma_dev(rn_dev);
+
+  /*
+   * 3. Allocate memory for CQ and RQ's cidb buffers, data buffer,
+   *    incoming_pkt_error_stat_q buffer, err_buffer and response error pkt buffer.
+   */
+  uint32_t cidb_buffer_size = (1 << HUGE_PAGE_SHIFT);
+  cidb_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) cidb_buffer_size, "host_mem");
+  cq_cidb_addr = cidb_buffer->dma_addr;
+  rq_cidb_addr = cidb_buffer->dma_addr + (num_qp<<2);
+
+  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_data_buf*per_data_buf_size), "host_mem");
+  ipkterr_buf = allocate_rdma_buffer(rn_dev, (uint64_t) ipkt_err_stat_q_size, "host_mem");
+  err_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_err_buf*per_err_buf_size), "host_mem");
+  resp_err_pkt_buf = allocate_rdma_buffer(rn_dev, (uint64_t) resp_err_pkt_buf_size, "host_mem");
+
+  /*
+   * 4. Open RDMA engine
+   */
+  fprintf(stderr, "Info: OPEN RDMA DEVICE\n");
+  open_rdma_dev(rdma_dev, src_mac, src_ip, udp_sport, num_data_buf, per_data_buf_size,
+                data_buf->dma_addr, ipkt_err_stat_q_size, ipkterr_buf->dma_addr, num_err_buf,
+                per_err_buf_size, err_buf->dma_addr, resp_err_pkt_buf_size, resp_err_pkt_buf->dma_addr);
+
+  /*
+   * 5. Allocate protection domain for queues and memory regions
+   */
+  fprintf(stderr, "Info: ALLOCATE PD\n");
+  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+
+  qdepth = 64;
+
+  fprintf(stderr, "Info: OPEN DEVICE FILE\n");
+  // Open the character device, reconic-mm, for data communication between host and device memory.
+  fpga_fd = open(device, O_RDWR);
+  if (fpga_fd < 0) {
+    fprintf(stderr, "unable to open device %s, %d.\n",
+      device, fpga_fd);
+    perror("open device");
+    close(fpga_fd);
+    return -EINVAL;
+  }
+  set_rn_dev_mm_handle(rn_dev, device, fpga_fd);
+
+  /*
+   * 6. Allocate the queue pairs that are bound into stripes
+   */
+  fprintf(stderr, "Info: ALLOCATE %d RDMA QPs\n", max_stripe_qps);
+  qpids = (uint32_t* ) malloc(max_stripe_qps * sizeof(uint32_t));
+  if(qpids == NULL) {
+    fprintf(stderr, "Error: failed to allocate QP IDs\n");
+    exit(EXIT_FAILURE);
+  }
+  for(uint32_t i = 0; i < max_stripe_qps; i++) {
+    qpid = 2 + i;
+    qpids[i] = qpid;
+    allocate_rdma_qp(rdma_dev, qpid, dst_qpid + i, rdma_pd, cq_cidb_addr + (i<<2), rq_cidb_addr + (i<<2), qdepth, qp_location, &dst_mac, dst_ip, P_KEY, R_KEY);
+    config_last_rq_psn(rdma_dev, qpid, rq_psn);
+    config_sq_psn(rdma_dev, qpid, sq_psn);
+  }
+
+  if(client) {
+    memset(&server_addr, '\0', sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port   = htons(tcp_sport);
+    server_addr.sin_addr.s_addr = inet_addr(dst_ip_str);
+
+    fprintf(stderr, "Info: Client is connecting to a remote server\n");
+    connect(sockfd, (struct sockaddr* )&server_addr, sizeof(server_addr));
+
+    fprintf(stderr, "Info: Client is connected to a remote server\n");
+
+    rc = read(sockfd, &read_A_offset, sizeof(read_A_offset));
+
+    if(rc > 0) {
+      fprintf(stderr, "Info: client received remote offset of A = 0x%lx\n", ntohll(read_A_offset));
+    } else {
+      fprintf(stderr, "Error: Can't receive remote offset of A from the remote peer\n");
+      close(sockfd);
+      return -1;
+    }
+
+    read_A_offset = ntohll(read_A_offset);
+    local_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) payload_size, "dev_mem");
+
+    // Sweep the stripe width over 1, 2, 4, ... QPs and the message size over
+    // 64KB, 128KB, ... up to the payload size
+    stripe_qps = 1;
+    while(ret_val >= 0) {
+      rr_stripe = rdma_stripe_create(rdma_dev, qpids, stripe_qps, chunk_size, RDMA_STRIPE_ROUND_ROBIN);
+      ll_stripe = rdma_stripe_create(rdma_dev, qpids, stripe_qps, chunk_size, RDMA_STRIPE_LEAST_LOADED);
+      if(rr_stripe == NULL || ll_stripe == NULL) {
+        ret_val = -1;
+        break;
+      }
+      for(msg_size = MIN_MSG_SIZE; msg_size <= payload_size; msg_size = msg_size * 2) {
+        rr_gbps = run_stripe(rr_stripe, local_buffer->dma_addr, read_A_offset, msg_size, iterations);
+        ll_gbps = run_stripe(ll_stripe, local_buffer->dma_addr, read_A_offset, msg_size, iterations);
+        if(rr_gbps < 0.0 || ll_gbps < 0.0) {
+          fprintf(stderr, "Error: striped RDMA read failed over %d QPs\n", stripe_qps);
+          ret_val = -1;
+          break;
+        }
+        fprintf(stderr, "Info: QPs = %d, message size = %lu bytes, round-robin = %f Gb/s (%.1f%% of line rate), least-loaded = %f Gb/s (%.1f%% of line rate)\n",
+                stripe_qps, msg_size, rr_gbps, rr_gbps * 100 / LINE_RATE_GBPS,
+                ll_gbps, ll_gbps * 100 / LINE_RATE_GBPS);
+      }
+      rdma_stripe_destroy(rr_stripe);
+      rdma_stripe_destroy(ll_stripe);
+
+      if(stripe_qps == max_stripe_qps) {
+        break;
+      }
+      stripe_qps = (stripe_qps * 2 < max_stripe_qps) ? (stripe_qps * 2) : max_stripe_qps;
+    }
+
+    if(ret_val>=0) {
+      fprintf(stderr, "Info: Data read successfully\n");
+    } else {
+      fprintf(stderr, "Failed to send an RDMA read operation\n");
+    }
+  }
+
+  if(server) {
+    // Connect to the remote peer via TCP/IP
+    memset(&server_addr, '\0', sizeof(struct sockaddr_in));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(tcp_sport);
+    server_addr.sin_addr.s_addr = inet_addr((char *) src_ip_str);
+
+    bind(sockfd, (struct sockaddr*) &server_addr, sizeof(struct sockaddr_in));
+
+    fprintf(stderr, "Info: Server is listening to a remote peer\n");
+    listen(sockfd, LISTENQ);
+
+    addr_size = sizeof(client_addr);
+    accepted_sockfd = accept(sockfd, (struct sockaddr*)&client_addr, &addr_size);
+
+    fprintf(stderr, "Info: Server is connected to a remote peer\n");
+
+    // Every message of the sweep reads the start of the same registered buffer
+    tmp_buffer = allocate_rdma_buffer(rn_dev, payload_size, "dev_mem");
+    rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, tmp_buffer);
+
+    read_offset = htonll((uint64_t) tmp_buffer->buffer);
+    write(accepted_sockfd, &read_offset, sizeof(uint64_t));
+    fprintf(stderr, "Sending read_offset (%lx) to the remote client\n", ntohll(read_offset));
+
+    fprintf(stderr, "Does the client finish its RDMA read operation? If yes, please press any key\n");
+
+    while(val != '\r' && val != '\n') {
+      val = getchar();
+    }
+    fprintf(stderr, "\n");
+
+    if(shutdown(accepted_sockfd, SHUT_RDWR) < 0){
+      fprintf(stderr, "accepted_sockfd shutdown failed\n");
+      fprintf(stderr, "Error: %s\n", strerror(errno));
+    }
+    close(accepted_sockfd);
+  }
+
+  if(shutdown(sockfd, SHUT_RDWR) < 0){
+    fprintf(stderr, "sockfd shutdown failed\n");
+    fprintf(stderr, "Error: %s\n", strerror(errno));
+  }
+  close(sockfd);
+
+  free(qpids);
+  free(cidb_buffer);
+  free(data_buf);
+  free(ipkterr_buf);
+  free(err_buf);
+  free(resp_err_pkt_buf);
+  close(fpga_fd);
+  close(pcie_resource_fd);
+  destroy_rn_dev(rn_dev);
+  return 0;
+}
@@ -270,11 +270,10 @@ int main(int argc, char *argv[])
    * 6. Allocate a queue pair
    */
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size)
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --   1MB RQ (64 RQEs of RQE_SIZE = 16KB)
     //struct rdma_qp_t* qp = 
   allocate_rdma_qp(rdma_dev,qpid,dst_qpid,rdma_pd,cq_cidb_addr,rq_cidb_addr,qdepth,qp_location,&dst_mac,dst_ip,P_KEY,R_KEY);
 
@@ -392,7 +391,7 @@ if(client) {
     dump_registers(rn_dev->rdma_dev, 0, qpid);
 
     tmp_buffer = allocate_rdma_buffer(rn_dev, payload_size, /*qp_location*/"dev_mem");
-    fprintf(stderr,"tmp_buffer size is %d\n", tmp_buffer->buf_size);
+    fprintf(stderr,"tmp_buffer size is %lu\n", tmp_buffer->buf_size);
     rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, tmp_buffer);
     fprintf(stderr, "Info: allocating buffer for payload data\n");
     fprintf(stderr, "Info: tmp_buffer->buffer = %p, tmp_buffer->dma_addr = 0x%lx\n", (uint64_t *) tmp_buffer->buffer, tmp_buffer->dma_addr);
@@ -79,6 +79,8 @@ int main(int argc, char *argv[])
   uint32_t payload_size = 128;
   uint32_t total_payload_size;
   uint32_t WQE_count = 1;
+  // Pacing rate limit in Mb/s, 0 posts as fast as the SQ allows
+  uint32_t rate_mbps = 0;
   int   pcie_resource_fd;
   char  val = 0;
 
@@ -103,6 +105,9 @@ int main(int argc, char *argv[])
   uint32_t qdepth;
   uint16_t wrid;
   uint32_t wqe_idx;
+  uint32_t num_posted;
+  uint32_t batch_size;
+  struct rdma_qp_t* qp;
 
   uint64_t write_offset_client;
   int      ret_val;
@@ -117,7 +122,7 @@ int main(int argc, char *argv[])
 
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
 
-  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:b:l:scgh", \
+  while ((cmd_opt = getopt_long(argc, argv, "d:p:r:i:u:t:q:z:b:l:R:scgh", \
           long_opts, NULL)) != -1) {
     switch (cmd_opt) {
     case 'd':
@@ -181,6 +186,9 @@ int main(int argc, char *argv[])
     case 'b':
       WQE_count = (uint32_t) atoi(optarg);
       break;
+    case 'R':
+      rate_mbps = (uint32_t) atoi(optarg);
+      break;
     case 'l':
       /* QP allocated at host memory or device memory */
       fprintf(stderr, "Info: QP allocated at: %s\n", optarg);
@@ -277,11 +285,10 @@ int main(int argc, char *argv[])
    * 6. Allocate a queue pair
    */
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size)
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --   1MB RQ (64 RQEs of RQE_SIZE = 16KB)
     //struct rdma_qp_t* qp = 
     allocate_rdma_qp(rdma_dev,qpid,dst_qpid,rdma_pd,cq_cidb_addr,rq_cidb_addr,qdepth,qp_location,&dst_mac,dst_ip,P_KEY,R_KEY);
 
@@ -292,6 +299,14 @@ int main(int argc, char *argv[])
   config_last_rq_psn(rdma_dev, qpid, rq_psn);
   config_sq_psn(rdma_dev, qpid, sq_psn);
 
+  // Pace the doorbells and back off on CNPs, NAKs and retries
+  if(rate_mbps != 0) {
+    fprintf(stderr, "Info: pacing QP %d at %d Mb/s\n", qpid, rate_mbps);
+    if(rdma_set_pacing(rdma_dev->qps_ptr[qpid], rate_mbps, 0, 0) < 0) {
+      exit(EXIT_FAILURE);
+    }
+  }
+
   // Get golden data for verification
   fprintf(stderr, "total_payload_size = %d, total_payload_size>>2 = %d\n", total_payload_size, total_payload_size>>2);
   sw_golden = (uint32_t* ) malloc(total_payload_size);
@@ -343,20 +358,36 @@ if(client) {
       }
       fprintf(stderr, "Info: buffer physical address is 0x%lx\n",device_buffer->dma_addr);
 
-    for(int i=0; i < WQE_count; i++)
-    {
-      fprintf(stderr, "Info: creating an RDMA write WQE for writing data\n");
-      
-      create_a_wqe(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_buffer->dma_addr, payload_size, RNIC_OP_WRITE, write_offset_client, R_KEY, 0, 0, 0, 0, 0);
-      wqe_idx = wqe_idx + 1;
-      fprintf(stderr, "Info: Adding delay of 1s\n");
-      sleep(1);
-    }
-
     //Total payload size is 16777088
-    /* subtract the start time from the end time */
+    // Stream WQE_count RDMA write WQEs through the SQ ring: wait for at least one
+    // free slot, fill every free slot with new WQEs and ring the doorbell once
+      qp = rdma_dev->qps_ptr[qpid];
+      num_posted = 0;
+      ret_val = 0;
       clock_gettime(CLOCK_MONOTONIC, &ts_start);
-      ret_val = rdma_post_batch_send(rn_dev->rdma_dev, qpid, WQE_count);
+      while(num_posted < WQE_count) {
+        ret_val = rdma_sq_reserve(qp, 1);
+        if(ret_val < 0) {
+          break;
+        }
+        batch_size = rdma_sq_credits(qp);
+        if(batch_size > (WQE_count - num_posted)) {
+          batch_size = WQE_count - num_posted;
+        }
+        for(uint32_t i = 0; i < batch_size; i++) {
+          create_a_wqe(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_buffer->dma_addr, payload_size, RNIC_OP_WRITE, write_offset_client, R_KEY, 0, 0, 0, 0, 0);
+          wqe_idx = wqe_idx + 1;
+          wrid = wrid + 1;
+        }
+        ret_val = rdma_post_batch_send_async(rn_dev->rdma_dev, qpid, batch_size);
+        if(ret_val < 0) {
+          break;
+        }
+        num_posted += batch_size;
+      }
+      if(ret_val >= 0) {
+        ret_val = rdma_sq_drain(qp);
+      }
       clock_gettime(CLOCK_MONOTONIC, &ts_end);
       if(ret_val>=0) {
         fprintf(stderr, "Successfully sent an RDMA write operation\n");
@@ -397,7 +428,7 @@ if(client) {
     dump_registers(rn_dev->rdma_dev, 0, qpid);
 
     tmp_buffer = allocate_rdma_buffer(rn_dev, total_payload_size, /*qp_location*/"dev_mem");
-    fprintf(stderr,"tmp_buffer size is %d\n", tmp_buffer->buf_size);
+    fprintf(stderr,"tmp_buffer size is %lu\n", tmp_buffer->buf_size);
     rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, tmp_buffer);
     fprintf(stderr, "Info: allocating buffer for payload data\n");
     fprintf(stderr, "Info: tmp_buffer->buffer = %p, tmp_buffer->dma_addr = 0x%lx\n", (uint64_t *) tmp_buffer->buffer, tmp_buffer->dma_addr);
@@ -80,4 +80,13 @@ extern int debug;
  */
 void timespec_sub(struct timespec *t1, struct timespec *t2);
 
+/** @brief Read the monotonic clock.
+ *  @return CLOCK_MONOTONIC time in nanoseconds.
+ */
+static inline uint64_t get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * NSEC_DIV + (uint64_t) ts.tv_nsec;
+}
+
 #endif /* __AUXILIARY_H__ */
\ No newline at end of file
@@ -0,0 +1,501 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file cm_api.c
+ *  @brief Implementation of the out-of-band RDMA connection manager.
+ */
+
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include "cm_api.h"
+
+static int cm_set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if(flags < 0) {
+    return -1;
+  }
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void cm_close_peer(struct rdma_cm_t* cm, struct rdma_cm_peer_t* peer) {
+  if(peer->fd >= 0) {
+    epoll_ctl(cm->epfd, EPOLL_CTL_DEL, peer->fd, NULL);
+    close(peer->fd);
+    peer->fd = -1;
+  }
+}
+
+struct rdma_cm_t* rdma_cm_create(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* pd_entry,
+                                 char* src_ip_str, uint16_t port,
+                                 uint64_t cq_cidb_addr, uint64_t rq_cidb_addr,
+                                 uint32_t qdepth, char* buf_location, uint32_t partion_key) {
+  struct rdma_cm_t* cm;
+  struct sockaddr_in addr;
+  struct epoll_event ev;
+  int one = 1;
+
+  if((rdma_dev == NULL) || (pd_entry == NULL) || (src_ip_str == NULL)) {
+    fprintf(stderr, "Error: rdma_dev, pd_entry or src_ip_str is NULL\n");
+    return NULL;
+  }
+
+  cm = (struct rdma_cm_t* ) calloc(1, sizeof(struct rdma_cm_t));
+  if(cm == NULL) {
+    fprintf(stderr, "Error: failed to allocate the connection manager\n");
+    return NULL;
+  }
+  cm->rdma_dev     = rdma_dev;
+  cm->pd_entry     = pd_entry;
+  cm->src_ip       = convert_ip_addr_to_uint(src_ip_str);
+  cm->port         = port;
+  cm->cq_cidb_addr = cq_cidb_addr;
+  cm->rq_cidb_addr = rq_cidb_addr;
+  cm->qdepth       = qdepth;
+  cm->buf_location = buf_location;
+  cm->partion_key  = partion_key;
+  cm->listen_fd    = -1;
+  cm->epfd         = -1;
+  strncpy(cm->src_ip_str, src_ip_str, INET_ADDRSTRLEN - 1);
+  cm->peers = (struct rdma_cm_peer_t* ) calloc(RDMA_CM_MAX_PEERS, sizeof(struct rdma_cm_peer_t));
+  cm->neigh = (struct rdma_cm_neigh_t* ) calloc(RDMA_CM_MAX_NEIGH, sizeof(struct rdma_cm_neigh_t));
+  if((cm->peers == NULL) || (cm->neigh == NULL)) {
+    fprintf(stderr, "Error: failed to allocate the connection manager\n");
+    goto fail;
+  }
+
+  cm->epfd = epoll_create1(0);
+  if(cm->epfd < 0) {
+    fprintf(stderr, "Error: epoll_create1 failed: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  // Listen before any peer is added, so that early peers only see a short refusal
+  cm->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(cm->listen_fd < 0) {
+    fprintf(stderr, "Error: failed to create the listening socket: %s\n", strerror(errno));
+    goto fail;
+  }
+  setsockopt(cm->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  addr.sin_addr.s_addr = htonl(cm->src_ip);
+  if((bind(cm->listen_fd, (struct sockaddr* ) &addr, sizeof(struct sockaddr_in)) < 0) ||
+     (listen(cm->listen_fd, RDMA_CM_MAX_PEERS) < 0) || (cm_set_nonblocking(cm->listen_fd) < 0)) {
+    fprintf(stderr, "Error: failed to listen on %s:%d: %s\n", src_ip_str, port, strerror(errno));
+    goto fail;
+  }
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.events   = EPOLLIN;
+  ev.data.ptr = NULL;
+  if(epoll_ctl(cm->epfd, EPOLL_CTL_ADD, cm->listen_fd, &ev) < 0) {
+    fprintf(stderr, "Error: epoll_ctl failed: %s\n", strerror(errno));
+    goto fail;
+  }
+
+  return cm;
+
+fail:
+  rdma_cm_destroy(cm);
+  return NULL;
+}
+
+void rdma_cm_export_buffer(struct rdma_cm_t* cm, uint64_t buf_addr, uint64_t buf_size, uint32_t r_key) {
+  cm->buf_addr = buf_addr;
+  cm->buf_size = buf_size;
+  cm->r_key    = r_key;
+}
+
+int rdma_cm_add_peer(struct rdma_cm_t* cm, char* ip_str, uint32_t local_qpid, uint32_t sq_psn) {
+  struct rdma_cm_peer_t* peer;
+  uint32_t ip = convert_ip_addr_to_uint(ip_str);
+  uint32_t i;
+
+  if(cm->num_peers >= RDMA_CM_MAX_PEERS) {
+    fprintf(stderr, "Error: a connection manager takes at most %d peers\n", RDMA_CM_MAX_PEERS);
+    return -1;
+  }
+  if((local_qpid == 0) || (local_qpid >= cm->rdma_dev->num_qp) || (cm->rdma_dev->qps_ptr[local_qpid] != NULL)) {
+    fprintf(stderr, "Error: qpid %d is out of range or already allocated\n", local_qpid);
+    return -1;
+  }
+  if(ip == cm->src_ip) {
+    fprintf(stderr, "Error: peer %s is the local node\n", ip_str);
+    return -1;
+  }
+  for(i = 0; i < cm->num_peers; i++) {
+    if((cm->peers[i].ip == ip) || (cm->peers[i].local_qpid == local_qpid)) {
+      fprintf(stderr, "Error: peer %s or qpid %d is added twice\n", ip_str, local_qpid);
+      return -1;
+    }
+  }
+
+  peer = &cm->peers[cm->num_peers];
+  memset(peer, 0, sizeof(struct rdma_cm_peer_t));
+  strncpy(peer->ip_str, ip_str, INET_ADDRSTRLEN - 1);
+  peer->ip         = ip;
+  peer->local_qpid = local_qpid;
+  peer->sq_psn     = sq_psn;
+  peer->state      = RDMA_CM_PEER_INIT;
+  peer->active     = (cm->src_ip < ip);
+  peer->fd         = -1;
+
+  return (int) cm->num_peers++;
+}
+
+/* Reload the neighbor cache from the complete entries of /proc/net/arp */
+static void cm_load_neigh(struct rdma_cm_t* cm) {
+  FILE* fp;
+  char line[256];
+  char ip_str[INET_ADDRSTRLEN];
+  char mac_str[18];
+  unsigned int hw_type;
+  unsigned int flags;
+
+  fp = fopen("/proc/net/arp", "r");
+  if(fp == NULL) {
+    fprintf(stderr, "Error: failed to open /proc/net/arp: %s\n", strerror(errno));
+    return;
+  }
+  cm->num_neigh = 0;
+  // The first line is the header: "IP address  HW type  Flags  HW address  Mask  Device"
+  if(fgets(line, sizeof(line), fp) != NULL) {
+    while((cm->num_neigh < RDMA_CM_MAX_NEIGH) && (fgets(line, sizeof(line), fp) != NULL)) {
+      if(sscanf(line, "%15s 0x%x 0x%x %17s", ip_str, &hw_type, &flags, mac_str) != 4) {
+        continue;
+      }
+      // ATF_COM (0x2): the entry is resolved
+      if((flags & 0x2) == 0) {
+        continue;
+      }
+      cm->neigh[cm->num_neigh].ip  = convert_ip_addr_to_uint(ip_str);
+      cm->neigh[cm->num_neigh].mac = convert_mac_addr_str_to_uint(mac_str);
+      cm->num_neigh++;
+    }
+  }
+  fclose(fp);
+}
+
+int rdma_cm_resolve_mac(struct rdma_cm_t* cm, uint32_t ip, struct mac_addr_t* mac) {
+  uint32_t i;
+  int pass;
+
+  for(pass = 0; pass < 2; pass++) {
+    for(i = 0; i < cm->num_neigh; i++) {
+      if(cm->neigh[i].ip == ip) {
+        *mac = cm->neigh[i].mac;
+        return 0;
+      }
+    }
+    if(pass == 0) {
+      cm_load_neigh(cm);
+    }
+  }
+  return -1;
+}
+
+/* Send as much of the pending bytes of a peer as the socket takes, and only
+ * watch for writability while some are left.
+ */
+static int cm_flush_tx(struct rdma_cm_t* cm, struct rdma_cm_peer_t* peer) {
+  struct epoll_event ev;
+  ssize_t rc;
+
+  while(peer->tx_off < peer->tx_len) {
+    rc = send(peer->fd, peer->tx_buf + peer->tx_off, peer->tx_len - peer->tx_off, MSG_NOSIGNAL);
+    if(rc < 0) {
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        break;
+      }
+      fprintf(stderr, "Error: send to %s failed: %s\n", peer->ip_str, strerror(errno));
+      return -1;
+    }
+    peer->tx_off += (uint32_t) rc;
+  }
+
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.events   = (peer->tx_off < peer->tx_len) ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+  ev.data.ptr = peer;
+  return epoll_ctl(cm->epfd, EPOLL_CTL_MOD, peer->fd, &ev);
+}
+
+/* A TCP connection with the peer is up: queue the local parameters */
+static int cm_start_exchange(struct rdma_cm_t* cm, struct rdma_cm_peer_t* peer) {
+  struct rdma_cm_msg_t msg;
+  int one = 1;
+
+  setsockopt(peer->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  msg.magic    = htonl(RDMA_CM_MAGIC);
+  msg.qpid     = htonl(peer->local_qpid);
+  msg.sq_psn   = htonl(peer->sq_psn);
+  msg.r_key    = htonl(cm->r_key);
+  msg.buf_addr = htonll(cm->buf_addr);
+  msg.buf_size = htonll(cm->buf_size);
+  memcpy(peer->tx_buf, &msg, sizeof(struct rdma_cm_msg_t));
+  peer->tx_len = sizeof(struct rdma_cm_msg_t);
+  peer->tx_off = 0;
+  peer->rx_len = 0;
+  peer->state  = RDMA_CM_PEER_EXCHANGE;
+  return cm_flush_tx(cm, peer);
+}
+
+static int cm_start_connect(struct rdma_cm_t* cm, struct rdma_cm_peer_t* peer) {
+  struct sockaddr_in addr;
+  struct epoll_event ev;
+
+  peer->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if((peer->fd < 0) || (cm_set_nonblocking(peer->fd) < 0)) {
+    fprintf(stderr, "Error: failed to create a socket for %s: %s\n", peer->ip_str, strerror(errno));
+    return -1;
+  }
+  // Bind to the local address, so that the peer can tell who connects by the
+  // source address even on a host with several interfaces
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = 0;
+  addr.sin_addr.s_addr = htonl(cm->src_ip);
+  if(bind(peer->fd, (struct sockaddr* ) &addr, sizeof(struct sockaddr_in)) < 0) {
+    fprintf(stderr, "Error: failed to bind a socket to %s: %s\n", cm->src_ip_str, strerror(errno));
+    return -1;
+  }
+  addr.sin_port        = htons(cm->port);
+  addr.sin_addr.s_addr = htonl(peer->ip);
+
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.events   = EPOLLOUT;
+  ev.data.ptr = peer;
+  if(epoll_ctl(cm->epfd, EPOLL_CTL_ADD, peer->fd, &ev) < 0) {
+    fprintf(stderr, "Error: epoll_ctl failed: %s\n", strerror(errno));
+    return -1;
+  }
+  // The outcome, success or refusal, is reported as writability
+  if((connect(peer->fd, (struct sockaddr* ) &addr, sizeof(struct sockaddr_in)) < 0) && (errno != EINPROGRESS)) {
+    cm_close_peer(cm, peer);
+    peer->retry_at_ns = get_time_ns() + (uint64_t) RDMA_CM_RETRY_MS * 1000000;
+    return 0;
+  }
+  peer->state = RDMA_CM_PEER_CONNECTING;
+  return 0;
+}
+
+static void cm_accept(struct rdma_cm_t* cm) {
+  struct sockaddr_in addr;
+  socklen_t addr_size;
+  struct epoll_event ev;
+  uint32_t ip;
+  uint32_t i;
+  int fd;
+
+  while(1) {
+    addr_size = sizeof(struct sockaddr_in);
+    fd = accept(cm->listen_fd, (struct sockaddr* ) &addr, &addr_size);
+    if(fd < 0) {
+      return;
+    }
+    ip = ntohl(addr.sin_addr.s_addr);
+    for(i = 0; i < cm->num_peers; i++) {
+      if((cm->peers[i].ip == ip) && !cm->peers[i].active && (cm->peers[i].state == RDMA_CM_PEER_INIT)) {
+        break;
+      }
+    }
+    if((i == cm->num_peers) || (cm_set_nonblocking(fd) < 0)) {
+      // Not a peer of this run, or one that is already connected
+      close(fd);
+      continue;
+    }
+    cm->peers[i].fd = fd;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &cm->peers[i];
+    if((epoll_ctl(cm->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) || (cm_start_exchange(cm, &cm->peers[i]) < 0)) {
+      cm->peers[i].state = RDMA_CM_PEER_FAILED;
+    }
+  }
+}
+
+/* The parameters of the peer are in: configure the local QP and tell the
+ * peer it can send.
+ */
+static int cm_config_qp(struct rdma_cm_t* cm, struct rdma_cm_peer_t* peer) {
+  struct rdma_cm_msg_t msg;
+  uint64_t idx = (uint64_t) (peer - cm->peers);
+
+  memcpy(&msg, peer->rx_buf, sizeof(struct rdma_cm_msg_t));
+  peer->remote.magic    = ntohl(msg.magic);
+  peer->remote.qpid     = ntohl(msg.qpid);
+  peer->remote.sq_psn   = ntohl(msg.sq_psn);
+  peer->remote.r_key    = ntohl(msg.r_key);
+  peer->remote.buf_addr = ntohll(msg.buf_addr);
+  peer->remote.buf_size = ntohll(msg.buf_size);
+  if(peer->remote.magic != RDMA_CM_MAGIC) {
+    fprintf(stderr, "Error: unexpected message from %s\n", peer->ip_str);
+    return -1;
+  }
+  if(rdma_cm_resolve_mac(cm, peer->ip, &peer->mac) < 0) {
+    fprintf(stderr, "Error: no ARP entry for %s\n", peer->ip_str);
+    return -1;
+  }
+
+  peer->qp = allocate_rdma_qp(cm->rdma_dev, peer->local_qpid, peer->remote.qpid, cm->pd_entry,
+                              cm->cq_cidb_addr + (idx<<2), cm->rq_cidb_addr + (idx<<2), cm->qdepth, cm->buf_location,
+                              &peer->mac, peer->ip, cm->partion_key, cm->r_key);
+  // The first request of the peer carries its initial SQ PSN
+  config_last_rq_psn(cm->rdma_dev, peer->local_qpid, peer->remote.sq_psn - 1);
+  config_sq_psn(cm->rdma_dev, peer->local_qpid, peer->sq_psn);
+
+  peer->tx_buf[0] = 1;
+  peer->tx_len = 1;
+  peer->tx_off = 0;
+  peer->state  = RDMA_CM_PEER_READY;
+  return cm_flush_tx(cm, peer);
+}
+
+static int cm_recv(struct rdma_cm_t* cm, struct rdma_cm_peer_t* peer) {
+  ssize_t rc;
+
+  while(peer->rx_len < sizeof(peer->rx_buf)) {
+    rc = recv(peer->fd, peer->rx_buf + peer->rx_len, sizeof(peer->rx_buf) - peer->rx_len, 0);
+    if(rc == 0) {
+      fprintf(stderr, "Error: %s closed the connection\n", peer->ip_str);
+      return -1;
+    }
+    if(rc < 0) {
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        break;
+      }
+      fprintf(stderr, "Error: recv from %s failed: %s\n", peer->ip_str, strerror(errno));
+      return -1;
+    }
+    peer->rx_len += (uint32_t) rc;
+    if((peer->qp == NULL) && (peer->rx_len >= sizeof(struct rdma_cm_msg_t)) && (cm_config_qp(cm, peer) < 0)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Drive one peer after an epoll event */
+static void cm_handle_peer(struct rdma_cm_t* cm, struct rdma_cm_peer_t* peer, uint32_t events) {
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+
+  if(peer->state == RDMA_CM_PEER_CONNECTING) {
+    getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+    if(err != 0) {
+      // The peer does not listen yet, try again a bit later
+      cm_close_peer(cm, peer);
+      peer->state = RDMA_CM_PEER_INIT;
+      peer->retry_at_ns = get_time_ns() + (uint64_t) RDMA_CM_RETRY_MS * 1000000;
+      return;
+    }
+    if(cm_start_exchange(cm, peer) < 0) {
+      peer->state = RDMA_CM_PEER_FAILED;
+    }
+    return;
+  }
+
+  if(((events & EPOLLOUT) && (cm_flush_tx(cm, peer) < 0)) ||
+     ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && (cm_recv(cm, peer) < 0))) {
+    peer->state = RDMA_CM_PEER_FAILED;
+    cm_close_peer(cm, peer);
+    return;
+  }
+
+  // Both QPs are configured once each side got the other's ready byte
+  if((peer->state == RDMA_CM_PEER_READY) && (peer->tx_off == peer->tx_len) &&
+     (peer->rx_len == sizeof(struct rdma_cm_msg_t) + 1)) {
+    peer->state = RDMA_CM_PEER_CONNECTED;
+    cm_close_peer(cm, peer);
+  }
+}
+
+int rdma_cm_connect_all(struct rdma_cm_t* cm, int timeout_ms) {
+  struct epoll_event events[64];
+  struct rdma_cm_peer_t* peer;
+  uint64_t deadline_ns;
+  uint64_t wake_ns;
+  uint64_t now_ns;
+  uint32_t num_connected;
+  uint32_t i;
+  int num_events;
+  int wait_ms;
+  int n;
+
+  deadline_ns = get_time_ns() + (uint64_t) timeout_ms * 1000000;
+  while(1) {
+    now_ns = get_time_ns();
+    wake_ns = deadline_ns;
+    num_connected = 0;
+    for(i = 0; i < cm->num_peers; i++) {
+      peer = &cm->peers[i];
+      if(peer->state == RDMA_CM_PEER_FAILED) {
+        fprintf(stderr, "Error: connection with %s failed\n", peer->ip_str);
+        return -1;
+      }
+      if(peer->state == RDMA_CM_PEER_CONNECTED) {
+        num_connected++;
+        continue;
+      }
+      // Outgoing connections are (re)started when due
+      if(peer->active && (peer->state == RDMA_CM_PEER_INIT)) {
+        if(peer->retry_at_ns <= now_ns) {
+          if(cm_start_connect(cm, peer) < 0) {
+            return -1;
+          }
+        }
+        if((peer->state == RDMA_CM_PEER_INIT) && (peer->retry_at_ns < wake_ns)) {
+          wake_ns = peer->retry_at_ns;
+        }
+      }
+    }
+    if(num_connected == cm->num_peers) {
+      return (int) num_connected;
+    }
+    if(now_ns >= deadline_ns) {
+      fprintf(stderr, "Error: rdma_cm_connect_all timeout, %d of %d peers connected\n", num_connected, cm->num_peers);
+      for(i = 0; i < cm->num_peers; i++) {
+        if(cm->peers[i].state != RDMA_CM_PEER_CONNECTED) {
+          fprintf(stderr, "Error: peer %s is in state %d\n", cm->peers[i].ip_str, cm->peers[i].state);
+        }
+      }
+      return -1;
+    }
+
+    wait_ms = (wake_ns > now_ns) ? (int) ((wake_ns - now_ns + 999999) / 1000000) : 0;
+    num_events = epoll_wait(cm->epfd, events, 64, wait_ms);
+    if((num_events < 0) && (errno != EINTR)) {
+      fprintf(stderr, "Error: epoll_wait failed: %s\n", strerror(errno));
+      return -1;
+    }
+    for(n = 0; n < num_events; n++) {
+      if(events[n].data.ptr == NULL) {
+        cm_accept(cm);
+      } else {
+        cm_handle_peer(cm, (struct rdma_cm_peer_t* ) events[n].data.ptr, events[n].events);
+      }
+    }
+  }
+}
+
+void rdma_cm_destroy(struct rdma_cm_t* cm) {
+  uint32_t i;
+
+  if(cm == NULL) {
+    return;
+  }
+  for(i = 0; i < cm->num_peers; i++) {
+    cm_close_peer(cm, &cm->peers[i]);
+  }
+  if(cm->listen_fd >= 0) {
+    close(cm->listen_fd);
+  }
+  if(cm->epfd >= 0) {
+    close(cm->epfd);
+  }
+  free(cm->peers);
+  free(cm->neigh);
+  free(cm);
+}
@@ -0,0 +1,217 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file cm_api.h
+ *  @brief Header file of the out-of-band RDMA connection manager.
+ *
+ *  Before two nodes can run RDMA operations, they must exchange QP numbers,
+ *  PSNs, r_keys and buffer addresses over a side channel, and each must know
+ *  the MAC address of the other. The connection manager does this over TCP
+ *  with many peers at once. A single epoll loop drives every connection, so
+ *  bringing up a full mesh takes about as long as the slowest peer. MAC
+ *  addresses are taken from a neighbor cache that is loaded from
+ *  /proc/net/arp. Once a peer's parameters arrive, its QP is configured with
+ *  allocate_rdma_qp(), config_sq_psn() and config_last_rq_psn().
+ */
+
+#ifndef __CM_API_H__
+#define __CM_API_H__
+
+#include <arpa/inet.h>
+#include "rdma_api.h"
+
+/*! \def RDMA_CM_MAX_PEERS
+    \brief Largest number of peers of a connection manager, one QP each.
+*/
+#define RDMA_CM_MAX_PEERS 253
+
+/*! \def RDMA_CM_MAX_NEIGH
+    \brief Number of entries of the neighbor MAC cache.
+*/
+#define RDMA_CM_MAX_NEIGH 512
+
+/*! \def RDMA_CM_MAGIC
+    \brief First word of every connection manager message.
+*/
+#define RDMA_CM_MAGIC 0x52434d31
+
+/*! \def RDMA_CM_RETRY_MS
+    \brief Delay before an outgoing connection refused by a peer is retried.
+*/
+#define RDMA_CM_RETRY_MS 100
+
+/*! \def RDMA_CM_PEER_INIT
+    \brief Peer state: no connection yet.
+*/
+#define RDMA_CM_PEER_INIT       0
+
+/*! \def RDMA_CM_PEER_CONNECTING
+    \brief Peer state: outgoing TCP connection in progress.
+*/
+#define RDMA_CM_PEER_CONNECTING 1
+
+/*! \def RDMA_CM_PEER_EXCHANGE
+    \brief Peer state: connected, exchanging QP parameters.
+*/
+#define RDMA_CM_PEER_EXCHANGE   2
+
+/*! \def RDMA_CM_PEER_READY
+    \brief Peer state: local QP configured, waiting for the peer's QP.
+*/
+#define RDMA_CM_PEER_READY      3
+
+/*! \def RDMA_CM_PEER_CONNECTED
+    \brief Peer state: the QPs of both sides are configured.
+*/
+#define RDMA_CM_PEER_CONNECTED  4
+
+/*! \def RDMA_CM_PEER_FAILED
+    \brief Peer state: the exchange failed.
+*/
+#define RDMA_CM_PEER_FAILED     5
+
+/*! \struct rdma_cm_msg_t
+    \brief QP parameters sent to a peer, in network byte order on the wire.
+*/
+struct rdma_cm_msg_t {
+  uint32_t magic;    /*!< magic RDMA_CM_MAGIC. */
+  uint32_t qpid;     /*!< qpid QP ID of the sender used for this peer. */
+  uint32_t sq_psn;   /*!< sq_psn initial SQ PSN of the sender. */
+  uint32_t r_key;    /*!< r_key r_key of the buffer exported by the sender. */
+  uint64_t buf_addr; /*!< buf_addr remote offset of the exported buffer. */
+  uint64_t buf_size; /*!< buf_size size in bytes of the exported buffer. */
+};
+
+/*! \struct rdma_cm_neigh_t
+    \brief An IPv4 neighbor and its MAC address.
+*/
+struct rdma_cm_neigh_t {
+  uint32_t ip;           /*!< ip IPv4 address, as returned by convert_ip_addr_to_uint(). */
+  struct mac_addr_t mac; /*!< mac MAC address. */
+};
+
+/*! \struct rdma_cm_peer_t
+    \brief A peer of the connection manager and the parameters it sent.
+*/
+struct rdma_cm_peer_t {
+  char ip_str[INET_ADDRSTRLEN]; /*!< ip_str IPv4 address of the peer. */
+  uint32_t ip;                  /*!< ip IPv4 address, as returned by convert_ip_addr_to_uint(). */
+  struct mac_addr_t mac;        /*!< mac MAC address of the peer, the QP points to it. */
+  uint32_t local_qpid;          /*!< local_qpid local QP ID used for this peer. */
+  uint32_t sq_psn;              /*!< sq_psn initial SQ PSN of the local QP. */
+  struct rdma_cm_msg_t remote;  /*!< remote parameters sent by the peer, host byte order. */
+  struct rdma_qp_t* qp;         /*!< qp local QP, NULL until configured. */
+  uint8_t state;                /*!< state RDMA_CM_PEER_INIT ... RDMA_CM_PEER_FAILED. */
+  uint8_t active;               /*!< active set if this node opens the TCP connection. */
+  int fd;                       /*!< fd TCP socket, -1 if none. */
+  uint64_t retry_at_ns;         /*!< retry_at_ns time of the next connection attempt. */
+  uint8_t tx_buf[sizeof(struct rdma_cm_msg_t) + 1]; /*!< tx_buf bytes not sent yet. */
+  uint32_t tx_len;              /*!< tx_len number of bytes in tx_buf. */
+  uint32_t tx_off;              /*!< tx_off number of bytes of tx_buf already sent. */
+  uint8_t rx_buf[sizeof(struct rdma_cm_msg_t) + 1]; /*!< rx_buf bytes received. */
+  uint32_t rx_len;              /*!< rx_len number of bytes in rx_buf. */
+};
+
+/*! \struct rdma_cm_t
+    \brief A connection manager: local QP settings, peers and neighbor cache.
+*/
+struct rdma_cm_t {
+  struct rdma_dev_t* rdma_dev;  /*!< rdma_dev the RDMA device. */
+  struct rdma_pd_t* pd_entry;   /*!< pd_entry protection domain of the QPs. */
+  uint32_t src_ip;              /*!< src_ip local IPv4 address. */
+  char src_ip_str[INET_ADDRSTRLEN]; /*!< src_ip_str local IPv4 address. */
+  uint16_t port;                /*!< port TCP port every node listens on. */
+  uint64_t cq_cidb_addr;        /*!< cq_cidb_addr CQ doorbell address of the QPs. */
+  uint64_t rq_cidb_addr;        /*!< rq_cidb_addr RQ doorbell address of the QPs. */
+  uint32_t qdepth;              /*!< qdepth queue depth of the QPs. */
+  char* buf_location;           /*!< buf_location "host_mem" or "dev_mem". */
+  uint32_t partion_key;         /*!< partion_key partition key of the QPs. */
+  uint32_t r_key;               /*!< r_key r_key of the exported buffer. */
+  uint64_t buf_addr;            /*!< buf_addr remote offset of the exported buffer. */
+  uint64_t buf_size;            /*!< buf_size size in bytes of the exported buffer. */
+  int listen_fd;                /*!< listen_fd listening TCP socket, -1 if none. */
+  int epfd;                     /*!< epfd epoll instance of the event loop. */
+  uint32_t num_peers;           /*!< num_peers number of peers. */
+  struct rdma_cm_peer_t* peers; /*!< peers RDMA_CM_MAX_PEERS peers. */
+  uint32_t num_neigh;           /*!< num_neigh number of entries of the neighbor cache. */
+  struct rdma_cm_neigh_t* neigh; /*!< neigh neighbor cache. */
+};
+
+/** @brief Create a connection manager.
+ *
+ *  Every node of a run creates its connection manager with the same port.
+ *  @param rdma_dev A pointer to the opened RDMA device.
+ *  @param pd_entry protection domain of the QPs.
+ *  @param src_ip_str local IPv4 address, the one passed to open_rdma_dev().
+ *  @param port TCP port to listen on and to connect to.
+ *  @param cq_cidb_addr address of the CQ doorbells of the QPs, one 32-bit word
+ *         per peer: the QP of cm->peers[i] uses cq_cidb_addr + 4 * i, so
+ *         4 * RDMA_CM_MAX_PEERS bytes cover any number of peers.
+ *  @param rq_cidb_addr address of the RQ doorbells of the QPs, laid out as the
+ *         CQ doorbells and not overlapping them.
+ *  @param qdepth queue depth of the QPs.
+ *  @param buf_location "host_mem" or "dev_mem", where the QP rings are allocated.
+ *  @param partion_key partition key of the QPs.
+ *  @return a pointer to the connection manager, or NULL on failure.
+ */
+struct rdma_cm_t* rdma_cm_create(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* pd_entry,
+                                 char* src_ip_str, uint16_t port,
+                                 uint64_t cq_cidb_addr, uint64_t rq_cidb_addr,
+                                 uint32_t qdepth, char* buf_location, uint32_t partion_key);
+
+/** @brief Set the buffer advertised to every peer.
+ *  @param cm a pointer to the connection manager.
+ *  @param buf_addr remote offset of the buffer, as used in WQEs.
+ *  @param buf_size size of the buffer in bytes.
+ *  @param r_key r_key the buffer is registered with.
+ *  @return void.
+ */
+void rdma_cm_export_buffer(struct rdma_cm_t* cm, uint64_t buf_addr, uint64_t buf_size, uint32_t r_key);
+
+/** @brief Add a peer to connect with.
+ *  @param cm a pointer to the connection manager.
+ *  @param ip_str IPv4 address of the peer.
+ *  @param local_qpid local QP ID used for this peer, not allocated yet.
+ *  @param sq_psn initial SQ PSN of the local QP.
+ *  @return the index of the peer in cm->peers, or -1 on failure.
+ */
+int rdma_cm_add_peer(struct rdma_cm_t* cm, char* ip_str, uint32_t local_qpid, uint32_t sq_psn);
+
+/** @brief Connect with every peer added.
+ *
+ *  Of each pair of nodes, the one with the lower IP address opens the TCP
+ *  connection and retries it until the other side listens. Both sides send
+ *  their parameters right away. The local QP of a peer is configured as soon
+ *  as the peer's parameters arrive. A one-byte ready message then tells the
+ *  peer that the QP can take traffic.
+ *  @param cm a pointer to the connection manager.
+ *  @param timeout_ms time limit in milliseconds for the whole bring-up.
+ *  @return Number of peers connected, or -1 if a peer failed or the time
+ *          limit expired.
+ */
+int rdma_cm_connect_all(struct rdma_cm_t* cm, int timeout_ms);
+
+/** @brief Get the MAC address of a neighbor.
+ *
+ *  The neighbor cache is looked up first. On a miss, it is reloaded from
+ *  /proc/net/arp.
+ *  @param cm a pointer to the connection manager.
+ *  @param ip IPv4 address, as returned by convert_ip_addr_to_uint().
+ *  @param mac MAC address filled by the call.
+ *  @return Success (0) or Failure (-1) if the neighbor has no complete ARP entry.
+ */
+int rdma_cm_resolve_mac(struct rdma_cm_t* cm, uint32_t ip, struct mac_addr_t* mac);
+
+/** @brief Close the sockets and free a connection manager.
+ *
+ *  The QPs stay allocated and keep pointing at the MAC addresses held by the
+ *  connection manager, so destroy it after the QPs.
+ *  @param cm a pointer to the connection manager.
+ *  @return void.
+ */
+void rdma_cm_destroy(struct rdma_cm_t* cm);
+
+#endif /* __CM_API_H__ */
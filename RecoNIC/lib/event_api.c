@@ -0,0 +1,283 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file event_api.c
+ *  @brief Implementation of user-space RDMA completion event APIs.
+ */
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "event_api.h"
+
+int rdma_read_int_status(uint32_t* axil_ctl, struct rdma_int_status_t* sts) {
+  int w;
+
+  memset(sts, 0, sizeof(struct rdma_int_status_t));
+  sts->intsts = read32_data(axil_ctl, RN_RDMA_GCSR_INTSTS);
+  if(sts->intsts == 0) {
+    return 0;
+  }
+
+  // RQINTSTS1..8 and CQINTSTS1..8 are consecutive 32-bit registers
+  for(w = 0; w < 8; w++) {
+    sts->rq_intsts[w] = read32_data(axil_ctl, RN_RDMA_GCSR_RQINTSTS1 + (w << 2));
+    sts->cq_intsts[w] = read32_data(axil_ctl, RN_RDMA_GCSR_CQINTSTS1 + (w << 2));
+  }
+
+  return 1;
+}
+
+void rdma_clear_int_status(uint32_t* axil_ctl, const struct rdma_int_status_t* sts) {
+  int w;
+
+  // Status bits are write-1-to-clear, only the bits seen are cleared so that
+  // events raised after the snapshot are kept
+  for(w = 0; w < 8; w++) {
+    if(sts->rq_intsts[w] != 0) {
+      write32_data(axil_ctl, RN_RDMA_GCSR_RQINTSTS1 + (w << 2), sts->rq_intsts[w]);
+    }
+    if(sts->cq_intsts[w] != 0) {
+      write32_data(axil_ctl, RN_RDMA_GCSR_CQINTSTS1 + (w << 2), sts->cq_intsts[w]);
+    }
+  }
+  if(sts->intsts != 0) {
+    write32_data(axil_ctl, RN_RDMA_GCSR_INTSTS, sts->intsts);
+  }
+}
+
+uint32_t rdma_decode_int_status(const struct rdma_int_status_t* sts,
+                                struct rdma_qp_event_t* events,
+                                uint32_t max_events) {
+  uint32_t num_events = 0;
+  uint32_t pending;
+  uint32_t bit;
+  int w;
+
+  for(w = 0; w < 8; w++) {
+    pending = sts->cq_intsts[w] | sts->rq_intsts[w];
+    while((pending != 0) && (num_events < max_events)) {
+      bit = (uint32_t) __builtin_ctz(pending);
+      pending &= pending - 1;
+
+      events[num_events].qpid  = ((uint32_t) w << 5) + bit + 1;
+      events[num_events].flags = 0;
+      if(sts->cq_intsts[w] & (1U << bit)) {
+        events[num_events].flags |= RDMA_EVENT_CQ;
+      }
+      if(sts->rq_intsts[w] & (1U << bit)) {
+        events[num_events].flags |= RDMA_EVENT_RQ;
+      }
+      num_events++;
+    }
+  }
+
+  return num_events;
+}
+
+/* Notifier thread: scan the interrupt status registers, signal the eventfd of
+ * every pending QP and back off exponentially while nothing happens.
+ */
+static void* event_channel_main(void* arg) {
+  struct rdma_event_channel_t* ch = (struct rdma_event_channel_t* ) arg;
+  struct rdma_int_status_t sts;
+  struct rdma_qp_event_t events[RDMA_EVENT_MAX_QP];
+  uint32_t sleep_us = ch->min_sleep_us;
+  uint32_t num_events;
+  uint32_t i;
+  uint32_t w;
+  uint64_t one = 1;
+  int efd;
+
+  while(ch->running) {
+    ch->num_scans++;
+    if(rdma_read_int_status(ch->axil_ctl, &sts)) {
+      // Hand the CQ bits to the sinks before they are gone from the registers
+      pthread_mutex_lock(&ch->lock);
+      for(i = 0; i < ch->num_cq_sinks; i++) {
+        for(w = 0; w < 8; w++) {
+          if(sts.cq_intsts[w] != 0) {
+            __atomic_fetch_or(&ch->cq_sinks[i][w], sts.cq_intsts[w], __ATOMIC_RELEASE);
+          }
+        }
+      }
+      pthread_mutex_unlock(&ch->lock);
+      rdma_clear_int_status(ch->axil_ctl, &sts);
+      num_events = rdma_decode_int_status(&sts, events, RDMA_EVENT_MAX_QP);
+      for(i = 0; i < num_events; i++) {
+        if(events[i].qpid > ch->num_qp) {
+          continue;
+        }
+        efd = __atomic_load_n(&ch->qp_efd[events[i].qpid], __ATOMIC_ACQUIRE);
+        if(efd >= 0) {
+          if(write(efd, &one, sizeof(one)) == sizeof(one)) {
+            ch->num_events++;
+          }
+        }
+      }
+      sleep_us = ch->min_sleep_us;
+    } else {
+      sleep_us = (sleep_us << 1) > ch->max_sleep_us ? ch->max_sleep_us : (sleep_us << 1);
+    }
+    usleep(sleep_us);
+  }
+
+  return NULL;
+}
+
+struct rdma_event_channel_t* rdma_create_event_channel(uint32_t* axil_ctl, uint32_t num_qp) {
+  struct rdma_event_channel_t* ch;
+  uint32_t i;
+
+  if((axil_ctl == NULL) || (num_qp == 0) || (num_qp > RDMA_EVENT_MAX_QP)) {
+    fprintf(stderr, "Error: invalid event channel configuration, num_qp = %d\n", num_qp);
+    return NULL;
+  }
+
+  ch = (struct rdma_event_channel_t* ) malloc(sizeof(struct rdma_event_channel_t));
+  if(ch == NULL) {
+    fprintf(stderr, "Error: failed to allocate event channel\n");
+    return NULL;
+  }
+  memset(ch, 0, sizeof(struct rdma_event_channel_t));
+
+  ch->qp_efd = (int* ) malloc((num_qp + 1) * sizeof(int));
+  if(ch->qp_efd == NULL) {
+    fprintf(stderr, "Error: failed to allocate event channel fds\n");
+    free(ch);
+    return NULL;
+  }
+  for(i = 0; i <= num_qp; i++) {
+    ch->qp_efd[i] = -1;
+  }
+
+  ch->axil_ctl = axil_ctl;
+  ch->num_qp = num_qp;
+  ch->min_sleep_us = RDMA_EVENT_MIN_SLEEP_US;
+  ch->max_sleep_us = RDMA_EVENT_MAX_SLEEP_US;
+  pthread_mutex_init(&ch->lock, NULL);
+
+  return ch;
+}
+
+int rdma_start_event_channel(struct rdma_event_channel_t* ch) {
+  if(ch->running) {
+    return 0;
+  }
+
+  ch->running = 1;
+  if(pthread_create(&ch->thread, NULL, event_channel_main, ch) != 0) {
+    fprintf(stderr, "Error: failed to create the event channel thread\n");
+    ch->running = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+int rdma_get_event_fd(struct rdma_event_channel_t* ch, uint32_t qpid) {
+  int efd;
+
+  if((qpid == 0) || (qpid > ch->num_qp)) {
+    fprintf(stderr, "Error: qpid %d is not served by the event channel\n", qpid);
+    return -1;
+  }
+
+  pthread_mutex_lock(&ch->lock);
+  efd = ch->qp_efd[qpid];
+  if(efd < 0) {
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(efd < 0) {
+      perror("Error: eventfd");
+    } else {
+      __atomic_store_n(&ch->qp_efd[qpid], efd, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&ch->lock);
+
+  return efd;
+}
+
+int rdma_event_add_cq_sink(struct rdma_event_channel_t* ch, uint32_t* bits) {
+  int rc = 0;
+
+  pthread_mutex_lock(&ch->lock);
+  if(ch->num_cq_sinks < RDMA_EVENT_MAX_CQ_SINKS) {
+    ch->cq_sinks[ch->num_cq_sinks++] = bits;
+  } else {
+    fprintf(stderr, "Error: the event channel already feeds %d CQ sinks\n", RDMA_EVENT_MAX_CQ_SINKS);
+    rc = -1;
+  }
+  pthread_mutex_unlock(&ch->lock);
+
+  return rc;
+}
+
+void rdma_event_remove_cq_sink(struct rdma_event_channel_t* ch, uint32_t* bits) {
+  uint32_t i;
+
+  pthread_mutex_lock(&ch->lock);
+  for(i = 0; i < ch->num_cq_sinks; i++) {
+    if(ch->cq_sinks[i] == bits) {
+      ch->cq_sinks[i] = ch->cq_sinks[--ch->num_cq_sinks];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ch->lock);
+}
+
+int rdma_wait_event(struct rdma_event_channel_t* ch, uint32_t qpid, int timeout_ms) {
+  struct pollfd pfd;
+  uint64_t count;
+  int rc;
+
+  pfd.fd = rdma_get_event_fd(ch, qpid);
+  if(pfd.fd < 0) {
+    return -1;
+  }
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  rc = poll(&pfd, 1, timeout_ms);
+  if(rc < 0) {
+    if(errno == EINTR) {
+      return 0;
+    }
+    perror("Error: poll");
+    return -1;
+  }
+  if(rc == 0) {
+    return 0;
+  }
+
+  if(read(pfd.fd, &count, sizeof(count)) != sizeof(count)) {
+    // Another thread consumed the events first
+    return 0;
+  }
+
+  return (int) count;
+}
+
+void rdma_destroy_event_channel(struct rdma_event_channel_t* ch) {
+  uint32_t i;
+
+  if(ch == NULL) {
+    return;
+  }
+
+  if(ch->running) {
+    ch->running = 0;
+    pthread_join(ch->thread, NULL);
+  }
+
+  for(i = 0; i <= ch->num_qp; i++) {
+    if(ch->qp_efd[i] >= 0) {
+      close(ch->qp_efd[i]);
+    }
+  }
+  pthread_mutex_destroy(&ch->lock);
+  free(ch->qp_efd);
+  free(ch);
+}
@@ -0,0 +1,196 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file event_api.h
+ *  @brief Header file of user-space RDMA completion event APIs.
+ *
+ *  The ERNIC raises per-QP CQ and RQ interrupt status bits (CQINTSTS1..8 and
+ *  RQINTSTS1..8), but the interrupt line is not delivered to user space. An
+ *  event channel runs one notifier thread that watches the interrupt status
+ *  registers with an adaptive backoff, clears them and signals one eventfd per
+ *  QP. Applications block on those fds with poll/epoll instead of spinning on
+ *  the CQ.
+ *
+ *  The notifier polls: after an idle scan it doubles its sleep, up to
+ *  max_sleep_us (RDMA_EVENT_MAX_SLEEP_US, 1 ms, by default). A completion that
+ *  arrives on an idle channel is therefore signaled up to max_sleep_us plus one
+ *  register scan after the hardware raised it. Workloads that need lower wakeup
+ *  latency should lower max_sleep_us, at the cost of more scans, or spin.
+ *
+ *  The notifier is the only clearer of CQINTSTS and RQINTSTS, so an application
+ *  must not clear them itself. Other users of the CQ status, such as CQ groups
+ *  (rdma_cq_group_set_event_channel()), register a CQ sink: a bitmap the
+ *  notifier ORs every CQINTSTS snapshot into before clearing the registers.
+ */
+
+#ifndef __EVENT_API_H__
+#define __EVENT_API_H__
+
+#include <pthread.h>
+#include "auxiliary.h"
+#include "reconic_reg.h"
+#include "control_api.h"
+
+/*! \def RDMA_EVENT_MAX_QP
+    \brief Number of QPs covered by the 8 CQINTSTS/RQINTSTS registers.
+*/
+#define RDMA_EVENT_MAX_QP 256
+
+/*! \def RDMA_EVENT_CQ
+    \brief Event flag: the CQ interrupt status bit of the QP was set.
+*/
+#define RDMA_EVENT_CQ 0x1
+
+/*! \def RDMA_EVENT_RQ
+    \brief Event flag: the RQ interrupt status bit of the QP was set.
+*/
+#define RDMA_EVENT_RQ 0x2
+
+/*! \def RDMA_EVENT_MAX_CQ_SINKS
+    \brief Number of CQ sinks an event channel can feed.
+*/
+#define RDMA_EVENT_MAX_CQ_SINKS 8
+
+/*! \def RDMA_EVENT_MIN_SLEEP_US
+    \brief Default sleep of the notifier thread right after an event.
+*/
+#define RDMA_EVENT_MIN_SLEEP_US 1
+
+/*! \def RDMA_EVENT_MAX_SLEEP_US
+    \brief Default upper bound of the notifier thread sleep when idle, and so
+    of the time an idle channel takes to signal a new event.
+*/
+#define RDMA_EVENT_MAX_SLEEP_US 1000
+
+/*! \struct rdma_int_status_t
+    \brief Snapshot of the ERNIC interrupt status registers.
+
+    Bit b of cq_intsts[w] and rq_intsts[w] belongs to QP (w*32 + b + 1).
+*/
+struct rdma_int_status_t {
+  uint32_t intsts;       /*!< intsts global interrupt status (INTSTS). */
+  uint32_t rq_intsts[8]; /*!< rq_intsts per-QP RQ interrupt status (RQINTSTS1..8). */
+  uint32_t cq_intsts[8]; /*!< cq_intsts per-QP CQ interrupt status (CQINTSTS1..8). */
+};
+
+/*! \struct rdma_qp_event_t
+    \brief A QP with a pending interrupt, decoded from rdma_int_status_t.
+*/
+struct rdma_qp_event_t {
+  uint32_t qpid;  /*!< qpid QP ID. */
+  uint32_t flags; /*!< flags RDMA_EVENT_CQ and/or RDMA_EVENT_RQ. */
+};
+
+/*! \struct rdma_event_channel_t
+    \brief An event channel: a notifier thread and one eventfd per QP.
+*/
+struct rdma_event_channel_t {
+  uint32_t* axil_ctl;       /*!< axil_ctl register file, the mapped BAR or an emulated copy. */
+  uint32_t num_qp;          /*!< num_qp highest QP ID served by the channel. */
+  int* qp_efd;              /*!< qp_efd eventfd of each QP, indexed by QP ID, -1 if not created. */
+  pthread_mutex_t lock;     /*!< lock serializes eventfd creation and CQ sink changes. */
+  uint32_t* cq_sinks[RDMA_EVENT_MAX_CQ_SINKS]; /*!< cq_sinks bitmaps of 8 words fed with the CQINTSTS1..8 bits. */
+  uint32_t num_cq_sinks;    /*!< num_cq_sinks number of registered CQ sinks. */
+  pthread_t thread;         /*!< thread notifier thread. */
+  volatile int running;     /*!< running notifier thread keeps running while set. */
+  uint32_t min_sleep_us;    /*!< min_sleep_us sleep of the notifier right after an event. */
+  uint32_t max_sleep_us;    /*!< max_sleep_us upper bound of the notifier sleep when idle. */
+  uint64_t num_events;      /*!< num_events number of QP events signaled. */
+  uint64_t num_scans;       /*!< num_scans number of interrupt status register scans. */
+};
+
+/** @brief Read the interrupt status registers.
+ *
+ *  INTSTS is read first and the 16 per-QP status words are only read when it
+ *  is non-zero.
+ *  @param axil_ctl register file, the mapped BAR or an emulated copy.
+ *  @param sts snapshot filled by the call.
+ *  @return 1 if any interrupt is pending, 0 otherwise.
+ */
+int rdma_read_int_status(uint32_t* axil_ctl, struct rdma_int_status_t* sts);
+
+/** @brief Clear the interrupt status bits of a snapshot by writing them back.
+ *  @param axil_ctl register file, the mapped BAR or an emulated copy.
+ *  @param sts snapshot returned by rdma_read_int_status().
+ *  @return void.
+ */
+void rdma_clear_int_status(uint32_t* axil_ctl, const struct rdma_int_status_t* sts);
+
+/** @brief Decode the QPs with a pending CQ or RQ interrupt from a snapshot.
+ *
+ *  The function only looks at sts, so it can be checked against hand-made
+ *  register values. QPs are reported in increasing QP ID order.
+ *  @param sts interrupt status snapshot.
+ *  @param events array of at least max_events entries filled by the call.
+ *  @param max_events maximum number of events to return.
+ *  @return Number of events returned.
+ */
+uint32_t rdma_decode_int_status(const struct rdma_int_status_t* sts,
+                                struct rdma_qp_event_t* events,
+                                uint32_t max_events);
+
+/** @brief Create an event channel.
+ *  @param axil_ctl register file, rdma_dev->axil_ctl or an emulated copy of
+ *                  RN_SCR_MAP_SIZE bytes.
+ *  @param num_qp highest QP ID served by the channel, at most RDMA_EVENT_MAX_QP.
+ *  @return a pointer to the event channel, NULL on failure.
+ */
+struct rdma_event_channel_t* rdma_create_event_channel(uint32_t* axil_ctl, uint32_t num_qp);
+
+/** @brief Start the notifier thread of an event channel.
+ *  @param ch a pointer to the event channel.
+ *  @return Success (0) or Failure (-1).
+ */
+int rdma_start_event_channel(struct rdma_event_channel_t* ch);
+
+/** @brief Get the eventfd signaled when a QP has a pending CQ or RQ interrupt.
+ *
+ *  The fd is non-blocking and can be added to poll/epoll. It is created on
+ *  first use and owned by the event channel.
+ *  @param ch a pointer to the event channel.
+ *  @param qpid A QP ID.
+ *  @return the eventfd, or -1 on failure.
+ */
+int rdma_get_event_fd(struct rdma_event_channel_t* ch, uint32_t qpid);
+
+/** @brief Register a CQ sink.
+ *
+ *  The notifier ORs the CQINTSTS1..8 bits it is about to clear into word w of
+ *  the sink with an atomic operation. The owner of the sink takes the bits
+ *  with __atomic_exchange_n(&bits[w], 0, ...).
+ *  @param ch a pointer to the event channel.
+ *  @param bits bitmap of 8 words, valid until rdma_event_remove_cq_sink().
+ *  @return Success (0) or Failure (-1) if RDMA_EVENT_MAX_CQ_SINKS sinks are
+ *          registered already.
+ */
+int rdma_event_add_cq_sink(struct rdma_event_channel_t* ch, uint32_t* bits);
+
+/** @brief Unregister a CQ sink added with rdma_event_add_cq_sink().
+ *  @param ch a pointer to the event channel.
+ *  @param bits the bitmap of the sink.
+ *  @return void.
+ */
+void rdma_event_remove_cq_sink(struct rdma_event_channel_t* ch, uint32_t* bits);
+
+/** @brief Block until a QP is signaled or the timeout expires.
+ *
+ *  Completions that arrived before the call are not reported twice, so
+ *  callers should poll their CQ/RQ first and only wait when it is empty. The
+ *  wakeup comes up to max_sleep_us after the completion, see the file comment.
+ *  @param ch a pointer to the event channel.
+ *  @param qpid A QP ID.
+ *  @param timeout_ms timeout in milliseconds, -1 waits forever.
+ *  @return Number of events consumed (> 0), 0 on timeout or -1 on failure.
+ */
+int rdma_wait_event(struct rdma_event_channel_t* ch, uint32_t qpid, int timeout_ms);
+
+/** @brief Stop the notifier thread, close every eventfd and free the channel.
+ *  @param ch a pointer to the event channel.
+ *  @return void.
+ */
+void rdma_destroy_event_channel(struct rdma_event_channel_t* ch);
+
+#endif /* __EVENT_API_H__ */
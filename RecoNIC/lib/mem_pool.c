@@ -0,0 +1,390 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file mem_pool.c
+ *  @brief Buddy and slab allocator of the host hugepage and device memory pools.
+ */
+
+#include "mem_pool.h"
+
+static void page_list_push(struct rn_mem_pool_t* pool, uint32_t* head, uint32_t page) {
+  pool->pages[page].prev = RN_MEM_NIL;
+  pool->pages[page].next = *head;
+  if(*head != RN_MEM_NIL) {
+    pool->pages[*head].prev = page;
+  }
+  *head = page;
+}
+
+static void page_list_remove(struct rn_mem_pool_t* pool, uint32_t* head, uint32_t page) {
+  struct rn_mem_page_t* p = &pool->pages[page];
+
+  if(p->prev != RN_MEM_NIL) {
+    pool->pages[p->prev].next = p->next;
+  } else {
+    *head = p->next;
+  }
+  if(p->next != RN_MEM_NIL) {
+    pool->pages[p->next].prev = p->prev;
+  }
+}
+
+static void push_free_block(struct rn_mem_pool_t* pool, uint32_t page, uint32_t order) {
+  pool->pages[page].state = RN_MEM_PAGE_FREE;
+  pool->pages[page].order = (uint8_t) order;
+  page_list_push(pool, &pool->free_head[order], page);
+  pool->free_bytes += ((uint64_t) 1) << (order + RN_MEM_PAGE_SHIFT);
+}
+
+static void remove_free_block(struct rn_mem_pool_t* pool, uint32_t page) {
+  uint32_t order = pool->pages[page].order;
+
+  page_list_remove(pool, &pool->free_head[order], page);
+  pool->pages[page].state = RN_MEM_PAGE_INNER;
+  pool->free_bytes -= ((uint64_t) 1) << (order + RN_MEM_PAGE_SHIFT);
+}
+
+/* Take a block of 2^order pages, splitting a larger one if needed */
+static uint32_t buddy_alloc(struct rn_mem_pool_t* pool, uint32_t order) {
+  uint32_t page;
+  uint32_t o;
+
+  for(o = order; o <= pool->max_order; o++) {
+    if(pool->free_head[o] != RN_MEM_NIL) {
+      break;
+    }
+  }
+  if(o > pool->max_order) {
+    return RN_MEM_NIL;
+  }
+  page = pool->free_head[o];
+  remove_free_block(pool, page);
+  // Give the upper halves back until the block has the requested order
+  while(o > order) {
+    o--;
+    push_free_block(pool, page + (1U << o), o);
+  }
+  pool->pages[page].state = RN_MEM_PAGE_USED;
+  pool->pages[page].order = (uint8_t) order;
+  return page;
+}
+
+/* Give a block back, merging it with its buddy as long as that one is free */
+static void buddy_free(struct rn_mem_pool_t* pool, uint32_t page, uint32_t order) {
+  uint32_t buddy;
+
+  pool->pages[page].state = RN_MEM_PAGE_INNER;
+  while(order < pool->max_order) {
+    buddy = page ^ (1U << order);
+    if((buddy >= pool->num_pages) || (pool->pages[buddy].state != RN_MEM_PAGE_FREE) ||
+       (pool->pages[buddy].order != order)) {
+      break;
+    }
+    remove_free_block(pool, buddy);
+    page = (page < buddy) ? page : buddy;
+    order++;
+  }
+  push_free_block(pool, page, order);
+}
+
+static uint32_t log2_ceil(uint64_t value) {
+  uint32_t shift = 0;
+
+  while((((uint64_t) 1) << shift) < value) {
+    shift++;
+  }
+  return shift;
+}
+
+static uint64_t used_bytes(struct rn_mem_pool_t* pool) {
+  return (((uint64_t) pool->num_pages) << RN_MEM_PAGE_SHIFT) - pool->free_bytes;
+}
+
+struct rn_mem_pool_t* rn_mem_pool_create(uint64_t size, uint32_t max_order, const uint32_t* span_contig) {
+  struct rn_mem_pool_t* pool;
+  uint32_t page;
+  uint32_t order;
+  uint32_t i;
+
+  if(((size >> RN_MEM_PAGE_SHIFT) == 0) || ((size >> RN_MEM_PAGE_SHIFT) >= RN_MEM_NIL) || (max_order > RN_MEM_MAX_ORDER)) {
+    fprintf(stderr, "Error: a memory pool of %ld bytes and order %d is not supported\n", size, max_order);
+    return NULL;
+  }
+
+  pool = (struct rn_mem_pool_t* ) calloc(1, sizeof(struct rn_mem_pool_t));
+  if(pool == NULL) {
+    fprintf(stderr, "Error: failed to allocate a memory pool\n");
+    return NULL;
+  }
+  pool->num_pages   = (uint32_t) (size >> RN_MEM_PAGE_SHIFT);
+  pool->max_order   = max_order;
+  pool->span_contig = span_contig;
+  // Pages that are never touched stay unbacked, so large pools cost little
+  pool->pages = (struct rn_mem_page_t* ) calloc(pool->num_pages, sizeof(struct rn_mem_page_t));
+  if(pool->pages == NULL) {
+    fprintf(stderr, "Error: failed to allocate a memory pool\n");
+    free(pool);
+    return NULL;
+  }
+  for(i = 0; i <= RN_MEM_MAX_ORDER; i++) {
+    pool->free_head[i] = RN_MEM_NIL;
+  }
+  for(i = 0; i < RN_MEM_NUM_CLASSES; i++) {
+    pool->slab_head[i] = RN_MEM_NIL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+
+  // Cover the pool with the largest aligned blocks that fit
+  page = 0;
+  while(page < pool->num_pages) {
+    order = max_order;
+    while((order > 0) && (((page & ((1U << order) - 1)) != 0) || (((uint64_t) page + (1U << order)) > pool->num_pages))) {
+      order--;
+    }
+    push_free_block(pool, page, order);
+    page += 1U << order;
+  }
+
+  return pool;
+}
+
+/* Serve a small request from a slab of its size class */
+static int slab_alloc(struct rn_mem_pool_t* pool, uint32_t shift, uint64_t* offset) {
+  uint32_t size_class = shift - RN_MEM_SLAB_MIN_SHIFT;
+  uint32_t num_obj = 1U << (RN_MEM_PAGE_SHIFT - shift);
+  uint32_t page;
+  uint32_t obj;
+
+  if(pool->slab_head[size_class] == RN_MEM_NIL) {
+    page = buddy_alloc(pool, 0);
+    if(page == RN_MEM_NIL) {
+      return -1;
+    }
+    pool->pages[page].state    = RN_MEM_PAGE_SLAB;
+    pool->pages[page].order    = (uint8_t) size_class;
+    pool->pages[page].slab_map = (num_obj == 32) ? 0xffffffff : ((1U << num_obj) - 1);
+    page_list_push(pool, &pool->slab_head[size_class], page);
+  }
+
+  page = pool->slab_head[size_class];
+  obj = (uint32_t) __builtin_ctz(pool->pages[page].slab_map);
+  pool->pages[page].slab_map &= ~(1U << obj);
+  if(pool->pages[page].slab_map == 0) {
+    page_list_remove(pool, &pool->slab_head[size_class], page);
+  }
+  *offset = (((uint64_t) page) << RN_MEM_PAGE_SHIFT) + (((uint64_t) obj) << shift);
+  return 0;
+}
+
+/* Serve a request larger than a block of max_order from consecutive free
+ * blocks of max_order that the hardware sees as one range.
+ */
+static int span_alloc(struct rn_mem_pool_t* pool, uint64_t size, uint32_t align_order, uint64_t* offset) {
+  uint32_t block_shift = pool->max_order + RN_MEM_PAGE_SHIFT;
+  uint32_t num_blocks = pool->num_pages >> pool->max_order;
+  uint64_t count = (size + (((uint64_t) 1) << block_shift) - 1) >> block_shift;
+  uint32_t start;
+  uint32_t i;
+
+  if((pool->span_contig == NULL) || (count > num_blocks)) {
+    return -1;
+  }
+  for(start = 0; start + count <= num_blocks; start++) {
+    if((pool->span_contig[start] < count) || (((start << pool->max_order) & ((1U << align_order) - 1)) != 0)) {
+      continue;
+    }
+    for(i = 0; i < count; i++) {
+      if((pool->pages[(start + i) << pool->max_order].state != RN_MEM_PAGE_FREE) ||
+         (pool->pages[(start + i) << pool->max_order].order != pool->max_order)) {
+        break;
+      }
+    }
+    if(i == count) {
+      for(i = 0; i < count; i++) {
+        remove_free_block(pool, (start + i) << pool->max_order);
+      }
+      pool->pages[start << pool->max_order].state    = RN_MEM_PAGE_SPAN;
+      pool->pages[start << pool->max_order].slab_map = (uint32_t) count;
+      *offset = ((uint64_t) start) << block_shift;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int rn_mem_pool_alloc(struct rn_mem_pool_t* pool, uint64_t size, uint64_t align, uint64_t* offset) {
+  uint32_t align_shift = (align > 1) ? log2_ceil(align) : 0;
+  uint32_t shift;
+  uint32_t page;
+  int rc = -1;
+
+  if((align & (align - 1)) != 0) {
+    fprintf(stderr, "Error: alignment %ld is not a power of two\n", align);
+    return -1;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if((size <= RN_MEM_SLAB_MAX) && (align <= RN_MEM_SLAB_MAX)) {
+    shift = log2_ceil((size > align) ? size : align);
+    if(shift < RN_MEM_SLAB_MIN_SHIFT) {
+      shift = RN_MEM_SLAB_MIN_SHIFT;
+    }
+    rc = slab_alloc(pool, shift, offset);
+  } else {
+    // Whole pages, aligned to the larger of the block size and align
+    shift = log2_ceil((size + (1U << RN_MEM_PAGE_SHIFT) - 1) >> RN_MEM_PAGE_SHIFT);
+    if(align_shift > RN_MEM_PAGE_SHIFT + shift) {
+      shift = align_shift - RN_MEM_PAGE_SHIFT;
+    }
+    if(shift <= pool->max_order) {
+      page = buddy_alloc(pool, shift);
+      if(page != RN_MEM_NIL) {
+        *offset = ((uint64_t) page) << RN_MEM_PAGE_SHIFT;
+        rc = 0;
+      }
+    } else {
+      rc = span_alloc(pool, size, (align_shift > RN_MEM_PAGE_SHIFT) ? (align_shift - RN_MEM_PAGE_SHIFT) : 0, offset);
+    }
+  }
+
+  if(rc == 0) {
+    pool->num_allocs++;
+    pool->requested_bytes += size;
+    if(used_bytes(pool) > pool->high_water) {
+      pool->high_water = used_bytes(pool);
+    }
+  } else {
+    pool->num_failures++;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return rc;
+}
+
+int rn_mem_pool_free(struct rn_mem_pool_t* pool, uint64_t offset, uint64_t size) {
+  uint32_t page = (uint32_t) (offset >> RN_MEM_PAGE_SHIFT);
+  struct rn_mem_page_t* p;
+  uint32_t shift;
+  uint32_t full;
+  uint32_t obj;
+  uint32_t i;
+  int rc = 0;
+
+  if((offset >> RN_MEM_PAGE_SHIFT) >= pool->num_pages) {
+    fprintf(stderr, "Error: offset 0x%lx is outside the memory pool\n", offset);
+    return -1;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  p = &pool->pages[page];
+  switch(p->state) {
+  case RN_MEM_PAGE_SLAB:
+    shift = p->order + RN_MEM_SLAB_MIN_SHIFT;
+    obj = (uint32_t) ((offset & ((1U << RN_MEM_PAGE_SHIFT) - 1)) >> shift);
+    full = (shift == RN_MEM_SLAB_MIN_SHIFT) ? 0xffffffff : ((1U << (1U << (RN_MEM_PAGE_SHIFT - shift))) - 1);
+    if(((offset & ((1U << shift) - 1)) != 0) || ((p->slab_map >> obj) & 1) || (size > (1U << shift))) {
+      rc = -1;
+      break;
+    }
+    if(p->slab_map == 0) {
+      // The slab was full, it has a free object again
+      page_list_push(pool, &pool->slab_head[p->order], page);
+    }
+    p->slab_map |= 1U << obj;
+    if(p->slab_map == full) {
+      // Empty slabs go back to the buddy allocator
+      page_list_remove(pool, &pool->slab_head[p->order], page);
+      p->slab_map = 0;
+      buddy_free(pool, page, 0);
+    }
+    break;
+  case RN_MEM_PAGE_USED:
+    if(((offset & ((1U << RN_MEM_PAGE_SHIFT) - 1)) != 0) || (size > (((uint64_t) 1) << (p->order + RN_MEM_PAGE_SHIFT)))) {
+      rc = -1;
+      break;
+    }
+    buddy_free(pool, page, p->order);
+    break;
+  case RN_MEM_PAGE_SPAN:
+    if(((offset & ((1U << RN_MEM_PAGE_SHIFT) - 1)) != 0) ||
+       (size > (((uint64_t) p->slab_map) << (pool->max_order + RN_MEM_PAGE_SHIFT)))) {
+      rc = -1;
+      break;
+    }
+    for(i = p->slab_map; i > 0; i--) {
+      buddy_free(pool, page + ((i - 1) << pool->max_order), pool->max_order);
+    }
+    p->slab_map = 0;
+    break;
+  default:
+    rc = -1;
+    break;
+  }
+
+  if(rc == 0) {
+    pool->num_frees++;
+    pool->requested_bytes -= size;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  if(rc < 0) {
+    fprintf(stderr, "Error: offset 0x%lx of %ld bytes is not an allocation of the memory pool\n", offset, size);
+  }
+  return rc;
+}
+
+void rn_mem_pool_stats(struct rn_mem_pool_t* pool, struct rn_mem_stats_t* stats) {
+  uint32_t num_blocks = pool->num_pages >> pool->max_order;
+  uint64_t run = 0;
+  uint32_t order;
+  uint32_t b;
+
+  pthread_mutex_lock(&pool->lock);
+  memset(stats, 0, sizeof(struct rn_mem_stats_t));
+  stats->pool_size       = ((uint64_t) pool->num_pages) << RN_MEM_PAGE_SHIFT;
+  stats->free_bytes      = pool->free_bytes;
+  stats->used_bytes      = used_bytes(pool);
+  stats->requested_bytes = pool->requested_bytes;
+  stats->high_water      = pool->high_water;
+  stats->num_allocs      = pool->num_allocs;
+  stats->num_frees       = pool->num_frees;
+  stats->num_failures    = pool->num_failures;
+
+  for(order = pool->max_order + 1; order > 0; order--) {
+    if(pool->free_head[order - 1] != RN_MEM_NIL) {
+      stats->largest_free = ((uint64_t) 1) << (order - 1 + RN_MEM_PAGE_SHIFT);
+      break;
+    }
+  }
+  // Free blocks of max_order next to each other also make one allocation
+  if(pool->span_contig != NULL) {
+    for(b = 0; b < num_blocks; b++) {
+      if((pool->pages[b << pool->max_order].state == RN_MEM_PAGE_FREE) &&
+         (pool->pages[b << pool->max_order].order == pool->max_order)) {
+        run = ((run != 0) && (pool->span_contig[b - 1] > 1)) ? (run + 1) : 1;
+        if((run << (pool->max_order + RN_MEM_PAGE_SHIFT)) > stats->largest_free) {
+          stats->largest_free = run << (pool->max_order + RN_MEM_PAGE_SHIFT);
+        }
+      } else {
+        run = 0;
+      }
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if(stats->used_bytes != 0) {
+    stats->internal_frag = (uint32_t) (((stats->used_bytes - stats->requested_bytes) * 100) / stats->used_bytes);
+  }
+  if(stats->free_bytes != 0) {
+    stats->external_frag = (uint32_t) (((stats->free_bytes - stats->largest_free) * 100) / stats->free_bytes);
+  }
+}
+
+void rn_mem_pool_destroy(struct rn_mem_pool_t* pool) {
+  if(pool != NULL) {
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->pages);
+    free(pool);
+  }
+}
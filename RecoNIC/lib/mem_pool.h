@@ -0,0 +1,175 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file mem_pool.h
+ *  @brief Buddy and slab allocator of the host hugepage and device memory pools.
+ *
+ *  A pool is a range of memory split into 4KB pages. Blocks of 2^order pages
+ *  are handed out by a buddy allocator and merged with their buddy when freed.
+ *  Requests of RN_MEM_SLAB_MAX bytes or less are served from slabs, 4KB pages
+ *  cut into objects of one size class, so that small rings do not take a
+ *  whole page each and never cross a page. A pool only deals in offsets from
+ *  its start, the caller turns them into addresses.
+ */
+
+#ifndef __MEM_POOL_H__
+#define __MEM_POOL_H__
+
+#include <pthread.h>
+#include "auxiliary.h"
+
+/*! \def RN_MEM_PAGE_SHIFT
+    \brief log2 of the page size of a pool, the smallest buddy block (4KB).
+*/
+#define RN_MEM_PAGE_SHIFT 12
+
+/*! \def RN_MEM_MAX_ORDER
+    \brief Largest buddy order a pool can be created with.
+*/
+#define RN_MEM_MAX_ORDER 24
+
+/*! \def RN_MEM_SLAB_MIN_SHIFT
+    \brief log2 of the smallest slab object size (128 bytes).
+*/
+#define RN_MEM_SLAB_MIN_SHIFT 7
+
+/*! \def RN_MEM_SLAB_MAX
+    \brief Largest request in bytes served from a slab.
+*/
+#define RN_MEM_SLAB_MAX 2048
+
+/*! \def RN_MEM_NUM_CLASSES
+    \brief Number of slab size classes: 128, 256, 512, 1024 and 2048 bytes.
+*/
+#define RN_MEM_NUM_CLASSES 5
+
+/*! \def RN_MEM_NIL
+    \brief End of a page list.
+*/
+#define RN_MEM_NIL 0xffffffff
+
+/*! \def RN_MEM_PAGE_INNER
+    \brief Page state: not the first page of a block.
+*/
+#define RN_MEM_PAGE_INNER 0
+
+/*! \def RN_MEM_PAGE_FREE
+    \brief Page state: first page of a free block of 2^order pages.
+*/
+#define RN_MEM_PAGE_FREE  1
+
+/*! \def RN_MEM_PAGE_USED
+    \brief Page state: first page of an allocated block of 2^order pages.
+*/
+#define RN_MEM_PAGE_USED  2
+
+/*! \def RN_MEM_PAGE_SLAB
+    \brief Page state: slab of size class order.
+*/
+#define RN_MEM_PAGE_SLAB  3
+
+/*! \def RN_MEM_PAGE_SPAN
+    \brief Page state: first page of an allocation of slab_map blocks of the
+    largest order.
+*/
+#define RN_MEM_PAGE_SPAN  4
+
+/*! \struct rn_mem_page_t
+    \brief Allocator state of a 4KB page of a pool.
+*/
+struct rn_mem_page_t {
+  uint32_t next;     /*!< next next page of the free list or of the partial slab list. */
+  uint32_t prev;     /*!< prev previous page of the free list or of the partial slab list. */
+  uint32_t slab_map; /*!< slab_map free objects of a slab, one bit each, or the number of
+                          blocks of a span. */
+  uint8_t  state;    /*!< state RN_MEM_PAGE_INNER ... RN_MEM_PAGE_SPAN. */
+  uint8_t  order;    /*!< order buddy order of the block, or size class of a slab. */
+};
+
+/*! \struct rn_mem_stats_t
+    \brief Usage and fragmentation of a pool.
+*/
+struct rn_mem_stats_t {
+  uint64_t pool_size;       /*!< pool_size size of the pool in bytes. */
+  uint64_t used_bytes;      /*!< used_bytes bytes taken by blocks and slabs. */
+  uint64_t requested_bytes; /*!< requested_bytes bytes asked for by the live allocations. */
+  uint64_t high_water;      /*!< high_water largest used_bytes seen. */
+  uint64_t free_bytes;      /*!< free_bytes bytes in free blocks. */
+  uint64_t largest_free;    /*!< largest_free largest allocation that can succeed now. */
+  uint64_t num_allocs;      /*!< num_allocs number of successful allocations. */
+  uint64_t num_frees;       /*!< num_frees number of frees. */
+  uint64_t num_failures;    /*!< num_failures number of allocations that failed. */
+  uint32_t internal_frag;   /*!< internal_frag percentage of used_bytes not requested. */
+  uint32_t external_frag;   /*!< external_frag percentage of free_bytes outside the largest free block. */
+};
+
+/*! \struct rn_mem_pool_t
+    \brief A memory pool managed by a buddy allocator with slabs for small requests.
+*/
+struct rn_mem_pool_t {
+  uint32_t num_pages;        /*!< num_pages number of 4KB pages of the pool. */
+  uint32_t max_order;        /*!< max_order largest buddy order. */
+  const uint32_t* span_contig; /*!< span_contig for each block of max_order, number of blocks
+                                    from it that are contiguous for the hardware, NULL if
+                                    requests larger than a block of max_order fail. */
+  struct rn_mem_page_t* pages; /*!< pages state of every page. */
+  uint32_t free_head[RN_MEM_MAX_ORDER + 1];   /*!< free_head first free block of each order. */
+  uint32_t slab_head[RN_MEM_NUM_CLASSES];     /*!< slab_head first slab with a free object of each class. */
+  uint64_t free_bytes;       /*!< free_bytes bytes in free blocks. */
+  uint64_t requested_bytes;  /*!< requested_bytes bytes asked for by the live allocations. */
+  uint64_t high_water;       /*!< high_water largest number of used bytes seen. */
+  uint64_t num_allocs;       /*!< num_allocs number of successful allocations. */
+  uint64_t num_frees;        /*!< num_frees number of frees. */
+  uint64_t num_failures;     /*!< num_failures number of allocations that failed. */
+  pthread_mutex_t lock;      /*!< lock serializes allocations and frees. */
+};
+
+/** @brief Create a pool.
+ *  @param size size of the pool in bytes, a multiple of 4KB.
+ *  @param max_order largest buddy order, blocks are at most 4KB << max_order.
+ *  @param span_contig for each block of max_order, how many blocks from it
+ *         on are contiguous, or NULL. The array must outlive the pool.
+ *  @return a pointer to the pool, or NULL on failure.
+ */
+struct rn_mem_pool_t* rn_mem_pool_create(uint64_t size, uint32_t max_order, const uint32_t* span_contig);
+
+/** @brief Allocate from a pool.
+ *
+ *  Requests of up to RN_MEM_SLAB_MAX bytes with an alignment of at most the
+ *  size class come from a slab. Larger ones take a buddy block of the next
+ *  power of two pages, at least align bytes, which is aligned to its size.
+ *  Requests larger than a block of max_order take consecutive blocks of
+ *  max_order within one span_contig run.
+ *  @param pool a pointer to the pool.
+ *  @param size size in bytes.
+ *  @param align alignment in bytes, a power of two, 0 for the default.
+ *  @param offset offset of the allocation from the start of the pool, set on success.
+ *  @return Success (0) or Failure (-1) if no free range is large enough.
+ */
+int rn_mem_pool_alloc(struct rn_mem_pool_t* pool, uint64_t size, uint64_t align, uint64_t* offset);
+
+/** @brief Return an allocation to a pool.
+ *  @param pool a pointer to the pool.
+ *  @param offset offset returned by rn_mem_pool_alloc().
+ *  @param size size passed to rn_mem_pool_alloc().
+ *  @return Success (0) or Failure (-1) if offset is not a live allocation.
+ */
+int rn_mem_pool_free(struct rn_mem_pool_t* pool, uint64_t offset, uint64_t size);
+
+/** @brief Get the usage and fragmentation of a pool.
+ *  @param pool a pointer to the pool.
+ *  @param stats statistics filled by the call.
+ *  @return void.
+ */
+void rn_mem_pool_stats(struct rn_mem_pool_t* pool, struct rn_mem_stats_t* stats);
+
+/** @brief Free a pool. Allocations from it become invalid.
+ *  @param pool a pointer to the pool.
+ *  @return void.
+ */
+void rn_mem_pool_destroy(struct rn_mem_pool_t* pool);
+
+#endif /* __MEM_POOL_H__ */
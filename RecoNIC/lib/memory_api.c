@@ -14,6 +14,8 @@
  */
 
 #include "memory_api.h"
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 ssize_t read_to_buffer(char *char_device, int fd, char *buffer, uint64_t size,
 			uint64_t dev_offset)
@@ -29,24 +31,9 @@ ssize_t read_to_buffer(char *char_device, int fd, char *buffer, uint64_t size,
 		if (bytes > RW_MAX_SIZE)
 			bytes = RW_MAX_SIZE;
 
-    rc = lseek(fd, offset, SEEK_SET);
-    if (rc < 0) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx failed %zd.\n",
-        char_device, offset, rc);
-      perror("seek file");
-      return -EIO;
-    }
-    if (rc != offset) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx != 0x%lx.\n",
-        char_device, rc, offset);
-      return -EIO;
-    }
-		
-
-		/* read data from file into memory buffer */
-		rc = read(fd, buf, bytes);
+		/* read data from file into memory buffer, pread() keeps the file offset
+		 * untouched so several threads can share fd */
+		rc = pread(fd, buf, bytes, offset);
 		if (rc < 0) {
 			fprintf(stderr,
 				"%s, read off 0x%lx + 0x%lx failed %zd.\n",
@@ -88,23 +75,9 @@ ssize_t write_from_buffer(char *char_device, int fd, char *buffer, uint64_t size
 		if (bytes > RW_MAX_SIZE)
 			bytes = RW_MAX_SIZE;
 
-    rc = lseek(fd, offset, SEEK_SET);
-    if (rc < 0) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx failed %zd.\n",
-        char_device, offset, rc);
-      perror("seek file");
-      return -EIO;
-    }
-    if (rc != offset) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx != 0x%lx.\n",
-        char_device, rc, offset);
-      return -EIO;
-    }
-
-		/* write data to file from memory buffer */
-		rc = write(fd, buf, bytes);
+		/* write data to file from memory buffer, pwrite() keeps the file offset
+		 * untouched so several threads can share fd */
+		rc = pwrite(fd, buf, bytes, offset);
 		if (rc < 0) {
 			fprintf(stderr, "%s, W off 0x%lx, 0x%lx failed %zd.\n",
 				char_device, offset, bytes, rc);
@@ -128,4 +101,283 @@ ssize_t write_from_buffer(char *char_device, int fd, char *buffer, uint64_t size
 		return -EIO;
 	}
 	return count;
-}
\ No newline at end of file
+}
+
+/* State of an io_uring context, the ring pointers point into the mappings
+ * shared with the kernel */
+struct rn_aio_ctx_t {
+	char *char_device;          /*!< char_device name of the character device, for messages. */
+	int dev_fd;                 /*!< dev_fd file descriptor of the character device. */
+	int ring_fd;                /*!< ring_fd file descriptor of the io_uring. */
+	uint32_t depth;             /*!< depth largest number of operations in flight, as requested. */
+	uint32_t inflight;          /*!< inflight operations submitted and not reaped yet. */
+	void *sq_ring;              /*!< sq_ring mapping of the submission ring. */
+	size_t sq_ring_size;        /*!< sq_ring_size size of the sq_ring mapping. */
+	void *cq_ring;              /*!< cq_ring mapping of the completion ring, may be sq_ring. */
+	size_t cq_ring_size;        /*!< cq_ring_size size of the cq_ring mapping. */
+	struct io_uring_sqe *sqes;  /*!< sqes submission queue entries. */
+	size_t sqes_size;           /*!< sqes_size size of the sqes mapping. */
+	uint32_t *sq_head;          /*!< sq_head SQ head, moved by the kernel. */
+	uint32_t *sq_tail;          /*!< sq_tail SQ tail, moved by the library. */
+	uint32_t sq_mask;           /*!< sq_mask index mask of the SQ. */
+	uint32_t *sq_array;         /*!< sq_array SQ slot to SQE index. */
+	uint32_t *cq_head;          /*!< cq_head CQ head, moved by the library. */
+	uint32_t *cq_tail;          /*!< cq_tail CQ tail, moved by the kernel. */
+	uint32_t cq_mask;           /*!< cq_mask index mask of the CQ. */
+	struct io_uring_cqe *cqes;  /*!< cqes completion queue entries. */
+};
+
+/* io_uring is used through its system calls so that libreconic does not
+ * depend on liburing */
+static int rn_io_uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int rn_io_uring_enter(int ring_fd, uint32_t to_submit,
+			uint32_t min_complete, uint32_t flags)
+{
+	return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit,
+			min_complete, flags, NULL, 0);
+}
+
+void rn_aio_destroy(struct rn_aio_ctx_t *ctx)
+{
+	struct rn_aio_op_t *done[64];
+
+	if (!ctx)
+		return;
+
+	/* The kernel still writes into the host buffers of operations in flight */
+	while (ctx->ring_fd >= 0 && ctx->inflight > 0) {
+		if (rn_aio_reap(ctx, done, 64, 1) < 0)
+			break;
+	}
+	if (ctx->sqes)
+		munmap(ctx->sqes, ctx->sqes_size);
+	if (ctx->cq_ring && ctx->cq_ring != ctx->sq_ring)
+		munmap(ctx->cq_ring, ctx->cq_ring_size);
+	if (ctx->sq_ring)
+		munmap(ctx->sq_ring, ctx->sq_ring_size);
+	if (ctx->ring_fd >= 0)
+		close(ctx->ring_fd);
+	free(ctx);
+}
+
+struct rn_aio_ctx_t* rn_aio_create(char *char_device, int fd, uint32_t depth)
+{
+	struct rn_aio_ctx_t *ctx;
+	struct io_uring_params p;
+
+	if (depth == 0 || depth > RN_AIO_MAX_DEPTH) {
+		fprintf(stderr, "Error: io_uring depth %u is not in 1..%d\n",
+			depth, RN_AIO_MAX_DEPTH);
+		return NULL;
+	}
+
+	ctx = (struct rn_aio_ctx_t *) calloc(1, sizeof(struct rn_aio_ctx_t));
+	if (!ctx) {
+		fprintf(stderr, "Error: failed to allocate the io_uring context\n");
+		return NULL;
+	}
+	ctx->char_device = char_device;
+	ctx->dev_fd = fd;
+
+	memset(&p, 0, sizeof(p));
+	ctx->ring_fd = rn_io_uring_setup(depth, &p);
+	if (ctx->ring_fd < 0) {
+		fprintf(stderr, "Error: io_uring_setup failed: %s\n",
+			strerror(errno));
+		ctx->ring_fd = -1;
+		rn_aio_destroy(ctx);
+		return NULL;
+	}
+	// The kernel rounds the ring up to a power of two, only the ring mappings
+	// use sq_entries
+	ctx->depth = depth;
+
+	ctx->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	ctx->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	/* Since 5.4 both rings share one mapping */
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ctx->cq_ring_size > ctx->sq_ring_size)
+			ctx->sq_ring_size = ctx->cq_ring_size;
+		ctx->cq_ring_size = ctx->sq_ring_size;
+	}
+	ctx->sq_ring = mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQ_RING);
+	if (ctx->sq_ring == MAP_FAILED) {
+		ctx->sq_ring = NULL;
+		goto map_failed;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ctx->cq_ring = ctx->sq_ring;
+	} else {
+		ctx->cq_ring = mmap(NULL, ctx->cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_CQ_RING);
+		if (ctx->cq_ring == MAP_FAILED) {
+			ctx->cq_ring = NULL;
+			goto map_failed;
+		}
+	}
+	ctx->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = (struct io_uring_sqe *) mmap(NULL, ctx->sqes_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ctx->ring_fd, IORING_OFF_SQES);
+	if (ctx->sqes == MAP_FAILED) {
+		ctx->sqes = NULL;
+		goto map_failed;
+	}
+
+	ctx->sq_head = (uint32_t *) ((char *) ctx->sq_ring + p.sq_off.head);
+	ctx->sq_tail = (uint32_t *) ((char *) ctx->sq_ring + p.sq_off.tail);
+	ctx->sq_mask = *(uint32_t *) ((char *) ctx->sq_ring + p.sq_off.ring_mask);
+	ctx->sq_array = (uint32_t *) ((char *) ctx->sq_ring + p.sq_off.array);
+	ctx->cq_head = (uint32_t *) ((char *) ctx->cq_ring + p.cq_off.head);
+	ctx->cq_tail = (uint32_t *) ((char *) ctx->cq_ring + p.cq_off.tail);
+	ctx->cq_mask = *(uint32_t *) ((char *) ctx->cq_ring + p.cq_off.ring_mask);
+	ctx->cqes = (struct io_uring_cqe *) ((char *) ctx->cq_ring + p.cq_off.cqes);
+	return ctx;
+
+map_failed:
+	fprintf(stderr, "Error: failed to map the io_uring rings: %s\n",
+		strerror(errno));
+	rn_aio_destroy(ctx);
+	return NULL;
+}
+
+int rn_aio_submit(struct rn_aio_ctx_t *ctx, struct rn_aio_op_t *ops, uint32_t num_ops)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t first = *ctx->sq_tail;
+	uint32_t tail = first;
+	uint32_t queued = 0;
+	uint32_t submitted = 0;
+	uint32_t index;
+	int rc;
+
+	/* The CQ has twice as many entries as the SQ, bounding the operations
+	 * in flight by the SQ size keeps it from overflowing */
+	while (queued < num_ops && ctx->inflight + queued < ctx->depth) {
+		if (ops[queued].len > RW_MAX_SIZE) {
+			fprintf(stderr, "Error: %s, transfer of 0x%lx bytes is larger than 0x%x\n",
+				ctx->char_device, ops[queued].len, RW_MAX_SIZE);
+			if (queued == 0)
+				return -1;
+			break;
+		}
+		index = tail & ctx->sq_mask;
+		sqe = &ctx->sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = (ops[queued].dir == RN_AIO_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+		sqe->fd = ctx->dev_fd;
+		sqe->addr = (uint64_t) ops[queued].host_buf;
+		sqe->len = (uint32_t) ops[queued].len;
+		sqe->off = ops[queued].dev_addr & DEVICE_MEMORY_ADDRESS_MASK;
+		sqe->user_data = (uint64_t) &ops[queued];
+		ctx->sq_array[index] = index;
+		tail++;
+		queued++;
+	}
+	if (queued == 0)
+		return 0;
+
+	/* Publish the SQEs before the new tail */
+	__atomic_store_n(ctx->sq_tail, tail, __ATOMIC_RELEASE);
+	while (submitted < queued) {
+		rc = rn_io_uring_enter(ctx->ring_fd, queued - submitted, 0, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error: %s, io_uring_enter failed: %s\n",
+				ctx->char_device, strerror(errno));
+			/* Take back the SQEs the kernel did not consume, the
+			 * caller submits those operations again */
+			__atomic_store_n(ctx->sq_tail, first + submitted,
+					__ATOMIC_RELEASE);
+			ctx->inflight += submitted;
+			return (submitted > 0) ? (int) submitted : -1;
+		}
+		submitted += (uint32_t) rc;
+	}
+	ctx->inflight += submitted;
+	return (int) submitted;
+}
+
+int rn_aio_reap(struct rn_aio_ctx_t *ctx, struct rn_aio_op_t **done, uint32_t max_ops, uint32_t min_complete)
+{
+	struct io_uring_cqe *cqe;
+	struct rn_aio_op_t *op;
+	uint32_t head = *ctx->cq_head;
+	uint32_t tail;
+	uint32_t reaped = 0;
+
+	if (min_complete > ctx->inflight)
+		min_complete = ctx->inflight;
+	if (min_complete > max_ops)
+		min_complete = max_ops;
+
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	if (tail - head < min_complete) {
+		while (rn_io_uring_enter(ctx->ring_fd, 0, min_complete,
+					IORING_ENTER_GETEVENTS) < 0) {
+			if (errno != EINTR) {
+				fprintf(stderr, "Error: %s, io_uring_enter failed: %s\n",
+					ctx->char_device, strerror(errno));
+				return -1;
+			}
+		}
+		tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	while (head != tail && reaped < max_ops) {
+		cqe = &ctx->cqes[head & ctx->cq_mask];
+		op = (struct rn_aio_op_t *) cqe->user_data;
+		op->result = cqe->res;
+		done[reaped++] = op;
+		head++;
+	}
+	/* Give the CQEs back to the kernel in one store */
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+	ctx->inflight -= reaped;
+	return (int) reaped;
+}
+
+int rn_aio_run(struct rn_aio_ctx_t *ctx, struct rn_aio_op_t *ops, uint32_t num_ops)
+{
+	struct rn_aio_op_t *done[64];
+	uint32_t next = 0;
+	uint32_t completed = 0;
+	uint32_t i;
+	int failed = 0;
+	int rc;
+
+	while (completed < num_ops) {
+		if (next < num_ops && !failed) {
+			rc = rn_aio_submit(ctx, &ops[next], num_ops - next);
+			if (rc < 0) {
+				/* Nothing more is submitted, reap what is in flight */
+				failed = 1;
+				num_ops = next;
+				continue;
+			}
+			next += (uint32_t) rc;
+		}
+		if (ctx->inflight == 0)
+			break;
+		rc = rn_aio_reap(ctx, done, 64, 1);
+		if (rc < 0)
+			return -EIO;
+		for (i = 0; i < (uint32_t) rc; i++) {
+			if (done[i]->result != (ssize_t) done[i]->len) {
+				fprintf(stderr, "%s, %s off 0x%lx, 0x%lx != 0x%lx.\n",
+					ctx->char_device,
+					(done[i]->dir == RN_AIO_READ) ? "R" : "W",
+					done[i]->dev_addr, done[i]->result, done[i]->len);
+				failed = 1;
+			}
+		}
+		completed += (uint32_t) rc;
+	}
+	return failed ? -EIO : 0;
+}
@@ -53,4 +53,87 @@ ssize_t read_to_buffer(char *char_device, int fd, char *buffer, uint64_t size, u
  */
 ssize_t write_from_buffer(char *char_device, int fd, char *buffer, uint64_t size, uint64_t base);
 
+/*! \def RN_AIO_READ
+    \brief Direction of an asynchronous operation: device memory to host buffer.
+*/
+#define RN_AIO_READ  0
+
+/*! \def RN_AIO_WRITE
+    \brief Direction of an asynchronous operation: host buffer to device memory.
+*/
+#define RN_AIO_WRITE 1
+
+/*! \def RN_AIO_MAX_DEPTH
+    \brief Largest number of asynchronous operations in flight on one context.
+*/
+#define RN_AIO_MAX_DEPTH 4096
+
+/*! \struct rn_aio_op_t
+    \brief One asynchronous transfer between a host buffer and the device memory.
+*/
+struct rn_aio_op_t {
+  char *host_buf;    /*!< host_buf host buffer to read into or write from. */
+  uint64_t dev_addr; /*!< dev_addr address of the device memory. */
+  uint64_t len;      /*!< len size of the transfer in bytes, at most RW_MAX_SIZE. */
+  uint8_t dir;       /*!< dir RN_AIO_READ or RN_AIO_WRITE. */
+  ssize_t result;    /*!< result bytes transferred or -errno, set when the operation is reaped. */
+  void *user_data;   /*!< user_data left untouched for the caller. */
+};
+
+/*! \struct rn_aio_ctx_t
+    \brief An io_uring instance issuing positional reads and writes on the
+    device memory character device. Its layout is private to memory_api.c.
+*/
+struct rn_aio_ctx_t;
+
+/** @brief Create an io_uring context for asynchronous device memory transfers.
+ *
+ *  The QDMA MM driver blocks for the whole transfer, so io_uring runs each
+ *  operation on one of its worker threads. Up to depth independent
+ *  transfers are then in flight at once.
+ *  @param char_device Name of the character device, for messages.
+ *  @param fd File descriptor of the char_device.
+ *  @param depth Largest number of operations in flight, at most RN_AIO_MAX_DEPTH.
+ *  @return a pointer to the context, or NULL if io_uring is not available.
+ */
+struct rn_aio_ctx_t* rn_aio_create(char *char_device, int fd, uint32_t depth);
+
+/** @brief Queue operations and submit them with one system call.
+ *
+ *  Operations are queued while the context has free slots.
+ *  @param ctx a pointer to the context.
+ *  @param ops operations to submit, they must stay valid until reaped.
+ *  @param num_ops number of operations.
+ *  @return Number of operations submitted, which may be less than num_ops,
+ *          or -1 on failure.
+ */
+int rn_aio_submit(struct rn_aio_ctx_t *ctx, struct rn_aio_op_t *ops, uint32_t num_ops);
+
+/** @brief Reap completed operations.
+ *
+ *  Waits in one system call until at least min_complete operations have
+ *  completed, then takes every available completion up to max_ops. The
+ *  result field of each reaped operation is set.
+ *  @param ctx a pointer to the context.
+ *  @param done filled with the operations reaped.
+ *  @param max_ops size of done.
+ *  @param min_complete number of completions to wait for, 0 to poll.
+ *  @return Number of operations reaped, or -1 on failure.
+ */
+int rn_aio_reap(struct rn_aio_ctx_t *ctx, struct rn_aio_op_t **done, uint32_t max_ops, uint32_t min_complete);
+
+/** @brief Run a batch of operations, keeping the context full until all are done.
+ *  @param ctx a pointer to the context.
+ *  @param ops operations to run.
+ *  @param num_ops number of operations.
+ *  @return Success (0) or -EIO if an operation failed or was short.
+ */
+int rn_aio_run(struct rn_aio_ctx_t *ctx, struct rn_aio_op_t *ops, uint32_t num_ops);
+
+/** @brief Wait for the operations in flight and free a context.
+ *  @param ctx a pointer to the context.
+ *  @return void.
+ */
+void rn_aio_destroy(struct rn_aio_ctx_t *ctx);
+
 #endif /* __MEMORY_API_H__ */
\ No newline at end of file
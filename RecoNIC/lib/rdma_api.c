@@ -10,6 +10,10 @@
 
 #include "rdma_api.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 struct rdma_dev_t* create_rdma_dev(struct rn_dev_t* rn_dev) {
     int i;
     uint32_t num_qp;
@@ -27,6 +31,20 @@ struct rdma_dev_t* create_rdma_dev(struct rn_dev_t* rn_dev) {
     rdma_dev->winSize = rn_dev->winSize;
     rdma_dev->rn_dev = rn_dev;
     rdma_dev->num_qp = rn_dev->num_qp;
+
+    memset(&rdma_dev->csr_shadow, 0, sizeof(struct rdma_csr_shadow_t));
+    rdma_dev->csr_shadow.qp_csr = (uint32_t* ) calloc(num_qp * RDMA_QP_CSR_WORDS, sizeof(uint32_t));
+    rdma_dev->csr_shadow.qp_valid = (uint64_t* ) calloc(num_qp, sizeof(uint64_t));
+    if((rdma_dev->csr_shadow.qp_csr == NULL) || (rdma_dev->csr_shadow.qp_valid == NULL)) {
+      fprintf(stderr, "Error: failed to allocate the CSR shadow\n");
+      exit(EXIT_FAILURE);
+    }
+    memset(rdma_dev->mr_table, 0, sizeof(rdma_dev->mr_table));
+    memset(rdma_dev->mr_entry_busy, 0, sizeof(rdma_dev->mr_entry_busy));
+    memset(rdma_dev->mr_r_key, 0, sizeof(rdma_dev->mr_r_key));
+    memset(rdma_dev->mr_r_key_valid, 0, sizeof(rdma_dev->mr_r_key_valid));
+    rdma_dev->next_r_key = RDMA_MR_CACHE_FIRST_R_KEY;
+    rdma_dev->rq_scratch = NULL;
     rn_dev->rdma_dev = (void* ) rdma_dev;
 
     return rdma_dev;
@@ -39,6 +57,7 @@ void open_rdma_dev(struct rdma_dev_t* rdma_dev, struct mac_addr_t local_mac,
                    uint16_t num_err_buf, uint16_t per_err_buf_size, 
                    uint64_t err_buf_baseaddr, uint64_t resp_err_pkt_buf_size, 
                    uint64_t resp_err_pkt_buf_baseaddr) {
+  uint64_t open_start_ns = get_time_ns();
   uint32_t xrnic_conf;
   uint32_t xrnic_advanced_conf;
   uint32_t en_ernic;
@@ -119,7 +138,119 @@ void open_rdma_dev(struct rdma_dev_t* rdma_dev, struct mac_addr_t local_mac,
   rdma_global_config->xrnic_advanced_conf = xrnic_advanced_conf;
 
   config_rdma_global_csr(rdma_dev);
+  rdma_dev->rn_dev->timing.rdma_open_ns = get_time_ns() - open_start_ns;
   fprintf(stderr, "Info: rdma_dev opened\n");
+  print_rn_dev_timing(rdma_dev->rn_dev);
+}
+
+uint32_t get_rdma_per_q_config_addr(uint32_t offset, uint32_t qpid) {
+  return offset + 0x100 * (qpid-1);
+}
+
+uint32_t get_rdma_pd_config_addr(uint32_t offset, uint32_t pd_num) {
+  return offset + 0x100 * pd_num;
+}
+
+/* Per-queue registers that only software writes, bit i stands for the
+ * register at RN_RDMA_QCSR_QPCONFi + 4*i. Doorbells, PSNs and status registers
+ * are changed by the hardware and are never cached.
+ */
+#define RDMA_QP_CSR_CACHED ((1ULL << 0)  | (1ULL << 1)  | (1ULL << 2)  | (1ULL << 4)  | \
+                            (1ULL << 6)  | (1ULL << 8)  | (1ULL << 9)  | (1ULL << 10) | \
+                            (1ULL << 11) | (1ULL << 15) | (1ULL << 18) | (1ULL << 20) | \
+                            (1ULL << 21) | (1ULL << 24) | (1ULL << 25) | (1ULL << 26) | \
+                            (1ULL << 27) | (1ULL << 44) | (1ULL << 48) | (1ULL << 50) | \
+                            (1ULL << 52))
+
+/* Write a per-queue register unless the shadow says it already holds value. */
+static void write_qp_csr(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t reg, uint32_t value) {
+  struct rdma_csr_shadow_t* shadow = &rdma_dev->csr_shadow;
+  uint32_t idx = (reg - (RN_RDMA_QCSR_QPCONFi)) >> 2;
+  uint64_t bit = 1ULL << idx;
+  uint32_t* word;
+
+  if((qpid < rdma_dev->num_qp) && (RDMA_QP_CSR_CACHED & bit)) {
+    word = &shadow->qp_csr[qpid * RDMA_QP_CSR_WORDS + idx];
+    if((shadow->qp_valid[qpid] & bit) && (*word == value)) {
+      shadow->writes_skipped++;
+      return;
+    }
+    *word = value;
+    shadow->qp_valid[qpid] |= bit;
+  }
+
+  shadow->writes++;
+  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(reg, qpid), value);
+  Debug("[Register] 0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(reg, qpid), qpid, value);
+}
+
+/* Read a per-queue register, from the shadow when its value is known. */
+static uint32_t read_qp_csr(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t reg) {
+  struct rdma_csr_shadow_t* shadow = &rdma_dev->csr_shadow;
+  uint32_t idx = (reg - (RN_RDMA_QCSR_QPCONFi)) >> 2;
+  uint64_t bit = 1ULL << idx;
+  uint32_t value;
+
+  if((qpid < rdma_dev->num_qp) && (RDMA_QP_CSR_CACHED & bit) && (shadow->qp_valid[qpid] & bit)) {
+    shadow->reads_saved++;
+    return shadow->qp_csr[qpid * RDMA_QP_CSR_WORDS + idx];
+  }
+
+  value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(reg, qpid));
+  if((qpid < rdma_dev->num_qp) && (RDMA_QP_CSR_CACHED & bit)) {
+    shadow->qp_csr[qpid * RDMA_QP_CSR_WORDS + idx] = value;
+    shadow->qp_valid[qpid] |= bit;
+  }
+  return value;
+}
+
+/* Write a protection domain register unless the shadow says it already holds value. */
+static void write_pd_csr(struct rdma_dev_t* rdma_dev, uint32_t pd_num, uint32_t reg, uint32_t value) {
+  struct rdma_csr_shadow_t* shadow = &rdma_dev->csr_shadow;
+  uint32_t idx = (reg - (RN_RDMA_PDT_PDPDNUM)) >> 2;
+
+  if(pd_num < RDMA_CSR_SHADOW_NUM_PD) {
+    if((shadow->pd_valid[pd_num] & (1U << idx)) && (shadow->pd_csr[pd_num][idx] == value)) {
+      shadow->writes_skipped++;
+      return;
+    }
+    shadow->pd_csr[pd_num][idx] = value;
+    shadow->pd_valid[pd_num] |= (uint8_t) (1U << idx);
+  }
+
+  shadow->writes++;
+  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(reg, pd_num), value);
+  Debug("[Register] 0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(reg, pd_num), pd_num, value);
+}
+
+/* XRNICADCONF is only written by the library, keep its value at hand for the
+ * read-modify-write sequences of QP teardown and recovery.
+ */
+static uint32_t read_xrnic_adconf(struct rdma_dev_t* rdma_dev) {
+  struct rdma_csr_shadow_t* shadow = &rdma_dev->csr_shadow;
+
+  if(shadow->xrnic_adconf_valid) {
+    shadow->reads_saved++;
+    return shadow->xrnic_adconf;
+  }
+  shadow->xrnic_adconf = read32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF);
+  shadow->xrnic_adconf_valid = 1;
+  return shadow->xrnic_adconf;
+}
+
+static void write_xrnic_adconf(struct rdma_dev_t* rdma_dev, uint32_t value) {
+  rdma_dev->csr_shadow.xrnic_adconf = value;
+  rdma_dev->csr_shadow.xrnic_adconf_valid = 1;
+  rdma_dev->csr_shadow.writes++;
+  write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF, value);
+}
+
+void rdma_csr_shadow_invalidate(struct rdma_dev_t* rdma_dev) {
+  struct rdma_csr_shadow_t* shadow = &rdma_dev->csr_shadow;
+
+  memset(shadow->qp_valid, 0, rdma_dev->num_qp * sizeof(uint64_t));
+  memset(shadow->pd_valid, 0, sizeof(shadow->pd_valid));
+  shadow->xrnic_adconf_valid = 0;
 }
 
 void config_rdma_global_csr (struct rdma_dev_t* rdma_dev) {
@@ -229,18 +360,86 @@ void config_rdma_global_csr (struct rdma_dev_t* rdma_dev) {
   write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICCONF, global_csr->xrnic_conf);
   Debug("[Register] RN_RDMA_GCSR_XRNICCONF=0x%x, value=0x%x\n", RN_RDMA_GCSR_XRNICCONF, global_csr->xrnic_conf);
 
-  write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF, global_csr->xrnic_advanced_conf);
+  write_xrnic_adconf(rdma_dev, global_csr->xrnic_advanced_conf);
   Debug("[Register] RN_RDMA_GCSR_XRNICADCONF=0x%x, value=0x%x\n", RN_RDMA_GCSR_XRNICADCONF, global_csr->xrnic_advanced_conf);
 
   fprintf(stderr, "Info: RDMA global control status registers are configured.\n");
 }
 
-uint32_t get_rdma_per_q_config_addr(uint32_t offset, uint32_t qpid) {
-  return offset + 0x100 * (qpid-1);
+/* Write one entry of the PD table. The entry index and the PD number are the
+ * same for the region registered by rdma_register_memory_region().
+ */
+static void write_mr_entry(struct rdma_dev_t* rdma_dev, uint32_t index, uint32_t pd_num,
+                           uint64_t vaddr, uint64_t dma_addr, uint64_t length,
+                           uint32_t r_key, uint16_t access) {
+  uint32_t dma_addr_lsb;
+  uint32_t dma_addr_msb;
+
+  if(is_device_address(dma_addr)) {
+    // Buffer in device memory
+    dma_addr_lsb = (uint32_t) (dma_addr & 0x00000000ffffffff);
+    dma_addr_msb = (uint32_t) ((dma_addr >> 32) & 0x00000000ffffffff);
+  } else {
+    // Buffer in host memory
+    dma_addr_lsb = (uint32_t) (dma_addr & 0x00000000ffffffff & rdma_dev->winSize->win_size_lsb);
+    dma_addr_msb = (uint32_t) ((dma_addr >> 32) & 0x00000000ffffffff & rdma_dev->winSize->win_size_msb);
+  }
+
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_PDPDNUM, pd_num);
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_VIRTADDRLSB, (uint32_t) (vaddr & 0x00000000ffffffff));
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_VIRTADDRMSB, (uint32_t) ((vaddr >> 32) & 0x00000000ffffffff));
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_BUFBASEADDRLSB, dma_addr_lsb);
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_BUFBASEADDRMSB, dma_addr_msb);
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_BUFRKEY, r_key);
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_WRRDBUFLEN, (uint32_t) (length & 0x00000000ffffffff));
+  write_pd_csr(rdma_dev, index, RN_RDMA_PDT_ACCESSDESC,
+               ((uint32_t) (((length >> 32) & 0x0000ffff) << 16)) | access);
+  if(index < RDMA_MR_TABLE_SIZE) {
+    rdma_dev->mr_r_key[index] = r_key;
+    rdma_dev->mr_r_key_valid[index] = 1;
+  }
 }
 
-uint32_t get_rdma_pd_config_addr(uint32_t offset, uint32_t pd_num) {
-  return offset + 0x100 * pd_num;
+/* Return 1 if a PD table entry other than skip_index grants access with r_key.
+ * rdma_register_memory_region(), rdma_reg_mr() and the registration cache
+ * share one r_key namespace, and the ERNIC only compares its low 8 bits.
+ */
+static int mr_r_key_in_use(struct rdma_dev_t* rdma_dev, uint32_t r_key, uint32_t skip_index) {
+  uint32_t i;
+
+  for(i = 0; i < RDMA_MR_TABLE_SIZE; i++) {
+    if((i != skip_index) && rdma_dev->mr_r_key_valid[i] && ((rdma_dev->mr_r_key[i] & RDMA_R_KEY_MASK) == (r_key & RDMA_R_KEY_MASK))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Hand out the next r_key that no region uses, -1 if all of them are taken */
+static int alloc_mr_r_key(struct rdma_dev_t* rdma_dev) {
+  uint32_t r_key;
+  uint32_t i;
+
+  for(i = 0; i <= RDMA_R_KEY_MASK; i++) {
+    r_key = rdma_dev->next_r_key;
+    rdma_dev->next_r_key = (rdma_dev->next_r_key + 1) & RDMA_R_KEY_MASK;
+    if(!mr_r_key_in_use(rdma_dev, r_key, RDMA_MR_TABLE_SIZE)) {
+      return (int) r_key;
+    }
+  }
+  fprintf(stderr, "Error: all %d r_keys are in use\n", RDMA_R_KEY_MASK + 1);
+  return -1;
+}
+
+static int find_free_mr_entry(struct rdma_dev_t* rdma_dev) {
+  uint32_t i;
+
+  for(i = 0; i < RDMA_MR_TABLE_SIZE; i++) {
+    if(!rdma_dev->mr_entry_busy[i]) {
+      return (int) i;
+    }
+  }
+  return -1;
 }
 
 struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num) {
@@ -250,8 +449,11 @@ struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num)
     rdma_pd = (struct rdma_pd_t* ) malloc(sizeof(struct rdma_pd_t));
     rdma_pd->pd_num = pd_num;
     rdma_pd->pd_access_type = 2 & 0x0000ffff;
-    write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_PDPDNUM, pd_num), pd_num);
-    Debug("[Register] RN_RDMA_PDT_PDPDNUM=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_PDPDNUM, pd_num), pd_num, pd_num);
+    write_pd_csr(rdma_dev, pd_num, RN_RDMA_PDT_PDPDNUM, pd_num);
+    // The entry of the PD number is kept for rdma_register_memory_region()
+    if(pd_num < RDMA_MR_TABLE_SIZE) {
+      rdma_dev->mr_entry_busy[pd_num] = 1;
+    }
 
     //rdma_pd->mr_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
     rdma_pd->mr_buffer = NULL;
@@ -266,7 +468,6 @@ struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num)
 void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, uint32_t r_key, struct rdma_buff_t* rdma_buf) {
   uint32_t pd_num;
   uint64_t buffer_size;
-  uint32_t access_config;
 
   uint32_t win_size_low  = rdma_dev->winSize->win_size_lsb;
   uint32_t win_size_high = rdma_dev->winSize->win_size_msb;
@@ -307,31 +508,257 @@ void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t*
   rdma_pd->buffer_size_msb = (uint32_t) ((buffer_size>>32) & 0x00000000ffffffff);
   rdma_pd->r_key = r_key;
 
+  if(mr_r_key_in_use(rdma_dev, r_key, pd_num)) {
+    fprintf(stderr, "Error: r_key 0x%x is already used by another memory region\n", r_key);
+    exit(EXIT_FAILURE);
+  }
+
   if(rdma_dev->axil_ctl == 0) {
     fprintf(stderr, "Error: rdma_dev->axil_ctl=0x%lx is not valid!\n", (uint64_t) rdma_dev->axil_ctl);
     exit(EXIT_FAILURE);
   }
 
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_VIRTADDRLSB, pd_num), rdma_pd->virtual_addr_lsb);
-  Debug("[Register] RN_RDMA_PDT_VIRTADDRLSB=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_VIRTADDRLSB, pd_num), pd_num, rdma_pd->virtual_addr_lsb);
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_VIRTADDRMSB, pd_num), rdma_pd->virtual_addr_msb);
-  Debug("[Register] RN_RDMA_PDT_VIRTADDRMSB=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_VIRTADDRMSB, pd_num), pd_num, rdma_pd->virtual_addr_msb);
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_BUFBASEADDRLSB, pd_num), rdma_pd->dma_addr_lsb);
-  Debug("[Register] RN_RDMA_PDT_BUFBASEADDRLSB=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_BUFBASEADDRLSB, pd_num), pd_num, rdma_pd->dma_addr_lsb);
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_BUFBASEADDRMSB, pd_num), rdma_pd->dma_addr_msb);
-  Debug("[Register] RN_RDMA_PDT_BUFBASEADDRMSB=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_BUFBASEADDRMSB, pd_num), pd_num, rdma_pd->dma_addr_msb);
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_BUFRKEY, pd_num), r_key);
-  Debug("[Register] RN_RDMA_PDT_BUFRKEY=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_BUFRKEY, pd_num), pd_num, r_key);
-
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_WRRDBUFLEN, pd_num), buffer_size);
-  Debug("[Register] RN_RDMA_PDT_WRRDBUFLEN=0x%x, pd_num=%d, value=0x%lx B\n", get_rdma_pd_config_addr(RN_RDMA_PDT_WRRDBUFLEN, pd_num), pd_num, buffer_size);
-  access_config = ((rdma_pd->buffer_size_msb<<16) | rdma_pd->pd_access_type);
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_ACCESSDESC, pd_num), access_config);
-  Debug("[Register] RN_RDMA_PDT_ACCESSDESC=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_ACCESSDESC, pd_num), pd_num, access_config);
+  write_mr_entry(rdma_dev, pd_num, pd_num, (uint64_t) rdma_pd->mr_buffer->buffer,
+                 rdma_pd->mr_buffer->dma_addr, buffer_size, r_key, rdma_pd->pd_access_type);
 
   fprintf(stderr, "Info: memory region for the %d-th PD is registered\n", pd_num);
 }
 
+struct rdma_mr_t* rdma_reg_mr(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd,
+                              struct rdma_buff_t* rdma_buf, uint64_t offset, uint64_t length,
+                              uint32_t r_key, uint16_t access) {
+  struct rdma_mr_t* mr;
+  int index;
+
+  if(rdma_dev == NULL || rdma_pd == NULL || rdma_buf == NULL) {
+    fprintf(stderr, "Error: rdma_dev, rdma_pd or rdma_buf is NULL\n");
+    return NULL;
+  }
+  if((length == 0) || (offset + length > (uint64_t) rdma_buf->buf_size) || (access > RDMA_ACCESS_READ_WRITE)) {
+    fprintf(stderr, "Error: invalid memory region, offset = 0x%lx, length = 0x%lx, access = %d\n", offset, length, access);
+    return NULL;
+  }
+  if(mr_r_key_in_use(rdma_dev, r_key, RDMA_MR_TABLE_SIZE)) {
+    fprintf(stderr, "Error: r_key 0x%x is already used by another memory region\n", r_key);
+    return NULL;
+  }
+  index = find_free_mr_entry(rdma_dev);
+  if(index < 0) {
+    fprintf(stderr, "Error: the memory region table is full\n");
+    return NULL;
+  }
+
+  mr = (struct rdma_mr_t* ) calloc(1, sizeof(struct rdma_mr_t));
+  if(mr == NULL) {
+    fprintf(stderr, "Error: failed to allocate a memory region\n");
+    exit(EXIT_FAILURE);
+  }
+  mr->rdma_dev = rdma_dev;
+  mr->pd       = rdma_pd;
+  mr->buf      = rdma_buf;
+  mr->index    = (uint32_t) index;
+  mr->r_key    = r_key;
+  mr->vaddr    = ((uint64_t) rdma_buf->buffer) + offset;
+  mr->dma_addr = rdma_buf->dma_addr + offset;
+  mr->length   = length;
+  mr->access   = access;
+
+  write_mr_entry(rdma_dev, mr->index, rdma_pd->pd_num, mr->vaddr, mr->dma_addr, mr->length, r_key, access);
+  rdma_dev->mr_entry_busy[index] = 1;
+  rdma_dev->mr_table[index] = mr;
+
+  Debug("DEBUG: memory region %d registered, pd_num=%d, r_key=0x%x, vaddr=0x%lx, length=0x%lx\n",
+        index, rdma_pd->pd_num, r_key, mr->vaddr, length);
+  return mr;
+}
+
+static void mr_cache_unlink(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr) {
+  if(mr->lru_prev != NULL) {
+    mr->lru_prev->lru_next = mr->lru_next;
+  } else {
+    cache->lru_head = mr->lru_next;
+  }
+  if(mr->lru_next != NULL) {
+    mr->lru_next->lru_prev = mr->lru_prev;
+  } else {
+    cache->lru_tail = mr->lru_prev;
+  }
+  mr->lru_prev = NULL;
+  mr->lru_next = NULL;
+}
+
+static void mr_cache_push_front(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr) {
+  mr->lru_prev = NULL;
+  mr->lru_next = cache->lru_head;
+  if(cache->lru_head != NULL) {
+    cache->lru_head->lru_prev = mr;
+  } else {
+    cache->lru_tail = mr;
+  }
+  cache->lru_head = mr;
+}
+
+int rdma_dereg_mr(struct rdma_mr_t* mr) {
+  struct rdma_dev_t* rdma_dev;
+
+  if(mr == NULL) {
+    return -1;
+  }
+  if(mr->refcnt != 0) {
+    fprintf(stderr, "Error: memory region %d is still referenced %d times\n", mr->index, mr->refcnt);
+    return -1;
+  }
+
+  // A cached region leaves its cache before it is freed
+  if(mr->cache != NULL) {
+    mr_cache_unlink(mr->cache, mr);
+    mr->cache->num_mr--;
+    mr->cache = NULL;
+  }
+
+  // A zero length entry no longer grants access to anything
+  rdma_dev = mr->rdma_dev;
+  write_pd_csr(rdma_dev, mr->index, RN_RDMA_PDT_WRRDBUFLEN, 0);
+  write_pd_csr(rdma_dev, mr->index, RN_RDMA_PDT_ACCESSDESC, 0);
+  rdma_dev->mr_entry_busy[mr->index] = 0;
+  rdma_dev->mr_r_key_valid[mr->index] = 0;
+  rdma_dev->mr_table[mr->index] = NULL;
+  free(mr);
+  return 0;
+}
+
+struct rdma_mr_cache_t* rdma_mr_cache_create(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, uint32_t capacity) {
+  struct rdma_mr_cache_t* cache;
+
+  if(rdma_dev == NULL || rdma_pd == NULL || capacity == 0) {
+    fprintf(stderr, "Error: invalid memory region cache arguments\n");
+    return NULL;
+  }
+  cache = (struct rdma_mr_cache_t* ) calloc(1, sizeof(struct rdma_mr_cache_t));
+  if(cache == NULL) {
+    fprintf(stderr, "Error: failed to allocate the memory region cache\n");
+    exit(EXIT_FAILURE);
+  }
+  cache->rdma_dev = rdma_dev;
+  cache->pd       = rdma_pd;
+  cache->capacity = capacity;
+  return cache;
+}
+
+/* Deregister the least recently used region nobody holds. */
+static int mr_cache_evict(struct rdma_mr_cache_t* cache) {
+  struct rdma_mr_t* mr;
+
+  for(mr = cache->lru_tail; mr != NULL; mr = mr->lru_prev) {
+    if(mr->refcnt == 0) {
+      cache->evictions++;
+      return rdma_dereg_mr(mr);
+    }
+  }
+  return -1;
+}
+
+struct rdma_mr_t* rdma_mr_cache_get(struct rdma_mr_cache_t* cache, struct rdma_buff_t* rdma_buf,
+                                    uint64_t offset, uint64_t length, uint16_t access) {
+  struct rdma_dev_t* rdma_dev = cache->rdma_dev;
+  struct rdma_mr_t* mr;
+  uint64_t vaddr;
+  uint64_t start;
+  uint64_t end;
+  int index;
+  int r_key;
+
+  if(rdma_buf == NULL || length == 0 || (offset + length > (uint64_t) rdma_buf->buf_size)) {
+    fprintf(stderr, "Error: invalid memory region cache request\n");
+    return NULL;
+  }
+  vaddr = ((uint64_t) rdma_buf->buffer) + offset;
+
+  // A region that covers the range with enough access rights is reused as is
+  for(mr = cache->lru_head; mr != NULL; mr = mr->lru_next) {
+    if((mr->vaddr <= vaddr) && (vaddr + length <= mr->vaddr + mr->length) &&
+       ((mr->access == access) || (mr->access == RDMA_ACCESS_READ_WRITE))) {
+      break;
+    }
+  }
+  if(mr != NULL) {
+    cache->hits++;
+    mr_cache_unlink(cache, mr);
+    mr_cache_push_front(cache, mr);
+    mr->refcnt++;
+    return mr;
+  }
+  cache->misses++;
+
+  // An unused region of the same buffer that overlaps the range is grown to
+  // cover both, keeping its table entry and r_key
+  for(mr = cache->lru_head; mr != NULL; mr = mr->lru_next) {
+    if((mr->buf == rdma_buf) && (mr->refcnt == 0) && (mr->access == access) &&
+       (mr->vaddr < vaddr + length) && (vaddr < mr->vaddr + mr->length)) {
+      break;
+    }
+  }
+  if(mr != NULL) {
+    start = (mr->vaddr < vaddr) ? mr->vaddr : vaddr;
+    end   = (mr->vaddr + mr->length > vaddr + length) ? (mr->vaddr + mr->length) : (vaddr + length);
+    mr->dma_addr = rdma_buf->dma_addr + (start - (uint64_t) rdma_buf->buffer);
+    mr->vaddr    = start;
+    mr->length   = end - start;
+    write_mr_entry(rdma_dev, mr->index, cache->pd->pd_num, mr->vaddr, mr->dma_addr, mr->length, mr->r_key, mr->access);
+    mr_cache_unlink(cache, mr);
+    mr_cache_push_front(cache, mr);
+    mr->refcnt++;
+    return mr;
+  }
+
+  if(cache->num_mr >= cache->capacity) {
+    if(mr_cache_evict(cache) < 0) {
+      fprintf(stderr, "Error: all %d cached memory regions are in use\n", cache->num_mr);
+      return NULL;
+    }
+  }
+  index = find_free_mr_entry(rdma_dev);
+  if((index < 0) && (mr_cache_evict(cache) == 0)) {
+    index = find_free_mr_entry(rdma_dev);
+  }
+  if(index < 0) {
+    fprintf(stderr, "Error: the memory region table is full\n");
+    return NULL;
+  }
+
+  r_key = alloc_mr_r_key(rdma_dev);
+  if(r_key < 0) {
+    return NULL;
+  }
+  mr = rdma_reg_mr(rdma_dev, cache->pd, rdma_buf, offset, length, (uint32_t) r_key, access);
+  if(mr == NULL) {
+    return NULL;
+  }
+  mr->cache = cache;
+  mr->refcnt = 1;
+  mr_cache_push_front(cache, mr);
+  cache->num_mr++;
+  return mr;
+}
+
+void rdma_mr_cache_put(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr) {
+  if((mr != NULL) && (mr->cache == cache) && (mr->refcnt > 0)) {
+    mr->refcnt--;
+  }
+}
+
+void rdma_mr_cache_destroy(struct rdma_mr_cache_t* cache) {
+  struct rdma_mr_t* mr;
+
+  if(cache != NULL) {
+    while((mr = cache->lru_head) != NULL) {
+      mr->refcnt = 0;
+      rdma_dereg_mr(mr);
+    }
+    free(cache);
+  }
+}
+
 struct rdma_buff_t* allocate_hugepages_buffer(uint32_t num_hugepages) {
   struct rdma_buff_t* rdma_buffer;
   rdma_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
@@ -341,20 +768,13 @@ struct rdma_buff_t* allocate_hugepages_buffer(uint32_t num_hugepages) {
     exit(EXIT_FAILURE);
   }
 
-  rdma_buffer->buffer = mmap(NULL, num_hugepages * (1 << HUGE_PAGE_SHIFT),
-                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | 
-                             MAP_HUGETLB, -1, 0);
-
+  // No card is known here, leave the NUMA placement to the kernel
+  rdma_buffer->buffer = map_hugepages(((uint64_t) num_hugepages) << HUGE_PAGE_SHIFT, HUGE_PAGE_SHIFT, RN_NUMA_NODE_NONE, NULL);
   if(rdma_buffer->buffer == NULL) {
     fprintf(stderr, "Error: failed to allocate hugepage memory\n");
     exit(EXIT_FAILURE);
   }
-
-  // Lock the buffer in physical memory
-  if(mlock(rdma_buffer->buffer, num_hugepages * (1 << HUGE_PAGE_SHIFT)) == -1) {
-    fprintf(stderr, "Error: failed to lock %d page in memory\n", num_hugepages);
-    exit(EXIT_FAILURE);
-  }
+  rdma_buffer->buf_size = num_hugepages << HUGE_PAGE_SHIFT;
 
   rdma_buffer->dma_addr = get_buffer_paddr(rdma_buffer->buffer);
 
@@ -366,125 +786,160 @@ void config_last_rq_psn(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t las
   uint32_t rq_opcode = 0x0000000a; // Just a random op-code to avoid opcode sequence error
   uint32_t rq_conf = ((rq_opcode<<24) & 0xff000000) | (last_rq_psn & 0x00ffffff);
 
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid), 
-              rq_conf);
-  fprintf(stderr, "[Register] RN_RDMA_QCSR_LSTRQREQi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid), 
-                    qpid, 
-                    rq_conf);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_LSTRQREQi, rq_conf);
   rdma_dev->qps_ptr[qpid]->last_rq_psn = last_rq_psn;
 }
 
 void config_sq_psn(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t sq_psn){
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid), 
-              sq_psn);
-  fprintf(stderr, "[Register] RN_RDMA_QCSR_SQPSNi=0x%x, qpid=%d, value=0x%x\n", 
-                  get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid), 
-                  qpid, 
-                  sq_psn);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_SQPSNi, sq_psn);
   rdma_dev->qps_ptr[qpid]->sq_psn = sq_psn;
 }
 
-struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
-                                   uint32_t qpid,
-                                   uint32_t dst_qpid,
-                                   struct rdma_pd_t* pd_entry,
-                                   uint64_t cq_cidb_addr,
-                                   uint64_t rq_cidb_addr,
-                                   uint32_t qdepth,
-                                   char*    buf_location,
-                                   struct mac_addr_t* dst_mac,
-                                   uint32_t dst_ip,
-                                   uint32_t partion_key,
-                                   uint32_t r_key) {
-  uint32_t sq_addr_lsb;
-  uint32_t sq_addr_msb;
-  uint32_t cq_addr_lsb;
-  uint32_t cq_addr_msb;
-  uint32_t rq_addr_lsb;
-  uint32_t rq_addr_msb;
-  uint32_t cq_cidb_addr_lsb;
-  uint32_t cq_cidb_addr_msb;
-  uint32_t rq_cidb_addr_lsb;
-  uint32_t rq_cidb_addr_msb;
+/* Bring the host side indices of a queue pair back to an empty SQ, CQ and RQ. */
+static void reset_rdma_qp_state(struct rdma_qp_t* qp) {
+  qp->sq_pidb = 0;
+  qp->sq_cidb = 0;
+  qp->sq_credits = qp->qdepth - 1;
+  qp->sq_dirty_start = 0;
+  qp->sq_dirty_cnt = 0;
+  qp->cq_cidb = 0;
+  qp->rq_cidb = 0;
+  qp->rq_pidb = 0;
+  qp->poll_mismatch = 0;
+  memset(&qp->db_coalescer, 0, sizeof(struct rdma_db_coalescer_t));
+  memset(&qp->pacer, 0, sizeof(struct rdma_pacer_t));
+  memset(qp->wr_ctx, 0, qp->qdepth * sizeof(struct rdma_wr_ctx_t));
+  if(qp->sq_shadow != NULL) {
+    memset(qp->sq_shadow, 0, qp->qdepth * sizeof(struct rdma_wqe_t));
+  }
+  if(qp->cq_db_shadow != NULL) {
+    *(qp->cq_db_shadow) = 0;
+  }
+  if(qp->rq_db_shadow != NULL) {
+    *(qp->rq_db_shadow) = 0;
+  }
+}
+
+/* Allocate the host side of a queue pair: SQ, CQ and RQ rings, per-slot
+ * records and doorbell shadows. No register is written here.
+ */
+static struct rdma_qp_t* init_rdma_qp(struct rdma_dev_t* rdma_dev, const struct rdma_qp_attr_t* attr) {
   struct rdma_qp_t* qp;
-  uint32_t mtu_config;
-  uint32_t en_qp;
-  //uint32_t ip_proto;
-  uint32_t qp_config;
-  uint32_t traffic_class;
-  uint32_t time_to_live;
-  uint32_t qp_adv_conf;
-  uint32_t rq_buffer_entry_size;
   uint32_t cq_size;
   uint32_t rq_size;
   uint32_t sq_size;
-  uint32_t win_size_low  = rdma_dev->winSize->win_size_lsb;
-  uint32_t win_size_high = rdma_dev->winSize->win_size_msb;
+  uint32_t qdepth = attr->qdepth;
 
-  qp = (struct rdma_qp_t* ) malloc(sizeof(struct rdma_qp_t));
+  // Keep the hot counters of this QP off the cache lines of other QPs
+  if(posix_memalign((void** ) &qp, RDMA_CACHE_LINE_SIZE, sizeof(struct rdma_qp_t)) != 0) {
+    fprintf(stderr, "Error: failed to allocate qp\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(qp, 0, sizeof(struct rdma_qp_t));
   qp->rdma_dev = rdma_dev;
-  qp->qpid = qpid;
-  qp->dst_qpid = dst_qpid;
-  fprintf(stderr, "Allocating qp->sq\n");
-  // Each WQE has 64 bytes
-  sq_size = rdma_dev->num_qp * qdepth * 64;
-  cq_size = rdma_dev->num_qp * qdepth * 4;
-  rq_size = rdma_dev->num_qp * qdepth * RQE_SIZE;
-
-  Debug("sq_size = %d, cq_size = %d, rq_size %d, buf_location = %s\n", sq_size, cq_size, rq_size, buf_location);
-  qp->sq = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) sq_size, buf_location);
-  qp->sq_pidb = 0;
-  qp->sq_cidb = 0;
-
-  fprintf(stderr, "Allocating qp->cq\n");
-  // Each CQE has 4 bytes
-  qp->cq = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) cq_size, buf_location);
-  qp->cq_cidb = 0;
+  qp->qpid = attr->qpid;
+  qp->dst_qpid = attr->dst_qpid;
+  qp->rq_entry_size = (attr->rq_entry_size == 0) ? RQE_SIZE : attr->rq_entry_size;
+  qp->buf_location = attr->buf_location;
+  // Each ring holds the qdepth entries of this QP only, a WQE has 64 bytes
+  sq_size = qdepth * 64;
+  cq_size = qdepth * 4;
+  rq_size = qdepth * qp->rq_entry_size;
+
+  Debug("sq_size = %d, cq_size = %d, rq_size %d, buf_location = %s\n", sq_size, cq_size, rq_size, attr->buf_location);
+  qp->sq = allocate_rdma_buffer_aligned(rdma_dev->rn_dev, (uint64_t) sq_size, 0, attr->buf_location);
+  if(qp->sq == NULL) {
+    fprintf(stderr, "Error: failed to allocate the SQ of qpid %d\n", attr->qpid);
+    exit(EXIT_FAILURE);
+  }
+  if(posix_memalign((void** ) &qp->wr_ctx, RDMA_CACHE_LINE_SIZE, qdepth * sizeof(struct rdma_wr_ctx_t)) != 0) {
+    fprintf(stderr, "Error: failed to allocate qp->wr_ctx\n");
+    exit(EXIT_FAILURE);
+  }
 
-  if(is_device_address(cq_cidb_addr)) {
-    // Device memory address
-    cq_cidb_addr_lsb = ((uint32_t) ((cq_cidb_addr) & 0x00000000ffffffff));
-    cq_cidb_addr_msb = ((uint32_t) ((cq_cidb_addr >> 32) & 0x00000000ffffffff));
-  } else {
-    // Host memory address
-    cq_cidb_addr_lsb = ((uint32_t) ((cq_cidb_addr) & 0x00000000ffffffff)) & win_size_low;
-    cq_cidb_addr_msb = ((uint32_t) ((cq_cidb_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
+  // WQEs of an SQ in the device memory are staged in a host ring and copied
+  // to the device memory in one transfer right before the SQ doorbell
+  qp->sq_shadow = NULL;
+  if(is_device_address(qp->sq->dma_addr)) {
+    if(posix_memalign((void** ) &qp->sq_shadow, RDMA_CACHE_LINE_SIZE, qdepth * sizeof(struct rdma_wqe_t)) != 0) {
+      fprintf(stderr, "Error: failed to allocate qp->sq_shadow\n");
+      exit(EXIT_FAILURE);
+    }
   }
 
-  qp->cq_cidb_addr = cq_cidb_addr;
-  fprintf(stderr, "Allocating qp->rq\n");
+  // Each CQE has 4 bytes
+  qp->cq = allocate_rdma_buffer_aligned(rdma_dev->rn_dev, (uint64_t) cq_size, 0, attr->buf_location);
+  if(qp->cq == NULL) {
+    fprintf(stderr, "Error: failed to allocate the CQ of qpid %d\n", attr->qpid);
+    exit(EXIT_FAILURE);
+  }
+  qp->cq_cidb_addr = attr->cq_cidb_addr;
+
+  // Each RQE is rq_entry_size bytes. QPs that only issue READ/WRITE can
+  // leave their RQ to the first receive call. The hardware keeps receiving on
+  // an enabled QP, so until then RQBAi points at one scratch RQ shared by all
+  // such QPs. A QP whose RQ does not fit in it gets its own RQ right away.
+  qp->rq = NULL;
+  if(attr->lazy_rq && (rdma_dev->rq_scratch == NULL)) {
+    rdma_dev->rq_scratch = allocate_rdma_buffer_aligned(rdma_dev->rn_dev, (uint64_t) rq_size, 0, attr->buf_location);
+  }
+  if(!attr->lazy_rq || (rdma_dev->rq_scratch == NULL) || (rdma_dev->rq_scratch->buf_size < rq_size)) {
+    qp->rq = allocate_rdma_buffer_aligned(rdma_dev->rn_dev, (uint64_t) rq_size, 0, attr->buf_location);
+    if(qp->rq == NULL) {
+      fprintf(stderr, "Error: failed to allocate the RQ of qpid %d\n", attr->qpid);
+      exit(EXIT_FAILURE);
+    }
+  }
+  qp->rq_cidb_addr = attr->rq_cidb_addr;
+
+  // The hardware also writes CQ head and RQ producer index to cq_cidb_addr and
+  // rq_cidb_addr. If they are in the hugepages, poll those words from the cache
+  // instead of reading the registers over PCIe.
+  qp->cq_db_shadow = (volatile uint32_t* ) get_buffer_vaddr(rdma_dev->rn_dev, attr->cq_cidb_addr);
+  qp->rq_db_shadow = (volatile uint32_t* ) get_buffer_vaddr(rdma_dev->rn_dev, attr->rq_cidb_addr);
+  qp->poll_mode = (qp->cq_db_shadow != NULL) ? RDMA_POLL_SHADOW : RDMA_POLL_MMIO;
+  Debug("DEBUG: cq_db_shadow = %p, rq_db_shadow = %p, poll_mode = %d\n", (void*) qp->cq_db_shadow, (void*) qp->rq_db_shadow, qp->poll_mode);
+
+  qp->pd_entry = attr->pd_entry;
+  qp->pd_num   = attr->pd_entry->pd_num;
+  qp->qdepth   = qdepth;
+  qp->dst_mac  = attr->dst_mac;
+  qp->dst_ip   = attr->dst_ip;
+  reset_rdma_qp_state(qp);
+  rdma_dev->qps_ptr[attr->qpid] = qp;
 
-  // Each RQE is 256B
-  qp->rq = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) rq_size, buf_location);
-  //rdma_register_memory_region(rdma_dev, pd_entry, r_key, qp->rq);
-  qp->rq_cidb = 0;
-  qp->rq_pidb = 0;
+  return qp;
+}
 
-  if(is_device_address(rq_cidb_addr)) {
+/* Split a buffer address into the LSB/MSB register values. Host memory
+ * addresses are masked with the PCIe BDF window.
+ */
+static void get_csr_addr(struct rdma_dev_t* rdma_dev, uint64_t addr, uint32_t* addr_lsb, uint32_t* addr_msb) {
+  if(is_device_address(addr)) {
     // Device memory address
-    rq_cidb_addr_lsb = ((uint32_t) ((rq_cidb_addr) & 0x00000000ffffffff));
-    rq_cidb_addr_msb = ((uint32_t) ((rq_cidb_addr >> 32) & 0x00000000ffffffff));
+    *addr_lsb = ((uint32_t) ((addr) & 0x00000000ffffffff));
+    *addr_msb = ((uint32_t) ((addr >> 32) & 0x00000000ffffffff));
   } else {
     // Host memory address
-    rq_cidb_addr_lsb = ((uint32_t) ((rq_cidb_addr) & 0x00000000ffffffff)) & win_size_low;
-    rq_cidb_addr_msb = ((uint32_t) ((rq_cidb_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
+    *addr_lsb = ((uint32_t) ((addr) & 0x00000000ffffffff)) & rdma_dev->winSize->win_size_lsb;
+    *addr_msb = ((uint32_t) ((addr >> 32) & 0x00000000ffffffff)) & rdma_dev->winSize->win_size_msb;
   }
-  qp->rq_cidb_addr = rq_cidb_addr;
-  
-  qp->pd_entry = pd_entry;
-  
-  qp->qdepth   = qdepth;
-  qp->dst_mac = dst_mac;
-  qp->dst_ip  = dst_ip;
-  rdma_dev->qps_ptr[qpid] = qp;
+}
 
-  fprintf(stderr, "Info: queue pair setting is done! Configuring RDMA per-queu CSR registers\n");
-  Debug("DEBUG: rdma_dev->rn_dev->axil_ctl = 0x%lx, rdma_dev->axil_ctl = 0x%lx\n", 
-                  (uint64_t) rdma_dev->rn_dev->axil_ctl, 
-                  (uint64_t) rdma_dev->axil_ctl);
+/* Configure the registers of a queue pair that do not depend on its peer:
+ * ring and doorbell addresses, queue depth and protection domain. Writes of
+ * values already held by the registers are skipped by write_qp_csr().
+ */
+static void config_rdma_qp_ring_csr(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, uint32_t partion_key) {
+  uint32_t qpid = qp->qpid;
+  uint32_t addr_lsb;
+  uint32_t addr_msb;
+  uint32_t sq_addr_msb;
+  uint32_t cq_addr_msb;
+  uint32_t rq_addr_msb;
+  uint32_t traffic_class;
+  uint32_t time_to_live;
+  uint32_t qp_adv_conf;
 
   if(rdma_dev->axil_ctl == 0) {
     fprintf(stderr, "Error: rdma_dev->axil_ctl=0x%lx is not valid!\n", 
@@ -492,191 +947,77 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
     exit(EXIT_FAILURE);
   }
 
-  // Configure RDMA per-queue CSR registers
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_IPDESADDR1i, qpid), 
-              dst_ip);
-  Debug("[Register] RN_RDMA_QCSR_IPDESADDR1i=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_IPDESADDR1i, qpid),  
-                    qpid, 
-                    dst_ip);
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_MACDESADDLSBi, qpid), 
-                dst_mac->mac_lsb);
-  Debug("[Register] RN_RDMA_QCSR_MACDESADDLSBi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_MACDESADDLSBi, qpid), 
-                    qpid, 
-                    dst_mac->mac_lsb);
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_MACDESADDMSBi, qpid), 
-              dst_mac->mac_msb);
-  Debug("[Register] RN_RDMA_QCSR_MACDESADDMSBi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_MACDESADDMSBi, qpid), 
-                    qpid, 
-                    dst_mac->mac_msb);
-  
-  // Mask the physical address of sq, rq and cq
-  Debug("DEBUG: win_size_high = 0x%x, win_size_low = 0x%x\n", 
-                  win_size_high, 
-                  win_size_low);
+  // Queue pair advanced control configuration
+  traffic_class = 0;
+  time_to_live  = 64;
+  qp_adv_conf = ((partion_key<<16) & 0xffff0000) | 
+                ((time_to_live<<8) & 0x0000ff00) | 
+                (traffic_class & 0x000000ff);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QPADVCONFi, qp_adv_conf);
+
+  // RQ, SQ and CQ base addresses, MSB registers are written further below.
+  // An RQ not allocated yet points at the scratch RQ until alloc_rdma_qp_rq().
+  get_csr_addr(rdma_dev, (qp->rq != NULL) ? qp->rq->dma_addr : rdma_dev->rq_scratch->dma_addr, &addr_lsb, &rq_addr_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_RQBAi, addr_lsb);
+  get_csr_addr(rdma_dev, qp->sq->dma_addr, &addr_lsb, &sq_addr_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_SQBAi, addr_lsb);
+  get_csr_addr(rdma_dev, qp->cq->dma_addr, &addr_lsb, &cq_addr_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_CQBAi, addr_lsb);
+
+  // RQ and CQ DB addresses
+  get_csr_addr(rdma_dev, qp->rq_cidb_addr, &addr_lsb, &addr_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_RQWPTRDBADDi, addr_lsb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_RQWPTRDBADDMSBi, addr_msb);
+  get_csr_addr(rdma_dev, qp->cq_cidb_addr, &addr_lsb, &addr_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_CQDBADDi, addr_lsb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_CQDBADDMSBi, addr_msb);
+
+  // Queue depth
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QDEPTHi, (qp->qdepth | qp->qdepth << 16));
 
-  if(is_device_address(qp->sq->dma_addr)) {
-    // Device memory address
-    sq_addr_lsb = ((uint32_t) ((qp->sq->dma_addr) & 0x00000000ffffffff));
-    sq_addr_msb = ((uint32_t) ((qp->sq->dma_addr >> 32) & 0x00000000ffffffff));
-  } else {
-    // Host memory address
-    sq_addr_lsb = ((uint32_t) ((qp->sq->dma_addr) & 0x00000000ffffffff)) & win_size_low;
-    sq_addr_msb = ((uint32_t) ((qp->sq->dma_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
-  }
-
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQBAi, qpid),  
-                sq_addr_lsb);
-  Debug("[Register] RN_RDMA_QCSR_SQBAi=0x%x, qpid=%d, value=0x%x\n", 
-                  get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQBAi, qpid), 
-                  qpid, 
-                  sq_addr_lsb);
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQBAMSBi, qpid), 
-                sq_addr_msb);
-  Debug("[Register] RN_RDMA_QCSR_SQBAMSBi=0x%x, qpid=%d, value=0x%x\n", 
-                  get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQBAMSBi, qpid), 
-                  qpid, 
-                  sq_addr_msb);
-  Debug("DEBUG: qp->sq->dma_addr = 0x%lx, sq_addr_msb = 0x%x, sq_addr_lsb = 0x%x\n", 
-                  qp->sq->dma_addr, 
-                  sq_addr_msb, 
-                  sq_addr_lsb);
-
-  if(is_device_address(qp->cq->dma_addr)) {
-    // Device memory address
-    cq_addr_lsb = ((uint32_t) ((qp->cq->dma_addr) & 0x00000000ffffffff));
-    cq_addr_msb = ((uint32_t) ((qp->cq->dma_addr >> 32) & 0x00000000ffffffff));
-  } else {
-    // Host memory address
-    cq_addr_lsb = ((uint32_t) ((qp->cq->dma_addr) & 0x00000000ffffffff)) & win_size_low;
-    cq_addr_msb = ((uint32_t) ((qp->cq->dma_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
-  }
-
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQBAi, qpid), 
-              cq_addr_lsb);
-  Debug("[Register] RN_RDMA_QCSR_CQBAi=0x%x, qpid=%d, value=0x%x\n", 
-                  get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQBAi, qpid), 
-                  qpid, 
-                  cq_addr_lsb);
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQBAMSBi, qpid), 
-                cq_addr_msb);
-  Debug("[Register] RN_RDMA_QCSR_CQBAMSBi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQBAMSBi, qpid), 
-                    qpid, 
-                    cq_addr_msb);
-  Debug("DEBUG: qp->cq->dma_addr = 0x%lx, cq_addr_msb = 0x%x, cq_addr_lsb = 0x%x\n", 
-                  qp->cq->dma_addr, 
-                  cq_addr_msb, 
-                  cq_addr_lsb);
-
-  if(is_device_address(qp->rq->dma_addr)) {
-    // Device memory address
-    rq_addr_lsb = ((uint32_t) ((qp->rq->dma_addr) & 0x00000000ffffffff));
-    rq_addr_msb = ((uint32_t) ((qp->rq->dma_addr >> 32) & 0x00000000ffffffff));
-  } else {
-    // Host memory address
-    rq_addr_lsb = ((uint32_t) ((qp->rq->dma_addr) & 0x00000000ffffffff)) & win_size_low;
-    rq_addr_msb = ((uint32_t) ((qp->rq->dma_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
-  }
-
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQBAi, qpid), 
-                rq_addr_lsb);
-  Debug("[Register] RN_RDMA_QCSR_RQBAi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQBAi, qpid), 
-                    qpid, 
-                    rq_addr_lsb);
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQBAMSBi, qpid), 
-                rq_addr_msb);
-  Debug("[Register] RN_RDMA_QCSR_RQBAMSBi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQBAMSBi, qpid), 
-                    qpid, 
-                    rq_addr_msb);
-  Debug("DEBUG: qp->rq->dma_addr = 0x%lx, rq_addr_msb = 0x%x, rq_addr_lsb = 0x%x\n",
-                    qp->rq->dma_addr, 
-                    rq_addr_msb, 
-                    rq_addr_lsb);
-
-  // CQ DB address
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQDBADDi, qpid), 
-              cq_cidb_addr_lsb);
-  Debug("[Register] RN_RDMA_QCSR_CQDBADDi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQDBADDi, qpid), 
-                    qpid, 
-                    cq_cidb_addr_lsb);
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQDBADDMSBi, qpid), 
-                cq_cidb_addr_msb);
-  Debug("[Register] RN_RDMA_QCSR_CQDBADDMSBi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQDBADDMSBi, qpid), 
-                    qpid, 
-                    cq_cidb_addr_msb);
-  Debug("DEBUG: cq_cidb_addr = 0x%lx\n", cq_cidb_addr);
-
-  // RQ DB address
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQWPTRDBADDi, qpid), 
-              rq_cidb_addr_lsb);
-  Debug("[Register] RN_RDMA_QCSR_RQWPTRDBADDi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQWPTRDBADDi, qpid), 
-                    qpid, 
-                    rq_cidb_addr_lsb);
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQWPTRDBADDMSBi, qpid), 
-              rq_cidb_addr_msb);
-  Debug("[Register] RN_RDMA_QCSR_RQWPTRDBADDMSBi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQWPTRDBADDMSBi, qpid), 
-                    qpid, 
-                    rq_cidb_addr_msb);
-  Debug("DEBUG: rq_cidb_addr = 0x%lx\n", rq_cidb_addr);
-  
-  // Destination QP configuration
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_DESTQPCONFi, qpid), 
-              dst_qpid);
-  Debug("[Register] RN_RDMA_QCSR_DESTQPCONFi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_DESTQPCONFi, qpid), 
-                    qpid, 
-                    dst_qpid);
-
-  // Queue depth configuration
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_QDEPTHi, qpid), 
-                (qdepth | qdepth << 16));
-  Debug("[Register] RN_RDMA_QCSR_QDEPTHi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_QDEPTHi, qpid), 
-                    qpid, 
-                    (qdepth | qdepth << 16));
+  // PD number configuration
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_PDi, qp->pd_num);
 
-  // Queue pair control configuration
-  // [0]: QP enable – Should be set to 1 for all active QPs. A disabled QP will not be 
-  //      able to receive or transmit packets.
-	// [2]: RQ interrupt enable – When enabled, allows the receive queue interrupt to be 
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_RQBAMSBi, rq_addr_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_SQBAMSBi, sq_addr_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_CQBAMSBi, cq_addr_msb);
+}
+
+/* Configure the registers of a queue pair that describe its peer. */
+static void config_rdma_qp_peer_csr(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp) {
+  uint32_t qpid = qp->qpid;
+
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_DESTQPCONFi, qp->dst_qpid);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_MACDESADDLSBi, qp->dst_mac->mac_lsb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_MACDESADDMSBi, qp->dst_mac->mac_msb);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_IPDESADDR1i, qp->dst_ip);
+}
+
+/* Enable a queue pair, once everything else is in place. */
+static void enable_rdma_qp_csr(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp) {
+  uint32_t mtu_config;
+  uint32_t en_qp;
+  uint32_t qp_config;
+  uint32_t rq_buffer_entry_size;
+
+  // Queue pair control configuration
+  // [0]: QP enable – Should be set to 1 for all active QPs. A disabled QP will not be 
+  //      able to receive or transmit packets.
+  // [2]: RQ interrupt enable – When enabled, allows the receive queue interrupt to be 
   //      generated for every new packet received on the receive queue
-	// [3]: CQ interrupt enable – When enabled, allows the completion queue interrupt to 
+  // [3]: CQ interrupt enable – When enabled, allows the completion queue interrupt to 
   //      be generated for every send work queue entry completion
-	// [4]: HW Handshake disable – This bit when reset to 0 enables the HW handshake ports 
+  // [4]: HW Handshake disable – This bit when reset to 0 enables the HW handshake ports 
   //      for doorbell exchange. If set, all doorbell values are exchanged through writes 
   //      through the AXI4 or AXI4-Lite interface.
-	// [5]: CQE write enable – This bit when set, enables completion queue entry writes. 
+  // [5]: CQE write enable – This bit when set, enables completion queue entry writes. 
   //      The writes are disabled when this bit is reset. CQE writes can be enabled to 
   //      debug failed completions.
-	// [6]: QP under recovery. This bit need to be set in the fatal clearing process.
-	// [7]: QP configured for IPv4 or IPv6
-	//      0 - IPv4
-	//      1 - IPv6 - not supported in this simulation
-	// [10:8]: Path MTU
+  // [6]: QP under recovery. This bit need to be set in the fatal clearing process.
+  // [7]: QP configured for IPv4 or IPv6
+  //      0 - IPv4
+  //      1 - IPv6 - not supported in this simulation
+  // [10:8]: Path MTU
   //      000 – 256B 
   //      001 – 512B
   //      010 – 1024B
@@ -685,12 +1026,9 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
   //      101 to 111 - Reserved
   // [31:16]: RQ Buffer size (in multiple of 256B). This is the size of each buffer 
   //          element in the request and not the size of the entire request.
-  
   en_qp = 1;
-  //ip_proto = 0;
   mtu_config = 4;
-  rq_buffer_entry_size = RQE_SIZE;
-  //qp_config = (en_qp & 0x0000000f) | (0x20 & 0x000000f0) | ((mtu_config<<8) & 0x0000ff00) | ((rq_buffer_entry_size<<16) & 0xffff0000);
+  rq_buffer_entry_size = qp->rq_entry_size / RDMA_RQE_SIZE_UNIT;
   // set QPCONFi[4] = 1 to disable HW handshake
   // enable QPCONFi[2] and QPCONFi[3]
   qp_config = (en_qp & 0x00000001) | 
@@ -698,41 +1036,192 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
                 (0x30 & 0x000000f0) | 
                 ((mtu_config<<8) & 0x0000ff00) | 
                 ((rq_buffer_entry_size<<16) & 0xffff0000);
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid), 
-                qp_config);
-  Debug("[Register] RN_RDMA_QCSR_QPCONFi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid), 
-                    qpid, 
-                    qp_config);
+  write_qp_csr(rdma_dev, qp->qpid, RN_RDMA_QCSR_QPCONFi, qp_config);
+}
 
-  // Queue pair advanced control configuration
-  traffic_class = 0;
-  time_to_live  = 64;
-  qp_adv_conf = ((partion_key<<16) & 0xffff0000) | 
-                ((time_to_live<<8) & 0x0000ff00) | 
-                (traffic_class & 0x000000ff);
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPADVCONFi, qpid), 
-                qp_adv_conf);
-  Debug("[Register] RN_RDMA_QCSR_QPADVCONFi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPADVCONFi, qpid), 
-                    qpid, 
-                    qp_adv_conf);
+/* Allocate the RQ of a queue pair created with lazy_rq and point the RQ base
+ * address registers at it.
+ */
+static int alloc_rdma_qp_rq(struct rdma_qp_t* qp) {
+  uint32_t addr_lsb;
+  uint32_t addr_msb;
 
-  // PD number configuration
-  write32_data(rdma_dev->axil_ctl, 
-                get_rdma_per_q_config_addr(RN_RDMA_QCSR_PDi, qpid), 
-                pd_entry->pd_num);
-  Debug("[Register] RN_RDMA_QCSR_PDi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_PDi, qpid), 
-                    qpid, 
-                    pd_entry->pd_num);
+  if(qp->rq != NULL) {
+    return 0;
+  }
+  qp->rq = allocate_rdma_buffer_aligned(qp->rdma_dev->rn_dev, (uint64_t) qp->qdepth * qp->rq_entry_size, 0, qp->buf_location);
+  if(qp->rq == NULL) {
+    fprintf(stderr, "Error: failed to allocate the RQ of qpid %d\n", qp->qpid);
+    return -1;
+  }
+  get_csr_addr(qp->rdma_dev, qp->rq->dma_addr, &addr_lsb, &addr_msb);
+  write_qp_csr(qp->rdma_dev, qp->qpid, RN_RDMA_QCSR_RQBAi, addr_lsb);
+  write_qp_csr(qp->rdma_dev, qp->qpid, RN_RDMA_QCSR_RQBAMSBi, addr_msb);
+  return 0;
+}
+
+/* Configure the whole per-queue CSR window of a queue pair, enabling the QP
+ * with the last write.
+ */
+static void config_rdma_qp_csr(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, uint32_t partion_key) {
+  config_rdma_qp_ring_csr(rdma_dev, qp, partion_key);
+  config_rdma_qp_peer_csr(rdma_dev, qp);
+  enable_rdma_qp_csr(rdma_dev, qp);
+}
+
+struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
+                                   uint32_t qpid,
+                                   uint32_t dst_qpid,
+                                   struct rdma_pd_t* pd_entry,
+                                   uint64_t cq_cidb_addr,
+                                   uint64_t rq_cidb_addr,
+                                   uint32_t qdepth,
+                                   char*    buf_location,
+                                   struct mac_addr_t* dst_mac,
+                                   uint32_t dst_ip,
+                                   uint32_t partion_key,
+                                   uint32_t r_key) {
+  struct rdma_qp_attr_t attr;
+  struct rdma_qp_t* qp;
+
+  memset(&attr, 0, sizeof(struct rdma_qp_attr_t));
+  attr.qpid         = qpid;
+  attr.dst_qpid     = dst_qpid;
+  attr.pd_entry     = pd_entry;
+  attr.cq_cidb_addr = cq_cidb_addr;
+  attr.rq_cidb_addr = rq_cidb_addr;
+  attr.qdepth       = qdepth;
+  attr.buf_location = buf_location;
+  attr.dst_mac      = dst_mac;
+  attr.dst_ip       = dst_ip;
+  attr.partion_key  = partion_key;
+  attr.r_key        = r_key;
+
+  qp = init_rdma_qp(rdma_dev, &attr);
+  fprintf(stderr, "Info: queue pair setting is done! Configuring RDMA per-queu CSR registers\n");
+  config_rdma_qp_csr(rdma_dev, qp, partion_key);
 
   fprintf(stderr, "Info: allocate_rdma_qp - Successfully allocated a rdma qp\n");
   return qp;
 }
 
+static int compare_qp_attr(const void* a, const void* b) {
+  const struct rdma_qp_attr_t* attr_a = *((const struct rdma_qp_attr_t* const*) a);
+  const struct rdma_qp_attr_t* attr_b = *((const struct rdma_qp_attr_t* const*) b);
+  return (attr_a->qpid > attr_b->qpid) - (attr_a->qpid < attr_b->qpid);
+}
+
+int rdma_qp_create_bulk(struct rdma_dev_t* rdma_dev,
+                        const struct rdma_qp_attr_t* attrs,
+                        uint32_t num_qp,
+                        struct rdma_qp_t** qps) {
+  const struct rdma_qp_attr_t** order;
+  struct rdma_qp_t* qp;
+  uint32_t i;
+
+  if(num_qp == 0) {
+    return 0;
+  }
+
+  // Reject the whole request before touching anything
+  for(i = 0; i < num_qp; i++) {
+    if((attrs[i].qpid == 0) || (attrs[i].qpid >= rdma_dev->num_qp)) {
+      fprintf(stderr, "Error: qpid %d is out of range, %d QPs are enabled\n", attrs[i].qpid, rdma_dev->num_qp);
+      return -1;
+    }
+    if(rdma_dev->qps_ptr[attrs[i].qpid] != NULL) {
+      fprintf(stderr, "Error: qpid %d is already allocated\n", attrs[i].qpid);
+      return -1;
+    }
+    if((attrs[i].pd_entry == NULL) || (attrs[i].dst_mac == NULL) || (attrs[i].qdepth < 2)) {
+      fprintf(stderr, "Error: invalid attributes for qpid %d\n", attrs[i].qpid);
+      return -1;
+    }
+    if((attrs[i].rq_entry_size % RDMA_RQE_SIZE_UNIT != 0) || (attrs[i].rq_entry_size > RDMA_RQE_SIZE_MAX)) {
+      fprintf(stderr, "Error: RQ entry size %d of qpid %d is not a multiple of %d bytes up to %d bytes\n",
+              attrs[i].rq_entry_size, attrs[i].qpid, RDMA_RQE_SIZE_UNIT, RDMA_RQE_SIZE_MAX);
+      return -1;
+    }
+  }
+
+  order = (const struct rdma_qp_attr_t** ) malloc(num_qp * sizeof(struct rdma_qp_attr_t*));
+  if(order == NULL) {
+    fprintf(stderr, "Error: failed to allocate rdma_qp_create_bulk order\n");
+    return -1;
+  }
+  for(i = 0; i < num_qp; i++) {
+    order[i] = &attrs[i];
+  }
+  qsort(order, num_qp, sizeof(struct rdma_qp_attr_t*), compare_qp_attr);
+  for(i = 1; i < num_qp; i++) {
+    if(order[i]->qpid == order[i-1]->qpid) {
+      fprintf(stderr, "Error: qpid %d is requested twice\n", order[i]->qpid);
+      free(order);
+      return -1;
+    }
+  }
+
+  // Host side first, then a single pass over the CSR windows in address order
+  for(i = 0; i < num_qp; i++) {
+    init_rdma_qp(rdma_dev, order[i]);
+  }
+  for(i = 0; i < num_qp; i++) {
+    qp = rdma_dev->qps_ptr[order[i]->qpid];
+    config_rdma_qp_csr(rdma_dev, qp, order[i]->partion_key);
+    config_sq_psn(rdma_dev, qp->qpid, order[i]->sq_psn);
+    config_last_rq_psn(rdma_dev, qp->qpid, order[i]->last_rq_psn);
+  }
+  free(order);
+
+  if(qps != NULL) {
+    for(i = 0; i < num_qp; i++) {
+      qps[i] = rdma_dev->qps_ptr[attrs[i].qpid];
+    }
+  }
+
+  Debug("DEBUG: %d QPs created, %lu register writes skipped so far\n", num_qp, rdma_dev->csr_shadow.writes_skipped);
+  return 0;
+}
+
+/* Copy the dirty WQE slots of a device memory SQ from its host shadow ring to
+ * the device memory. A run of dirty slots that wraps around the end of the ring
+ * needs two transfers, otherwise a single one is enough.
+ */
+static int flush_sq_shadow(struct rdma_qp_t* qp) {
+  struct rn_dev_t* rn_dev = qp->rdma_dev->rn_dev;
+  uint32_t first_cnt;
+  ssize_t rc;
+
+  if(qp->sq_dirty_cnt == 0) {
+    return 0;
+  }
+
+  first_cnt = qp->qdepth - qp->sq_dirty_start;
+  if(first_cnt > qp->sq_dirty_cnt) {
+    first_cnt = qp->sq_dirty_cnt;
+  }
+
+  RN_TRACE_EVENT(RN_TRACE_SQ_FLUSH, qp->qpid, qp->sq_dirty_start, qp->sq_dirty_cnt);
+  rc = write_from_buffer(get_rn_dev_mm_device(rn_dev), get_rn_dev_mm_fd(rn_dev),
+                         (char* ) &qp->sq_shadow[qp->sq_dirty_start],
+                         first_cnt * sizeof(struct rdma_wqe_t),
+                         qp->sq->dma_addr + (qp->sq_dirty_start * sizeof(struct rdma_wqe_t)));
+  if((rc >= 0) && (first_cnt < qp->sq_dirty_cnt)) {
+    rc = write_from_buffer(get_rn_dev_mm_device(rn_dev), get_rn_dev_mm_fd(rn_dev),
+                           (char* ) &qp->sq_shadow[0],
+                           (qp->sq_dirty_cnt - first_cnt) * sizeof(struct rdma_wqe_t),
+                           qp->sq->dma_addr);
+  }
+  if(rc < 0) {
+    fprintf(stderr, "Error: Failed to write WQEs to the device memory!\n");
+    return -1;
+  }
+
+  qp->sq_dirty_start = (qp->sq_dirty_start + qp->sq_dirty_cnt) % qp->qdepth;
+  qp->sq_dirty_cnt = 0;
+  return 0;
+}
+
 void create_a_wqe(struct rdma_dev_t* rdma_dev, 
                   uint32_t qpid, 
                   uint16_t wrid, 
@@ -750,7 +1239,6 @@ void create_a_wqe(struct rdma_dev_t* rdma_dev,
 
   uint32_t high_addr;
   uint32_t low_addr;
-  uint64_t masked_buf_addr;
   struct rdma_wqe_t* wqe;
   uint32_t win_size_low  = rdma_dev->winSize->win_size_lsb;
   uint32_t win_size_high = rdma_dev->winSize->win_size_msb;
@@ -765,16 +1253,35 @@ void create_a_wqe(struct rdma_dev_t* rdma_dev,
     low_addr  = ((uint32_t) (laddr & 0x00000000ffffffff)) & win_size_low;
   }
 
-  masked_buf_addr = (((uint64_t) high_addr) << 32) | ((uint64_t) low_addr);
-  Debug("Info: WQE mem_buffer = 0x%lx, masked_mem_buffer = 0x%lx\n", laddr, masked_buf_addr);
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+  struct rdma_buff_t* sq = qp->sq;
+  // The SQ is a ring, wqe_idx may keep increasing across wraparounds
+  uint32_t slot = wqe_idx % qp->qdepth;
+
+  // Remember what was posted in this slot for rdma_poll_cq()
+  qp->wr_ctx[slot].wrid   = wrid;
+  qp->wr_ctx[slot].opcode = (uint8_t) (opcode & 0x000000ff);
+  qp->wr_ctx[slot].length = length;
 
-  struct rdma_buff_t* sq = rdma_dev->qps_ptr[qpid]->sq;
   if(is_device_address(sq->dma_addr)) {
-    // SQ is allocated at device memory
-    wqe = (struct rdma_wqe_t* ) malloc(sizeof(struct rdma_wqe_t));
+    // SQ is allocated at device memory, build the WQE in the host shadow ring.
+    // Slots are normally filled in order; a WQE that does not extend the
+    // current dirty run has to flush that run first.
+    if((qp->sq_dirty_cnt != 0) && (slot != ((qp->sq_dirty_start + qp->sq_dirty_cnt) % qp->qdepth))) {
+      if(flush_sq_shadow(qp) < 0) {
+        exit(EXIT_FAILURE);
+      }
+    }
+    if(qp->sq_dirty_cnt == 0) {
+      qp->sq_dirty_start = slot;
+    }
+    if(qp->sq_dirty_cnt < qp->qdepth) {
+      qp->sq_dirty_cnt++;
+    }
+    wqe = &qp->sq_shadow[slot];
   } else {
     // SQ is allocated at host memory
-    wqe = &(((struct rdma_wqe_t*) sq->buffer)[wqe_idx]);
+    wqe = &(((struct rdma_wqe_t*) sq->buffer)[slot]);
   }
   memset(wqe, 0, sizeof(struct rdma_wqe_t));
 
@@ -793,60 +1300,221 @@ void create_a_wqe(struct rdma_dev_t* rdma_dev,
   wqe->send_small_payload2 = send_small_payload2;
   wqe->send_small_payload3 = send_small_payload3;
   wqe->immdt_data = immdt_data;
-  Debug("[WQE] wrid=0x%x\n", (uint32_t) wqe->wrid);
-  Debug("[WQE] laddr_low=0x%x\n", wqe->laddr_low);
-  Debug("[WQE] laddr_high=0x%x\n", wqe->laddr_high);
-  Debug("[WQE] length=0x%x\n", wqe->length);
-  Debug("[WQE] opcode=0x%x\n", wqe->opcode);
-  Debug("[WQE] remote_offset_low=0x%x\n", wqe->remote_offset_low);
-  Debug("[WQE] remote_offset_high=0x%x\n", wqe->remote_offset_high);
-  Debug("[WQE] r_key=0x%x\n", wqe->r_key);
-  Debug("[WQE] send_small_payload0=0x%x\n", wqe->send_small_payload0);
-  Debug("[WQE] send_small_payload1=0x%x\n", wqe->send_small_payload1);
-  Debug("[WQE] send_small_payload2=0x%x\n", wqe->send_small_payload2);
-  Debug("[WQE] send_small_payload3=0x%x\n", wqe->send_small_payload3);
-  Debug("[WQE] immdt_data=0x%x\n", wqe->immdt_data);
-  if(is_device_address(sq->dma_addr)) {
-    // Write WQE to SQ in the device memory
-    Debug("DEBUG: Write WQE to the device memory\n");
-    ssize_t rc = write_from_buffer(device, fpga_fd, (char* ) wqe, sizeof(struct rdma_wqe_t), (sq->dma_addr + (wqe_idx*sizeof(struct rdma_wqe_t))));
-    if (rc < 0){
-      fprintf(stderr, "Error: Failed to write WQE to the device memory!\n");
-      exit(EXIT_FAILURE);
+  RN_TRACE_EVENT(RN_TRACE_WQE_POST, qpid, slot,
+                 (((uint64_t) wqe->opcode) << 48) | (((uint64_t) wrid) << 32) | length);
+}
+
+/* Write a 64-byte WQE with four 16-byte stores. Non-temporal stores bypass the
+ * cache for an SQ the hardware reads from the host memory; they have to be
+ * fenced before the doorbell.
+ */
+static inline void store_wqe(struct rdma_wqe_t* dst, const struct rdma_wqe_t* src, int non_temporal) {
+#ifdef __SSE2__
+  __m128i* d = (__m128i* ) dst;
+  const __m128i* s = (const __m128i* ) src;
+  if(non_temporal) {
+    _mm_stream_si128(d,     _mm_loadu_si128(s));
+    _mm_stream_si128(d + 1, _mm_loadu_si128(s + 1));
+    _mm_stream_si128(d + 2, _mm_loadu_si128(s + 2));
+    _mm_stream_si128(d + 3, _mm_loadu_si128(s + 3));
+  } else {
+    _mm_store_si128(d,     _mm_loadu_si128(s));
+    _mm_store_si128(d + 1, _mm_loadu_si128(s + 1));
+    _mm_store_si128(d + 2, _mm_loadu_si128(s + 2));
+    _mm_store_si128(d + 3, _mm_loadu_si128(s + 3));
+  }
+#else
+  (void) non_temporal;
+  memcpy(dst, src, sizeof(struct rdma_wqe_t));
+#endif
+}
+
+int rdma_wqe_batch(struct rdma_dev_t* rdma_dev,
+                   uint32_t qpid,
+                   const struct rdma_wqe_desc_t* descs,
+                   uint32_t num_desc,
+                   uint32_t r_key) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+  struct rdma_wqe_t* sq_ring;
+  struct rdma_wqe_t wqe;
+  uint64_t win_mask;
+  uint64_t laddr;
+  uint32_t slot;
+  uint32_t i;
+  int non_temporal;
+  int aligned;
+
+  if(num_desc == 0) {
+    return 0;
+  }
+  if(num_desc > qp->sq_credits) {
+    RN_TRACE_EVENT(RN_TRACE_SQ_FULL, qpid, num_desc, qp->sq_credits);
+    return -1;
+  }
+
+  // Decide once per batch where WQEs go and how host addresses are masked
+  win_mask = (((uint64_t) rdma_dev->winSize->win_size_msb) << 32) | ((uint64_t) rdma_dev->winSize->win_size_lsb);
+  if(qp->sq_shadow != NULL) {
+    // Extend the dirty run of the device memory SQ, flush it first if it does
+    // not end where this batch starts
+    if((qp->sq_dirty_cnt != 0) && (((qp->sq_dirty_start + qp->sq_dirty_cnt) % qp->qdepth) != (uint32_t) qp->sq_pidb)) {
+      if(flush_sq_shadow(qp) < 0) {
+        return -1;
+      }
+    }
+    if(qp->sq_dirty_cnt == 0) {
+      qp->sq_dirty_start = qp->sq_pidb;
+    }
+    qp->sq_dirty_cnt += num_desc;
+    sq_ring = qp->sq_shadow;
+    non_temporal = 0;
+  } else {
+    sq_ring = (struct rdma_wqe_t* ) qp->sq->buffer;
+    non_temporal = 1;
+  }
+  // 16-byte stores need a 16-byte aligned ring, small SQs may not be
+  aligned = (((uint64_t) sq_ring) & 0xf) == 0;
+
+  memset(&wqe, 0, sizeof(struct rdma_wqe_t));
+  wqe.r_key = r_key;
+  slot = qp->sq_pidb;
+  for(i = 0; i < num_desc; i++) {
+    laddr = descs[i].laddr;
+    if(!is_device_address(laddr)) {
+      laddr &= win_mask;
+    }
+    wqe.wrid               = descs[i].wrid;
+    wqe.laddr_low          = (uint32_t) (laddr & 0x00000000ffffffff);
+    wqe.laddr_high         = (uint32_t) (laddr >> 32);
+    wqe.length             = descs[i].length;
+    wqe.opcode             = descs[i].opcode;
+    wqe.remote_offset_low  = (uint32_t) (descs[i].remote_offset & 0x00000000ffffffff);
+    wqe.remote_offset_high = (uint32_t) (descs[i].remote_offset >> 32);
+    if(aligned) {
+      store_wqe(&sq_ring[slot], &wqe, non_temporal);
     } else {
-      Debug("DEBUG: successfully write WQE to the device memory!\n");
+      memcpy(&sq_ring[slot], &wqe, sizeof(struct rdma_wqe_t));
     }
-    free(wqe);
+
+    qp->wr_ctx[slot].wrid   = descs[i].wrid;
+    qp->wr_ctx[slot].opcode = descs[i].opcode;
+    qp->wr_ctx[slot].length = descs[i].length;
+    RN_TRACE_EVENT(RN_TRACE_WQE_POST, qpid, slot,
+                   (((uint64_t) descs[i].opcode) << 48) | (((uint64_t) descs[i].wrid) << 32) | descs[i].length);
+
+    slot = (slot + 1 == qp->qdepth) ? 0 : slot + 1;
+  }
+
+#ifdef __SSE2__
+  if(non_temporal) {
+    // Non-temporal stores must be globally visible before the doorbell
+    _mm_sfence();
+  }
+#endif
+
+  return rdma_post_batch_send_async(rdma_dev, qpid, num_desc);
+}
+
+int rdma_send_inline(struct rdma_dev_t* rdma_dev,
+                     uint32_t qpid,
+                     uint16_t wrid,
+                     const void* payload,
+                     uint32_t length) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+  uint32_t small_payload[RDMA_INLINE_MAX >> 2];
+
+  if(length > RDMA_INLINE_MAX) {
+    fprintf(stderr, "Error: inline SEND payload of %d bytes exceeds %d bytes\n", length, RDMA_INLINE_MAX);
+    return -1;
+  }
+  if(qp->sq_credits == 0) {
+    RN_TRACE_EVENT(RN_TRACE_SQ_FULL, qpid, 1, qp->sq_credits);
+    return -1;
   }
+
+  memset(small_payload, 0, sizeof(small_payload));
+  memcpy(small_payload, payload, length);
+
+  create_a_wqe(rdma_dev, qpid, wrid, qp->sq_pidb, 0, length, RNIC_OP_SEND, 0, 0,
+               small_payload[0], small_payload[1], small_payload[2], small_payload[3], 0);
+
+  return rdma_post_send_async(rdma_dev, qpid);
+}
+
+int rdma_set_poll_mode(struct rdma_qp_t* qp, uint8_t poll_mode) {
+  if((poll_mode != RDMA_POLL_MMIO) && (poll_mode != RDMA_POLL_SHADOW) && (poll_mode != RDMA_POLL_CHECKED)) {
+    fprintf(stderr, "Error: unknown poll mode %d\n", poll_mode);
+    return -1;
+  }
+
+  if((poll_mode != RDMA_POLL_MMIO) && (qp->cq_db_shadow == NULL)) {
+    fprintf(stderr, "Error: qpid %d has no CQ doorbell in the host memory, only RDMA_POLL_MMIO is supported\n", qp->qpid);
+    return -1;
+  }
+
+  qp->poll_mode = poll_mode;
+  return 0;
+}
+
+/* Read a doorbell index either from its host memory shadow or from its register,
+ * depending on the poll mode of the queue pair.
+ */
+static uint32_t read_qp_db(struct rdma_qp_t* qp, volatile uint32_t* db_shadow, uint32_t reg_offset) {
+  uint32_t reg_val;
+  uint32_t shadow_val;
+
+  if((qp->poll_mode == RDMA_POLL_MMIO) || (db_shadow == NULL)) {
+    return read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(reg_offset, qp->qpid));
+  }
+
+  // Entries written by the hardware before the doorbell must not be read ahead of it
+  shadow_val = __atomic_load_n(db_shadow, __ATOMIC_ACQUIRE);
+  if(qp->poll_mode == RDMA_POLL_SHADOW) {
+    return shadow_val;
+  }
+
+  reg_val = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(reg_offset, qp->qpid));
+  if(reg_val != shadow_val) {
+    qp->poll_mismatch++;
+    RN_TRACE_EVENT(RN_TRACE_DB_MISMATCH, qp->qpid, reg_val, shadow_val);
+  }
+  return reg_val;
+}
+
+static inline uint32_t read_cq_head(struct rdma_qp_t* qp) {
+  return read_qp_db(qp, qp->cq_db_shadow, RN_RDMA_QCSR_CQHEADi);
+}
+
+static inline uint32_t read_rq_pidb(struct rdma_qp_t* qp) {
+  return read_qp_db(qp, qp->rq_db_shadow, RN_RDMA_QCSR_STATRQPIDBi);
 }
 
 int poll_rq_pidb(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
   struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
-  int rq_pidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qpid));
+  int rq_pidb = read_rq_pidb(qp);
 
-  // If poll, read until greater than what we previously have read
-  Debug("DEBUG: Polling on RQ PIDB. Count: 0x%x\n", rq_pidb);
-  if(getenv("DEBUG") && atoi(getenv("DEBUG")) == 1) {
+  // If poll, read until greater than what we previously have read. The debug
+  // flag is set once when the device is opened.
+  if(debug == 1) {
     dump_registers(rdma_dev, 0, qpid);
   }
   while(rq_pidb == qp->rq_pidb) {
-      rq_pidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qpid));
+      rq_pidb = read_rq_pidb(qp);
   }
 
-  qp->rq_pidb = rq_pidb;        
+  RN_TRACE_EVENT(RN_TRACE_RQ_POLL, qpid, rq_pidb, qp->rq_pidb);
+  qp->rq_pidb = rq_pidb;
   return qp->rq_pidb;
 }
 
 int poll_cq_cidb(struct rdma_dev_t* rdma_dev, uint32_t qpid, int sq_cidb) {
   int cq_cidb;
   uint32_t timeout_cnt = 0;
-  cq_cidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
-  Debug("[Register] RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), qpid, cq_cidb);
-
-  Debug("DEBUG: before polling: sq_cidb = %d; Polling CQ CIDB = %d\n", sq_cidb, cq_cidb);
+  cq_cidb = read_cq_head(rdma_dev->qps_ptr[qpid]);
+  RN_TRACE_EVENT(RN_TRACE_CQ_WAIT, qpid, sq_cidb, cq_cidb);
   // dump_registers(rdma_dev, 1, qpid);
   while(cq_cidb == sq_cidb) {
-    cq_cidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
+    cq_cidb = read_cq_head(rdma_dev->qps_ptr[qpid]);
     timeout_cnt += 1;
     if(timeout_cnt > TIMEOUT_THRESHOLD) {
       goto timeout_action;
@@ -854,7 +1522,7 @@ int poll_cq_cidb(struct rdma_dev_t* rdma_dev, uint32_t qpid, int sq_cidb) {
     //fprintf(stderr, "Waiting for completion doorbell index update\n");
   }
 
-  Debug("DEBUG: after polling: sq_cidb = %d; Polling CQ CIDB = %d\n", sq_cidb, cq_cidb);
+  RN_TRACE_EVENT(RN_TRACE_CQ_WAIT, qpid, sq_cidb, cq_cidb);
   return cq_cidb;
 
 timeout_action:
@@ -863,7 +1531,195 @@ timeout_action:
   return -1;
 }
 
-int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+/* Read the congestion counters of the ERNIC and move the rate of a paced
+ * queue pair, see rdma_pacer_t.
+ */
+static void update_pacer_rate(struct rdma_qp_t* qp, uint64_t now_ns) {
+  struct rdma_pacer_t* pacer = &qp->pacer;
+  uint32_t* axil_ctl = qp->rdma_dev->axil_ctl;
+  uint32_t cnp_cnt   = read32_data(axil_ctl, RN_RDMA_GCSR_INCNPPKTCNT);
+  uint32_t nak_cnt   = read32_data(axil_ctl, RN_RDMA_GCSR_INNAKPKTCNT);
+  uint32_t retry_cnt = read32_data(axil_ctl, RN_RDMA_GCSR_RETRYCNTSTS);
+
+  pacer->last_update_ns = now_ns;
+  if((cnp_cnt != pacer->cnp_cnt) || (nak_cnt != pacer->nak_cnt) || (retry_cnt != pacer->retry_cnt)) {
+    // Congestion: remember the rate to recover to and cut by alpha/2
+    pacer->cnp_cnt   = cnp_cnt;
+    pacer->nak_cnt   = nak_cnt;
+    pacer->retry_cnt = retry_cnt;
+    pacer->alpha += (RDMA_PACER_ALPHA_ONE - pacer->alpha) >> RDMA_PACER_ALPHA_SHIFT;
+    pacer->target_rate = pacer->rate;
+    pacer->rate -= (pacer->rate * pacer->alpha) / (2 * RDMA_PACER_ALPHA_ONE);
+    if(pacer->rate < pacer->min_rate) {
+      pacer->rate = pacer->min_rate;
+    }
+    pacer->recovery_periods = 0;
+    pacer->state = RDMA_PACER_FAST_RECOVERY;
+    pacer->rate_cuts++;
+    return;
+  }
+
+  pacer->alpha -= pacer->alpha >> RDMA_PACER_ALPHA_SHIFT;
+  if(pacer->state == RDMA_PACER_LINE_RATE) {
+    return;
+  }
+  pacer->recovery_periods++;
+  if(pacer->recovery_periods > RDMA_PACER_RECOVERY_PERIODS) {
+    pacer->state = RDMA_PACER_ADDITIVE;
+    pacer->target_rate += pacer->max_rate / RDMA_PACER_STEP_DIV;
+    if(pacer->target_rate > pacer->max_rate) {
+      pacer->target_rate = pacer->max_rate;
+    }
+  }
+  pacer->rate = (pacer->rate + pacer->target_rate + 1) / 2;
+  if(pacer->rate >= pacer->max_rate) {
+    pacer->rate  = pacer->max_rate;
+    pacer->state = RDMA_PACER_LINE_RATE;
+  }
+}
+
+/* Wait until the token bucket of a paced queue pair holds tokens, then take
+ * bytes from it. The bucket may go negative, so that doorbells larger than
+ * the bucket are delayed by the next ones instead of blocking forever.
+ */
+static void pace_doorbell(struct rdma_qp_t* qp, uint64_t bytes) {
+  struct rdma_pacer_t* pacer = &qp->pacer;
+  uint64_t start_ns = 0;
+  uint64_t now_ns;
+  uint64_t elapsed_ns;
+  uint64_t earned;
+
+  while(1) {
+    now_ns = get_time_ns();
+    if((now_ns - pacer->last_update_ns) >= RDMA_PACER_PERIOD_NS) {
+      update_pacer_rate(qp, now_ns);
+    }
+    // Any idle time beyond a second fills the bucket anyway
+    elapsed_ns = now_ns - pacer->last_refill_ns;
+    if(elapsed_ns > NSEC_DIV) {
+      elapsed_ns = NSEC_DIV;
+    }
+    earned = (pacer->rate * elapsed_ns) / NSEC_DIV;
+    if((pacer->tokens + (int64_t) earned) >= (int64_t) pacer->bucket_size) {
+      pacer->tokens = (int64_t) pacer->bucket_size;
+      pacer->last_refill_ns = now_ns;
+    } else if(earned != 0) {
+      // Only move the refill time by the time the whole bytes took, so that
+      // the fractions of a byte left by short spins are not lost
+      pacer->tokens += (int64_t) earned;
+      pacer->last_refill_ns += (earned * NSEC_DIV) / pacer->rate;
+    }
+    if(pacer->tokens > 0) {
+      break;
+    }
+    if(start_ns == 0) {
+      start_ns = now_ns;
+    }
+#ifdef __SSE2__
+    _mm_pause();
+#endif
+  }
+  if(start_ns != 0) {
+    pacer->wait_ns += now_ns - start_ns;
+  }
+  pacer->tokens -= (int64_t) bytes;
+}
+
+int rdma_flush_doorbell(struct rdma_qp_t* qp) {
+  struct rdma_db_coalescer_t* dbc = &qp->db_coalescer;
+
+  if(dbc->pending_wqes == 0) {
+    return 0;
+  }
+
+  if(qp->pacer.state != RDMA_PACER_OFF) {
+    pace_doorbell(qp, dbc->pending_bytes);
+  }
+
+  // WQEs staged for an SQ in the device memory have to land before the doorbell
+  if(flush_sq_shadow(qp) < 0) {
+    return -1;
+  }
+
+  // Update sq_pidb to hardware
+  write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qp->qpid), qp->sq_pidb);
+  RN_TRACE_EVENT(RN_TRACE_DOORBELL, qp->qpid, qp->sq_pidb, dbc->pending_wqes);
+
+  dbc->doorbells_rung++;
+  dbc->doorbells_saved += dbc->pending_posts - 1;
+  dbc->pending_wqes  = 0;
+  dbc->pending_posts = 0;
+  dbc->pending_bytes = 0;
+  return 0;
+}
+
+/* Ring the doorbell if the oldest WQE held back by the coalescer has waited
+ * past the deadline.
+ */
+static inline int check_db_deadline(struct rdma_qp_t* qp) {
+  struct rdma_db_coalescer_t* dbc = &qp->db_coalescer;
+
+  if((dbc->pending_wqes != 0) && (dbc->deadline_ns != 0) &&
+     ((get_time_ns() - dbc->first_post_ns) >= dbc->deadline_ns)) {
+    return rdma_flush_doorbell(qp);
+  }
+  return 0;
+}
+
+int rdma_set_db_coalescing(struct rdma_qp_t* qp, uint32_t max_wqes, uint64_t max_bytes, uint64_t deadline_ns) {
+  if(rdma_flush_doorbell(qp) < 0) {
+    return -1;
+  }
+
+  qp->db_coalescer.max_wqes    = max_wqes;
+  qp->db_coalescer.max_bytes   = max_bytes;
+  qp->db_coalescer.deadline_ns = deadline_ns;
+  return 0;
+}
+
+int rdma_set_pacing(struct rdma_qp_t* qp, uint32_t max_rate_mbps, uint32_t min_rate_mbps, uint32_t bucket_size) {
+  struct rdma_pacer_t* pacer = &qp->pacer;
+  uint32_t* axil_ctl = qp->rdma_dev->axil_ctl;
+
+  if((max_rate_mbps > RDMA_PACER_MAX_RATE_MBPS) || (min_rate_mbps > max_rate_mbps)) {
+    fprintf(stderr, "Error: pacing rates of %d and %d Mb/s are out of range\n", min_rate_mbps, max_rate_mbps);
+    return -1;
+  }
+  if(rdma_flush_doorbell(qp) < 0) {
+    return -1;
+  }
+
+  memset(pacer, 0, sizeof(struct rdma_pacer_t));
+  if(max_rate_mbps == 0) {
+    return 0;
+  }
+  // Mb/s to bytes per second
+  pacer->max_rate    = (uint64_t) max_rate_mbps * 125000;
+  pacer->min_rate    = (min_rate_mbps != 0) ? ((uint64_t) min_rate_mbps * 125000) : (pacer->max_rate / RDMA_PACER_STEP_DIV);
+  pacer->rate        = pacer->max_rate;
+  pacer->target_rate = pacer->max_rate;
+  pacer->bucket_size = (bucket_size != 0) ? bucket_size : RDMA_PACER_BUCKET_DEFAULT;
+  pacer->tokens      = (int64_t) pacer->bucket_size;
+  pacer->alpha       = RDMA_PACER_ALPHA_ONE;
+  // Only events from now on count as congestion
+  pacer->cnp_cnt     = read32_data(axil_ctl, RN_RDMA_GCSR_INCNPPKTCNT);
+  pacer->nak_cnt     = read32_data(axil_ctl, RN_RDMA_GCSR_INNAKPKTCNT);
+  pacer->retry_cnt   = read32_data(axil_ctl, RN_RDMA_GCSR_RETRYCNTSTS);
+  pacer->last_refill_ns = get_time_ns();
+  pacer->last_update_ns = pacer->last_refill_ns;
+  pacer->state       = RDMA_PACER_LINE_RATE;
+  return 0;
+}
+
+uint32_t rdma_pacing_rate(struct rdma_qp_t* qp) {
+  return (uint32_t) (qp->pacer.rate / 125000);
+}
+
+int rdma_post_batch_send_async(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t batch_size) {
+  struct rdma_db_coalescer_t* dbc;
+  uint32_t slot;
+  uint32_t i;
+
   if(rdma_dev == NULL) {
     fprintf(stderr, "Error: rdma_dev is NULL\n");  
     exit(EXIT_FAILURE);
@@ -871,30 +1727,627 @@ int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
 
   struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
 
-  // Increase send queue producer index doorbell
-  Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
-  Debug("DEBUG: original qp->sq_pidb = 0x%x\n", qp->sq_pidb);
-  
-  qp->sq_pidb++;
+  // Never post more WQEs than the SQ has free slots
+  if(batch_size > qp->sq_credits) {
+    RN_TRACE_EVENT(RN_TRACE_SQ_FULL, qpid, batch_size, qp->sq_credits);
+    return -1;
+  }
 
-  // Update sq_pidb to hardware
-  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qp->sq_pidb);
-  Debug("[Register] RN_RDMA_QCSR_SQPIi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qpid, qp->sq_pidb);
-  Debug("DEBUG: Update hardware sq db idx from software = %d\n", qp->sq_pidb);
-  Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
+  dbc = &qp->db_coalescer;
+  // Payload bytes are only counted if a byte limit or the pacer needs them
+  if((dbc->max_bytes != 0) || (qp->pacer.state != RDMA_PACER_OFF)) {
+    slot = qp->sq_pidb;
+    for(i = 0; i < batch_size; i++) {
+      dbc->pending_bytes += qp->wr_ctx[slot].length;
+      slot = (slot + 1 == qp->qdepth) ? 0 : slot + 1;
+    }
+  }
+  qp->sq_pidb = (qp->sq_pidb + batch_size) % qp->qdepth;
+  qp->sq_credits -= batch_size;
 
-  // polling on completion, by checking CQ doorbell
-  qp->cq_cidb = poll_cq_cidb(rdma_dev, qpid, qp->sq_cidb);
-  qp->sq_cidb++;
+  if((dbc->pending_wqes == 0) && (dbc->deadline_ns != 0)) {
+    dbc->first_post_ns = get_time_ns();
+  }
+  dbc->pending_wqes += batch_size;
+  dbc->pending_posts++;
+
+  // Ring the doorbell now unless the coalescer may hold the WQEs back
+  if((dbc->max_wqes <= 1) || (dbc->pending_wqes >= dbc->max_wqes) ||
+     ((dbc->max_bytes != 0) && (dbc->pending_bytes >= dbc->max_bytes))) {
+    return rdma_flush_doorbell(qp);
+  }
+
+  return check_db_deadline(qp);
+}
+
+int rdma_post_send_async(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  return rdma_post_batch_send_async(rdma_dev, qpid, 1);
+}
+
+int rdma_wait_qp_event(struct rdma_event_channel_t* ch, struct rdma_qp_t* qp, int timeout_ms) {
+  if(rdma_flush_doorbell(qp) < 0) {
+    return -1;
+  }
+  return rdma_wait_event(ch, qp->qpid, timeout_ms);
+}
+
+int rdma_poll_cq(struct rdma_qp_t* qp, uint32_t max, struct rdma_completion_t* completions) {
+  uint32_t* cqe_base = NULL;
+  uint32_t num_completed;
+  uint32_t slot;
+  uint32_t cqe;
+  uint32_t i;
+  int cq_head;
+
+  if(check_db_deadline(qp) < 0) {
+    return -1;
+  }
+
+  cq_head = read_cq_head(qp);
+  num_completed = (uint32_t) (cq_head + qp->qdepth - qp->sq_cidb) % qp->qdepth;
+  if(num_completed == 0) {
+    return 0;
+  }
+  if(num_completed > max) {
+    num_completed = max;
+  }
+
+  // CQEs can only be decoded from the host memory. CQs in the device memory
+  // report completions from the software records only.
+  if(!is_device_address(qp->cq->dma_addr)) {
+    cqe_base = (uint32_t* ) qp->cq->buffer;
+  }
+
+  for(i = 0; i < num_completed; i++) {
+    slot = (qp->sq_cidb + i) % qp->qdepth;
+    completions[i].wrid     = qp->wr_ctx[slot].wrid;
+    completions[i].opcode   = qp->wr_ctx[slot].opcode;
+    completions[i].byte_len = qp->wr_ctx[slot].length;
+    completions[i].status   = 0;
+    if(cqe_base != NULL) {
+      cqe = ((volatile uint32_t* ) cqe_base)[slot];
+      completions[i].status = RDMA_CQE_STATUS(cqe);
+    }
+  }
+
+  // Completed slots can be reused by new WQEs
+  qp->sq_cidb = (qp->sq_cidb + num_completed) % qp->qdepth;
+  qp->cq_cidb = qp->sq_cidb;
+  qp->sq_credits += num_completed;
+  RN_TRACE_EVENT(RN_TRACE_CQ_POLL, qp->qpid, num_completed, qp->sq_cidb);
+
+  return (int) num_completed;
+}
+
+uint32_t rdma_sq_credits(struct rdma_qp_t* qp) {
+  return qp->sq_credits;
+}
+
+int rdma_sq_reserve(struct rdma_qp_t* qp, uint32_t num_wqe) {
+  struct rdma_completion_t completions[64];
+  uint32_t timeout_cnt = 0;
+  int rc;
+
+  if(num_wqe > (qp->qdepth - 1)) {
+    fprintf(stderr, "Error: %d WQEs requested, but the SQ of qpid %d can hold at most %d\n", num_wqe, qp->qpid, qp->qdepth - 1);
+    return -1;
+  }
+
+  // Nothing held back by the doorbell coalescer can complete, announce it first
+  if((qp->sq_credits < num_wqe) && (rdma_flush_doorbell(qp) < 0)) {
+    return -1;
+  }
+
+  // Gives up after TIMEOUT_THRESHOLD polls without progress, like poll_cq_cidb() does
+  while(qp->sq_credits < num_wqe) {
+    rc = rdma_poll_cq(qp, 64, completions);
+    if(rc < 0) {
+      return -1;
+    }
+    if(rc > 0) {
+      timeout_cnt = 0;
+      continue;
+    }
+    timeout_cnt += 1;
+    if(timeout_cnt > TIMEOUT_THRESHOLD) {
+      fprintf(stderr, "ERROR: rdma_sq_reserve timeout! sq_pidb = %d; sq_cidb = %d; sq_credits = %d\n", qp->sq_pidb, qp->sq_cidb, qp->sq_credits);
+      dump_registers(qp->rdma_dev, 1, qp->qpid);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int rdma_sq_drain(struct rdma_qp_t* qp) {
+  return rdma_sq_reserve(qp, qp->qdepth - 1);
+}
+
+/* Split a transfer into chunks and keep every free SQ slot busy with them
+ * until the whole transfer is completed. All chunks carry the same wrid.
+ */
+static int rdma_xfer_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid, uint8_t opcode,
+                           uint64_t laddr, uint64_t remote_offset, uint64_t length,
+                           uint32_t chunk_size, uint32_t r_key) {
+  struct rdma_qp_t* qp;
+  struct rdma_completion_t completions[RDMA_XFER_BATCH];
+  struct rdma_wqe_desc_t descs[RDMA_XFER_BATCH];
+  uint64_t num_chunks;
+  uint64_t chunks_posted = 0;
+  uint64_t chunks_done = 0;
+  uint64_t offset;
+  uint64_t idle_since_ns = 0;
+  uint32_t idle_cnt = 0;
+  uint32_t batch_size;
+  uint32_t i;
+  int failed = 0;
+  int rc;
+
+  if((qpid == 0) || (qpid >= rdma_dev->num_qp) || (rdma_dev->qps_ptr[qpid] == NULL)) {
+    fprintf(stderr, "Error: qpid %d is not allocated\n", qpid);
+    return -1;
+  }
+  qp = rdma_dev->qps_ptr[qpid];
+  if(length == 0) {
+    return 0;
+  }
+  if(chunk_size == 0) {
+    chunk_size = RDMA_XFER_CHUNK_DEFAULT;
+  }
+  num_chunks = (length + chunk_size - 1) / chunk_size;
+
+  // WQEs posted before would be taken for chunks, let them complete first
+  if(rdma_sq_drain(qp) < 0) {
+    return -1;
+  }
+
+  memset(descs, 0, sizeof(descs));
+  while(chunks_done < chunks_posted || (!failed && chunks_posted < num_chunks)) {
+    // Refill the free SQ slots, one doorbell per refill
+    batch_size = failed ? 0 : qp->sq_credits;
+    if(batch_size > RDMA_XFER_BATCH) {
+      batch_size = RDMA_XFER_BATCH;
+    }
+    if(batch_size > num_chunks - chunks_posted) {
+      batch_size = (uint32_t) (num_chunks - chunks_posted);
+    }
+    if(batch_size > 0) {
+      for(i = 0; i < batch_size; i++) {
+        offset = (chunks_posted + i) * chunk_size;
+        descs[i].laddr         = laddr + offset;
+        descs[i].remote_offset = remote_offset + offset;
+        descs[i].length        = (length - offset < chunk_size) ? (uint32_t) (length - offset) : chunk_size;
+        descs[i].wrid          = wrid;
+        descs[i].opcode        = opcode;
+      }
+      if((rdma_wqe_batch(rdma_dev, qpid, descs, batch_size, r_key) < 0) || (rdma_flush_doorbell(qp) < 0)) {
+        return -1;
+      }
+      chunks_posted += batch_size;
+    }
+
+    rc = rdma_poll_cq(qp, RDMA_XFER_BATCH, completions);
+    if(rc < 0) {
+      return -1;
+    }
+    // A chunk may take much longer than a poll, so give up on time rather
+    // than on a poll count
+    if(rc == 0) {
+      idle_cnt += 1;
+      if(idle_since_ns == 0) {
+        idle_since_ns = get_time_ns();
+      } else if(((idle_cnt & 0x3ff) == 0) && ((get_time_ns() - idle_since_ns) > RDMA_XFER_TIMEOUT_NS)) {
+        fprintf(stderr, "ERROR: rdma_xfer_large timeout! qpid = %d, %lu of %lu chunks completed\n", qpid, chunks_done, num_chunks);
+        dump_registers(rdma_dev, 1, qpid);
+        return -1;
+      }
+      continue;
+    }
+    idle_since_ns = 0;
+    for(i = 0; i < (uint32_t) rc; i++) {
+      if(completions[i].status != 0) {
+        failed = 1;
+      }
+    }
+    chunks_done += rc;
+  }
+
+  if(failed) {
+    fprintf(stderr, "Error: a chunk of the transfer on qpid %d completed with an error\n", qpid);
+    return -1;
+  }
+  return 0;
+}
+
+int rdma_read_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid,
+                    uint64_t laddr, uint64_t remote_offset, uint64_t length,
+                    uint32_t chunk_size, uint32_t r_key) {
+  return rdma_xfer_large(rdma_dev, qpid, wrid, RNIC_OP_READ, laddr, remote_offset, length, chunk_size, r_key);
+}
+
+int rdma_write_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid,
+                     uint64_t laddr, uint64_t remote_offset, uint64_t length,
+                     uint32_t chunk_size, uint32_t r_key) {
+  return rdma_xfer_large(rdma_dev, qpid, wrid, RNIC_OP_WRITE, laddr, remote_offset, length, chunk_size, r_key);
+}
+
+struct rdma_stripe_t* rdma_stripe_create(struct rdma_dev_t* rdma_dev, const uint32_t* qpids,
+                                         uint32_t num_qps, uint32_t chunk_size, uint8_t policy) {
+  struct rdma_stripe_t* stripe;
+  struct rdma_qp_t* qp;
+  uint32_t i;
+
+  if(num_qps == 0) {
+    fprintf(stderr, "Error: a stripe needs at least one QP\n");
+    return NULL;
+  }
+  if(policy > RDMA_STRIPE_LEAST_LOADED) {
+    fprintf(stderr, "Error: unknown stripe policy %d\n", policy);
+    return NULL;
+  }
+  for(i = 0; i < num_qps; i++) {
+    if((qpids[i] == 0) || (qpids[i] >= rdma_dev->num_qp) || (rdma_dev->qps_ptr[qpids[i]] == NULL)) {
+      fprintf(stderr, "Error: qpid %d is not allocated\n", qpids[i]);
+      return NULL;
+    }
+    // Chunks of one transfer must all reach the same remote buffer
+    qp = rdma_dev->qps_ptr[qpids[i]];
+    if((qp->dst_ip != rdma_dev->qps_ptr[qpids[0]]->dst_ip) ||
+       memcmp(qp->dst_mac, rdma_dev->qps_ptr[qpids[0]]->dst_mac, sizeof(struct mac_addr_t))) {
+      fprintf(stderr, "Error: qpid %d and qpid %d have different destinations\n", qpids[0], qpids[i]);
+      return NULL;
+    }
+  }
+
+  stripe = (struct rdma_stripe_t* ) calloc(1, sizeof(struct rdma_stripe_t));
+  if(stripe == NULL) {
+    fprintf(stderr, "Error: failed to allocate a stripe\n");
+    return NULL;
+  }
+  stripe->rdma_dev     = rdma_dev;
+  stripe->num_qps      = num_qps;
+  stripe->chunk_size   = (chunk_size == 0) ? RDMA_XFER_CHUNK_DEFAULT : chunk_size;
+  stripe->policy       = policy;
+  stripe->qps          = (struct rdma_qp_t** ) calloc(num_qps, sizeof(struct rdma_qp_t*));
+  stripe->pending      = (uint32_t* ) calloc(num_qps, sizeof(uint32_t));
+  stripe->outstanding  = (uint64_t* ) calloc(num_qps, sizeof(uint64_t));
+  stripe->bytes_posted = (uint64_t* ) calloc(num_qps, sizeof(uint64_t));
+  stripe->descs        = (struct rdma_wqe_desc_t* ) calloc((size_t) num_qps * RDMA_XFER_BATCH, sizeof(struct rdma_wqe_desc_t));
+  if((stripe->qps == NULL) || (stripe->pending == NULL) || (stripe->outstanding == NULL) ||
+     (stripe->bytes_posted == NULL) || (stripe->descs == NULL)) {
+    fprintf(stderr, "Error: failed to allocate a stripe\n");
+    rdma_stripe_destroy(stripe);
+    return NULL;
+  }
+  for(i = 0; i < num_qps; i++) {
+    stripe->qps[i] = rdma_dev->qps_ptr[qpids[i]];
+  }
+
+  return stripe;
+}
+
+/* Index of the QP the next chunk of a stripe goes to, or -1 if no QP has a
+ * free SQ slot left in this refill.
+ */
+static int stripe_pick_qp(struct rdma_stripe_t* stripe) {
+  uint32_t best = stripe->num_qps;
+  uint32_t i;
+  uint32_t k;
+
+  for(i = 0; i < stripe->num_qps; i++) {
+    k = (stripe->next_qp + i) % stripe->num_qps;
+    if((stripe->pending[k] >= RDMA_XFER_BATCH) || (stripe->pending[k] >= stripe->qps[k]->sq_credits)) {
+      continue;
+    }
+    if(stripe->policy == RDMA_STRIPE_ROUND_ROBIN) {
+      best = k;
+      break;
+    }
+    if((best == stripe->num_qps) || (stripe->outstanding[k] < stripe->outstanding[best])) {
+      best = k;
+    }
+  }
+  if(best == stripe->num_qps) {
+    return -1;
+  }
+  stripe->next_qp = (best + 1) % stripe->num_qps;
+  return (int) best;
+}
+
+/* Same loop as rdma_xfer_large(), except that every refill spreads the chunks
+ * over the QPs of the stripe and every poll reaps the CQs of all of them.
+ */
+static int rdma_stripe_xfer(struct rdma_stripe_t* stripe, uint16_t wrid, uint8_t opcode,
+                            uint64_t laddr, uint64_t remote_offset, uint64_t length, uint32_t r_key) {
+  struct rdma_completion_t completions[RDMA_XFER_BATCH];
+  struct rdma_wqe_desc_t* desc;
+  struct rdma_qp_t* qp;
+  uint32_t chunk_size = stripe->chunk_size;
+  uint64_t num_chunks;
+  uint64_t chunks_posted = 0;
+  uint64_t chunks_done = 0;
+  uint64_t offset;
+  uint64_t idle_since_ns = 0;
+  uint32_t idle_cnt = 0;
+  uint32_t num_pending;
+  uint32_t progress;
+  uint32_t i;
+  uint32_t k;
+  int failed = 0;
+  int rc;
+
+  if(length == 0) {
+    return 0;
+  }
+  num_chunks = (length + chunk_size - 1) / chunk_size;
+
+  // WQEs posted before would be taken for chunks, let them complete first
+  for(k = 0; k < stripe->num_qps; k++) {
+    if(rdma_sq_drain(stripe->qps[k]) < 0) {
+      return -1;
+    }
+    stripe->pending[k] = 0;
+    stripe->outstanding[k] = 0;
+  }
+
+  while(chunks_done < chunks_posted || (!failed && chunks_posted < num_chunks)) {
+    // Hand out the next chunks to the QPs with free SQ slots
+    while(!failed && (chunks_posted < num_chunks) && ((rc = stripe_pick_qp(stripe)) >= 0)) {
+      k = (uint32_t) rc;
+      offset = chunks_posted * chunk_size;
+      desc = &stripe->descs[k * RDMA_XFER_BATCH + stripe->pending[k]];
+      desc->laddr         = laddr + offset;
+      desc->remote_offset = remote_offset + offset;
+      desc->length        = (length - offset < chunk_size) ? (uint32_t) (length - offset) : chunk_size;
+      desc->wrid          = wrid;
+      desc->opcode        = opcode;
+      stripe->pending[k] += 1;
+      stripe->outstanding[k] += desc->length;
+      stripe->bytes_posted[k] += desc->length;
+      chunks_posted += 1;
+    }
+
+    // One doorbell per QP and refill
+    for(k = 0; k < stripe->num_qps; k++) {
+      if(stripe->pending[k] == 0) {
+        continue;
+      }
+      qp = stripe->qps[k];
+      num_pending = stripe->pending[k];
+      stripe->pending[k] = 0;
+      if((rdma_wqe_batch(stripe->rdma_dev, qp->qpid, &stripe->descs[k * RDMA_XFER_BATCH], num_pending, r_key) < 0) ||
+         (rdma_flush_doorbell(qp) < 0)) {
+        return -1;
+      }
+    }
+
+    // Merge the completions of all QPs
+    progress = 0;
+    for(k = 0; k < stripe->num_qps; k++) {
+      rc = rdma_poll_cq(stripe->qps[k], RDMA_XFER_BATCH, completions);
+      if(rc < 0) {
+        return -1;
+      }
+      for(i = 0; i < (uint32_t) rc; i++) {
+        if(completions[i].status != 0) {
+          failed = 1;
+        }
+        stripe->outstanding[k] -= completions[i].byte_len;
+      }
+      progress += (uint32_t) rc;
+    }
+    if(progress == 0) {
+      idle_cnt += 1;
+      if(idle_since_ns == 0) {
+        idle_since_ns = get_time_ns();
+      } else if(((idle_cnt & 0x3ff) == 0) && ((get_time_ns() - idle_since_ns) > RDMA_XFER_TIMEOUT_NS)) {
+        fprintf(stderr, "ERROR: rdma_stripe_xfer timeout! %lu of %lu chunks completed\n", chunks_done, num_chunks);
+        for(k = 0; k < stripe->num_qps; k++) {
+          dump_registers(stripe->rdma_dev, 1, stripe->qps[k]->qpid);
+        }
+        return -1;
+      }
+      continue;
+    }
+    idle_since_ns = 0;
+    chunks_done += progress;
+  }
+
+  if(failed) {
+    fprintf(stderr, "Error: a chunk of the striped transfer completed with an error\n");
+    return -1;
+  }
+  return 0;
+}
+
+int rdma_stripe_read(struct rdma_stripe_t* stripe, uint16_t wrid, uint64_t laddr,
+                     uint64_t remote_offset, uint64_t length, uint32_t r_key) {
+  return rdma_stripe_xfer(stripe, wrid, RNIC_OP_READ, laddr, remote_offset, length, r_key);
+}
+
+int rdma_stripe_write(struct rdma_stripe_t* stripe, uint16_t wrid, uint64_t laddr,
+                      uint64_t remote_offset, uint64_t length, uint32_t r_key) {
+  return rdma_stripe_xfer(stripe, wrid, RNIC_OP_WRITE, laddr, remote_offset, length, r_key);
+}
+
+void rdma_stripe_destroy(struct rdma_stripe_t* stripe) {
+  if(stripe == NULL) {
+    return;
+  }
+  free(stripe->qps);
+  free(stripe->pending);
+  free(stripe->outstanding);
+  free(stripe->bytes_posted);
+  free(stripe->descs);
+  free(stripe);
+}
+
+struct rdma_cq_group_t* rdma_create_cq_group(struct rdma_dev_t* rdma_dev) {
+  struct rdma_cq_group_t* group;
+
+  group = (struct rdma_cq_group_t* ) malloc(sizeof(struct rdma_cq_group_t));
+  if(group == NULL) {
+    fprintf(stderr, "Error: failed to allocate rdma_cq_group\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(group, 0, sizeof(struct rdma_cq_group_t));
+  group->rdma_dev = rdma_dev;
 
-  if(qp->cq_cidb < 0) {
+  return group;
+}
+
+int rdma_cq_group_add(struct rdma_cq_group_t* group, uint32_t qpid) {
+  struct rdma_qp_t* qp;
+  uint32_t word;
+  uint32_t mask;
+
+  if((qpid == 0) || (qpid >= group->rdma_dev->num_qp) || (qpid > 256) || (group->rdma_dev->qps_ptr[qpid] == NULL)) {
+    fprintf(stderr, "Error: qpid %d is not allocated, it can't be added to the CQ group\n", qpid);
     return -1;
+  }
+
+  qp   = group->rdma_dev->qps_ptr[qpid];
+  word = (qpid - 1) >> 5;
+  mask = 1U << ((qpid - 1) & 0x1f);
+  if(((group->mmio_watch[word] | group->shadow_watch[word]) & mask) == 0) {
+    group->num_qp++;
+  }
+
+  if((qp->poll_mode != RDMA_POLL_MMIO) && (qp->cq_db_shadow != NULL)) {
+    group->shadow_watch[word] |= mask;
+    group->mmio_watch[word]   &= ~mask;
+    group->mmio_pending[word] &= ~mask;
   } else {
+    // Its CQINTSTS bit may be gone already, check the QP once
+    group->mmio_watch[word]   |= mask;
+    group->mmio_pending[word] |= mask;
+    group->shadow_watch[word] &= ~mask;
+  }
+
+  return 0;
+}
+
+int rdma_cq_group_set_event_channel(struct rdma_cq_group_t* group, struct rdma_event_channel_t* ch) {
+  if(group->event_ch != NULL) {
+    rdma_event_remove_cq_sink(group->event_ch, group->cq_events);
+    group->event_ch = NULL;
+  }
+  if(ch == NULL) {
     return 0;
   }
+  if(rdma_event_add_cq_sink(ch, group->cq_events) < 0) {
+    return -1;
+  }
+  group->event_ch = ch;
+  // Bits the channel cleared before are lost, check every QP once
+  memcpy(group->mmio_pending, group->mmio_watch, sizeof(group->mmio_pending));
+  return 0;
 }
 
-int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t batch_size) {
+void rdma_cq_group_remove(struct rdma_cq_group_t* group, uint32_t qpid) {
+  uint32_t word;
+  uint32_t mask;
+
+  if((qpid == 0) || (qpid > 256)) {
+    return;
+  }
+
+  word = (qpid - 1) >> 5;
+  mask = 1U << ((qpid - 1) & 0x1f);
+  if((group->mmio_watch[word] | group->shadow_watch[word]) & mask) {
+    group->num_qp--;
+  }
+  group->mmio_watch[word]   &= ~mask;
+  group->mmio_pending[word] &= ~mask;
+  group->shadow_watch[word] &= ~mask;
+}
+
+uint32_t rdma_cq_group_poll(struct rdma_cq_group_t* group, struct rdma_cq_ready_t* ready, uint32_t max) {
+  struct rdma_dev_t* rdma_dev = group->rdma_dev;
+  struct rdma_qp_t* qp;
+  uint32_t num_ready = 0;
+  uint32_t pending;
+  uint32_t bits;
+  uint32_t cq_head;
+  uint32_t qpid;
+  uint32_t bit;
+  uint32_t w;
+
+  for(w = 0; (w < 8) && (num_ready < max); w++) {
+    // QPs with a CQ doorbell in the host memory: compare the cached head with
+    // what has been consumed, no register access
+    pending = group->shadow_watch[w];
+    while((pending != 0) && (num_ready < max)) {
+      bit = (uint32_t) __builtin_ctz(pending);
+      pending &= pending - 1;
+      qpid = (w << 5) + bit + 1;
+      qp = rdma_dev->qps_ptr[qpid];
+      // A failed flush leaves the WQEs pending, the next sweep retries
+      check_db_deadline(qp);
+      cq_head = __atomic_load_n(qp->cq_db_shadow, __ATOMIC_ACQUIRE);
+      if(cq_head != (uint32_t) qp->sq_cidb) {
+        ready[num_ready].qpid    = qpid;
+        ready[num_ready].cq_head = cq_head;
+        num_ready++;
+      }
+    }
+
+    // Other QPs: only the ones whose CQINTSTS bit was set. The bits are taken
+    // from the event channel if there is one, it clears the registers.
+    if(group->mmio_watch[w] == 0) {
+      continue;
+    }
+    // WQEs held back by the coalescer raise no interrupt, their deadline is
+    // checked in the host memory
+    pending = group->mmio_watch[w];
+    while(pending != 0) {
+      bit = (uint32_t) __builtin_ctz(pending);
+      pending &= pending - 1;
+      qp = rdma_dev->qps_ptr[(w << 5) + bit + 1];
+      if(qp->db_coalescer.pending_wqes != 0) {
+        check_db_deadline(qp);
+      }
+    }
+    if(group->event_ch != NULL) {
+      bits = __atomic_exchange_n(&group->cq_events[w], 0, __ATOMIC_ACQUIRE);
+    } else {
+      bits = read32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_CQINTSTS1 + (w << 2));
+    }
+    group->mmio_pending[w] |= bits & group->mmio_watch[w];
+    pending = group->mmio_pending[w];
+    while((pending != 0) && (num_ready < max)) {
+      bit = (uint32_t) __builtin_ctz(pending);
+      pending &= pending - 1;
+      qpid = (w << 5) + bit + 1;
+      qp = rdma_dev->qps_ptr[qpid];
+      // Everything the hardware was told about is reaped
+      if(qp->sq_credits + qp->db_coalescer.pending_wqes >= qp->qdepth - 1) {
+        group->mmio_pending[w] &= ~(1U << bit);
+        continue;
+      }
+      cq_head = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
+      if(cq_head != (uint32_t) qp->sq_cidb) {
+        ready[num_ready].qpid    = qpid;
+        ready[num_ready].cq_head = cq_head;
+        num_ready++;
+      } else {
+        // Completions arriving later set the bit again
+        group->mmio_pending[w] &= ~(1U << bit);
+      }
+    }
+  }
+
+  return num_ready;
+}
+
+void rdma_destroy_cq_group(struct rdma_cq_group_t* group) {
+  if(group->event_ch != NULL) {
+    rdma_event_remove_cq_sink(group->event_ch, group->cq_events);
+  }
+  free(group);
+}
+
+int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
   if(rdma_dev == NULL) {
     fprintf(stderr, "Error: rdma_dev is NULL\n");  
     exit(EXIT_FAILURE);
@@ -902,35 +2355,34 @@ int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t ba
 
   struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
 
-  // Increase send queue producer index doorbell
-  Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
-  Debug("DEBUG: original qp->sq_pidb = 0x%x\n", qp->sq_pidb);
-  
-  qp->sq_pidb += batch_size;
-
-    if((qp->qdepth < batch_size) || ((qp->sq_pidb > qp->qdepth))) {
+  if(rdma_post_send_async(rdma_dev, qpid) < 0) {
     fprintf(stderr, "Error: SQ overflow\n");
-    exit(EXIT_FAILURE);
+    return -1;
   }
 
-  // Update sq_pidb to hardware
-  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qp->sq_pidb);
-  Debug("[Register] RN_RDMA_QCSR_SQPIi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qpid, qp->sq_pidb);
-  Debug("DEBUG: Update hardware sq db idx from software = %d\n", qp->sq_pidb);
-  Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
-  Debug("[Register] RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), qpid, qp->cq_cidb);
   // polling on completion, by checking CQ doorbell
-  while(qp->cq_cidb < qp->sq_pidb) {
-    // Wait for all WQE to be completed
-    qp->cq_cidb = poll_cq_cidb(rdma_dev, qpid, qp->sq_cidb);
-    qp->sq_cidb = qp->cq_cidb;
+  return rdma_sq_drain(qp);
+}
+
+int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t batch_size) {
+  if(rdma_dev == NULL) {
+    fprintf(stderr, "Error: rdma_dev is NULL\n");  
+    exit(EXIT_FAILURE);
   }
 
-  if(qp->cq_cidb < 0) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+
+  // Make room for the batch by reaping earlier completions first
+  if(rdma_sq_reserve(qp, batch_size) < 0) {
+    return -1;
+  }
+
+  if(rdma_post_batch_send_async(rdma_dev, qpid, batch_size) < 0) {
     return -1;
-  } else {
-    return 0;
   }
+
+  // Wait for all WQE to be completed
+  return rdma_sq_drain(qp);
 }
 
 void write_rq_cidb(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, uint32_t db_val) {
@@ -956,6 +2408,10 @@ void* rdma_post_receive(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp) {
 
   void *rqe = NULL;
 
+  if(alloc_rdma_qp_rq(qp) < 0) {
+    return NULL;
+  }
+
   int rq_pidb = poll_rq_pidb(rdma_dev, qp->qpid);
   if(rq_pidb == -1) {
     fprintf(stderr, "Error: rdma_post_receive failed\n");
@@ -964,10 +2420,10 @@ void* rdma_post_receive(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp) {
 
   // Pointing to the RQE
   if(rq_pidb == 0) {
-    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) ((qp->qdepth - 1) * RQE_SIZE));
+    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) (qp->qdepth - 1) * qp->rq_entry_size);
   }
   else {
-    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) ((rq_pidb - 1) * RQE_SIZE));
+    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) (rq_pidb - 1) * qp->rq_entry_size);
   }
 
   return rqe;
@@ -978,7 +2434,7 @@ uint8_t rdma_release_rq_consumed (struct rdma_dev_t* rdma_dev, struct rdma_qp_t*
   uint8_t rc = 0;
 
   // Check whether all RQ requests are received
-  rq_pidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qp->qpid));
+  rq_pidb = read_rq_pidb(qp);
 
   if (rq_pidb != qp->rq_pidb) {
     // We still have RQ requests pending.
@@ -992,6 +2448,55 @@ uint8_t rdma_release_rq_consumed (struct rdma_dev_t* rdma_dev, struct rdma_qp_t*
   return rc;
 }
 
+int rdma_poll_rq(struct rdma_qp_t* qp, uint32_t max, struct rdma_rqe_view_t* views) {
+  uint32_t num_new;
+  uint32_t slot;
+  uint32_t i;
+  int rq_pidb;
+
+  if(alloc_rdma_qp_rq(qp) < 0) {
+    return -1;
+  }
+
+  // RQEs between rq_cidb and rq_pidb are held by the caller, the ones between
+  // rq_pidb and the hardware producer index are new
+  rq_pidb = read_rq_pidb(qp);
+  num_new = (uint32_t) (rq_pidb + qp->qdepth - qp->rq_pidb) % qp->qdepth;
+  if(num_new == 0) {
+    return 0;
+  }
+  if(num_new > max) {
+    num_new = max;
+  }
+
+  for(i = 0; i < num_new; i++) {
+    slot = (qp->rq_pidb + i) % qp->qdepth;
+    views[i].data     = is_device_address(qp->rq->dma_addr) ? NULL : (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) slot * qp->rq_entry_size);
+    views[i].dma_addr = qp->rq->dma_addr + (uint64_t) slot * qp->rq_entry_size;
+    views[i].length   = qp->rq_entry_size;
+    views[i].index    = slot;
+  }
+
+  RN_TRACE_EVENT(RN_TRACE_RQ_POLL, qp->qpid, rq_pidb, qp->rq_pidb);
+  qp->rq_pidb = (qp->rq_pidb + num_new) % qp->qdepth;
+  return (int) num_new;
+}
+
+int rdma_rq_release(struct rdma_qp_t* qp, uint32_t count) {
+  uint32_t num_held = (uint32_t) (qp->rq_pidb + qp->qdepth - qp->rq_cidb) % qp->qdepth;
+
+  if(count > num_held) {
+    fprintf(stderr, "Error: %d RQEs released, but qpid %d holds only %d\n", count, qp->qpid, num_held);
+    return -1;
+  }
+  if(count == 0) {
+    return 0;
+  }
+
+  write_rq_cidb(qp->rdma_dev, qp, (qp->rq_cidb + count) % qp->qdepth);
+  return 0;
+}
+
 void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
   fprintf(stderr, "\n\n***** QP%d FATAL RECOVERY *****\n", qpid);
   // Steps to clear traffic on QP:
@@ -1010,30 +2515,35 @@ void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
 			break;
   }
 
-  /* 2. Check SQ PI == CQ Head */
+  /* 2. Check SQ PI == CQ Head. The library wrote SQPIi last, so a known QP
+   * is compared against the producer index it last rang instead of a register
+   * read. WQEs still held back by the doorbell coalescer never reached the
+   * hardware and are not waited for.
+   */
+  struct rdma_qp_t* qp = (qpid < rdma_dev->num_qp) ? rdma_dev->qps_ptr[qpid] : NULL;
+  uint32_t sq_pi;
+  if(qp != NULL) {
+    sq_pi = ((uint32_t) qp->sq_pidb + qp->qdepth - qp->db_coalescer.pending_wqes) % qp->qdepth;
+  } else {
+    sq_pi = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid));
+  }
   timeout_cnt = 0;
-  while(read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid)) 
-        != read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid))) {
+  while(1) {
+    rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
+    if(rt_value == sq_pi)
+      break;
     timeout_cnt += 1;
     if (timeout_cnt > 100000){
-      fprintf(stderr, "TIMEOUT: CQHEADi:0x%x and SQPIi:0x%x are different\n", 
-                      read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid)),
-                      read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
+      fprintf(stderr, "TIMEOUT: CQHEADi:0x%x and SQPIi:0x%x are different\n", rt_value, sq_pi);
       exit(EXIT_FAILURE);
     }
   }
   
   /* Disable the QP */
-  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid));
-  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid), 
-              (rt_value & ~(BIT(0)))); // set bit [0] to 0
-  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid));
-  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid), 
-              (rt_value | BIT(6))); // set bit [6] to 1
-  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid));
-  Debug("[Register] RN_RDMA_QCSR_QPCONFi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid), 
-                    qpid, rt_value);
+  rt_value = read_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QPCONFi);
+  rt_value &= ~(BIT(0)); // set bit [0] to 0
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QPCONFi, rt_value);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QPCONFi, (rt_value | BIT(6))); // set bit [6] to 1
 }
 
 void destroy_rdma_pd_entry(struct rdma_pd_t* pd) {
@@ -1043,75 +2553,244 @@ void destroy_rdma_pd_entry(struct rdma_pd_t* pd) {
   }
 }
 
-int destroy_rdma_qp(struct rdma_qp_t* qp) {
+/* Stop a queue pair and clear its indices in the hardware, after recovering
+ * it if it is in a fatal state. The QP is left disabled and under recovery
+ * until its QPCONFi is written again.
+ */
+static void quiesce_rdma_qp(struct rdma_qp_t* qp) {
+  struct rdma_dev_t* rdma_dev = qp->rdma_dev;
+  uint32_t qpid = qp->qpid;
   uint32_t rt_value;
 
-  if(qp != NULL) {
-    // Read STATQPi to make sure STATQPi[7:0] = 8'd0 and STATQPi[10:9] = 2'b11;
-    rt_value = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATQPi, qp->qpid));
-    if(!(((rt_value & 0x000000ff)==0) && (((rt_value>>9) & 0x00000003) == 0x3))) {
-      fprintf(stderr, "Warning: QP in fatal status\n");
-      // call rdma_qp_fatal_recovery()
-      rdma_qp_fatal_recovery(qp->rdma_dev, qp->qpid);
-    }
-
-    // Check whether SQPIi and CQHEADi have the same value
-    rt_value = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid));
-    if (rt_value != read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qp->qpid))) {
-      fprintf(stderr, "Warning: CQHEADi and SQPIi for QP%d are mismatched\n", qp->qpid);
-      // call rdma_qp_fatal_recovery()
-      rdma_qp_fatal_recovery(qp->rdma_dev, qp->qpid);
-    }
-
-    // Enable software override mode (1'b1) in XRNICADCONF[0] and disable QP (1'b0) in QPCONFi[0]
-    rt_value = read32_data(qp->rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF);
-    write32_data(qp->rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF, (rt_value | 0x00000001));
-    rt_value = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qp->qpid));
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qp->qpid),  (rt_value & 0xfffffffe));
-
-    // Reset RQWPTRDBADDi, SQPIi, CQHEADi, RQCIi, STATRQPIDBi, STATCURSQPTRi, SQPSNi, LSTRQREQi 
-    // and STATMSNi by 0; Configure QP under recovery in QPCONFi[6]
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQWPTRDBADDi, qp->qpid), 0);
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qp->qpid), 0);
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid), 0);
-    
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQCIi, qp->qpid), 0);
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qp->qpid), 0);
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATCURSQPTRi, qp->qpid), 0);
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qp->qpid), 0);
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qp->qpid), 0);
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATMSNi, qp->qpid), 0);
-    rt_value = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qp->qpid));
-    
-    uint32_t test = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid));
-    Debug("[DEBUG] Destroying dev: %p, RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", qp->rdma_dev->axil_ctl,
-                            get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid), qp->qpid, test);
-    
-    write32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qp->qpid),  (rt_value | 0x00000040));
-    test = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid));
-    Debug("[DEBUG] Destroying dev: %p, RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", qp->rdma_dev->axil_ctl,
-                            get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid), qp->qpid, test);
-    
-    // Disable software override mode (1'b0) in XRNICADCONF[0]
-    rt_value = read32_data(qp->rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF);
-    write32_data(qp->rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF, (rt_value & 0xfffffffe));
+  // Ring any WQEs still held back by the doorbell coalescer, so that SQPIi
+  // matches qp->sq_pidb below
+  rdma_flush_doorbell(qp);
+
+  // Read STATQPi to make sure STATQPi[7:0] = 8'd0 and STATQPi[10:9] = 2'b11;
+  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATQPi, qpid));
+  if(!(((rt_value & 0x000000ff)==0) && (((rt_value>>9) & 0x00000003) == 0x3))) {
+    fprintf(stderr, "Warning: QP in fatal status\n");
+    // call rdma_qp_fatal_recovery()
+    rdma_qp_fatal_recovery(rdma_dev, qpid);
+  }
+
+  // Check whether SQPIi and CQHEADi have the same value, SQPIi is the last
+  // producer index the library wrote
+  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
+  if (rt_value != (uint32_t) qp->sq_pidb) {
+    fprintf(stderr, "Warning: CQHEADi and SQPIi for QP%d are mismatched\n", qpid);
+    // call rdma_qp_fatal_recovery()
+    rdma_qp_fatal_recovery(rdma_dev, qpid);
+  }
+
+  // Enable software override mode (1'b1) in XRNICADCONF[0] and disable QP (1'b0) in QPCONFi[0]
+  write_xrnic_adconf(rdma_dev, (read_xrnic_adconf(rdma_dev) | 0x00000001));
+  rt_value = read_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QPCONFi) & 0xfffffffe;
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QPCONFi, rt_value);
+
+  // Reset RQWPTRDBADDi, SQPIi, CQHEADi, RQCIi, STATRQPIDBi, STATCURSQPTRi, SQPSNi, LSTRQREQi 
+  // and STATMSNi by 0; Configure QP under recovery in QPCONFi[6]
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_RQWPTRDBADDi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_SQPIi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_CQHEADi, 0);
   
-    test = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid));
-    Debug("[DEBUG] Destroying dev: %p, RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", qp->rdma_dev->axil_ctl,
-                            get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid), qp->qpid, test);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_RQCIi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_STATRQPIDBi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_STATCURSQPTRi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_SQPSNi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_LSTRQREQi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_STATMSNi, 0);
+  write_qp_csr(rdma_dev, qpid, RN_RDMA_QCSR_QPCONFi, (rt_value | 0x00000040));
   
-    // Free memory allocated for SQ, RQ and CQ
-    free(qp->sq);
-    free(qp->rq); 
-    free(qp->cq);
-    
-    destroy_rdma_pd_entry(qp->pd_entry);
+  // Disable software override mode (1'b0) in XRNICADCONF[0]
+  write_xrnic_adconf(rdma_dev, (read_xrnic_adconf(rdma_dev) & 0xfffffffe));
+  if(debug == 1) {
+    Debug("[DEBUG] Destroying dev: %p, RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", rdma_dev->axil_ctl,
+          get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), qpid,
+          read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid)));
+  }
+}
+
+int destroy_rdma_qp(struct rdma_qp_t* qp) {
+  struct rdma_dev_t* rdma_dev;
+  uint32_t qpid;
+
+  if(qp != NULL) {
+    rdma_dev = qp->rdma_dev;
+    qpid = qp->qpid;
+    quiesce_rdma_qp(qp);
+
+    // Return the SQ, RQ and CQ rings to their memory pool
+    free(qp->wr_ctx);
+    free(qp->sq_shadow);
+    free_rdma_buffer(rdma_dev->rn_dev, qp->sq);
+    free_rdma_buffer(rdma_dev->rn_dev, qp->rq);
+    free_rdma_buffer(rdma_dev->rn_dev, qp->cq);
+
+    // The protection domain may be shared with other QPs and is left to the caller
+    if(qpid < rdma_dev->num_qp)
+      rdma_dev->qps_ptr[qpid] = NULL;
+    free(qp);
     qp = NULL;
   }
 
   return 0;
 }
 
+struct rdma_qp_pool_t* rdma_qp_pool_create(struct rdma_dev_t* rdma_dev,
+                                           struct rdma_pd_t* pd_entry,
+                                           uint32_t first_qpid,
+                                           uint32_t size,
+                                           uint64_t cq_cidb_addr,
+                                           uint64_t rq_cidb_addr,
+                                           uint32_t qdepth,
+                                           char*    buf_location,
+                                           uint32_t partion_key) {
+  struct rdma_qp_pool_t* pool;
+  struct rdma_qp_attr_t attr;
+  uint32_t i;
+
+  if(rdma_dev == NULL || pd_entry == NULL) {
+    fprintf(stderr, "Error: rdma_dev or pd_entry is NULL\n");
+    return NULL;
+  }
+  if(first_qpid == 0 || first_qpid >= rdma_dev->num_qp) {
+    fprintf(stderr, "Error: first_qpid %d is out of range, %d QPs are enabled\n", first_qpid, rdma_dev->num_qp);
+    return NULL;
+  }
+  if(size == 0) {
+    size = rdma_dev->num_qp - first_qpid;
+  }
+  if((first_qpid + size > rdma_dev->num_qp) || (qdepth < 2)) {
+    fprintf(stderr, "Error: invalid QP pool, first_qpid = %d, size = %d, qdepth = %d\n", first_qpid, size, qdepth);
+    return NULL;
+  }
+  // Every QP gets its own CQ and RQ doorbell word, the two arrays must not overlap
+  if((cq_cidb_addr < rq_cidb_addr + ((uint64_t) size << 2)) &&
+     (rq_cidb_addr < cq_cidb_addr + ((uint64_t) size << 2))) {
+    fprintf(stderr, "Error: CQ doorbells at 0x%lx and RQ doorbells at 0x%lx overlap, %d words are needed for each\n",
+            cq_cidb_addr, rq_cidb_addr, size);
+    return NULL;
+  }
+  for(i = 0; i < size; i++) {
+    if(rdma_dev->qps_ptr[first_qpid + i] != NULL) {
+      fprintf(stderr, "Error: qpid %d is already allocated\n", first_qpid + i);
+      return NULL;
+    }
+  }
+
+  pool = (struct rdma_qp_pool_t* ) calloc(1, sizeof(struct rdma_qp_pool_t));
+  if(pool == NULL) {
+    fprintf(stderr, "Error: failed to allocate the QP pool\n");
+    exit(EXIT_FAILURE);
+  }
+  pool->qps       = (struct rdma_qp_t** ) calloc(size, sizeof(struct rdma_qp_t*));
+  pool->free_qps  = (struct rdma_qp_t** ) calloc(size, sizeof(struct rdma_qp_t*));
+  pool->peer_macs = (struct mac_addr_t* ) calloc(size, sizeof(struct mac_addr_t));
+  pool->in_use    = (uint8_t* ) calloc(size, sizeof(uint8_t));
+  if(pool->qps == NULL || pool->free_qps == NULL || pool->peer_macs == NULL || pool->in_use == NULL) {
+    fprintf(stderr, "Error: failed to allocate the QP pool\n");
+    exit(EXIT_FAILURE);
+  }
+  pool->rdma_dev    = rdma_dev;
+  pool->first_qpid  = first_qpid;
+  pool->size        = size;
+  pool->partion_key = partion_key;
+
+  memset(&attr, 0, sizeof(struct rdma_qp_attr_t));
+  attr.pd_entry     = pd_entry;
+  attr.qdepth       = qdepth;
+  attr.buf_location = buf_location;
+  attr.partion_key  = partion_key;
+  for(i = 0; i < size; i++) {
+    attr.qpid         = first_qpid + i;
+    attr.cq_cidb_addr = cq_cidb_addr + (i<<2);
+    attr.rq_cidb_addr = rq_cidb_addr + (i<<2);
+    attr.dst_mac      = &pool->peer_macs[i];
+    pool->qps[i] = init_rdma_qp(rdma_dev, &attr);
+    config_rdma_qp_ring_csr(rdma_dev, pool->qps[i], partion_key);
+  }
+
+  // Hand out the lowest QP IDs first
+  for(i = 0; i < size; i++) {
+    pool->free_qps[i] = pool->qps[size - 1 - i];
+  }
+  pool->num_free = size;
+
+  fprintf(stderr, "Info: rdma_qp_pool_create - %d QPs from qpid %d\n", size, first_qpid);
+  return pool;
+}
+
+struct rdma_qp_t* rdma_qp_pool_acquire(struct rdma_qp_pool_t* pool,
+                                       uint32_t dst_qpid,
+                                       struct mac_addr_t* dst_mac,
+                                       uint32_t dst_ip,
+                                       uint32_t sq_psn,
+                                       uint32_t last_rq_psn) {
+  struct rdma_dev_t* rdma_dev = pool->rdma_dev;
+  struct rdma_qp_t* qp;
+
+  if(pool->num_free == 0) {
+    return NULL;
+  }
+  pool->num_free--;
+  qp = pool->free_qps[pool->num_free];
+
+  qp->dst_qpid = dst_qpid;
+  qp->dst_ip   = dst_ip;
+  *(qp->dst_mac) = *dst_mac;
+
+  // Only RQWPTRDBADDi among the ring registers was cleared by the last release,
+  // the shadow skips the others
+  config_rdma_qp_ring_csr(rdma_dev, qp, pool->partion_key);
+  config_rdma_qp_peer_csr(rdma_dev, qp);
+  config_sq_psn(rdma_dev, qp->qpid, sq_psn);
+  config_last_rq_psn(rdma_dev, qp->qpid, last_rq_psn);
+  enable_rdma_qp_csr(rdma_dev, qp);
+
+  pool->in_use[qp->qpid - pool->first_qpid] = 1;
+  pool->num_acquired++;
+  return qp;
+}
+
+int rdma_qp_pool_release(struct rdma_qp_pool_t* pool, struct rdma_qp_t* qp) {
+  uint32_t idx;
+
+  if(qp == NULL || qp->qpid < pool->first_qpid || qp->qpid >= pool->first_qpid + pool->size) {
+    fprintf(stderr, "Error: QP does not belong to the pool\n");
+    return -1;
+  }
+  idx = qp->qpid - pool->first_qpid;
+  if(pool->qps[idx] != qp || !pool->in_use[idx]) {
+    fprintf(stderr, "Error: QP%d is not acquired from the pool\n", qp->qpid);
+    return -1;
+  }
+
+  quiesce_rdma_qp(qp);
+  reset_rdma_qp_state(qp);
+
+  pool->in_use[idx] = 0;
+  pool->free_qps[pool->num_free] = qp;
+  pool->num_free++;
+  pool->num_released++;
+  return 0;
+}
+
+void rdma_qp_pool_destroy(struct rdma_qp_pool_t* pool) {
+  uint32_t i;
+
+  if(pool != NULL) {
+    for(i = 0; i < pool->size; i++) {
+      destroy_rdma_qp(pool->qps[i]);
+    }
+    free(pool->qps);
+    free(pool->free_qps);
+    free(pool->peer_macs);
+    free(pool->in_use);
+    free(pool);
+  }
+}
+
 int destroy_rdma_dev(struct rdma_dev_t* rdma_dev) {
   int i;
   uint32_t rnic_enable;
@@ -1121,11 +2800,14 @@ int destroy_rdma_dev(struct rdma_dev_t* rdma_dev) {
     for(i=0; i<rdma_dev->num_qp; i++) {
       destroy_rdma_qp(rdma_dev->qps_ptr[i]);
     }
+    free_rdma_buffer(rdma_dev->rn_dev, rdma_dev->rq_scratch);
 
     // Disable RNIC hardware
     rnic_enable = 0;
     rnic_config = rnic_enable & 0xffffffff;
     write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICCONF, rnic_config);
+    free(rdma_dev->csr_shadow.qp_csr);
+    free(rdma_dev->csr_shadow.qp_valid);
     rdma_dev = NULL;
   }
 
@@ -1134,8 +2816,14 @@ int destroy_rdma_dev(struct rdma_dev_t* rdma_dev) {
 
 int destroy_rn_dev(struct rn_dev_t* rn_dev) {
   if(rn_dev != NULL) {
-    free(rn_dev->base_buf);
+    rn_trace_fini();
+    // The QPs return their rings to the pools, so destroy them first
     destroy_rdma_dev((struct rdma_dev_t* ) rn_dev->rdma_dev);
+    rn_mem_pool_destroy(rn_dev->host_pool);
+    rn_mem_pool_destroy(rn_dev->dev_pool);
+    free(rn_dev->base_buf);
+    free(rn_dev->hugepage_paddr);
+    free(rn_dev->hugepage_contig);
     rn_dev = NULL;
   }
 
@@ -1196,6 +2884,16 @@ void dump_registers(struct rdma_dev_t* rdma_dev, uint8_t is_sender, uint32_t qpi
 
   if(is_sender) {
     fprintf(stderr, "Info: [RN_RDMA_QCSR_SQPIi           = 0x%x] = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
+    if(rdma_dev->qps_ptr[qpid] != NULL) {
+      fprintf(stderr, "Info: SQ doorbells rung = %lu, doorbells saved by coalescing = %lu\n",
+                      rdma_dev->qps_ptr[qpid]->db_coalescer.doorbells_rung,
+                      rdma_dev->qps_ptr[qpid]->db_coalescer.doorbells_saved);
+      if(rdma_dev->qps_ptr[qpid]->pacer.state != RDMA_PACER_OFF) {
+        fprintf(stderr, "Info: pacing rate = %d Mb/s, state = %d, rate cuts = %lu, doorbell wait = %lu ns\n",
+                        rdma_pacing_rate(rdma_dev->qps_ptr[qpid]), rdma_dev->qps_ptr[qpid]->pacer.state,
+                        rdma_dev->qps_ptr[qpid]->pacer.rate_cuts, rdma_dev->qps_ptr[qpid]->pacer.wait_ns);
+      }
+    }
   }
   fprintf(stderr, "\n");
 
@@ -15,14 +15,70 @@
 #include "reconic.h"
 #include "reconic_reg.h"
 #include "control_api.h"
+#include "event_api.h"
+#include "trace_api.h"
 
 /*! \def RQE_SIZE
-    \brief Number of an RQ entry.
+    \brief Default size in bytes of an RQ entry, the largest SEND an RQE can hold.
 
-    Size RQ entry is aligned with 256B. Setting RQE_SIZE 512 indicates each RQE entry has 
-    512*256 = 128KB
+    The size of each QP's RQ entries is set by rdma_qp_attr_t::rq_entry_size and
+    programmed into QPCONFi[31:16] in units of RDMA_RQE_SIZE_UNIT.
 */
-#define RQE_SIZE 512
+#define RQE_SIZE (16 * 1024)
+
+/*! \def RDMA_RQE_SIZE_UNIT
+    \brief RQ entry sizes are multiples of 256B.
+*/
+#define RDMA_RQE_SIZE_UNIT 256
+
+/*! \def RDMA_RQE_SIZE_MAX
+    \brief Largest RQ entry size that fits into QPCONFi[31:16].
+*/
+#define RDMA_RQE_SIZE_MAX (0xffff * RDMA_RQE_SIZE_UNIT)
+
+/*! \def RDMA_CQE_WRID(cqe)
+    \brief Work request ID field [15:0] of a 32-bit completion queue entry.
+*/
+#define RDMA_CQE_WRID(cqe)   ((uint16_t) ((cqe) & 0x0000ffff))
+
+/*! \def RDMA_CQE_OPCODE(cqe)
+    \brief Opcode field [23:16] of a 32-bit completion queue entry.
+*/
+#define RDMA_CQE_OPCODE(cqe) ((uint8_t) (((cqe) >> 16) & 0x000000ff))
+
+/*! \def RDMA_CQE_STATUS(cqe)
+    \brief Error flags [31:24] of a 32-bit completion queue entry, 0 on success.
+*/
+#define RDMA_CQE_STATUS(cqe) ((uint8_t) (((cqe) >> 24) & 0x000000ff))
+
+/*! \def RDMA_INLINE_MAX
+    \brief Largest SEND payload in bytes that fits into send_small_payload0..3
+    of a WQE.
+*/
+#define RDMA_INLINE_MAX 16
+
+/*! \def RDMA_CACHE_LINE_SIZE
+    \brief Cache line size in bytes used to keep per-QP hot state apart.
+*/
+#define RDMA_CACHE_LINE_SIZE 64
+
+/*! \def RDMA_POLL_MMIO
+    \brief Completion polling mode: read CQHEADi/STATRQPIDBi over PCIe.
+*/
+#define RDMA_POLL_MMIO    0
+
+/*! \def RDMA_POLL_SHADOW
+    \brief Completion polling mode: read the CQ/RQ doorbell words the hardware
+    writes to host memory (CQDBADDi/RQWPTRDBADDi). Falls back to MMIO for a
+    doorbell that is not located in the preallocated hugepages.
+*/
+#define RDMA_POLL_SHADOW  1
+
+/*! \def RDMA_POLL_CHECKED
+    \brief Completion polling mode for validation: read both the host memory
+    doorbell and the register, count mismatches and trust the register.
+*/
+#define RDMA_POLL_CHECKED 2
 
 /*! \struct rdma_glb_csr_t
     \brief Structure used to store RDMA global control status registers.
@@ -56,6 +112,68 @@ struct rdma_glb_csr_t {
   uint32_t xrnic_advanced_conf; /*!< xrnic_advanced_conf ERNIC advanced global configuration. */
 };
 
+/*! \def RDMA_QP_CSR_WORDS
+    \brief Number of 32-bit words in the CSR window of a queue pair (0x100 bytes).
+*/
+#define RDMA_QP_CSR_WORDS 64
+
+/*! \def RDMA_CSR_SHADOW_NUM_PD
+    \brief Number of protection domains whose registers are shadowed. Higher
+    PD numbers are always written through.
+*/
+#define RDMA_CSR_SHADOW_NUM_PD 256
+
+/*! \def RDMA_MR_TABLE_SIZE
+    \brief Number of entries of the PD table managed as memory regions.
+*/
+#define RDMA_MR_TABLE_SIZE RDMA_CSR_SHADOW_NUM_PD
+
+/*! \def RDMA_R_KEY_MASK
+    \brief Bits of an r_key the ERNIC compares. r_keys equal in these bits
+    give access to the same memory region.
+*/
+#define RDMA_R_KEY_MASK 0xff
+
+/*! \def RDMA_MR_CACHE_FIRST_R_KEY
+    \brief First r_key tried by the registration cache. It goes up from there
+    and wraps around within RDMA_R_KEY_MASK, skipping the r_keys in use, so the
+    low r_keys applications usually pick are taken last.
+*/
+#define RDMA_MR_CACHE_FIRST_R_KEY 0x80
+
+/*! \def RDMA_ACCESS_READ
+    \brief Memory region access type: remote read only.
+*/
+#define RDMA_ACCESS_READ       0x0
+/*! \def RDMA_ACCESS_WRITE
+    \brief Memory region access type: remote write only.
+*/
+#define RDMA_ACCESS_WRITE      0x1
+/*! \def RDMA_ACCESS_READ_WRITE
+    \brief Memory region access type: remote read and write.
+*/
+#define RDMA_ACCESS_READ_WRITE 0x2
+
+/*! \struct rdma_csr_shadow_t
+    \brief Host copy of the configuration registers written by the library.
+
+    Only registers the hardware never changes are cached: writes of a value
+    the register already holds are skipped and reads are served from memory.
+    Call rdma_csr_shadow_invalidate() if the registers are changed behind the
+    library's back, e.g. after the FPGA is reprogrammed.
+*/
+struct rdma_csr_shadow_t {
+  uint32_t* qp_csr;   /*!< qp_csr per-queue CSR windows, RDMA_QP_CSR_WORDS words per QP ID. */
+  uint64_t* qp_valid; /*!< qp_valid per QP ID, bit i set if word i of its window is known. */
+  uint32_t  pd_csr[RDMA_CSR_SHADOW_NUM_PD][8]; /*!< pd_csr protection domain registers. */
+  uint8_t   pd_valid[RDMA_CSR_SHADOW_NUM_PD];  /*!< pd_valid per PD, bit i set if register i is known. */
+  uint32_t  xrnic_adconf;       /*!< xrnic_adconf value of XRNICADCONF. */
+  uint8_t   xrnic_adconf_valid; /*!< xrnic_adconf_valid xrnic_adconf is known. */
+  uint64_t  writes;             /*!< writes register writes issued to the shadowed registers. */
+  uint64_t  writes_skipped;     /*!< writes_skipped register writes avoided. */
+  uint64_t  reads_saved;        /*!< reads_saved register reads served from the shadow. */
+};
+
 /*! \struct rdma_dev_t
     \brief RDMA device structure.
 */
@@ -66,6 +184,15 @@ struct rdma_dev_t {
   uint32_t* axil_ctl; /*!< axil_ctl a pointer to PCIe register control interface. */
   uint32_t num_qp;    /*!< num_qp number of queue pair enabled. */
   struct win_size_t* winSize;    /*!< Window size mask for PCIe BDF address conversion. */
+  struct rdma_csr_shadow_t csr_shadow; /*!< csr_shadow host copy of the configuration registers. */
+  struct rdma_mr_t* mr_table[RDMA_MR_TABLE_SIZE]; /*!< mr_table memory regions by PD table entry. */
+  uint8_t mr_entry_busy[RDMA_MR_TABLE_SIZE];      /*!< mr_entry_busy 1 if the PD table entry is used by a
+                                                       memory region or kept for a PD. */
+  uint32_t mr_r_key[RDMA_MR_TABLE_SIZE];          /*!< mr_r_key r_key written to each PD table entry. */
+  uint8_t mr_r_key_valid[RDMA_MR_TABLE_SIZE];     /*!< mr_r_key_valid 1 if the entry grants access with mr_r_key. */
+  uint32_t next_r_key;                            /*!< next_r_key next r_key tried by the registration cache. */
+  struct rdma_buff_t* rq_scratch; /*!< rq_scratch RQ the QPs created with lazy_rq point at until
+                                       their own RQ is allocated, NULL if none was needed. */
 };
 
 /*! \struct rdma_pd_t
@@ -90,33 +217,365 @@ struct rdma_pd_t {
   struct rdma_buff_t* mr_buffer; /*!< mr_buffer a pointer to the allocated buffer. */
 };
 
+/*! \struct rdma_mr_t
+    \brief A memory region, one entry of the PD table. Any number of memory
+    regions can belong to the same protection domain.
+*/
+struct rdma_mr_t {
+  struct rdma_dev_t* rdma_dev; /*!< rdma_dev the RDMA device. */
+  struct rdma_pd_t* pd;        /*!< pd protection domain of the region. */
+  struct rdma_buff_t* buf;     /*!< buf buffer the region lies in. */
+  uint32_t index;              /*!< index PD table entry of the region. */
+  uint32_t r_key;              /*!< r_key RDMA security key of the region. */
+  uint64_t vaddr;              /*!< vaddr virtual address of the first byte. */
+  uint64_t dma_addr;           /*!< dma_addr physical address of the first byte. */
+  uint64_t length;             /*!< length size of the region in bytes. */
+  uint16_t access;             /*!< access RDMA_ACCESS_READ, RDMA_ACCESS_WRITE or RDMA_ACCESS_READ_WRITE. */
+  uint32_t refcnt;             /*!< refcnt references taken with rdma_mr_cache_get(). */
+  struct rdma_mr_cache_t* cache; /*!< cache the cache owning the region, NULL if registered by rdma_reg_mr(). */
+  struct rdma_mr_t* lru_prev;  /*!< lru_prev more recently used region of the cache. */
+  struct rdma_mr_t* lru_next;  /*!< lru_next less recently used region of the cache. */
+};
+
+/*! \struct rdma_mr_cache_t
+    \brief Registration cache: memory regions of a PD kept registered after
+    use and looked up by virtual address range, least recently used first out.
+*/
+struct rdma_mr_cache_t {
+  struct rdma_dev_t* rdma_dev; /*!< rdma_dev the RDMA device. */
+  struct rdma_pd_t* pd;        /*!< pd protection domain of the cached regions. */
+  uint32_t capacity;           /*!< capacity largest number of cached regions. */
+  uint32_t num_mr;             /*!< num_mr number of cached regions. */
+  struct rdma_mr_t* lru_head;  /*!< lru_head most recently used region. */
+  struct rdma_mr_t* lru_tail;  /*!< lru_tail least recently used region. */
+  uint64_t hits;               /*!< hits requests served by a cached region. */
+  uint64_t misses;             /*!< misses requests that registered or grew a region. */
+  uint64_t evictions;          /*!< evictions regions deregistered to make room. */
+};
+
+/*! \struct rdma_wr_ctx_t
+    \brief Software record of the WQE posted in one SQ slot.
+
+    The CQE only carries wrid, opcode and error flags, so the payload length of
+    a WQE is kept here until rdma_poll_cq() reports its completion.
+*/
+struct rdma_wr_ctx_t {
+  uint16_t wrid;   /*!< wrid work request ID. */
+  uint8_t  opcode; /*!< opcode 8-bit WQE opcode. */
+  uint32_t length; /*!< length payload size of the WQE. */
+};
+
+/*! \struct rdma_completion_t
+    \brief A work completion returned by rdma_poll_cq().
+*/
+struct rdma_completion_t {
+  uint16_t wrid;     /*!< wrid work request ID of the completed WQE. */
+  uint8_t  opcode;   /*!< opcode opcode of the completed WQE. */
+  uint8_t  status;   /*!< status CQE error flags, 0 on success. Always 0 if the CQ is
+                          allocated in the device memory. */
+  uint32_t byte_len; /*!< byte_len payload size of the completed WQE. */
+};
+
+/*! \struct rdma_rqe_view_t
+    \brief A received RQE returned by rdma_poll_rq(), valid until released with
+    rdma_rq_release().
+*/
+struct rdma_rqe_view_t {
+  void*    data;     /*!< data host virtual address of the RQE in qp->rq, NULL if the
+                          RQ is allocated in the device memory. */
+  uint64_t dma_addr; /*!< dma_addr physical or device address of the RQE. */
+  uint32_t length;   /*!< length size of the RQE slot in bytes. The ERNIC does not
+                          report the SEND length, the payload starts at data. */
+  uint32_t index;    /*!< index slot of the RQE in the RQ ring. */
+};
+
+/*! \struct rdma_db_coalescer_t
+    \brief SQ doorbell coalescing state of a queue pair.
+
+    Posted WQEs are accumulated and SQPIi is written once for all of them when
+    max_wqes WQEs or max_bytes payload bytes are pending, or when the oldest
+    pending WQE has waited deadline_ns nanoseconds. The deadline is checked by
+    every post and poll call on the queue pair and by rdma_cq_group_poll(), so
+    nothing rings it while the application sleeps: flush before blocking, or
+    wait with rdma_wait_qp_event().
+*/
+struct rdma_db_coalescer_t {
+  uint32_t max_wqes;        /*!< max_wqes pending WQEs that trigger a doorbell, 0 or 1 disables coalescing. */
+  uint64_t max_bytes;       /*!< max_bytes pending payload bytes that trigger a doorbell, 0 means no limit. */
+  uint64_t deadline_ns;     /*!< deadline_ns longest time a WQE may wait for its doorbell, 0 means no limit. */
+  uint32_t pending_wqes;    /*!< pending_wqes WQEs posted but not yet announced to the hardware. */
+  uint32_t pending_posts;   /*!< pending_posts post calls merged into the next doorbell. */
+  uint64_t pending_bytes;   /*!< pending_bytes payload bytes of the pending WQEs. */
+  uint64_t first_post_ns;   /*!< first_post_ns CLOCK_MONOTONIC time of the oldest pending WQE. */
+  uint64_t doorbells_rung;  /*!< doorbells_rung number of SQPIi writes. */
+  uint64_t doorbells_saved; /*!< doorbells_saved number of post calls that did not need their own SQPIi write. */
+};
+
+/*! \def RDMA_PACER_OFF
+    \brief Pacer state: pacing is disabled, the doorbell is never held back.
+*/
+#define RDMA_PACER_OFF            0
+
+/*! \def RDMA_PACER_LINE_RATE
+    \brief Pacer state: no congestion seen, the QP runs at its maximum rate.
+*/
+#define RDMA_PACER_LINE_RATE      1
+
+/*! \def RDMA_PACER_FAST_RECOVERY
+    \brief Pacer state: the rate was cut and moves halfway back to the rate
+    before the cut every period.
+*/
+#define RDMA_PACER_FAST_RECOVERY  2
+
+/*! \def RDMA_PACER_ADDITIVE
+    \brief Pacer state: the target rate grows by a fixed step every period.
+*/
+#define RDMA_PACER_ADDITIVE       3
+
+/*! \def RDMA_PACER_MAX_RATE_MBPS
+    \brief Largest maximum rate in Mb/s accepted by rdma_set_pacing(), the line rate.
+*/
+#define RDMA_PACER_MAX_RATE_MBPS 100000
+
+/*! \def RDMA_PACER_BUCKET_DEFAULT
+    \brief Token bucket size in bytes used when none is given to rdma_set_pacing().
+*/
+#define RDMA_PACER_BUCKET_DEFAULT (64 * 1024)
+
+/*! \def RDMA_PACER_PERIOD_NS
+    \brief Period of the rate controller in nanoseconds. The congestion
+    counters are read at most once per period.
+*/
+#define RDMA_PACER_PERIOD_NS 50000
+
+/*! \def RDMA_PACER_ALPHA_ONE
+    \brief Fixed-point 1.0 of the congestion estimate alpha.
+*/
+#define RDMA_PACER_ALPHA_ONE 1024
+
+/*! \def RDMA_PACER_ALPHA_SHIFT
+    \brief alpha moves by 1/2^RDMA_PACER_ALPHA_SHIFT of its distance to 1 (on
+    congestion) or to 0 (otherwise) every period.
+*/
+#define RDMA_PACER_ALPHA_SHIFT 4
+
+/*! \def RDMA_PACER_RECOVERY_PERIODS
+    \brief Number of periods without congestion spent in fast recovery before
+    the target rate is increased.
+*/
+#define RDMA_PACER_RECOVERY_PERIODS 5
+
+/*! \def RDMA_PACER_STEP_DIV
+    \brief The additive increase step is the maximum rate divided by this value.
+*/
+#define RDMA_PACER_STEP_DIV 100
+
+/*! \struct rdma_pacer_t
+    \brief Token bucket pacing and congestion control state of a queue pair.
+
+    Every SQPIi write takes the payload bytes of the WQEs it announces from a
+    token bucket that fills at the current rate, and waits while the bucket is
+    empty. Once per RDMA_PACER_PERIOD_NS, a DCQCN-like controller reads the
+    CNP, NAK and retry counters of the ERNIC. If any of them moved, the rate is
+    cut by alpha/2 and alpha grows. Otherwise alpha decays and the rate climbs
+    back to the maximum, first halfway to the rate before the cut every period
+    (fast recovery), then by a fixed step (additive increase). The ERNIC only
+    counts these events per device, so every paced QP reacts to them.
+*/
+struct rdma_pacer_t {
+  uint8_t  state;           /*!< state RDMA_PACER_OFF ... RDMA_PACER_ADDITIVE. */
+  uint64_t max_rate;        /*!< max_rate maximum rate in bytes per second. */
+  uint64_t min_rate;        /*!< min_rate the rate is never cut below this, in bytes per second. */
+  uint64_t rate;            /*!< rate current rate in bytes per second. */
+  uint64_t target_rate;     /*!< target_rate rate the controller recovers to, in bytes per second. */
+  uint64_t bucket_size;     /*!< bucket_size largest number of tokens (bytes) of the bucket. */
+  int64_t  tokens;          /*!< tokens bytes that may be sent now, negative after a large doorbell. */
+  uint64_t last_refill_ns;  /*!< last_refill_ns CLOCK_MONOTONIC time of the last refill. */
+  uint64_t last_update_ns;  /*!< last_update_ns CLOCK_MONOTONIC time of the last controller update. */
+  uint32_t alpha;           /*!< alpha congestion estimate, RDMA_PACER_ALPHA_ONE is 1.0. */
+  uint32_t recovery_periods; /*!< recovery_periods periods without congestion since the last cut. */
+  uint32_t cnp_cnt;         /*!< cnp_cnt last value of RN_RDMA_GCSR_INCNPPKTCNT. */
+  uint32_t nak_cnt;         /*!< nak_cnt last value of RN_RDMA_GCSR_INNAKPKTCNT. */
+  uint32_t retry_cnt;       /*!< retry_cnt last value of RN_RDMA_GCSR_RETRYCNTSTS. */
+  uint64_t rate_cuts;       /*!< rate_cuts number of rate cuts. */
+  uint64_t wait_ns;         /*!< wait_ns total time doorbells waited for tokens. */
+};
+
 /*! \struct rdma_qp_t
     \brief RDMA queue pair structure.
+
+    The counters moved by posting and polling are grouped at the end of the
+    structure, starting on their own cache line, so that threads driving
+    different queue pairs never write to a shared line. Queue pairs are
+    allocated with RDMA_CACHE_LINE_SIZE alignment by allocate_rdma_qp().
 */
 struct rdma_qp_t {
   struct rdma_dev_t* rdma_dev; /*!< rdma_dev An RDMA device. */
   uint32_t qpid;               /*!< qpid A queue pair ID. */
   struct rdma_buff_t* sq; /*!< sq a pointer to a send queue buffer. */
   uint32_t sq_psn;        /*!< sq_psn Packet sequence number for a sq request. */
-  int sq_pidb;            /*!< sq_pidb SQ producer index doorbell. */
-  int sq_cidb;            /*!< sq_cidb SQ consumer index doorbell. */
+  struct rdma_wr_ctx_t* wr_ctx; /*!< wr_ctx per-slot records of posted WQEs (qdepth entries). */
+  struct rdma_wqe_t* sq_shadow; /*!< sq_shadow host copy of an SQ located in the device memory,
+                                     NULL if the SQ is in the host memory. */
 
   struct rdma_buff_t* cq; /*!< cq a pointer to a completion queue buffer. */
   uint64_t cq_cidb_addr;  /*!< cq_cidb_addr completion queue consumer index doorbell address. */
-  int cq_cidb;            /*!< cq_cidb completion queue consumer index doorbell. */
+  volatile uint32_t* cq_db_shadow; /*!< cq_db_shadow host virtual address of the CQ doorbell
+                                        written by the hardware, NULL if in the device memory. */
 
   // Receive queue and its doorbell
   struct rdma_buff_t* rq; /*!< rq a pointer to a receive queue buffer. */
   uint64_t rq_cidb_addr;  /*!< rq_cidb_addr receive queue consumer index doorbell address. */
-  int rq_cidb;            /*!< rq_cidb receive queue consumer index doorbell. */
-  int rq_pidb;            /*!< rq_cidb receive queue producer index doorbell. */
+  volatile uint32_t* rq_db_shadow; /*!< rq_db_shadow host virtual address of the RQ doorbell
+                                        written by the hardware, NULL if in the device memory. */
+  uint8_t poll_mode;      /*!< poll_mode completion polling mode, RDMA_POLL_MMIO,
+                               RDMA_POLL_SHADOW or RDMA_POLL_CHECKED. */
   uint32_t pd_num;        /*!< pd_num protection domain number associated. */
   struct rdma_pd_t* pd_entry; /*!< pd_entry protection domain entry associated. */
   uint32_t dst_qpid; /*!< dst_qpid destination queue pair ID. */
   uint32_t qdepth;   /*!< qdepth Queue pair depth. */
+  uint32_t rq_entry_size; /*!< rq_entry_size size of an RQ entry in bytes. */
+  char* buf_location;     /*!< buf_location "host_mem" or "dev_mem", where the rings are. */
   uint32_t last_rq_psn; /*!< last_rq_psn Last RQ request PSN associated. */
   struct mac_addr_t* dst_mac; /*!< dst_mac destination MAC address. */
   uint32_t dst_ip; /*!< dst_ip destination IP address. */
+
+  // Hot data path state, only written by the thread driving this QP
+  int sq_pidb __attribute__((aligned(RDMA_CACHE_LINE_SIZE)));
+                          /*!< sq_pidb SQ producer index doorbell, wraps modulo qdepth. */
+  int sq_cidb;            /*!< sq_cidb SQ consumer index doorbell, wraps modulo qdepth. */
+  uint32_t sq_credits;    /*!< sq_credits number of free SQ slots (at most qdepth - 1). */
+  uint32_t sq_dirty_start; /*!< sq_dirty_start first SQ slot not yet copied to the device memory. */
+  uint32_t sq_dirty_cnt;   /*!< sq_dirty_cnt number of consecutive SQ slots not yet copied. */
+  int cq_cidb;            /*!< cq_cidb completion queue consumer index doorbell. */
+  int rq_cidb;            /*!< rq_cidb receive queue consumer index doorbell. */
+  int rq_pidb;            /*!< rq_cidb receive queue producer index doorbell. */
+  uint32_t poll_mismatch; /*!< poll_mismatch number of shadow/register mismatches seen
+                               in RDMA_POLL_CHECKED mode. */
+  struct rdma_db_coalescer_t db_coalescer; /*!< db_coalescer SQ doorbell coalescing state. */
+  struct rdma_pacer_t pacer; /*!< pacer SQ doorbell pacing and congestion control state. */
+};
+
+/*! \struct rdma_qp_attr_t
+    \brief Attributes of a queue pair created by rdma_qp_create_bulk().
+*/
+struct rdma_qp_attr_t {
+  uint32_t qpid;               /*!< qpid QP ID, 1 to num_qp - 1. */
+  uint32_t dst_qpid;           /*!< dst_qpid destination QP ID. */
+  struct rdma_pd_t* pd_entry;  /*!< pd_entry protection domain. */
+  uint64_t cq_cidb_addr;       /*!< cq_cidb_addr CQ doorbell address. */
+  uint64_t rq_cidb_addr;       /*!< rq_cidb_addr RQ doorbell address. */
+  uint32_t qdepth;             /*!< qdepth queue depth. */
+  char*    buf_location;       /*!< buf_location "host_mem" or "dev_mem". */
+  struct mac_addr_t* dst_mac;  /*!< dst_mac destination MAC address. */
+  uint32_t dst_ip;             /*!< dst_ip destination IP address. */
+  uint32_t partion_key;        /*!< partion_key partition key. */
+  uint32_t r_key;              /*!< r_key RDMA security key. */
+  uint32_t sq_psn;             /*!< sq_psn initial SQ packet sequence number. */
+  uint32_t last_rq_psn;        /*!< last_rq_psn last RQ request PSN. */
+  uint32_t rq_entry_size;      /*!< rq_entry_size size of an RQ entry in bytes, a multiple of
+                                    RDMA_RQE_SIZE_UNIT, 0 for RQE_SIZE. */
+  uint8_t  lazy_rq;            /*!< lazy_rq if set, the RQ is only allocated by the first
+                                    rdma_post_receive() or rdma_poll_rq() call. Until then the
+                                    QP points at the RQ scratch buffer of the device, and SENDs
+                                    that target it are lost. */
+};
+
+/*! \def RDMA_XFER_CHUNK_DEFAULT
+    \brief Chunk size in bytes used by rdma_read_large() and rdma_write_large()
+    when none is given.
+*/
+#define RDMA_XFER_CHUNK_DEFAULT (64 * 1024)
+
+/*! \def RDMA_XFER_BATCH
+    \brief Largest number of chunks posted or reaped at once by rdma_read_large()
+    and rdma_write_large().
+*/
+#define RDMA_XFER_BATCH 64
+
+/*! \def RDMA_XFER_TIMEOUT_NS
+    \brief rdma_read_large() and rdma_write_large() give up after this many
+    nanoseconds without any completion.
+*/
+#define RDMA_XFER_TIMEOUT_NS 1000000000ULL
+
+/*! \def RDMA_STRIPE_ROUND_ROBIN
+    \brief Stripe policy: chunks go to the queue pairs of a stripe in turn.
+*/
+#define RDMA_STRIPE_ROUND_ROBIN  0
+
+/*! \def RDMA_STRIPE_LEAST_LOADED
+    \brief Stripe policy: each chunk goes to the queue pair with the fewest
+    bytes outstanding.
+*/
+#define RDMA_STRIPE_LEAST_LOADED 1
+
+/*! \struct rdma_stripe_t
+    \brief Queue pairs to the same peer driven as one, see rdma_stripe_create().
+
+    The ERNIC serializes the WQEs of a queue pair, so a single QP cannot fill
+    the link. A stripe spreads the chunks of one transfer over its QPs and
+    merges their completions into a single result.
+*/
+struct rdma_stripe_t {
+  struct rdma_dev_t* rdma_dev;  /*!< rdma_dev the RDMA device of the QPs. */
+  uint32_t num_qps;             /*!< num_qps number of QPs in the stripe. */
+  struct rdma_qp_t** qps;       /*!< qps the QPs of the stripe. */
+  uint32_t chunk_size;          /*!< chunk_size chunk size in bytes. */
+  uint8_t  policy;              /*!< policy RDMA_STRIPE_ROUND_ROBIN or RDMA_STRIPE_LEAST_LOADED. */
+  uint32_t next_qp;             /*!< next_qp index of the QP tried first for the next chunk. */
+  uint32_t* pending;            /*!< pending per-QP number of chunks not posted yet. */
+  uint64_t* outstanding;        /*!< outstanding per-QP bytes posted and not completed. */
+  uint64_t* bytes_posted;       /*!< bytes_posted per-QP bytes posted since the stripe was created. */
+  struct rdma_wqe_desc_t* descs; /*!< descs RDMA_XFER_BATCH descriptors per QP. */
+};
+
+/*! \struct rdma_qp_pool_t
+    \brief A range of queue pairs whose rings are allocated once and reused.
+
+    The rings, doorbell addresses, queue depth and PD of every QP are set up
+    when the pool is created. Acquiring a QP only programs its peer and PSNs
+    and enables it, releasing it clears its indices and disables it.
+*/
+struct rdma_qp_pool_t {
+  struct rdma_dev_t* rdma_dev;  /*!< rdma_dev the RDMA device of the QPs. */
+  uint32_t first_qpid;          /*!< first_qpid QP ID of the first QP of the pool. */
+  uint32_t size;                /*!< size number of QPs in the pool. */
+  uint32_t num_free;            /*!< num_free number of QPs ready to be acquired. */
+  uint32_t partion_key;         /*!< partion_key partition key of the QPs. */
+  struct rdma_qp_t** qps;       /*!< qps all QPs, indexed by qpid - first_qpid. */
+  struct rdma_qp_t** free_qps;  /*!< free_qps stack of the QPs ready to be acquired. */
+  struct mac_addr_t* peer_macs; /*!< peer_macs destination MAC address of each QP. */
+  uint8_t* in_use;              /*!< in_use 1 if the QP is acquired. */
+  uint64_t num_acquired;        /*!< num_acquired number of successful acquisitions. */
+  uint64_t num_released;        /*!< num_released number of releases. */
+};
+
+/*! \struct rdma_cq_group_t
+    \brief A set of queue pairs whose CQs are checked together.
+
+    Bit b of word w stands for QP (w*32 + b + 1), the layout of CQINTSTS1..8.
+    QPs whose CQ doorbell has a host memory shadow are checked from the cache.
+    The others are picked from the CQINTSTS bits and only those are checked
+    through their CQ head register. A QP is reported as long as it has
+    unreaped completions, the same way for both kinds of QPs.
+*/
+struct rdma_cq_group_t {
+  struct rdma_dev_t* rdma_dev; /*!< rdma_dev the RDMA device of the watched QPs. */
+  uint32_t mmio_watch[8];      /*!< mmio_watch QPs checked through their CQHEADi register. */
+  uint32_t shadow_watch[8];    /*!< shadow_watch QPs checked through their host memory CQ doorbell. */
+  uint32_t mmio_pending[8];    /*!< mmio_pending MMIO QPs with a CQINTSTS bit seen and completions possibly unreaped. */
+  uint32_t cq_events[8];       /*!< cq_events CQ sink fed by event_ch, see rdma_event_add_cq_sink(). */
+  struct rdma_event_channel_t* event_ch; /*!< event_ch event channel owning CQINTSTS, NULL if none. */
+  uint32_t num_qp;             /*!< num_qp number of watched QPs. */
+};
+
+/*! \struct rdma_cq_ready_t
+    \brief A QP reported by rdma_cq_group_poll() with new completions.
+*/
+struct rdma_cq_ready_t {
+  uint32_t qpid;    /*!< qpid QP ID. */
+  uint32_t cq_head; /*!< cq_head current CQ head index of the QP. */
 };
 
 /*! \struct rdma_wqe_t
@@ -144,6 +603,18 @@ struct rdma_wqe_t {
 
 };
 
+/*! \struct rdma_wqe_desc_t
+    \brief Compact description of one WQE posted with rdma_wqe_batch().
+*/
+struct rdma_wqe_desc_t {
+  uint64_t laddr;         /*!< laddr physical address of the local payload buffer. */
+  uint64_t remote_offset; /*!< remote_offset remote memory address offset. */
+  uint32_t length;        /*!< length payload size for the transfer. */
+  uint16_t wrid;          /*!< wrid work request ID. */
+  uint8_t  opcode;        /*!< opcode 8-bit WQE opcode. */
+  uint8_t  reserved;      /*!< reserved reserved. */
+};
+
 /** @brief Create an RDMA device.
  *  @param rn_dev A pointer to the RecoNIC device.
  *  @return a pointer to the RDMA deivce created.
@@ -196,13 +667,78 @@ struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num)
 /** @brief Register a memory region in the RDMA engine.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param rdma_pd A pointer to the RDMA protection domain entry.
- *  @param r_key RDMA security key or remote tag.
+ *  @param r_key RDMA security key or remote tag, not used by another registered
+ *               region. Only the bits of RDMA_R_KEY_MASK are compared.
  *  @param rdma_buf the RDMA buffer to be registered.
  *  @return void.
  */
 void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, 
                                  uint32_t r_key, struct rdma_buff_t* rdma_buf);
 
+/** @brief Register a memory region in its own PD table entry, keeping the
+ *  other regions of the PD. The r_key must differ from the r_keys of all
+ *  other registered regions in the bits of RDMA_R_KEY_MASK.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param rdma_pd protection domain of the region.
+ *  @param rdma_buf buffer the region lies in.
+ *  @param offset offset of the region in rdma_buf.
+ *  @param length size of the region in bytes.
+ *  @param r_key RDMA security key of the region.
+ *  @param access RDMA_ACCESS_READ, RDMA_ACCESS_WRITE or RDMA_ACCESS_READ_WRITE.
+ *  @return a pointer to the memory region, NULL if the range is invalid, the
+ *          r_key is already in use or the table is full.
+ */
+struct rdma_mr_t* rdma_reg_mr(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd,
+                              struct rdma_buff_t* rdma_buf, uint64_t offset, uint64_t length,
+                              uint32_t r_key, uint16_t access);
+
+/** @brief Deregister a memory region and free its PD table entry. A region
+ *  of a registration cache is removed from the cache first.
+ *  @param mr a pointer to the memory region.
+ *  @return 0 on success, -1 if the region is still referenced.
+ */
+int rdma_dereg_mr(struct rdma_mr_t* mr);
+
+/** @brief Create a registration cache for a protection domain.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param rdma_pd protection domain of the cached regions.
+ *  @param capacity largest number of regions kept registered.
+ *  @return a pointer to the cache, NULL on invalid arguments.
+ */
+struct rdma_mr_cache_t* rdma_mr_cache_create(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, uint32_t capacity);
+
+/** @brief Get a memory region covering a buffer range and take a reference
+ *  on it. A cached region covering the range is returned as is. Otherwise an
+ *  unreferenced cached region of the same buffer overlapping the range is
+ *  grown to cover it, or a new region is registered, evicting the least
+ *  recently used unreferenced region when the cache is full. A region
+ *  registered by the cache gets an r_key from RDMA_MR_CACHE_FIRST_R_KEY up
+ *  that no other registered region uses. When all RDMA_R_KEY_MASK + 1 r_keys
+ *  are taken the call fails.
+ *  @param cache a pointer to the registration cache.
+ *  @param rdma_buf buffer the range lies in.
+ *  @param offset offset of the range in rdma_buf.
+ *  @param length size of the range in bytes.
+ *  @param access access type needed.
+ *  @return a pointer to the memory region, NULL if no region can be registered.
+ */
+struct rdma_mr_t* rdma_mr_cache_get(struct rdma_mr_cache_t* cache, struct rdma_buff_t* rdma_buf,
+                                    uint64_t offset, uint64_t length, uint16_t access);
+
+/** @brief Drop a reference taken with rdma_mr_cache_get(). The region stays
+ *  registered until it is evicted.
+ *  @param cache a pointer to the registration cache.
+ *  @param mr a pointer to the memory region.
+ *  @return void.
+ */
+void rdma_mr_cache_put(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr);
+
+/** @brief Deregister all cached regions and free the cache.
+ *  @param cache a pointer to the registration cache.
+ *  @return void.
+ */
+void rdma_mr_cache_destroy(struct rdma_mr_cache_t* cache);
+
 /** @brief Allocate a host-side buffer.
  *  @param num_hugepages Number of hugepages requested.
  *  @return a pointer to an RDMA buffer allocated.
@@ -257,6 +793,90 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
                                    uint32_t partion_key,
                                    uint32_t r_key);
 
+/** @brief Create and configure many RDMA queue pairs at once.
+ *
+ *  The host side of every QP is allocated first, then the CSR windows are
+ *  configured in one pass in ascending QP ID order, each QP being enabled by
+ *  its last write. SQPSNi and LSTRQREQi are set from the attributes,
+ *  so config_sq_psn() and config_last_rq_psn() are not needed afterwards.
+ *  Nothing is created if any attribute is invalid.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param attrs attributes of the QPs, see allocate_rdma_qp() for their meaning.
+ *  @param num_qp number of entries in attrs.
+ *  @param qps optional array of num_qp entries receiving the QPs in attrs order.
+ *  @return 0 on success, -1 on invalid attributes.
+ */
+int rdma_qp_create_bulk(struct rdma_dev_t* rdma_dev,
+                        const struct rdma_qp_attr_t* attrs,
+                        uint32_t num_qp,
+                        struct rdma_qp_t** qps);
+
+/** @brief Create a pool of queue pairs with consecutive QP IDs. The rings of
+ *  every QP are allocated here, acquiring and releasing a QP does not allocate.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param pd_entry protection domain of the QPs.
+ *  @param first_qpid QP ID of the first QP of the pool.
+ *  @param size number of QPs, 0 for all QP IDs from first_qpid to num_qp - 1.
+ *  @param cq_cidb_addr address of an array of size 32-bit CQ doorbells, the
+ *         i-th QP of the pool uses cq_cidb_addr + 4 * i.
+ *  @param rq_cidb_addr address of an array of size 32-bit RQ doorbells, laid
+ *         out as the CQ doorbells and not overlapping them.
+ *  @param qdepth queue depth of the QPs.
+ *  @param buf_location rings in "host_mem" or "dev_mem".
+ *  @param partion_key partition key.
+ *  @return a pointer to the pool, NULL if the QP ID range is not free or the
+ *          doorbell arrays overlap.
+ */
+struct rdma_qp_pool_t* rdma_qp_pool_create(struct rdma_dev_t* rdma_dev,
+                                           struct rdma_pd_t* pd_entry,
+                                           uint32_t first_qpid,
+                                           uint32_t size,
+                                           uint64_t cq_cidb_addr,
+                                           uint64_t rq_cidb_addr,
+                                           uint32_t qdepth,
+                                           char*    buf_location,
+                                           uint32_t partion_key);
+
+/** @brief Take a queue pair from the pool and connect it to a peer. Peer
+ *  registers that hold the right value already are not written again.
+ *  @param pool a pointer to the QP pool.
+ *  @param dst_qpid destination QP ID.
+ *  @param dst_mac destination MAC address, copied into the pool.
+ *  @param dst_ip destination IP address.
+ *  @param sq_psn initial SQ packet sequence number.
+ *  @param last_rq_psn last RQ request PSN.
+ *  @return a pointer to the enabled QP, NULL if the pool is empty.
+ */
+struct rdma_qp_t* rdma_qp_pool_acquire(struct rdma_qp_pool_t* pool,
+                                       uint32_t dst_qpid,
+                                       struct mac_addr_t* dst_mac,
+                                       uint32_t dst_ip,
+                                       uint32_t sq_psn,
+                                       uint32_t last_rq_psn);
+
+/** @brief Disable a queue pair, clear its indices and give it back to the
+ *  pool. Its SQ should be drained first. A QP watched by a CQ group must be
+ *  removed from the group by the caller.
+ *  @param pool a pointer to the QP pool.
+ *  @param qp a QP acquired from this pool.
+ *  @return 0 on success, -1 if the QP is not acquired from this pool.
+ */
+int rdma_qp_pool_release(struct rdma_qp_pool_t* pool, struct rdma_qp_t* qp);
+
+/** @brief Destroy all queue pairs of the pool, acquired or not, and the pool.
+ *  Call it before destroy_rdma_dev().
+ *  @param pool a pointer to the QP pool.
+ *  @return void.
+ */
+void rdma_qp_pool_destroy(struct rdma_qp_pool_t* pool);
+
+/** @brief Forget all shadowed register values, the next access of each
+ *  register goes to the hardware.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @return void.
+ */
+void rdma_csr_shadow_invalidate(struct rdma_dev_t* rdma_dev);
+
 /** @brief Create an RDMA work queue element.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid A QP ID.
@@ -285,6 +905,44 @@ void create_a_wqe(struct rdma_dev_t* rdma_dev,
                   uint32_t send_small_payload3,
                   uint32_t immdt_data);
 
+/** @brief Fill consecutive SQ slots from an array of WQE descriptors and post
+ *         them with a single SQ doorbell.
+ *
+ *  WQEs are written starting at the SQ producer index, so WQEs created with
+ *  create_a_wqe() must be posted before calling this function. The call does
+ *  not wait for completions, use rdma_poll_cq() to collect them.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param descs array of WQE descriptors.
+ *  @param num_desc number of descriptors in descs.
+ *  @param r_key RDMA security key used by every WQE of the batch.
+ *  @return Success (0) or Failure (-1) if the SQ has not enough free slots.
+ */
+int rdma_wqe_batch(struct rdma_dev_t* rdma_dev,
+                   uint32_t qpid,
+                   const struct rdma_wqe_desc_t* descs,
+                   uint32_t num_desc,
+                   uint32_t r_key);
+
+/** @brief Post an RDMA SEND whose payload is carried inside the WQE.
+ *
+ *  The payload is packed into send_small_payload0..3, so no data buffer is
+ *  needed and the RDMA engine does not read the payload from memory. The WQE
+ *  is written at the SQ producer index and the call does not wait for its
+ *  completion, use rdma_poll_cq() or rdma_sq_drain() to collect it.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param wrid A work request ID.
+ *  @param payload payload to be sent.
+ *  @param length payload size in bytes, at most RDMA_INLINE_MAX.
+ *  @return Success (0) or Failure (-1) if length is too large or the SQ is full.
+ */
+int rdma_send_inline(struct rdma_dev_t* rdma_dev,
+                     uint32_t qpid,
+                     uint16_t wrid,
+                     const void* payload,
+                     uint32_t length);
+
 /** @brief Poll CQ consumer index doorbell to check whether RDMA read/write is completed 
  *         and get its value.
  *  @param rdma_dev A pointer to the RDMA device.
@@ -324,6 +982,267 @@ int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid);
  */
 int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t batch_size);
 
+/** @brief Post an RDMA operation without waiting for its completion.
+ *
+ *  The SQPIi doorbell is rung and the call returns immediately. Completions are
+ *  collected later with rdma_poll_cq().
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @return Success (0) or Failure (-1) if the SQ has no free slot.
+ */
+int rdma_post_send_async(struct rdma_dev_t* rdma_dev, uint32_t qpid);
+
+/** @brief Post a batch of RDMA operations without waiting for their completion.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @param batch_size batch size.
+ *  @return Success (0) or Failure (-1) if the SQ has not enough free slots.
+ */
+int rdma_post_batch_send_async(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t batch_size);
+
+/** @brief Configure SQ doorbell coalescing of a queue pair.
+ *
+ *  Pending WQEs are flushed first. Coalescing is disabled by default.
+ *  @param qp a pointer to a queue pair.
+ *  @param max_wqes number of pending WQEs that triggers a doorbell, 0 or 1 disables coalescing.
+ *  @param max_bytes pending payload bytes that trigger a doorbell, 0 means no limit.
+ *  @param deadline_ns longest time in nanoseconds a WQE waits for its doorbell, 0 means no limit.
+ *  @return Success (0) or Failure (-1) if pending WQEs could not be flushed.
+ */
+int rdma_set_db_coalescing(struct rdma_qp_t* qp, uint32_t max_wqes, uint64_t max_bytes, uint64_t deadline_ns);
+
+/** @brief Configure doorbell pacing and congestion control of a queue pair.
+ *
+ *  Pending WQEs are flushed first. Pacing is disabled by default. Once
+ *  enabled, every SQPIi write may wait for tokens, see rdma_pacer_t.
+ *  @param qp a pointer to a queue pair.
+ *  @param max_rate_mbps maximum rate in Mb/s, 0 disables pacing.
+ *  @param min_rate_mbps lowest rate in Mb/s the controller cuts to, 0 for
+ *         max_rate_mbps / RDMA_PACER_STEP_DIV.
+ *  @param bucket_size token bucket size in bytes, the largest burst sent at
+ *         once, 0 for RDMA_PACER_BUCKET_DEFAULT.
+ *  @return Success (0) or Failure (-1) if pending WQEs could not be flushed,
+ *          max_rate_mbps exceeds RDMA_PACER_MAX_RATE_MBPS or min_rate_mbps
+ *          exceeds max_rate_mbps.
+ */
+int rdma_set_pacing(struct rdma_qp_t* qp, uint32_t max_rate_mbps, uint32_t min_rate_mbps, uint32_t bucket_size);
+
+/** @brief Get the current pacing rate of a queue pair.
+ *  @param qp a pointer to a queue pair.
+ *  @return Current rate in Mb/s, 0 if pacing is disabled. The controller
+ *          state is in qp->pacer.state.
+ */
+uint32_t rdma_pacing_rate(struct rdma_qp_t* qp);
+
+/** @brief Ring the SQ doorbell for every WQE held back by the doorbell coalescer.
+ *  @param qp a pointer to a queue pair.
+ *  @return Success (0) or Failure (-1).
+ */
+int rdma_flush_doorbell(struct rdma_qp_t* qp);
+
+/** @brief Collect completions of WQEs posted on a queue pair.
+ *
+ *  Reads the CQ head once and returns every WQE completed since the last call,
+ *  up to max entries. The call never blocks. It also rings the SQ doorbell if
+ *  the doorbell coalescer holds WQEs back past their deadline.
+ *  @param qp a pointer to a queue pair.
+ *  @param max maximum number of completions to return.
+ *  @param completions array of at least max entries filled by the call.
+ *  @return Number of completions returned (0 if nothing completed) or -1 if
+ *          the doorbell could not be rung.
+ */
+int rdma_poll_cq(struct rdma_qp_t* qp, uint32_t max, struct rdma_completion_t* completions);
+
+/** @brief Block until the event channel signals a queue pair.
+ *
+ *  WQEs held back by the doorbell coalescer are announced to the hardware
+ *  first, otherwise they would not complete while the caller sleeps. Threads
+ *  that wait on several eventfds themselves should call rdma_flush_doorbell()
+ *  on every QP before blocking.
+ *  @param ch a pointer to the event channel serving the QP.
+ *  @param qp a pointer to a queue pair.
+ *  @param timeout_ms timeout in milliseconds, -1 waits forever.
+ *  @return Number of events consumed (> 0), 0 on timeout or -1 on failure.
+ */
+int rdma_wait_qp_event(struct rdma_event_channel_t* ch, struct rdma_qp_t* qp, int timeout_ms);
+
+/** @brief Select how completions of a queue pair are detected.
+ *
+ *  RDMA_POLL_SHADOW is the default whenever the CQ doorbell address given to
+ *  allocate_rdma_qp() lies in the preallocated hugepages.
+ *  @param qp a pointer to a queue pair.
+ *  @param poll_mode RDMA_POLL_MMIO, RDMA_POLL_SHADOW or RDMA_POLL_CHECKED.
+ *  @return Success (0) or Failure (-1) if the mode is unknown or the doorbells
+ *          have no host memory shadow.
+ */
+int rdma_set_poll_mode(struct rdma_qp_t* qp, uint8_t poll_mode);
+
+/** @brief Get the number of free SQ slots of a queue pair.
+ *
+ *  The SQ is a ring of qdepth slots indexed modulo qdepth. One slot is kept
+ *  empty so that a full ring can be told apart from an empty one, hence at
+ *  most qdepth - 1 WQEs can be outstanding.
+ *  @param qp a pointer to a queue pair.
+ *  @return Number of WQEs that can be created and posted without overwriting
+ *          an outstanding one.
+ */
+uint32_t rdma_sq_credits(struct rdma_qp_t* qp);
+
+/** @brief Reap completions until the SQ has enough free slots.
+ *  @param qp a pointer to a queue pair.
+ *  @param num_wqe number of free SQ slots required.
+ *  @return Success (0) or Failure (-1) on timeout or if num_wqe exceeds qdepth - 1.
+ */
+int rdma_sq_reserve(struct rdma_qp_t* qp, uint32_t num_wqe);
+
+/** @brief Reap completions until every WQE posted on a queue pair is completed.
+ *  @param qp a pointer to a queue pair.
+ *  @return Success (0) or Failure (-1) on timeout.
+ */
+int rdma_sq_drain(struct rdma_qp_t* qp);
+
+/** @brief RDMA read of any size, split into chunks that are kept in flight on
+ *  the SQ ring until the whole transfer is completed.
+ *
+ *  WQEs already posted on the QP are completed first. Up to qdepth - 1 chunks
+ *  are outstanding at any time and every chunk carries wrid, the call returns
+ *  once the last chunk is completed.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param wrid work request ID of the transfer.
+ *  @param laddr physical address of the local buffer.
+ *  @param remote_offset remote memory address offset.
+ *  @param length transfer size in bytes.
+ *  @param chunk_size chunk size in bytes, 0 for RDMA_XFER_CHUNK_DEFAULT.
+ *  @param r_key RDMA security key of the remote buffer.
+ *  @return Success (0) or Failure (-1) on timeout or if a chunk completed with an error.
+ */
+int rdma_read_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid,
+                    uint64_t laddr, uint64_t remote_offset, uint64_t length,
+                    uint32_t chunk_size, uint32_t r_key);
+
+/** @brief RDMA write of any size, see rdma_read_large().
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param wrid work request ID of the transfer.
+ *  @param laddr physical address of the local buffer.
+ *  @param remote_offset remote memory address offset.
+ *  @param length transfer size in bytes.
+ *  @param chunk_size chunk size in bytes, 0 for RDMA_XFER_CHUNK_DEFAULT.
+ *  @param r_key RDMA security key of the remote buffer.
+ *  @return Success (0) or Failure (-1) on timeout or if a chunk completed with an error.
+ */
+int rdma_write_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid,
+                     uint64_t laddr, uint64_t remote_offset, uint64_t length,
+                     uint32_t chunk_size, uint32_t r_key);
+
+/** @brief Bind queue pairs connected to the same peer into a stripe.
+ *
+ *  The QPs stay owned by the caller and must not be used on their own while
+ *  a striped transfer is running.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpids QP IDs of the allocated queue pairs to bind.
+ *  @param num_qps number of QP IDs.
+ *  @param chunk_size chunk size in bytes, 0 for RDMA_XFER_CHUNK_DEFAULT.
+ *  @param policy RDMA_STRIPE_ROUND_ROBIN or RDMA_STRIPE_LEAST_LOADED.
+ *  @return a pointer to the stripe, or NULL if a QP is not allocated or the
+ *          QPs do not share the same destination.
+ */
+struct rdma_stripe_t* rdma_stripe_create(struct rdma_dev_t* rdma_dev, const uint32_t* qpids,
+                                         uint32_t num_qps, uint32_t chunk_size, uint8_t policy);
+
+/** @brief RDMA read of any size striped over the queue pairs of a stripe.
+ *
+ *  WQEs already posted on the QPs are completed first. The transfer is split
+ *  into chunks of the stripe's chunk size and the chunks are spread over the
+ *  QPs by the stripe's policy. The call returns once every chunk is completed.
+ *  @param stripe a pointer to the stripe.
+ *  @param wrid work request ID carried by every chunk.
+ *  @param laddr physical address of the local buffer.
+ *  @param remote_offset remote memory address offset.
+ *  @param length transfer size in bytes.
+ *  @param r_key RDMA security key of the remote buffer.
+ *  @return Success (0) or Failure (-1) on timeout or if a chunk completed with an error.
+ */
+int rdma_stripe_read(struct rdma_stripe_t* stripe, uint16_t wrid, uint64_t laddr,
+                     uint64_t remote_offset, uint64_t length, uint32_t r_key);
+
+/** @brief RDMA write of any size striped over the queue pairs of a stripe,
+ *  see rdma_stripe_read().
+ *  @param stripe a pointer to the stripe.
+ *  @param wrid work request ID carried by every chunk.
+ *  @param laddr physical address of the local buffer.
+ *  @param remote_offset remote memory address offset.
+ *  @param length transfer size in bytes.
+ *  @param r_key RDMA security key of the remote buffer.
+ *  @return Success (0) or Failure (-1) on timeout or if a chunk completed with an error.
+ */
+int rdma_stripe_write(struct rdma_stripe_t* stripe, uint16_t wrid, uint64_t laddr,
+                      uint64_t remote_offset, uint64_t length, uint32_t r_key);
+
+/** @brief Free a stripe, its queue pairs are left untouched.
+ *  @param stripe a pointer to the stripe.
+ *  @return void.
+ */
+void rdma_stripe_destroy(struct rdma_stripe_t* stripe);
+
+/** @brief Create an empty CQ group.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @return a pointer to the CQ group.
+ */
+struct rdma_cq_group_t* rdma_create_cq_group(struct rdma_dev_t* rdma_dev);
+
+/** @brief Add an allocated queue pair to a CQ group.
+ *  @param group a pointer to the CQ group.
+ *  @param qpid A QP ID.
+ *  @return Success (0) or Failure (-1) if the QP is not allocated.
+ */
+int rdma_cq_group_add(struct rdma_cq_group_t* group, uint32_t qpid);
+
+/** @brief Take the CQ interrupt status of a CQ group from an event channel.
+ *
+ *  The event channel clears CQINTSTS1..8, so a group sharing the device with
+ *  one must get the bits from it instead of the registers. The group has to
+ *  be destroyed before the channel.
+ *  @param group a pointer to the CQ group.
+ *  @param ch a pointer to the event channel of the device.
+ *  @return Success (0) or Failure (-1) if the channel feeds too many groups.
+ */
+int rdma_cq_group_set_event_channel(struct rdma_cq_group_t* group, struct rdma_event_channel_t* ch);
+
+/** @brief Remove a queue pair from a CQ group.
+ *  @param group a pointer to the CQ group.
+ *  @param qpid A QP ID.
+ *  @return void.
+ */
+void rdma_cq_group_remove(struct rdma_cq_group_t* group, uint32_t qpid);
+
+/** @brief Find the queue pairs of a group that have new completions.
+ *
+ *  A QP is reported while its CQ head differs from what rdma_poll_cq() has
+ *  consumed, so completions that are not collected are reported again by the
+ *  next sweep. QPs with a host memory CQ doorbell cost no register access.
+ *  For the others, the CQINTSTS words of the group are taken, either from the
+ *  event channel set with rdma_cq_group_set_event_channel() or by reading up
+ *  to 8 registers without clearing them. CQHEADi is then read only for the
+ *  QPs whose bit was set and that have WQEs the hardware was told about
+ *  outstanding. Without an event channel nothing clears CQINTSTS, so a QP
+ *  stays a candidate once its bit was set. Doorbells held back by the
+ *  coalescer past their deadline are rung. Completions are not consumed,
+ *  call rdma_poll_cq() on the reported QPs to collect them.
+ *  @param group a pointer to the CQ group.
+ *  @param ready array of at least max entries filled by the call.
+ *  @param max maximum number of QPs to return.
+ *  @return Number of QPs returned.
+ */
+uint32_t rdma_cq_group_poll(struct rdma_cq_group_t* group, struct rdma_cq_ready_t* ready, uint32_t max);
+
+/** @brief Free a CQ group.
+ *  @param group a pointer to the CQ group.
+ *  @return void.
+ */
+void rdma_destroy_cq_group(struct rdma_cq_group_t* group);
+
 /** @brief Post an RDMA receive request.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qp a pointer to a queue pair.
@@ -338,6 +1257,25 @@ void* rdma_post_receive(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp);
  */
 uint8_t rdma_release_rq_consumed(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp);
 
+/** @brief Get every RQE received since the last call without copying it.
+ *
+ *  Does not wait: the RQ producer index is read once and the new RQEs are
+ *  returned in arrival order as views into qp->rq. The hardware does not
+ *  reuse an RQE before it is released, so views can be held across calls.
+ *  @param qp a pointer to a queue pair.
+ *  @param max maximum number of RQEs to return.
+ *  @param views array of at least max entries filled by the call.
+ *  @return Number of RQEs returned (0 if nothing arrived).
+ */
+int rdma_poll_rq(struct rdma_qp_t* qp, uint32_t max, struct rdma_rqe_view_t* views);
+
+/** @brief Release the oldest RQEs returned by rdma_poll_rq() with one RQCIi write.
+ *  @param qp a pointer to a queue pair.
+ *  @param count number of RQEs to release, in the order they were returned.
+ *  @return Success (0) or Failure (-1) if fewer than count RQEs are held.
+ */
+int rdma_rq_release(struct rdma_qp_t* qp, uint32_t count);
+
 /** @brief Reset RDMA device when encountering fatal error.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid the QP ID that has the fatal issues.
@@ -351,7 +1289,9 @@ void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid);
  */
 void destroy_rdma_pd_entry(struct rdma_pd_t* pd);
 
-/** @brief Destroy the RDMA queue pair generated.
+/** @brief Destroy the RDMA queue pair generated. The QP ID can be allocated
+ *  again afterwards. The protection domain of the QP is not released, it may
+ *  be shared with other QPs.
  *  @param qp a pointer to a queue pair.
  *  @return Success (0).
  */
@@ -10,6 +10,28 @@
  */
 
 #include "reconic.h"
+#include "trace_api.h"
+#include <sys/syscall.h>
+
+// mbind() policy of linux/mempolicy.h, the syscall is used without libnuma
+#define RN_MPOL_BIND 2
+
+/*! \struct prefault_arg_t
+ * \brief Hugepages touched by one prefault thread.
+ */
+struct prefault_arg_t {
+  char* start;        /*!< start first hugepage. */
+  uint64_t num_pages; /*!< num_pages number of hugepages. */
+  uint32_t page_shift; /*!< page_shift hugepage size. */
+};
+
+/*! \struct paddr_table_arg_t
+ * \brief Result of the thread building the hugepage address table.
+ */
+struct paddr_table_arg_t {
+  struct rn_dev_t* rn_dev; /*!< rn_dev device whose table is built. */
+  int rc;                  /*!< rc return code of load_hugepage_paddr_table(). */
+};
 
 int debug = 0;
 
@@ -17,6 +39,19 @@ char* device = "";
 
 int fpga_fd = -1;
 
+void set_rn_dev_mm_handle(struct rn_dev_t* rn_dev, char* mm_device, int mm_fd) {
+  rn_dev->mm_device = mm_device;
+  rn_dev->mm_fd = mm_fd;
+}
+
+char* get_rn_dev_mm_device(struct rn_dev_t* rn_dev) {
+  return (rn_dev->mm_device != NULL) ? rn_dev->mm_device : device;
+}
+
+int get_rn_dev_mm_fd(struct rn_dev_t* rn_dev) {
+  return (rn_dev->mm_fd >= 0) ? rn_dev->mm_fd : fpga_fd;
+}
+
 uint64_t get_win_size() {
   //return AXI_BAR_SIZE>>3;
   return AXI_BAR_SIZE;
@@ -156,6 +191,128 @@ uint64_t get_buffer_paddr(void *buffer) {
   return paddr;
 }
 
+/* Read count pagemap entries starting at byte offset of /proc/self/pagemap */
+static int read_pagemap_entries(int pagemap_fd, uint64_t* entries, uint64_t count, uint64_t offset) {
+  uint64_t done = 0;
+  ssize_t rc;
+
+  // pagemap may return fewer bytes than asked for, carry on from there
+  while(done < count * PAGEMAP_LENGTH) {
+    rc = pread(pagemap_fd, (char* ) entries + done, count * PAGEMAP_LENGTH - done, offset + done);
+    if(rc <= 0) {
+      fprintf(stderr, "Error: failed to read /proc/self/pagemap: %s\n", (rc < 0) ? strerror(errno) : "short read");
+      return -1;
+    }
+    done += (uint64_t) rc;
+  }
+  return 0;
+}
+
+/* Keep the physical address of each 2MB chunk of the preallocated hugepages.
+ * A hugepage is physically contiguous, so the pagemap entry of its first 4KB
+ * page is enough: the entries of all 2MB hugepages are read with one pread,
+ * and a 1GB hugepage takes a single entry for all of its 512 chunks.
+ */
+int load_hugepage_paddr_table(struct rn_dev_t* rn_dev) {
+  uint32_t chunks_per_page = 1U << (rn_dev->hugepage_shift - HUGE_PAGE_SHIFT);
+  uint32_t num_pages = rn_dev->num_hugepages / chunks_per_page;
+  uint64_t page_entries = (((uint64_t) 1) << rn_dev->hugepage_shift) / getpagesize();
+  uint64_t huge_page_size = ((uint64_t) 1) << HUGE_PAGE_SHIFT;
+  uint64_t offset = (uint64_t) rn_dev->base_buf->buffer / getpagesize() * PAGEMAP_LENGTH;
+  uint64_t entry_step;
+  uint64_t* entries;
+  uint64_t pfn;
+  uint32_t i;
+  uint32_t j;
+  int pagemap_fd;
+  int rc = 0;
+
+  // Reading every entry of a 1GB hugepage would take 2MB, read the first one only
+  entry_step = (chunks_per_page == 1) ? page_entries : 1;
+  rn_dev->hugepage_paddr  = (uint64_t* ) malloc(rn_dev->num_hugepages * sizeof(uint64_t));
+  rn_dev->hugepage_contig = (uint32_t* ) malloc(rn_dev->num_hugepages * sizeof(uint32_t));
+  entries = (uint64_t* ) malloc(num_pages * entry_step * PAGEMAP_LENGTH);
+  if((rn_dev->hugepage_paddr == NULL) || (rn_dev->hugepage_contig == NULL) || (entries == NULL)) {
+    fprintf(stderr, "Error: failed to allocate the hugepage address table\n");
+    free(entries);
+    return -1;
+  }
+
+  pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+  if(pagemap_fd < 0) {
+    fprintf(stderr, "Error: failed to open /proc/self/pagemap: %s\n", strerror(errno));
+    free(entries);
+    return -1;
+  }
+  if(chunks_per_page == 1) {
+    rc = read_pagemap_entries(pagemap_fd, entries, num_pages * entry_step, offset);
+  } else {
+    for(i = 0; (i < num_pages) && (rc == 0); i++) {
+      rc = read_pagemap_entries(pagemap_fd, &entries[i], 1, offset + i * page_entries * PAGEMAP_LENGTH);
+    }
+  }
+  close(pagemap_fd);
+  if(rc < 0) {
+    free(entries);
+    return -1;
+  }
+
+  for(i = 0; i < num_pages; i++) {
+    // The page frame number is in bits 0 - 54, bit 63 tells the page is present
+    pfn = entries[i * entry_step] & 0x7FFFFFFFFFFFFF;
+    if(((entries[i * entry_step] >> 63) == 0) || (pfn == 0)) {
+      fprintf(stderr, "Error: no page frame number for hugepage %d, root is needed to read it\n", i);
+      free(entries);
+      return -1;
+    }
+    for(j = 0; j < chunks_per_page; j++) {
+      rn_dev->hugepage_paddr[i * chunks_per_page + j] = (pfn << PAGE_SHIFT) + j * huge_page_size;
+    }
+  }
+  free(entries);
+
+  // Count, from the last chunk backwards, how far each physically contiguous run goes
+  for(i = rn_dev->num_hugepages; i > 0; i--) {
+    if((i < rn_dev->num_hugepages) && (rn_dev->hugepage_paddr[i] == rn_dev->hugepage_paddr[i - 1] + huge_page_size)) {
+      rn_dev->hugepage_contig[i - 1] = rn_dev->hugepage_contig[i] + 1;
+    } else {
+      rn_dev->hugepage_contig[i - 1] = 1;
+    }
+  }
+
+  return 0;
+}
+
+uint64_t get_hugepage_paddr(struct rn_dev_t* rn_dev, void* vaddr) {
+  uint64_t offset = (uint64_t) vaddr - (uint64_t) rn_dev->base_buf->buffer;
+
+  if(((uint64_t) vaddr < (uint64_t) rn_dev->base_buf->buffer) ||
+     ((offset >> HUGE_PAGE_SHIFT) >= rn_dev->num_hugepages)) {
+    return get_buffer_paddr(vaddr);
+  }
+  return rn_dev->hugepage_paddr[offset >> HUGE_PAGE_SHIFT] + (offset & ((((uint64_t) 1) << HUGE_PAGE_SHIFT) - 1));
+}
+
+/* This function is used to get the virtual address of a physical address that
+ * belongs to the preallocated hugepages, from the hugepage address table.
+ */
+void* get_buffer_vaddr(struct rn_dev_t* rn_dev, uint64_t paddr) {
+  uint64_t huge_page_size = ((uint64_t) 1) << HUGE_PAGE_SHIFT;
+  uint64_t i;
+
+  if((rn_dev == NULL) || (rn_dev->hugepage_paddr == NULL) || is_device_address(paddr)) {
+    return NULL;
+  }
+
+  for(i = 0; i < rn_dev->num_hugepages; i++) {
+    if((paddr >= rn_dev->hugepage_paddr[i]) && (paddr < (rn_dev->hugepage_paddr[i] + huge_page_size))) {
+      return (void*) ((uint64_t) rn_dev->base_buf->buffer + (i << HUGE_PAGE_SHIFT) + (paddr - rn_dev->hugepage_paddr[i]));
+    }
+  }
+
+  return NULL;
+}
+
 void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_t low_addr) {
   int i;
   uint64_t win_size = 0;
@@ -201,71 +358,359 @@ void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_
   }
 }
 
-struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, char* buf_location) {
+int get_pcie_numa_node(char* pcie_resource) {
+  char path[512];
+  char* slash;
+  FILE* fp;
+  int numa_node = -1;
+
+  // numa_node sits next to the resource file in the sysfs directory of the function
+  slash = (pcie_resource != NULL) ? strrchr(pcie_resource, '/') : NULL;
+  if(slash == NULL) {
+    return -1;
+  }
+  snprintf(path, sizeof(path), "%.*s/numa_node", (int) (slash - pcie_resource), pcie_resource);
+  fp = fopen(path, "r");
+  if(fp == NULL) {
+    return -1;
+  }
+  if(fscanf(fp, "%d", &numa_node) != 1) {
+    numa_node = -1;
+  }
+  fclose(fp);
+  return numa_node;
+}
+
+/* Number of free hugepages of size 1 << hugepage_shift on a NUMA node, -1 if unknown */
+static long get_node_free_hugepages(int numa_node, uint32_t hugepage_shift) {
+  char path[128];
+  FILE* fp;
+  long free_pages = -1;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/hugepages/hugepages-%lukB/free_hugepages",
+           numa_node, (((uint64_t) 1) << hugepage_shift) >> 10);
+  fp = fopen(path, "r");
+  if(fp == NULL) {
+    return -1;
+  }
+  if(fscanf(fp, "%ld", &free_pages) != 1) {
+    free_pages = -1;
+  }
+  fclose(fp);
+  return free_pages;
+}
+
+/* Number of online NUMA nodes, from a list such as "0-1,3". A machine
+ * without the sysfs node directory counts as one node.
+ */
+static int get_num_online_nodes(void) {
+  FILE* fp;
+  int first;
+  int last;
+  int num_nodes = 0;
+  char sep;
+
+  fp = fopen("/sys/devices/system/node/online", "r");
+  if(fp == NULL) {
+    return 1;
+  }
+  while(fscanf(fp, "%d", &first) == 1) {
+    last = first;
+    sep = (char) fgetc(fp);
+    if((sep == '-') && (fscanf(fp, "%d", &last) == 1)) {
+      sep = (char) fgetc(fp);
+    }
+    num_nodes += last - first + 1;
+    if(sep != ',') {
+      break;
+    }
+  }
+  fclose(fp);
+  return (num_nodes > 0) ? num_nodes : 1;
+}
+
+/* Print on which NUMA nodes the hugepages of a locked mapping ended up */
+static void report_hugepage_placement(void* buffer, uint64_t size, uint32_t hugepage_shift, int numa_node) {
+  uint64_t num_pages = size >> hugepage_shift;
+  uint64_t node_pages[RN_MAX_NUMA_NODES];
+  uint64_t far_pages = 0;
+  void** pages;
+  int* status;
+  uint64_t i;
+
+  pages  = (void** ) malloc(num_pages * sizeof(void*));
+  status = (int* ) malloc(num_pages * sizeof(int));
+  if((pages == NULL) || (status == NULL)) {
+    free(pages);
+    free(status);
+    return;
+  }
+  for(i = 0; i < num_pages; i++) {
+    pages[i] = (void*) ((uint64_t) buffer + (i << hugepage_shift));
+  }
+  // move_pages() without target nodes only reports where each page is
+  if(syscall(SYS_move_pages, 0, num_pages, pages, NULL, status, 0) != 0) {
+    fprintf(stderr, "Info: NUMA placement of the hugepages is unknown: %s\n", strerror(errno));
+    free(pages);
+    free(status);
+    return;
+  }
+
+  memset(node_pages, 0, sizeof(node_pages));
+  for(i = 0; i < num_pages; i++) {
+    if((status[i] >= 0) && (status[i] < RN_MAX_NUMA_NODES)) {
+      node_pages[status[i]]++;
+    }
+    if((numa_node >= 0) && (status[i] != numa_node)) {
+      far_pages++;
+    }
+  }
+  fprintf(stderr, "Info: %ld hugepages of %ldMB:", num_pages, (((uint64_t) 1) << hugepage_shift) >> 20);
+  for(i = 0; i < RN_MAX_NUMA_NODES; i++) {
+    if(node_pages[i] != 0) {
+      fprintf(stderr, " %ld on NUMA node %ld", node_pages[i], i);
+    }
+  }
+  fprintf(stderr, "\n");
+  if(far_pages != 0) {
+    fprintf(stderr, "Warning: %ld hugepages are not on NUMA node %d of the card, their DMA crosses sockets\n",
+            far_pages, numa_node);
+  }
+  free(pages);
+  free(status);
+}
+
+/* Write the first byte of each hugepage so that the kernel allocates and
+ * clears it. The pages were just mapped and hold zeroes only.
+ */
+static void* prefault_hugepages(void* arg) {
+  struct prefault_arg_t* prefault = (struct prefault_arg_t* ) arg;
+  uint64_t i;
+
+  for(i = 0; i < prefault->num_pages; i++) {
+    ((volatile char* ) prefault->start)[i << prefault->page_shift] = 0;
+  }
+  return NULL;
+}
+
+/* Fault in the hugepages of a mapping from up to max_threads threads. Clearing
+ * the pages is most of the cost of pinning a large pool, and it scales with
+ * cores.
+ */
+static void prefault_hugepages_parallel(void* buffer, uint64_t num_pages, uint32_t hugepage_shift, uint64_t max_threads) {
+  struct prefault_arg_t args[RN_PREFAULT_MAX_THREADS];
+  pthread_t threads[RN_PREFAULT_MAX_THREADS];
+  uint8_t started[RN_PREFAULT_MAX_THREADS];
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t num_threads;
+  uint64_t first = 0;
+  uint64_t i;
+
+  num_threads = (num_cpus > 0) ? (uint64_t) num_cpus : 1;
+  if(num_threads > max_threads) {
+    num_threads = max_threads;
+  }
+  if(num_threads > num_pages) {
+    num_threads = num_pages;
+  }
+  for(i = 0; i < num_threads; i++) {
+    args[i].start      = (char* ) buffer + (first << hugepage_shift);
+    args[i].num_pages  = num_pages / num_threads + ((i < (num_pages % num_threads)) ? 1 : 0);
+    args[i].page_shift = hugepage_shift;
+    first += args[i].num_pages;
+    // The calling thread takes the first slice, and any slice whose thread did not start
+    started[i] = (i != 0) && (pthread_create(&threads[i], NULL, prefault_hugepages, &args[i]) == 0);
+  }
+  for(i = 0; i < num_threads; i++) {
+    if(!started[i]) {
+      prefault_hugepages(&args[i]);
+    }
+  }
+  for(i = 1; i < num_threads; i++) {
+    if(started[i]) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+}
+
+void* map_hugepages(uint64_t size, uint32_t hugepage_shift, int numa_node, struct rn_dev_timing_t* timing) {
+  unsigned long nodemask[RN_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+  uint64_t num_pages = size >> hugepage_shift;
+  uint64_t start_ns = get_time_ns();
+  uint64_t end_ns;
+  long free_pages;
+  int bound = 0;
+  void* buffer;
+
+  // No MAP_POPULATE: it faults the pages in on this thread, before mbind()
+  buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB | (hugepage_shift << MAP_HUGE_SHIFT), -1, 0);
+  if(buffer == MAP_FAILED) {
+    fprintf(stderr, "Error: failed to map %ld hugepages of %ldkB: %s, check /sys/kernel/mm/hugepages/hugepages-%ldkB/nr_hugepages\n",
+            num_pages, (((uint64_t) 1) << hugepage_shift) >> 10, strerror(errno), (((uint64_t) 1) << hugepage_shift) >> 10);
+    return NULL;
+  }
+
+  // Bind the mapping before mlock() faults the pages in. Faulting a hugepage
+  // on a node that has none left raises SIGBUS, so such a pool stays unbound.
+  if((numa_node >= 0) && (numa_node < RN_MAX_NUMA_NODES)) {
+    free_pages = get_node_free_hugepages(numa_node, hugepage_shift);
+    if((free_pages >= 0) && ((uint64_t) free_pages < num_pages)) {
+      fprintf(stderr, "Warning: NUMA node %d has %ld free hugepages of %ldkB, %ld needed, the pool is not bound to it\n",
+              numa_node, free_pages, (((uint64_t) 1) << hugepage_shift) >> 10, num_pages);
+    } else {
+      memset(nodemask, 0, sizeof(nodemask));
+      nodemask[numa_node / (8 * sizeof(unsigned long))] = 1UL << (numa_node % (8 * sizeof(unsigned long)));
+      if(syscall(SYS_mbind, buffer, size, RN_MPOL_BIND, nodemask, RN_MAX_NUMA_NODES + 1, 0) != 0) {
+        fprintf(stderr, "Warning: failed to bind the hugepages to NUMA node %d: %s\n", numa_node, strerror(errno));
+      } else {
+        bound = 1;
+      }
+    }
+  }
+  end_ns = get_time_ns();
+  if(timing != NULL) {
+    timing->map_ns = end_ns - start_ns;
+  }
+
+  // Pages of an unbound mapping go to the node of the thread that touches them
+  // first. With several nodes, threads spread over the sockets would scatter
+  // the pool, so it is faulted in by the calling thread only.
+  start_ns = end_ns;
+  prefault_hugepages_parallel(buffer, num_pages, hugepage_shift,
+                              (bound || (get_num_online_nodes() == 1)) ? RN_PREFAULT_MAX_THREADS : 1);
+  end_ns = get_time_ns();
+  if(timing != NULL) {
+    timing->prefault_ns = end_ns - start_ns;
+  }
+
+  // Lock the buffer in physical memory, the pages are already present
+  start_ns = end_ns;
+  if(mlock(buffer, size) == -1) {
+    fprintf(stderr, "Error: failed to lock %ld hugepages in memory: %s\n", num_pages, strerror(errno));
+    munmap(buffer, size);
+    return NULL;
+  }
+  if(timing != NULL) {
+    timing->lock_ns = get_time_ns() - start_ns;
+  }
+  report_hugepage_placement(buffer, size, hugepage_shift, numa_node);
+
+  return buffer;
+}
+
+struct rdma_buff_t* allocate_rdma_buffer_aligned(struct rn_dev_t* rn_dev, uint64_t buf_size, uint64_t align, char* buf_location) {
   struct rdma_buff_t* rdma_buffer;
+  struct rn_mem_pool_t* pool;
+  uint64_t offset;
+  uint8_t host_mem;
+
+  if(!strcmp(buf_location, HOST_MEM)) {
+    host_mem = 1;
+    pool = rn_dev->host_pool;
+  } else if(!strcmp(buf_location, DEVICE_MEM)) {
+    host_mem = 0;
+    pool = rn_dev->dev_pool;
+  } else {
+    fprintf(stderr, "Error: please provide correct buffer location: [host_mem | dev_mem]\n");
+    exit(EXIT_FAILURE);
+  }
+
   rdma_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
   if(rdma_buffer == NULL) {
     fprintf(stderr, "Error: failed to create rdma_buffer\n");
     exit(EXIT_FAILURE);
   }
 
-  if(!strcmp(buf_location, HOST_MEM)) {
-    // Allocate the buffer in the host memory
-    // Check the buffer_offset and buf_size whether it meets 4KB alignment or not
-    if (buf_size <= HARDWARE_PAGE_SIZE) {
-      if (((rn_dev->buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) + buf_size) > HARDWARE_PAGE_SIZE) {
-        rn_dev->buffer_offset =  (rn_dev->buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-      }
-    } else {
-      // buf_size > HARDWARE_PAGE_SIZE
-      if((rn_dev->buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) != 0) {
-        // buffer_offset is not aligned with HARDWARE_PAGE_SIZE
-        rn_dev->buffer_offset =  (rn_dev->buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-      }
-    }
-    rdma_buffer->buffer = (void*)((uint64_t) rn_dev->base_buf->buffer + rn_dev->buffer_offset);
-    rn_dev->buffer_offset += buf_size;
-    rdma_buffer->buf_size = buf_size;
+  // Buffers never cross a 4KB page unless they start on one, and host buffers
+  // larger than a hugepage only take physically contiguous hugepages
+  if(rn_mem_pool_alloc(pool, buf_size, align, &offset) < 0) {
+    fprintf(stderr, "Error: no free %ld bytes left in %s\n", buf_size, buf_location);
+    free(rdma_buffer);
+    return NULL;
+  }
+  rdma_buffer->buf_size = buf_size;
 
-    // Get the physical address of the buffer
-    rdma_buffer->dma_addr = get_buffer_paddr(rdma_buffer->buffer);
-    Debug("Info: allocated host buffer vir addr = %p, physical addr = %lx, rn_dev->buffer_offset = 0x%lx\n", rdma_buffer->buffer, rdma_buffer->dma_addr, rn_dev->buffer_offset);
+  if(host_mem) {
+    rdma_buffer->buffer = (void*)((uint64_t) rn_dev->base_buf->buffer + offset);
+    // Get the physical address of the buffer from the hugepage address table
+    rdma_buffer->dma_addr = get_hugepage_paddr(rn_dev, rdma_buffer->buffer);
+    Debug("Info: allocated host buffer vir addr = %p, physical addr = %lx, offset = 0x%lx\n", rdma_buffer->buffer, rdma_buffer->dma_addr, offset);
     Debug("Info: allocate_rdma_buffer - successfully allocated rdma host buffer\n");
   } else {
-    if (!strcmp(buf_location, DEVICE_MEM)) {
-      // Allocate the buffer in the device memory
-      // TODO: We need to implement user-space device memory management function
-      // Check the dev_buffer_offset and buf_size whether it meets 4KB alignment or not
-      if (buf_size <= HARDWARE_PAGE_SIZE) {
-        if (((rn_dev->dev_buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) + buf_size) > HARDWARE_PAGE_SIZE) {
-          rn_dev->dev_buffer_offset =  (rn_dev->dev_buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-        }
-      } else {
-        // buf_size > HARDWARE_PAGE_SIZE
-        if((rn_dev->dev_buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) != 0) {
-          // dev_buffer_offset is not aligned with HARDWARE_PAGE_SIZE
-          rn_dev->dev_buffer_offset =  (rn_dev->dev_buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-        }
-      }
-      rdma_buffer->buffer = (void*)(rn_dev->dev_buffer_offset | DEVICE_MEM_OFFSET);
-      rdma_buffer->dma_addr = (uint64_t) (rn_dev->dev_buffer_offset | DEVICE_MEM_OFFSET);
-      rn_dev->dev_buffer_offset += buf_size;
-      rdma_buffer->buf_size = buf_size;
-
-      // TODO: We need to put assert here later to make sure we won't exceed device memory.
-      Debug("Info: allocated device buffer physical addr = %lx, rn_dev->dev_buffer_offset = 0x%lx\n", rdma_buffer->dma_addr, rn_dev->dev_buffer_offset);
-      assert(rn_dev->dev_buffer_offset <= (uint64_t) DEVICE_MEM_SIZE);
+    rdma_buffer->buffer = (void*)(offset | DEVICE_MEM_OFFSET);
+    rdma_buffer->dma_addr = (uint64_t) (offset | DEVICE_MEM_OFFSET);
+    Debug("Info: allocated device buffer physical addr = %lx, offset = 0x%lx\n", rdma_buffer->dma_addr, offset);
     Debug("Info: allocate_rdma_buffer - successfully allocated rdma device buffer\n");
-    } else {
-      fprintf(stderr, "Error: please provide correct buffer location: [host_mem | dev_mem]\n");
-      exit(EXIT_FAILURE);
-    }
   }
 
   return rdma_buffer;
 }
 
-struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, uint32_t num_qp) {
+struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, char* buf_location) {
+  struct rdma_buff_t* rdma_buffer;
+
+  // Callers of this function have never checked its result
+  rdma_buffer = allocate_rdma_buffer_aligned(rn_dev, buf_size, 0, buf_location);
+  if(rdma_buffer == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  return rdma_buffer;
+}
+
+void free_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  if(rdma_buffer == NULL) {
+    return;
+  }
+  if(is_device_address(rdma_buffer->dma_addr)) {
+    rn_mem_pool_free(rn_dev->dev_pool, rdma_buffer->dma_addr & ~DEVICE_MEM_OFFSET, rdma_buffer->buf_size);
+  } else {
+    rn_mem_pool_free(rn_dev->host_pool, (uint64_t) rdma_buffer->buffer - (uint64_t) rn_dev->base_buf->buffer,
+                     rdma_buffer->buf_size);
+  }
+  free(rdma_buffer);
+}
+
+int get_rn_mem_stats(struct rn_dev_t* rn_dev, char* buf_location, struct rn_mem_stats_t* stats) {
+  if(!strcmp(buf_location, HOST_MEM)) {
+    rn_mem_pool_stats(rn_dev->host_pool, stats);
+  } else if(!strcmp(buf_location, DEVICE_MEM)) {
+    rn_mem_pool_stats(rn_dev->dev_pool, stats);
+  } else {
+    fprintf(stderr, "Error: please provide correct buffer location: [host_mem | dev_mem]\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* Build the hugepage address table off the critical path */
+static void* load_paddr_table_thread(void* arg) {
+  struct paddr_table_arg_t* table_arg = (struct paddr_table_arg_t* ) arg;
+  uint64_t start_ns = get_time_ns();
+
+  table_arg->rc = load_hugepage_paddr_table(table_arg->rn_dev);
+  table_arg->rn_dev->timing.translate_ns = get_time_ns() - start_ns;
+  return NULL;
+}
+
+void print_rn_dev_timing(struct rn_dev_t* rn_dev) {
+  struct rn_dev_timing_t* timing = &rn_dev->timing;
+
+  fprintf(stderr, "Info: startup time %.3f ms: map %.3f, prefault %.3f, lock %.3f, translate %.3f, "
+          "BDF config %.3f, pools %.3f, RDMA open %.3f\n",
+          (double) (timing->total_ns + timing->rdma_open_ns) / 1e6, (double) timing->map_ns / 1e6,
+          (double) timing->prefault_ns / 1e6, (double) timing->lock_ns / 1e6, (double) timing->translate_ns / 1e6,
+          (double) timing->bdf_ns / 1e6, (double) timing->pool_ns / 1e6, (double) timing->rdma_open_ns / 1e6);
+}
+
+struct rn_dev_t* create_rn_dev_ext(char* pcie_resource, int* pcie_resource_fd, struct rn_dev_attr_t* attr) {
+  struct paddr_table_arg_t table_arg;
+  pthread_t table_thread;
+  uint8_t table_threaded;
+  uint64_t create_start_ns = get_time_ns();
+  uint64_t start_ns;
+  uint32_t chunks_per_page;
+  uint64_t pool_size;
   int scr;
   // int rdma = -1;
   void* axil_scr_base;
@@ -283,6 +728,12 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
     exit(EXIT_FAILURE);
   }
 
+  // DEBUG is read once here, Debug() and the data path only test the flag
+  if(getenv("DEBUG") && atoi(getenv("DEBUG")) == 1) {
+    debug = 1;
+  }
+  rn_trace_init();
+
   rn_dev->axil_map_size = RN_SCR_MAP_SIZE;
   rn_dev->rdma_dev = NULL;
   rn_dev->base_buf = NULL;
@@ -290,6 +741,15 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   rn_dev->winSize = winSize;
   rn_dev->winSize->win_size_lsb = 0;
   rn_dev->winSize->win_size_msb = 0;
+  rn_dev->mm_device = NULL;
+  rn_dev->mm_fd = -1;
+  rn_dev->hugepage_shift = attr->hugepage_shift;
+  rn_dev->numa_node = (attr->numa_node == RN_NUMA_NODE_AUTO) ? get_pcie_numa_node(pcie_resource) : attr->numa_node;
+  rn_dev->hugepage_paddr = NULL;
+  rn_dev->hugepage_contig = NULL;
+  rn_dev->host_pool = NULL;
+  rn_dev->dev_pool = NULL;
+  memset(&rn_dev->timing, 0, sizeof(struct rn_dev_timing_t));
 
   if((scr = open(pcie_resource, O_RDWR | O_SYNC)) == -1) {
     fprintf(stderr, "Error can't open %s file for the PCIe resource2!\n", pcie_resource);
@@ -309,7 +769,7 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   }
 
   rn_dev->axil_ctl = (uint32_t* ) axil_scr_base;
-  rn_dev->num_qp = num_qp;
+  rn_dev->num_qp = attr->num_qp;
 
   // Allocate 128MB memory space from HugePages
   rn_dev->base_buf = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
@@ -318,17 +778,34 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
     exit(EXIT_FAILURE);
   }
 
-  fprintf(stderr, "create_rn_dev - testing2\n");
-  rn_dev->base_buf->buffer = mmap(NULL, num_hugepages_request * (1 << HUGE_PAGE_SHIFT),
-                                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS |
-                                  MAP_HUGETLB, -1, 0);
-
-  // Lock the buffer in physical memory
-  if(mlock(rn_dev->base_buf->buffer, num_hugepages_request * (1 << HUGE_PAGE_SHIFT)) == -1) {
-    fprintf(stderr, "Error: failed to lock page in memory\n");
+  // The pool is a whole number of hugepages, the address table has one entry per 2MB
+  if((attr->hugepage_shift != HUGE_PAGE_SHIFT) && (attr->hugepage_shift != HUGE_PAGE_1GB_SHIFT)) {
+    fprintf(stderr, "Error: hugepages of 1 << %d bytes are not supported\n", attr->hugepage_shift);
+    exit(EXIT_FAILURE);
+  }
+  chunks_per_page = 1U << (attr->hugepage_shift - HUGE_PAGE_SHIFT);
+  rn_dev->num_hugepages = (attr->num_hugepages + chunks_per_page - 1) / chunks_per_page * chunks_per_page;
+  pool_size = ((uint64_t) rn_dev->num_hugepages) << HUGE_PAGE_SHIFT;
+  if(pool_size == 0) {
+    fprintf(stderr, "Error: a hugepage pool of %ld bytes is not supported\n", pool_size);
     exit(EXIT_FAILURE);
   }
 
+  fprintf(stderr, "Info: RecoNIC is on NUMA node %d\n", rn_dev->numa_node);
+  rn_dev->base_buf->buffer = map_hugepages(pool_size, attr->hugepage_shift, rn_dev->numa_node, &rn_dev->timing);
+  if(rn_dev->base_buf->buffer == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  rn_dev->base_buf->buf_size = pool_size;
+
+  // The BDF windows only need the address of the first hugepage, so the
+  // whole address table is built while the bridge and pools are set up
+  table_arg.rn_dev = rn_dev;
+  table_arg.rc = 0;
+  table_threaded = (pthread_create(&table_thread, NULL, load_paddr_table_thread, &table_arg) == 0);
+  if(!table_threaded) {
+    load_paddr_table_thread(&table_arg);
+  }
   rn_dev->base_buf->dma_addr = get_buffer_paddr(rn_dev->base_buf->buffer);
   fprintf(stderr, "Info: pre-allocated hugepage buffer vir addr = %p, physical addr = 0x%lx\n", rn_dev->base_buf->buffer, rn_dev->base_buf->dma_addr);
 
@@ -336,10 +813,52 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   phy_addr_lsb = (uint32_t) ((rn_dev->base_buf->dma_addr & 0x00000000ffffffff));
 
   // Configure QDMA slave AXI bridge
+  start_ns = get_time_ns();
   config_rn_dev_axib_bdf(rn_dev, phy_addr_msb, phy_addr_lsb);
+  rn_dev->timing.bdf_ns = get_time_ns() - start_ns;
+
+  start_ns = get_time_ns();
+  rn_dev->dev_pool  = rn_mem_pool_create((uint64_t) DEVICE_MEM_SIZE, 20, NULL);
+  rn_dev->timing.pool_ns = get_time_ns() - start_ns;
+
+  if(table_threaded) {
+    pthread_join(table_thread, NULL);
+  }
+  if(table_arg.rc < 0) {
+    exit(EXIT_FAILURE);
+  }
+  if(rn_dev->hugepage_paddr[0] != rn_dev->base_buf->dma_addr) {
+    fprintf(stderr, "Error: the first hugepage moved from physical address 0x%lx to 0x%lx while the address table was built\n",
+            rn_dev->base_buf->dma_addr, rn_dev->hugepage_paddr[0]);
+    exit(EXIT_FAILURE);
+  }
 
-  rn_dev->buffer_offset = (uint64_t) 0;
-  rn_dev->dev_buffer_offset = (uint64_t) 0;
+  // Hugepage blocks are at most one hugepage, larger host buffers span
+  // physically contiguous hugepages. Device memory has no such limit.
+  start_ns = get_time_ns();
+  rn_dev->host_pool = rn_mem_pool_create(rn_dev->base_buf->buf_size, HUGE_PAGE_SHIFT - RN_MEM_PAGE_SHIFT,
+                                         rn_dev->hugepage_contig);
+  rn_dev->timing.pool_ns += get_time_ns() - start_ns;
+  if((rn_dev->host_pool == NULL) || (rn_dev->dev_pool == NULL)) {
+    exit(EXIT_FAILURE);
+  }
 
+  rn_dev->timing.total_ns = get_time_ns() - create_start_ns;
+  fprintf(stderr, "Info: create_rn_dev took %.3f ms\n", (double) rn_dev->timing.total_ns / 1e6);
   return rn_dev;
 }
+
+struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, uint32_t num_qp) {
+  struct rn_dev_attr_t attr;
+  char* hugepage_size = getenv("RN_HUGEPAGE_SIZE");
+
+  attr.num_hugepages  = num_hugepages_request;
+  attr.num_qp         = num_qp;
+  attr.hugepage_shift = HUGE_PAGE_SHIFT;
+  attr.numa_node      = RN_NUMA_NODE_AUTO;
+  // RN_HUGEPAGE_SIZE=1G backs the pool with 1GB hugepages
+  if((hugepage_size != NULL) && ((strcmp(hugepage_size, "1G") == 0) || (strcmp(hugepage_size, "1g") == 0))) {
+    attr.hugepage_shift = HUGE_PAGE_1GB_SHIFT;
+  }
+  return create_rn_dev_ext(pcie_resource, pcie_resource_fd, &attr);
+}
@@ -16,6 +16,7 @@
 #include "auxiliary.h"
 #include "reconic_reg.h"
 #include "memory_api.h"
+#include "mem_pool.h"
 #include "control_api.h"
 
 // -- 全局变量声明 --
@@ -76,6 +77,32 @@ extern int fpga_fd;
  */
 #define HUGE_PAGE_SHIFT 21
 
+/*! \def HUGE_PAGE_1GB_SHIFT
+ * \brief 1GB大页的位移值 (1 << 30 = 1GB)
+ */
+#define HUGE_PAGE_1GB_SHIFT 30
+
+// -- NUMA相关宏定义 --
+/*! \def RN_MAX_NUMA_NODES
+ * \brief 支持的最大NUMA节点数
+ */
+#define RN_MAX_NUMA_NODES 256
+
+/*! \def RN_NUMA_NODE_AUTO
+ * \brief 从sysfs读取网卡所在的NUMA节点, 并将大页内存绑定到该节点
+ */
+#define RN_NUMA_NODE_AUTO -1
+
+/*! \def RN_NUMA_NODE_NONE
+ * \brief 不绑定大页内存的NUMA节点
+ */
+#define RN_NUMA_NODE_NONE -2
+
+/*! \def RN_PREFAULT_MAX_THREADS
+ * \brief 并行预取大页的最大线程数
+ */
+#define RN_PREFAULT_MAX_THREADS 16
+
 // -- 设备内存地址空间定义 --
 /*! \def DEVICE_MEM_OFFSET
  * \brief 设备内存地址的偏移量/标识符
@@ -111,7 +138,21 @@ struct win_size_t {
 struct rdma_buff_t {
   void* buffer;      /*!< 缓冲区的虚拟地址 */
   uint64_t dma_addr; /*!< 缓冲区的物理(DMA)地址 */
-  uint32_t buf_size; /*!< 缓冲区大小 */
+  uint64_t buf_size; /*!< 缓冲区大小 */
+};
+
+/*! \struct rn_dev_timing_t
+ * \brief create_rn_dev()和open_rdma_dev()各阶段的耗时(纳秒)
+ */
+struct rn_dev_timing_t {
+  uint64_t map_ns;       /*!< mmap()映射大页并用mbind()绑定NUMA节点 */
+  uint64_t prefault_ns;  /*!< 多线程触碰大页, 由内核分配并清零 */
+  uint64_t lock_ns;      /*!< mlock()锁定已分配的大页 */
+  uint64_t translate_ns; /*!< 建立物理地址表, 与BDF配置和内存池创建并行 */
+  uint64_t bdf_ns;       /*!< 配置QDMA AXI bridge的BDF窗口 */
+  uint64_t pool_ns;      /*!< 创建主机和设备内存池 */
+  uint64_t total_ns;     /*!< create_rn_dev()总耗时 */
+  uint64_t rdma_open_ns; /*!< open_rdma_dev()耗时 */
 };
 
 /*! \struct rn_dev_t
@@ -122,10 +163,28 @@ struct rn_dev_t {
   uint32_t  axil_map_size;      /*!< 控制寄存器的映射大小 */
   struct rdma_buff_t* base_buf; /*!< 指向预分配的大页内存缓冲区的指针 */
   void* rdma_dev;               /*!< 指向RDMA设备结构体的指针 (struct rdma_dev_t*) */
-  uint64_t buffer_offset;       /*!< 在预分配的主机内存中的当前偏移量，用于简单的内存管理 */
-  uint64_t dev_buffer_offset;   /*!< 在设备内存中的当前偏移量 */
+  struct rn_mem_pool_t* host_pool; /*!< 预分配大页内存的分配器, 偏移量相对于base_buf->buffer */
+  struct rn_mem_pool_t* dev_pool;  /*!< 设备内存的分配器, 偏移量相对于DEVICE_MEM_OFFSET */
   unsigned char num_qp;         /*!< 需要的RDMA队列对数量 */
   struct win_size_t* winSize;   /*!< PCIe BDF地址转换的窗口掩码 */
+  char* mm_device;              /*!< 用于设备内存访问的字符设备名称, NULL时使用全局变量device */
+  int   mm_fd;                  /*!< mm_device的文件描述符, -1时使用全局变量fpga_fd */
+  uint32_t  num_hugepages;      /*!< 预分配内存中2MB大页的数量, 1GB大页按512个2MB大页计 */
+  uint32_t  hugepage_shift;     /*!< 预分配内存实际使用的大页大小, HUGE_PAGE_SHIFT或HUGE_PAGE_1GB_SHIFT */
+  int       numa_node;          /*!< 大页内存绑定的NUMA节点, 负数表示未绑定 */
+  uint64_t* hugepage_paddr;     /*!< 每个2MB大页的物理地址, 在create_rn_dev()中一次性读出 */
+  uint32_t* hugepage_contig;    /*!< 从每个2MB大页开始(含该页)物理地址连续的2MB大页数量 */
+  struct rn_dev_timing_t timing; /*!< 启动各阶段的耗时 */
+};
+
+/*! \struct rn_dev_attr_t
+ * \brief create_rn_dev_ext()的参数
+ */
+struct rn_dev_attr_t {
+  uint32_t num_hugepages;       /*!< 预分配的2MB大页数量, 使用1GB大页时向上取整为512的倍数 */
+  uint32_t num_qp;              /*!< 需要的RDMA队列对数量 */
+  uint32_t hugepage_shift;      /*!< 大页大小, HUGE_PAGE_SHIFT(2MB)或HUGE_PAGE_1GB_SHIFT(1GB) */
+  int      numa_node;           /*!< 大页内存绑定的NUMA节点, 或RN_NUMA_NODE_AUTO, RN_NUMA_NODE_NONE */
 };
 
 // -- 函数原型声明 --
@@ -173,6 +232,52 @@ unsigned long get_page_frame_number_of_address(void *addr);
  */
 uint64_t get_buffer_paddr(void *buffer);
 
+/** @brief 建立预分配大页内存的物理地址表
+ *
+ * 打开一次/proc/self/pagemap, 2MB大页用一次批量pread读出所有大页的页表项,
+ * 1GB大页每页只读一个页表项, 填写rn_dev->hugepage_paddr和rn_dev->hugepage_contig.
+ * 此后的地址转换均查表完成, 不再访问pagemap.
+ * @param rn_dev RecoNIC设备指针, base_buf, num_hugepages和hugepage_shift须已设置
+ * @return 成功返回0; 失败(如非root用户读不到物理页帧号)返回-1
+ */
+int load_hugepage_paddr_table(struct rn_dev_t* rn_dev);
+
+/** @brief 查表获取预分配大页内存中虚拟地址对应的物理地址, O(1)
+ * @param rn_dev RecoNIC设备指针
+ * @param vaddr 虚拟地址
+ * @return 物理地址; 若该地址不在预分配的大页内存中则退回get_buffer_paddr()
+ */
+uint64_t get_hugepage_paddr(struct rn_dev_t* rn_dev, void* vaddr);
+
+/** @brief 获取预分配大页内存中物理地址对应的虚拟地址
+ * @param rn_dev 指向RecoNIC设备的指针
+ * @param paddr 物理地址
+ * @return 对应的虚拟地址; 若该物理地址不在预分配的大页内存中则返回NULL
+ */
+void* get_buffer_vaddr(struct rn_dev_t* rn_dev, uint64_t paddr);
+
+/** @brief 为RecoNIC设备指定用于设备内存访问的字符设备
+ *
+ * 库内部对设备内存的读写(如设备内存中的SQ)均使用pread/pwrite,
+ * 不依赖文件偏移量, 因此多个线程可以共享同一个mm_fd.
+ * @param rn_dev RecoNIC设备指针
+ * @param mm_device 字符设备名称 (如 /dev/reconic-mm)
+ * @param mm_fd 已打开的字符设备文件描述符
+ */
+void set_rn_dev_mm_handle(struct rn_dev_t* rn_dev, char* mm_device, int mm_fd);
+
+/** @brief 获取RecoNIC设备用于设备内存访问的字符设备名称
+ * @param rn_dev RecoNIC设备指针
+ * @return 字符设备名称; 未指定时返回全局变量device
+ */
+char* get_rn_dev_mm_device(struct rn_dev_t* rn_dev);
+
+/** @brief 获取RecoNIC设备用于设备内存访问的文件描述符
+ * @param rn_dev RecoNIC设备指针
+ * @return 文件描述符; 未指定时返回全局变量fpga_fd
+ */
+int get_rn_dev_mm_fd(struct rn_dev_t* rn_dev);
+
 /** @brief 获取用于计算BDF地址掩码的AXI BAR映射窗口大小
  * @return 窗口大小
  */
@@ -186,20 +291,87 @@ uint64_t get_win_size();
 void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_t low_addr);
 
 /** @brief 为RDMA通信分配一个缓冲区
+ *
+ * 不超过RN_MEM_SLAB_MAX字节的缓冲区从slab中分配, 不会跨越4KB页;
+ * 更大的缓冲区由伙伴分配器分配, 大小向上取整为4KB的2的幂次倍并按其大小对齐.
+ * 主机内存中的缓冲区总是物理连续的: 超过一个大页的缓冲区只从物理连续的大页中分配.
  * @param rn_dev RecoNIC设备指针
  * @param buf_size 缓冲区大小
  * @param buf_location 缓冲区位置 ("host_mem" 或 "dev_mem")
- * @return 指向分配的RDMA缓冲区的指针
+ * @return 指向分配的RDMA缓冲区的指针, 内存不足时打印错误并退出程序
  */
 struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, char* buf_location);
 
+/** @brief 按指定对齐方式为RDMA通信分配一个缓冲区
+ * @param rn_dev RecoNIC设备指针
+ * @param buf_size 缓冲区大小
+ * @param align 对齐字节数, 须为2的幂, 0表示默认对齐
+ * @param buf_location 缓冲区位置 ("host_mem" 或 "dev_mem")
+ * @return 指向分配的RDMA缓冲区的指针, 内存不足时返回NULL
+ */
+struct rdma_buff_t* allocate_rdma_buffer_aligned(struct rn_dev_t* rn_dev, uint64_t buf_size, uint64_t align, char* buf_location);
+
+/** @brief 释放allocate_rdma_buffer()分配的缓冲区
+ *
+ * 将内存归还给所属的内存池并释放缓冲区描述符. 已注册为MR的缓冲区须先注销.
+ * @param rn_dev RecoNIC设备指针
+ * @param rdma_buffer 要释放的缓冲区, 可以为NULL
+ * @return void
+ */
+void free_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer);
+
+/** @brief 获取主机内存池或设备内存池的使用量和碎片统计
+ * @param rn_dev RecoNIC设备指针
+ * @param buf_location 内存池 ("host_mem" 或 "dev_mem")
+ * @param stats 由调用填写的统计信息
+ * @return 成功返回0, buf_location无效时返回-1
+ */
+int get_rn_mem_stats(struct rn_dev_t* rn_dev, char* buf_location, struct rn_mem_stats_t* stats);
+
+/** @brief 读取PCIe设备所在的NUMA节点
+ * @param pcie_resource PCIe设备的resource文件路径, 如/sys/bus/pci/devices/0000:d8:00.0/resource2
+ * @return NUMA节点号; 未知或非NUMA系统返回-1
+ */
+int get_pcie_numa_node(char* pcie_resource);
+
+/** @brief 映射并锁定一段大页内存
+ *
+ * 在大页实际分配之前用mbind()将其绑定到指定NUMA节点;
+ * 若该节点空闲大页不足则不绑定并给出警告. 随后由最多RN_PREFAULT_MAX_THREADS个线程
+ * 并行触碰各个大页, 再用mlock()锁定. 多个NUMA节点在线而未绑定时只由调用线程
+ * 触碰, 以免大页按首次访问分散到各个节点. 锁定后打印大页所在的NUMA节点.
+ * @param size 映射大小, 须为大页大小的整数倍
+ * @param hugepage_shift 大页大小, HUGE_PAGE_SHIFT或HUGE_PAGE_1GB_SHIFT
+ * @param numa_node 绑定的NUMA节点, 负数表示不绑定
+ * @param timing 若不为NULL, 填写map_ns, prefault_ns和lock_ns
+ * @return 映射的虚拟地址; 失败(如大页不足)返回NULL
+ */
+void* map_hugepages(uint64_t size, uint32_t hugepage_shift, int numa_node, struct rn_dev_timing_t* timing);
+
+/** @brief 打印启动各阶段的耗时, open_rdma_dev()结束时自动调用
+ * @param rn_dev RecoNIC设备指针
+ * @return void
+ */
+void print_rn_dev_timing(struct rn_dev_t* rn_dev);
+
 /** @brief 创建一个RecoNIC设备实例
+ *
+ * 大页内存默认为2MB大页, 并绑定到网卡所在的NUMA节点.
+ * 设置环境变量RN_HUGEPAGE_SIZE=1G时改用1GB大页.
  * @param pcie_resource PCIe设备的resource文件路径
  * @param pcie_resource_fd 指向PCIe资源文件描述符的指针
- * @param num_hugepages_request 请求的预分配大页数量
+ * @param num_hugepages_request 请求的预分配2MB大页数量
  * @param num_qp 需要的RDMA队列对数量
  * @return 指向创建的RecoNIC设备实例的指针
  */
 struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, uint32_t num_qp);
 
+/** @brief 按指定的大页大小和NUMA节点创建一个RecoNIC设备实例
+ * @param pcie_resource PCIe设备的resource文件路径
+ * @param pcie_resource_fd 指向PCIe资源文件描述符的指针
+ * @param attr 大页数量, 大页大小, NUMA节点和队列对数量
+ * @return 指向创建的RecoNIC设备实例的指针
+ */
+struct rn_dev_t* create_rn_dev_ext(char* pcie_resource, int* pcie_resource_fd, struct rn_dev_attr_t* attr);
+
 #endif /* __RECONIC_H__ */
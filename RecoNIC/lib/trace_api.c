@@ -0,0 +1,141 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file trace_api.c
+ *  @brief Implementation of the binary data path tracer.
+ *
+ *  Each thread owns one ring and is its only writer, so recording needs no
+ *  lock. Rings are pushed on a global list with a compare-and-swap when they
+ *  are created and are never freed, the dump walks that list.
+ *
+ *  Trace file layout (little endian):
+ *    header: magic[8], version (u32), record size (u32), number of rings (u32),
+ *            reserved (u32)
+ *    per ring: thread ID (u32), number of records (u32), records oldest first
+ */
+
+#include "trace_api.h"
+
+#ifdef RN_TRACE
+
+#include <sys/syscall.h>
+
+struct rn_trace_ring_t {
+  struct rn_trace_ring_t* next;
+  uint32_t tid;
+  uint64_t head;
+  struct rn_trace_rec_t recs[RN_TRACE_RING_SIZE];
+};
+
+static struct rn_trace_ring_t* rn_trace_rings = NULL;
+static __thread struct rn_trace_ring_t* rn_trace_ring = NULL;
+static const char* rn_trace_file = NULL;
+
+static struct rn_trace_ring_t* create_trace_ring() {
+  struct rn_trace_ring_t* ring;
+
+  if(posix_memalign((void** ) &ring, 64, sizeof(struct rn_trace_ring_t)) != 0) {
+    return NULL;
+  }
+  ring->tid  = (uint32_t) syscall(SYS_gettid);
+  ring->head = 0;
+
+  ring->next = __atomic_load_n(&rn_trace_rings, __ATOMIC_ACQUIRE);
+  while(!__atomic_compare_exchange_n(&rn_trace_rings, &ring->next, ring, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+  }
+  return ring;
+}
+
+void rn_trace_record(uint16_t event, uint32_t qpid, uint64_t arg0, uint64_t arg1) {
+  struct rn_trace_ring_t* ring = rn_trace_ring;
+  struct rn_trace_rec_t* rec;
+  struct timespec ts;
+  uint64_t head;
+
+  if(ring == NULL) {
+    ring = create_trace_ring();
+    if(ring == NULL) {
+      return;
+    }
+    rn_trace_ring = ring;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  head = ring->head;
+  rec = &ring->recs[head & (RN_TRACE_RING_SIZE - 1)];
+  rec->ts_ns    = ((uint64_t) ts.tv_sec) * NSEC_DIV + (uint64_t) ts.tv_nsec;
+  rec->qpid     = qpid;
+  rec->event    = event;
+  rec->reserved = 0;
+  rec->arg0     = arg0;
+  rec->arg1     = arg1;
+  // Publish the record after it is complete
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void rn_trace_init() {
+  rn_trace_file = getenv("RN_TRACE_FILE");
+}
+
+void rn_trace_fini() {
+  if(rn_trace_file != NULL) {
+    if(rn_trace_dump(rn_trace_file) >= 0) {
+      fprintf(stderr, "Info: trace written to %s\n", rn_trace_file);
+    }
+  }
+}
+
+int rn_trace_dump(const char* path) {
+  struct rn_trace_ring_t* ring;
+  struct rn_trace_ring_t* rings;
+  uint32_t hdr[4];
+  uint32_t ring_hdr[2];
+  uint64_t head;
+  uint64_t start;
+  uint64_t idx;
+  uint32_t num_rings = 0;
+  int num_recs = 0;
+  FILE* fp;
+
+  rings = __atomic_load_n(&rn_trace_rings, __ATOMIC_ACQUIRE);
+  for(ring = rings; ring != NULL; ring = ring->next) {
+    num_rings++;
+  }
+
+  fp = fopen(path, "wb");
+  if(fp == NULL) {
+    fprintf(stderr, "Error: failed to open trace file %s\n", path);
+    return -1;
+  }
+
+  hdr[0] = 1;
+  hdr[1] = sizeof(struct rn_trace_rec_t);
+  hdr[2] = num_rings;
+  hdr[3] = 0;
+  fwrite(RN_TRACE_MAGIC, 1, 8, fp);
+  fwrite(hdr, sizeof(uint32_t), 4, fp);
+
+  for(ring = rings; ring != NULL; ring = ring->next) {
+    head  = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    start = (head > RN_TRACE_RING_SIZE) ? (head - RN_TRACE_RING_SIZE) : 0;
+    ring_hdr[0] = ring->tid;
+    ring_hdr[1] = (uint32_t) (head - start);
+    fwrite(ring_hdr, sizeof(uint32_t), 2, fp);
+    for(idx = start; idx < head; idx++) {
+      fwrite(&ring->recs[idx & (RN_TRACE_RING_SIZE - 1)], sizeof(struct rn_trace_rec_t), 1, fp);
+    }
+    num_recs += (int) (head - start);
+  }
+
+  if(fclose(fp) != 0) {
+    fprintf(stderr, "Error: failed to write trace file %s\n", path);
+    return -1;
+  }
+  return num_recs;
+}
+
+#endif /* RN_TRACE */
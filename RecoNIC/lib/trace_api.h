@@ -0,0 +1,109 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file trace_api.h
+ *  @brief Header file of the binary data path tracer.
+ *
+ *  The data path records fixed-size binary events (timestamp, QP ID, event ID
+ *  and two arguments) into a lock-free ring owned by the calling thread,
+ *  instead of formatting messages with fprintf. Rings are written to a file by
+ *  rn_trace_dump() and decoded offline by scripts/rn_trace_decode.py.
+ *
+ *  Tracing is selected at compile time: build the library with RN_TRACE=1
+ *  (make RN_TRACE=1). Without it RN_TRACE_EVENT() expands to nothing, so the
+ *  hot path carries no tracing code at all.
+ */
+
+#ifndef __TRACE_API_H__
+#define __TRACE_API_H__
+
+#include "auxiliary.h"
+
+/*! \def RN_TRACE_RING_SIZE
+    \brief Number of records kept per thread, a power of two. Older records
+    are overwritten.
+*/
+#define RN_TRACE_RING_SIZE 65536
+
+/*! \def RN_TRACE_MAGIC
+    \brief Magic bytes at the start of a trace file.
+*/
+#define RN_TRACE_MAGIC "RNTRACE1"
+
+/*! \enum rn_trace_event_t
+    \brief Event IDs. The decoder keeps the same table, append new IDs only.
+*/
+enum rn_trace_event_t {
+  RN_TRACE_WQE_POST    = 1, /*!< arg0: slot, arg1: (opcode << 48) | (wrid << 32) | length. */
+  RN_TRACE_SQ_FULL     = 2, /*!< arg0: WQEs requested, arg1: sq_credits. */
+  RN_TRACE_SQ_FLUSH    = 3, /*!< arg0: first dirty slot, arg1: dirty slots copied to the device memory. */
+  RN_TRACE_DOORBELL    = 4, /*!< arg0: sq_pidb written to SQPIi, arg1: WQEs announced. */
+  RN_TRACE_CQ_POLL     = 5, /*!< arg0: WQEs completed, arg1: sq_cidb after the poll. */
+  RN_TRACE_RQ_POLL     = 6, /*!< arg0: RQ producer index, arg1: previous RQ producer index. */
+  RN_TRACE_DB_MISMATCH = 7, /*!< arg0: register value, arg1: shadow value. */
+  RN_TRACE_CQ_WAIT     = 8  /*!< arg0: sq_cidb waited on, arg1: CQ head seen. */
+};
+
+/*! \struct rn_trace_rec_t
+    \brief A trace record, 32 bytes.
+*/
+struct rn_trace_rec_t {
+  uint64_t ts_ns;   /*!< ts_ns CLOCK_MONOTONIC time in nanoseconds. */
+  uint32_t qpid;    /*!< qpid QP ID, 0 if not QP related. */
+  uint16_t event;   /*!< event event ID, see rn_trace_event_t. */
+  uint16_t reserved; /*!< reserved reserved. */
+  uint64_t arg0;    /*!< arg0 first event argument. */
+  uint64_t arg1;    /*!< arg1 second event argument. */
+};
+
+#ifdef RN_TRACE
+
+/*! \def RN_TRACE_EVENT(event, qpid, arg0, arg1)
+    \brief Record an event in the ring of the calling thread.
+*/
+#define RN_TRACE_EVENT(event, qpid, arg0, arg1) \
+    rn_trace_record((event), (uint32_t) (qpid), (uint64_t) (arg0), (uint64_t) (arg1))
+
+/** @brief Record an event in the ring of the calling thread. The ring is
+ *  allocated on the first record of each thread.
+ *  @param event event ID.
+ *  @param qpid QP ID.
+ *  @param arg0 first event argument.
+ *  @param arg1 second event argument.
+ *  @return void.
+ */
+void rn_trace_record(uint16_t event, uint32_t qpid, uint64_t arg0, uint64_t arg1);
+
+/** @brief Read the trace configuration once. RN_TRACE_FILE names the file
+ *  written by rn_trace_fini(). Called by create_rn_dev().
+ *  @return void.
+ */
+void rn_trace_init();
+
+/** @brief Dump the rings to the RN_TRACE_FILE file, if set. Called by
+ *  destroy_rn_dev().
+ *  @return void.
+ */
+void rn_trace_fini();
+
+/** @brief Write all rings to a file. Threads should have stopped posting,
+ *  a record being written during the dump may come out torn.
+ *  @param path file name.
+ *  @return Return number of records written, -1 on failure.
+ */
+int rn_trace_dump(const char* path);
+
+#else
+
+#define RN_TRACE_EVENT(event, qpid, arg0, arg1) do { } while(0)
+
+static inline void rn_trace_init() {}
+static inline void rn_trace_fini() {}
+static inline int rn_trace_dump(const char* path) { (void) path; return 0; }
+
+#endif /* RN_TRACE */
+
+#endif /* __TRACE_API_H__ */
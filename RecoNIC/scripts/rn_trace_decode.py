@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# ==============================================================================
+#  Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+#  SPDX-License-Identifier: MIT
+# 
+# ==============================================================================
+#
+# rn_trace_decode.py
+# -- The script is used to decode a binary trace file written by a libreconic
+#    built with RN_TRACE=1 (see lib/trace_api.h)
+#
+# ==============================================================================
+
+import sys
+import struct
+import argparse
+
+MAGIC    = b"RNTRACE1"
+HDR_FMT  = "<8sIIII"
+RING_FMT = "<II"
+REC_FMT  = "<QIHHQQ"
+
+# Keep in sync with enum rn_trace_event_t
+EVENTS = {
+  1: ("WQE_POST",    lambda a0, a1: "slot=%d opcode=0x%x wrid=0x%x length=%d" % (a0, (a1 >> 48) & 0xff, (a1 >> 32) & 0xffff, a1 & 0xffffffff)),
+  2: ("SQ_FULL",     lambda a0, a1: "requested=%d credits=%d" % (a0, a1)),
+  3: ("SQ_FLUSH",    lambda a0, a1: "start=%d count=%d" % (a0, a1)),
+  4: ("DOORBELL",    lambda a0, a1: "sq_pidb=%d wqes=%d" % (a0, a1)),
+  5: ("CQ_POLL",     lambda a0, a1: "completed=%d sq_cidb=%d" % (a0, a1)),
+  6: ("RQ_POLL",     lambda a0, a1: "rq_pidb=%d prev=%d" % (a0, a1)),
+  7: ("DB_MISMATCH", lambda a0, a1: "register=0x%x shadow=0x%x" % (a0, a1)),
+  8: ("CQ_WAIT",     lambda a0, a1: "sq_cidb=%d cq_head=%d" % (a0, a1)),
+}
+
+def read_trace(path):
+  records = []
+  with open(path, "rb") as f:
+    magic, version, rec_size, num_rings, _ = struct.unpack(HDR_FMT, f.read(struct.calcsize(HDR_FMT)))
+    if magic != MAGIC:
+      sys.exit("Error: %s is not a RecoNIC trace file" % path)
+    if rec_size != struct.calcsize(REC_FMT):
+      sys.exit("Error: unsupported record size %d (version %d)" % (rec_size, version))
+    for _ in range(num_rings):
+      tid, count = struct.unpack(RING_FMT, f.read(struct.calcsize(RING_FMT)))
+      for _ in range(count):
+        ts, qpid, event, _, a0, a1 = struct.unpack(REC_FMT, f.read(rec_size))
+        records.append((ts, tid, qpid, event, a0, a1))
+  records.sort()
+  return records
+
+def main():
+  parser = argparse.ArgumentParser(description="Decode a RecoNIC binary trace file")
+  parser.add_argument("trace", help="trace file written by rn_trace_dump()")
+  parser.add_argument("-q", "--qpid", type=int, default=None, help="only print events of this QP")
+  parser.add_argument("-s", "--summary", action="store_true", help="print event counts per QP only")
+  args = parser.parse_args()
+
+  records = read_trace(args.trace)
+  if args.qpid is not None:
+    records = [r for r in records if r[2] == args.qpid]
+  if not records:
+    return
+
+  if args.summary:
+    counts = {}
+    for _, _, qpid, event, _, _ in records:
+      counts[(qpid, event)] = counts.get((qpid, event), 0) + 1
+    for (qpid, event), count in sorted(counts.items()):
+      name = EVENTS.get(event, ("EVENT_%d" % event, None))[0]
+      print("qpid=%-4d %-12s %d" % (qpid, name, count))
+    return
+
+  t0 = records[0][0]
+  for ts, tid, qpid, event, a0, a1 in records:
+    name, fmt = EVENTS.get(event, ("EVENT_%d" % event, lambda a0, a1: "arg0=0x%x arg1=0x%x" % (a0, a1)))
+    print("%14.3f us tid=%-7d qpid=%-4d %-12s %s" % ((ts - t0) / 1000.0, tid, qpid, name, fmt(a0, a1)))
+
+if __name__ == "__main__":
+  main()